@@ -1,454 +1,118 @@
-#include <iostream>
-#include <fstream>
-#include <vector>
-#include <map>
-#include <set>
-#include <thread>
-#include <mutex>
-#include <chrono>
-#include <cstdlib>
-#include <ctime>
-#include <atomic>
-#include <iomanip>
-#include <queue>   // For storing recent prices
-#include <conio.h>
-using namespace std;
+#include "stock_market.h"
+#include "market_feed.h"
+#include "order_gateway.h"
+#include "trader_agents.h"
+#include "conio_compat.h"
 // Function to clear the console screen
 void clearScreen()
 {
     cout << "\033[2J\033[H"; // ANSI escape code to clear screen and move cursor to top-left
 }
-class Stock {
-private:
-    string fullName;
-    string abbreviation;
-    double price;
-    double volatility;
-    double peakHigh;
-    double peakLow;
-    queue<double> recentPrices;
-    int historySize;
-
-public:
-    Stock(const string& fullName = "", const string& abbreviation = "", double price = 0.0, double volatility = 0.05,
-          int historySize = 60)
-        : fullName(fullName),
-          abbreviation(abbreviation),
-          price(price),
-          volatility(volatility),
-          peakHigh(price),
-          peakLow(price),
-          historySize(historySize) {
-        for (int i = 0; i < historySize; ++i)
-        {
-            recentPrices.push(price);
-        }
-    }
-
-    void updatePrice() {
-        int randChange = rand() % 201 - 100;
-        double changePercent = randChange / 10000.0 * (1 + volatility);
-        price += price * changePercent;
-
-        if (price > peakHigh) peakHigh = price;
-        if (price < peakLow) peakLow = price;
-
-        recentPrices.pop();
-        recentPrices.push(price);
-        // Randomly change volatility
-        double volatilityChange = (rand() % 11 - 5) / 1000.0; // Change by +/- 0.005
-        volatility += volatilityChange;
-        if (volatility < 0.01) volatility = 0.01; // Ensure volatility doesn't go too low.
-        if (volatility > 0.10) volatility = 0.10; // Ensure volatility doesn't go too high
-    }
-
-    string getFullName() const
-    {
-         return fullName;
-    }
-    string getAbbreviation() const
-    {
-        return abbreviation;
-    }
-    double getPrice() const
-    {
-        return price;
-    }
-    double getVolatility() const
-    {
-        return volatility;
-    }
-    double getPeakHigh() const
-    {
-        return peakHigh;
-    }
-    double getPeakLow() const
-    {
-        return peakLow;
-    }
-    queue<double> getRecentPrices() const
-    {
-        return recentPrices;
-    }
-
-    // Public getter for historySize
-    int getHistorySize() const
-    {
-        return historySize;
-    }
-};
-
-class StockMarket {
-private:
-    map<string, Stock> stocks;
-    mutex mtx;
-    atomic<bool> running{true};
-    atomic<int> Userchoice;
-    thread priceUpdateThread;
-    int numStocks;
-
-public:
-    StockMarket() : priceUpdateThread(), numStocks(0), Userchoice(0) {}  // Initialize in constructor
-
-    ~StockMarket()
-     {
-        stop(); // Ensure thread is stopped in destructor
-        if (priceUpdateThread.joinable()) {
-            priceUpdateThread.join(); // Wait for thread to finish.
-        }
-    }
-
-    void loadStocks(const string& namesFile, const string& pricesFile, const string& abbrFile) {
-        ifstream names(namesFile);
-        ifstream prices(pricesFile);
-        ifstream abbrs(abbrFile);
-        string name, abbr;
-        double price;
-        vector<string> namesList, abbrList;
-        vector<double> pricesList;
-
-        while (getline(names, name) && getline(abbrs, abbr) && prices >> price)
-        {
-            namesList.push_back(name);
-            abbrList.push_back(abbr);
-            pricesList.push_back(price);
-            prices.ignore();
-        }
-        if (namesList.size() != abbrList.size() || namesList.size() != pricesList.size())
-        {
-            cout << "Mismatch in the number of entries across files!" << endl;
-            return;
-        }
-        for (size_t i = 0; i < namesList.size(); ++i)
-        {
-            stocks[abbrList[i]] = Stock(namesList[i], abbrList[i], pricesList[i]);
-        }
-        numStocks = namesList.size();
-    }
-
-    void startPriceUpdates()
-    {
-        if (!priceUpdateThread.joinable())
-        { // Only start if not already running.
-            priceUpdateThread = thread
-            ([this]()
-                {
-                    while (running)
-                    {
-                        this_thread::sleep_for(chrono::seconds(1));
-                        lock_guard<mutex> lock(mtx);
-                        for (auto& [abbr, stock] : stocks)
-                        {
-                            stock.updatePrice();
-                        }
-                    }
-                }
-            );
-        }
-    }
-    void stop()
-    {
-        running = false;
-        if (priceUpdateThread.joinable()) {
-            priceUpdateThread.join(); // Wait for the thread to finish.
-        }
-    }
-    void showAllStocksLive()
-     {
-        system("cls"); //clears console screen
-        cout << "\n--- Live Stock Prices ---\n";
-        cout << left << setw(35) << "Stock" << "Price" << setw(15) << "Volatility" << endl;
-        cout << string(50, '-') << endl;
-        for (const auto& [abbr, stock]; : stocks)
-        {
-            cout << setw(35) << stock.getFullName() + " (" + stock.getAbbreviation() + "): "
-                 << fixed << setprecision(2) << setw(10) << stock.getPrice()
-                 << fixed << setprecision(2) << setw(15) << stock.getVolatility() * 100 << "%" << endl;
-        }
-        cout << endl;
-        cout << "Press any character key" << endl;
-    }
-    void showMenu()
-    {
-        cout << "\n--- Stock Market Menu ---\n";
-        cout << "1. View All Stocks (Live)\n";
-        cout << "2. Buy Stock\n";
-        cout << "3. Sell Stock\n";
-        cout << "4. View Portfolio\n";
-        cout << "5. Add to Watchlist\n";
-        cout << "6. Remove from Watchlist\n";
-        cout << "7. View Watchlist\n";
-        cout << "8. View Stock Details\n";
-        cout << "9. Deposit Funds\n";
-        cout << "10. Withdraw Funds\n";
-        cout << "11. View Transaction History\n";
-        cout << "12. Exit\n";
-        cout << "Enter choice: ";
-    }
-    Stock* getStock(const string& abbreviation)
+atomic<bool> running{true};
+atomic<int> Userchoice{0};
+void inputThread()
+{
+    while (running)
     {
-        lock_guard<mutex> lock(mtx);
-        auto it = stocks.find(abbreviation);
-        if (it != stocks.end())
-        {
-            return &it->second;
-        }
-        return nullptr;
-    }
-
-    void showStockDetails(const string& abbreviation) {
-        lock_guard<mutex> lock(mtx);
-        auto it = stocks.find(abbreviation);
-        if (it != stocks.end())
+        if (_kbhit())
         {
-            const Stock& stock = it->second;
-            cout << "\n--- Stock Details: " << stock.getFullName() << " (" << stock.getAbbreviation() << ") ---\n";
-            cout << "Current Price: $" << fixed << setprecision(2) << stock.getPrice() << endl;
-            cout << "Volatility: " << fixed << setprecision(2) << stock.getVolatility() * 100 << "%" << endl;
-            cout << "Peak High (Last " << stock.getHistorySize() << " seconds): $" << fixed
-                 << setprecision(2) << stock.getPeakHigh() << endl;
-            cout << "Peak Low (Last " << stock.getHistorySize() << " seconds): $" << fixed
-                 << setprecision(2) << stock.getPeakLow() << endl;
-            cout << "Recent Prices (Last " << stock.getHistorySize() << " seconds): ";
-            queue<double> tempQueue = stock.getRecentPrices();
-            while (!tempQueue.empty())
+            char ch = _getch();
+            if (isdigit(ch))
             {
-                cout << fixed << setprecision(2) << tempQueue.front() << "||";
-                tempQueue.pop();
+                Userchoice = ch - '0'; // convert char to int
+                running = false;   // stop live update
             }
-            cout << endl;
-        }
-        else
-        {
-            cout << "Stock not found." << endl;
         }
+        this_thread::sleep_for(chrono::milliseconds(100));
     }
-};
-// Define a class for transaction history
-class Transaction
+}
+class StockExchange
 {
-public:
-    string stockAbbreviation;
-    int quantity;
-    double price;
-    time_t timestamp;
-    Transaction(const string& abbr, int qty, double p, time_t ts)
-        : stockAbbreviation(abbr), quantity(qty), price(p), timestamp(ts) {}
-};
-
-class Portfolio {
 private:
-    map<string, int> holdings;
-    double balance = 10000.0;
-    vector<Transaction> transactionHistory;
+    StockMarket market;
+    Journal journal; // Outlives the portfolio that writes to it
+    Portfolio portfolio;
+    Watchlist watchlist;
+    bool showingLivePrices = false;
+    TerminalRenderer board;
+    StatsDumper statsDumper;
+    MarketFeedPublisher feed;
+    OrderGateway gateway{market};
+    size_t boardTop = 0; // First row of the live board on screen
+    thread inputThread;
 public:
-    void deposit(double amount)
-    {
-        balance += amount;
-        cout << "Deposited $" << fixed << setprecision(2) << amount << endl;
-    }
-
-    void withdraw(double amount)
+    // Uses the binary universe when it exists, the three text files otherwise, and the correlated
+    // price model when factorsFile exists.
+    StockExchange(const string& namesFile, const string& pricesFile, const string& abbrFile,
+                  const string& universeFile = "stock_universe.bin", const string& journalPath = "portfolio",
+                  double ticksPerSecond = 1.0, OverrunPolicy overrunPolicy = OverrunPolicy::CatchUp,
+                  const string& statsPath = "stats.txt", double statsSeconds = 10.0, const string& feedEndpoint = "",
+                  uint16_t gatewayPort = 0, unsigned gatewayThreads = 2, const string& historyPath = "",
+                  uint32_t historyEvery = 1, const string& factorsFile = "stock_factors.txt", const string& recordPath = "")
+        : market()
     {
-        if (amount <= balance)
+        enableTerminalEscapes();
+        if (!market.setTickRate(ticksPerSecond, overrunPolicy))
         {
-            balance -= amount;
-            cout << "Withdrew $" << fixed << setprecision(2) << amount << endl;
-        } else
-        {
-            cout << "Insufficient balance for withdrawal." << endl;
+            cout << "Tick rate must be above 0 and at most " << maxTicksPerSecond << " per second; using 1." << endl;
         }
-    }
-    void buyStock(Stock* stock, int quantity)
-    {
-        if (!stock)
+        if (!market.loadUniverse(universeFile))
         {
-            cout << "Stock not found." << endl;
-            return;
+            market.loadStocks(namesFile, pricesFile, abbrFile);
         }
-        double cost = stock->getPrice() * quantity;
-        if (cost <= balance)
+        market.loadFactorModel(factorsFile);
+        string error = portfolio.attachJournal(market, journal, journalPath);
+        if (!error.empty())
         {
-            holdings[stock->getAbbreviation()] += quantity;
-            balance -= cost;
-            transactionHistory.emplace_back(stock->getAbbreviation(), quantity, stock->getPrice(), time(0));
-            cout << "Bought " << quantity << " shares of " << stock->getAbbreviation() << " at $" << fixed
-                << setprecision(2) << stock->getPrice() << endl;
+            cout << error << "; this session will not be saved." << endl;
         }
-        else
+        if (!recordPath.empty())
         {
-            cout << "Insufficient balance." << endl;
-        }
-    }
-
-    void sellStock(Stock* stock, int quantity)
-    {
-        if (!stock)
-        {
-            cout << "Stock not found." << endl;
-            return;
-        }
-        string abbr = stock->getAbbreviation();
-        if (holdings.count(abbr) && holdings[abbr] >= quantity)
-        {
-            holdings[abbr] -= quantity;
-            balance += stock->getPrice() * quantity;
-            transactionHistory.emplace_back(stock->getAbbreviation(), -quantity, stock->getPrice(), time(0));
-            cout << "Sold " << quantity << " shares of " << abbr << " at $" << fixed
-                << setprecision(2) << stock->getPrice() << endl;
-        } else
-        {
-            cout << "Not enough shares to sell." << endl;
-        }
-    }
-
-    void showPortfolio(StockMarket& market)
-    {
-        cout << "\n--- Your Portfolio ---\n";
-        cout << "Balance: $" << fixed << setprecision(2) << balance << endl;
-        double totalValue = balance;
-        for (const auto& [abbr, qty] : holdings)
+            error = portfolio.startRecording(market, recordPath);
+            if (!error.empty())
             {
-                Stock* stock = market.getStock(abbr);
-                if (stock)
-                {
-                    double currentValue = stock->getPrice() * qty;
-                    cout << abbr << ": " << qty << " shares, Current Price: $" << fixed << setprecision(2)
-                        << stock->getPrice() << ", Value: $" << fixed << setprecision(2) << currentValue;
-                    // Calculate profit/loss (requires tracking buying price) - for simplicity, skipping for now
-                    cout << endl;
-                    totalValue += currentValue;
-                }
+                cout << error << "; this session will not be recorded." << endl;
             }
-        cout << "Total Portfolio Value: $" << fixed << setprecision(2) << totalValue << endl;
-    }
-    void showTransactionHistory(StockMarket& market)
-    {
-        cout << "\n--- Transaction History ---\n";
-        if (transactionHistory.empty())
+        }
+        market.addTickListener([this](const MarketSnapshot& snap) { portfolio.onTick(snap); });
+        market.addTickListener([this](const MarketSnapshot& snap) { watchlist.onTick(snap); });
+        IndicatorEngine& indicators = market.getIndicators();
+        indicators.add(IndicatorKind::Sma, 20);
+        indicators.add(IndicatorKind::Ema, 20);
+        indicators.add(IndicatorKind::BollingerUpper, 20);
+        indicators.add(IndicatorKind::BollingerLower, 20);
+        indicators.add(IndicatorKind::Rsi, 14);
+        indicators.add(IndicatorKind::Vwap, 60);
+        error = market.enableHistory(historyPath, size_t{256} << 20, historyEvery);
+        if (!error.empty())
         {
-            cout << "No transactions yet." << endl;
-            return;
+            cout << error << "; price history is kept in memory only." << endl;
+            market.enableHistory("", size_t{256} << 20, historyEvery);
         }
-        cout << left << setw(15) << "Stock" << setw(10) << "Quantity" << setw(15) << "Price"
-            << "Timestamp\n";
-        for (const auto& transaction : transactionHistory)
+        if (!feedEndpoint.empty())
         {
-            char sign = transaction.quantity > 0 ? '+' : '-';
-            time_t t = transaction.timestamp;
-            tm* tm_val = localtime(&t);
-            if (tm_val)
+            error = feed.open(feedEndpoint);
+            if (error.empty())
             {
-                cout << left << setw(15) << transaction.stockAbbreviation << sign << setw(10) << abs(transaction.quantity)
-                    << setw(15) << fixed << setprecision(2) << transaction.price
-                    << put_time(tm_val, "%Y-%m-%d %H:%M:%S") << endl;
+                market.addTickListener([this](const MarketSnapshot& snap) { feed.onTick(snap); });
             }
             else
             {
-                cout<< "Error converting timestamp." << endl;
+                cout << error << "; prices will not be published." << endl;
             }
         }
-    }
-};
-class Watchlist {
-private:
-    set<string> watchlist;
-public:
-    void add(const string& abbr)
-    {
-        if (watchlist.find(abbr) != watchlist.end())
-        {
-            cout << "Error: Stock '" << abbr << "' is already in the watchlist." << endl;
-        }
-        else
+        if (gatewayPort != 0)
         {
-            watchlist.insert(abbr);
-            cout << abbr << " added to watchlist" << endl;
-        }
-    }
-    void remove(const string& abbr)
-    {
-        if(watchlist.erase(abbr)==0)
-        {
-            cout << "Stock not present" << endl;
-        }
-        else
-        {
-            watchlist.erase(abbr);
-            cout << abbr <<" erased successfully" << endl;
-        }
-    }
-    void view(StockMarket& market) {
-        cout << "\n--- Watchlist ---\n";
-        if (watchlist.empty()) {
-            cout << "Your watchlist is empty." << endl;
-            return;
-        }
-        for (const string& abbr : watchlist) {
-            if (auto stock = market.getStock(abbr)) {
-                cout << left << setw(10) << abbr << ": $" << fixed << setprecision(2) << stock->getPrice()
-                    << endl;
-            } else {
-                cout << abbr << " (Not found)" << endl;
+            error = gateway.open(gatewayPort, gatewayThreads);
+            if (!error.empty())
+            {
+                cout << error << "; orders are taken from the menu only." << endl;
             }
         }
-    }
-    const set<string>& getWatchlist() const
-    {
-        return watchlist;
-    }
-};
-atomic<bool> running{true};
-atomic<int> Userchoice{0};
-void inputThread()
-{
-    while (running)
-    {
-        if (_kbhit())
+        if (statsSeconds > 0.0)
         {
-            char ch = _getch();
-            if (isdigit(ch))
-            {
-                Userchoice = ch - '0'; // convert char to int
-                running = false;   // stop live update
-            }
+            statsDumper.start(statsPath, chrono::milliseconds(llround(statsSeconds * 1000.0)));
         }
-        this_thread::sleep_for(chrono::milliseconds(100));
-    }
-}
-class StockExchange
-{
-private:
-    StockMarket market;
-    Portfolio portfolio;
-    Watchlist watchlist;
-    bool showingLivePrices = false;
-    thread inputThread;
-public:
-    StockExchange(const string& namesFile, const string& pricesFile, const string& abbrFile)
-        : market()
-    {
-        market.loadStocks(namesFile, pricesFile, abbrFile);
         market.startPriceUpdates();
         inputThread = thread(inputThreadFunc);
     }
@@ -492,19 +156,18 @@ private:
             if (!showingLivePrices)
             {
                 clearScreen();
+                watchlist.showTriggeredAlerts(market);
                 market.showMenu();
             }
             if (showingLivePrices) {
-                if (_kbhit()) {
-                    _getch(); // Consume the key press
+                if (_kbhit() && !market.scrollLiveBoard(_getch(), boardTop)) {
                     showingLivePrices = false; // Exit the live price display
+                    board.release();
                     continue; // Return to the beginning of the menu loop
                 }
-                else
-                {
-                     market.showAllStocksLive();
-                     this_thread::sleep_for(chrono::seconds(2));
-                }
+                auto [rows, cols] = TerminalRenderer::terminalSize();
+                market.showAllStocksLive(board, boardTop, rows, cols);
+                this_thread::sleep_for(chrono::milliseconds(100)); // 10 Hz; unchanged cells cost nothing
             }
             else
             {
@@ -519,64 +182,76 @@ private:
                 string abbr;
                 int qty;
                 double amount;
+                Portfolio::Price price;
                 Stock* stock;
                 switch (choice)
                 {
                     case 1:
                         showingLivePrices = true;
+                        cout << flush;
                         break;
                     case 2:
                         showingLivePrices = false;
-                        system("cls");
+                        clearScreen();
                         cout << "Enter stock abbreviation to buy: ";
                         cin >> abbr;
                         cout << "Enter quantity: ";
                         cin >> qty;
                         stock = market.getStock(abbr);
                         if (stock)
-                            portfolio.buyStock(stock, qty);
+                        {
+                            auto orders = market.lockOrders(); // The gateway trades too
+                            portfolio.buyStock(market, stock, qty);
+                        }
                         else
                             cout << "Stock not found." << endl;
                         break;
                     case 3:
                         showingLivePrices = false;
-                        system("cls");
+                        clearScreen();
                         cout << "Enter stock abbreviation to sell: ";
                         cin >> abbr;
                         cout << "Enter quantity: ";
                         cin >> qty;
                         stock = market.getStock(abbr);
                         if (stock)
-                            portfolio.sellStock(stock, qty);
+                        {
+                            auto orders = market.lockOrders(); // The gateway trades too
+                            portfolio.sellStock(market, stock, qty);
+                        }
                         else
                             cout << "Stock not found." << endl;
                         break;
                     case 4:
-                        system("cls");
+                        clearScreen();
                         showingLivePrices = false;
+                        {
+                            auto orders = market.lockOrders(); // The gateway may have filled resting orders
+                            portfolio.takeFills(market);
+                        }
                         portfolio.showPortfolio(market);
                         break;
                     case 5:
-                        system("cls");
+                        clearScreen();
                         showingLivePrices = false;
                         cout << "Enter stock abbreviation to add to watchlist: ";
                         cin >> abbr;
-                        watchlist.add(abbr);
+                        watchlist.add(market, abbr);
                         break;
                     case 6:
-                        system("cls");
+                        clearScreen();
                         showingLivePrices = false;
                         cout << "Enter stock abbreviation to remove from watchlist: ";
                         cin >> abbr;
-                        watchlist.remove(abbr);
+                        watchlist.remove(market, abbr);
                         break;
                     case 7:
-                        system("cls");
+                        clearScreen();
                         showingLivePrices = false;
                         watchlist.view(market);
                         break;
                     case 8:
-                        system("cls");
+                        clearScreen();
                         showingLivePrices = false;
                         cout << "Enter stock abbreviation to view details: ";
                         cin >> abbr;
@@ -587,22 +262,176 @@ private:
                         clearScreen();
                         cout << "Enter amount to deposit: ";
                         cin >> amount;
-                        portfolio.deposit(amount);
+                        if (amountAs(amount, price))
+                            portfolio.deposit(price);
+                        else
+                            cout << "Amount out of range." << endl;
                         break;
                     case 10:
                         showingLivePrices = false;
                         clearScreen();
                         cout << "Enter amount to withdraw: ";
                         cin >> amount;
-                        portfolio.withdraw(amount);
+                        if (amountAs(amount, price))
+                            portfolio.withdraw(price);
+                        else
+                            cout << "Amount out of range." << endl;
                         break;
                     case 11:
-                        system("cls");
+                    {
+                        clearScreen();
                         showingLivePrices = false;
-                        portfolio.showTransactionHistory(market);
+                        HistoryQuery query;
+                        char side;
+                        int minutes;
+                        cout << "Enter stock abbreviation (* for all): ";
+                        cin >> abbr;
+                        cout << "Buys, sells or all (B/S/A): ";
+                        cin >> side;
+                        cout << "Last how many minutes (0 for all): ";
+                        cin >> minutes;
+                        if (abbr != "*")
+                        {
+                            stock = market.getStock(abbr);
+                            if (!stock)
+                            {
+                                cout << "Stock not found." << endl;
+                                break;
+                            }
+                            query.symbol = stock->getId();
+                        }
+                        side = static_cast<char>(toupper(static_cast<unsigned char>(side)));
+                        query.side = side == 'B'   ? HistorySide::Buy
+                                     : side == 'S' ? HistorySide::Sell
+                                                   : HistorySide::Any;
+                        if (minutes > 0)
+                        {
+                            query.from = time(0) - static_cast<time_t>(minutes) * 60;
+                        }
+                        {
+                            auto orders = market.lockOrders(); // The gateway may have filled resting orders
+                            portfolio.takeFills(market);
+                        }
+                        size_t page = 0;
+                        char command = 'N';
+                        while (true)
+                        {
+                            size_t pages = portfolio.showTransactionHistory(market, query, page);
+                            if (pages <= 1)
+                            {
+                                break;
+                            }
+                            cout << "N)ext  P)revious  F)irst  L)ast  Q)uit: ";
+                            cin >> command;
+                            command = static_cast<char>(toupper(static_cast<unsigned char>(command)));
+                            if (command == 'N')
+                                page = min(page + 1, pages - 1);
+                            else if (command == 'P')
+                                page = page > 0 ? page - 1 : 0;
+                            else if (command == 'F')
+                                page = 0;
+                            else if (command == 'L')
+                                page = pages - 1;
+                            else
+                                break;
+                            clearScreen();
+                        }
                         break;
+                    }
                     case 12:
-                        system("cls");
+                    {
+                        clearScreen();
+                        showingLivePrices = false;
+                        char side;
+                        cout << "Enter stock abbreviation: ";
+                        cin >> abbr;
+                        cout << "Buy or sell (B/S): ";
+                        cin >> side;
+                        cout << "Enter quantity: ";
+                        cin >> qty;
+                        cout << "Enter limit price: ";
+                        cin >> amount;
+                        stock = market.getStock(abbr);
+                        if (!amountAs(amount, price))
+                            cout << "Amount out of range." << endl;
+                        else if (stock)
+                        {
+                            auto orders = market.lockOrders();
+                            portfolio.placeLimitOrder(market, stock, toupper(side) == 'S' ? Side::Sell : Side::Buy,
+                                                      qty, price);
+                        }
+                        else
+                            cout << "Stock not found." << endl;
+                        break;
+                    }
+                    case 13:
+                    {
+                        clearScreen();
+                        showingLivePrices = false;
+                        {
+                            auto orders = market.lockOrders(); // The gateway may have filled resting orders
+                            portfolio.takeFills(market);
+                        }
+                        portfolio.showOpenOrders(market);
+                        cout << "Enter order number to cancel: ";
+                        uint64_t orderId;
+                        cin >> orderId;
+                        auto orders = market.lockOrders();
+                        portfolio.cancelOrder(market, orderId);
+                        break;
+                    }
+                    case 14:
+                    {
+                        clearScreen();
+                        showingLivePrices = false;
+                        size_t paths;
+                        int steps;
+                        cout << "Enter number of paths: ";
+                        cin >> paths;
+                        cout << "Enter horizon in ticks: ";
+                        cin >> steps;
+                        portfolio.showRisk(market, paths, steps);
+                        break;
+                    }
+                    case 15:
+                    {
+                        clearScreen();
+                        showingLivePrices = false;
+                        watchlist.showAlerts(market);
+                        cout << "A) above a price  B) below a price  P) percent move  C) cancel: ";
+                        char type;
+                        cin >> type;
+                        type = static_cast<char>(toupper(static_cast<unsigned char>(type)));
+                        if (type == 'C')
+                        {
+                            uint32_t alertId;
+                            cout << "Enter alert number: ";
+                            cin >> alertId;
+                            watchlist.cancelAlert(alertId);
+                            break;
+                        }
+                        if (type != 'A' && type != 'B' && type != 'P')
+                        {
+                            cout << "Invalid alert type." << endl;
+                            break;
+                        }
+                        cout << "Enter stock abbreviation: ";
+                        cin >> abbr;
+                        cout << (type == 'P' ? "Enter percent: " : "Enter price: ");
+                        cin >> amount;
+                        watchlist.addAlert(market, abbr,
+                                           type == 'A' ? AlertKind::Above
+                                                       : type == 'B' ? AlertKind::Below : AlertKind::PercentMove,
+                                           amount);
+                        break;
+                    }
+                    case 16:
+                        clearScreen();
+                        showingLivePrices = false;
+                        market.showStats();
+                        break;
+                    case 17:
+                        clearScreen();
                         showingLivePrices = false;
                         market.stop();
                         if(inputThread.joinable()){
@@ -617,12 +446,287 @@ private:
         }
     }
 };
-int main()
+// Headless batch run: loads the universe the way the menu does and runs ticks back to back.
+void runFastForward(uint64_t ticks, const string& namesFile, const string& pricesFile, const string& abbrFile,
+                    const string& universeFile, const string& factorsFile = "stock_factors.txt")
+{
+    StockMarket market;
+    if (!market.loadUniverse(universeFile) && !market.loadStocks(namesFile, pricesFile, abbrFile))
+    {
+        return;
+    }
+    market.loadFactorModel(factorsFile);
+    auto start = chrono::steady_clock::now();
+    market.fastForward(ticks);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Fast-forward: " << ticks << " ticks over " << market.size() << " symbols in " << fixed
+         << setprecision(3) << seconds << " s (" << setprecision(0) << ticks / seconds << " ticks/sec), now at tick "
+         << market.getTickCount() << endl;
+}
+// Headless load run: a synthetic trader population trading every tick, no clock in the loop. The
+// price path and the traders are seeded, so the same arguments give the same checksum on any
+// number of threads.
+void runTraders(uint32_t agents, uint64_t ticks, unsigned threads, uint32_t seed, const string& namesFile,
+                const string& pricesFile, const string& abbrFile, const string& universeFile,
+                const string& factorsFile = "stock_factors.txt")
+{
+    StockMarket market;
+    if (!market.loadUniverse(universeFile) && !market.loadStocks(namesFile, pricesFile, abbrFile))
+    {
+        return;
+    }
+    market.loadFactorModel(factorsFile);
+    market.setSeed(seed);
+    TraderMix mix;
+    mix.makers = agents / 8;
+    mix.momentum = agents / 4;
+    mix.random = agents - mix.makers - mix.momentum;
+    TraderPopulation population(market, mix, seed, threads);
+    auto start = chrono::steady_clock::now();
+    for (uint64_t t = 0; t < ticks; ++t)
+    {
+        market.fastForward(1);
+        population.step();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    TraderPopulation::Stats stats = population.getStats();
+    cout << "Traders: " << population.size() << " (" << mix.random << " random, " << mix.momentum << " momentum, "
+         << mix.makers << " market makers) on " << threads << " threads over " << ticks << " ticks in " << fixed
+         << setprecision(3) << seconds << " s" << endl;
+    cout << setprecision(0) << stats.resumes << " resumes (" << stats.resumes / seconds << "/sec), " << stats.orders
+         << " orders (" << stats.orders / seconds << "/sec, " << stats.rejected << " rejected), " << stats.fills
+         << " fills, " << stats.cancels << " cancels" << endl;
+    cout << "Checksum " << hex << population.checksum() << dec << endl;
+}
+// Headless server: ticks the market for a while, publishing the feed and/or taking gateway
+// orders, no menu.
+void runServer(double seconds, const string& feedEndpoint, uint16_t gatewayPort, unsigned gatewayThreads,
+               double ticksPerSecond, OverrunPolicy overrunPolicy, const string& namesFile, const string& pricesFile,
+               const string& abbrFile, const string& universeFile, const string& factorsFile = "stock_factors.txt")
 {
-    srand(time(0));
-    StockExchange exchange("stock_names.txt", "stock_prices.txt", "stock_abbr.txt");
+    StockMarket market;
+    if (!market.setTickRate(ticksPerSecond, overrunPolicy))
+    {
+        cout << "Tick rate must be above 0 and at most " << maxTicksPerSecond << " per second." << endl;
+        return;
+    }
+    if (!market.loadUniverse(universeFile) && !market.loadStocks(namesFile, pricesFile, abbrFile))
+    {
+        return;
+    }
+    market.loadFactorModel(factorsFile);
+    MarketFeedPublisher feed;
+    OrderGateway gateway(market);
+    string error = feedEndpoint.empty() ? "" : feed.open(feedEndpoint);
+    if (error.empty() && gatewayPort != 0)
+    {
+        error = gateway.open(gatewayPort, gatewayThreads);
+    }
+    if (!error.empty())
+    {
+        cout << error << endl;
+        return;
+    }
+    if (feed.isOpen())
+    {
+        market.addTickListener([&feed](const MarketSnapshot& snap) { feed.onTick(snap); });
+    }
+    market.startPriceUpdates();
+    this_thread::sleep_for(chrono::milliseconds(llround(seconds * 1000.0)));
+    market.stop();
+    OrderGateway::Stats orders = gateway.getStats();
+    gateway.close();
+    MarketFeedPublisher::Stats stats = feed.getStats();
+    feed.close();
+    if (!feedEndpoint.empty())
+    {
+        cout << "Published " << stats.ticks << " ticks over " << market.size() << " symbols: " << stats.datagrams
+             << " datagrams, " << stats.updates << " updates, " << stats.snapshots << " snapshots, " << stats.dropped
+             << " dropped" << endl;
+        cout << "Symbols " << market.size() << ", checksum " << hex << stats.checksum << dec << endl;
+    }
+    if (gatewayPort != 0)
+    {
+        cout << "Gateway: " << orders.requests << " requests in " << orders.batches << " batches (" << fixed
+             << setprecision(1) << (orders.batches ? double(orders.requests) / orders.batches : 0.0)
+             << " per batch), " << orders.accepted << " accepted, " << orders.cancelled << " cancelled, "
+             << orders.rejected << " rejected, " << orders.fills << " resting fills" << endl;
+        if (orders.unsettled)
+        {
+            cout << "Gateway: the account store refused " << orders.unsettled << " settlements" << endl;
+        }
+    }
+}
+// Plays a recording made with --record through a fresh account, without the menu.
+void runReplay(const string& recordingPath, double speed, const string& namesFile, const string& pricesFile,
+               const string& abbrFile, const string& universeFile)
+{
+    SessionReplay replay;
+    string error = replay.open(recordingPath);
+    if (!error.empty())
+    {
+        cout << error << endl;
+        return;
+    }
+    StockMarket market;
+    if (!market.loadUniverse(universeFile) && !market.loadStocks(namesFile, pricesFile, abbrFile))
+    {
+        return;
+    }
+    Portfolio portfolio;
+    market.addTickListener([&portfolio](const MarketSnapshot& snap) { portfolio.onTick(snap); });
+    SessionReplay::Stats stats;
+    error = replay.run(market, portfolio, speed, stats);
+    if (!error.empty())
+    {
+        cout << recordingPath << ": " << error << endl;
+        return;
+    }
+    cout << "Replayed " << stats.ticks << " ticks and " << stats.actions << " actions over " << market.size()
+         << " symbols in " << fixed << setprecision(3) << stats.seconds << " s (" << setprecision(0)
+         << stats.ticks / max(stats.seconds, 1e-9) << " ticks/sec)" << endl;
+    if (stats.truncated)
+    {
+        cout << "The recording ends partway through a record; replayed up to there." << endl;
+    }
+    if (stats.diverged)
+    {
+        cout << stats.diverged << " actions left different cash than when recorded, the first at tick "
+             << stats.firstDivergedAt << endl;
+    }
+    else
+    {
+        cout << "Every action left the same cash as when recorded." << endl;
+    }
+    cout << "Cash $" << setprecision(2) << portfolio.getCash() << ", total value $"
+         << portfolio.getValuation().totalValue << endl;
+}
+int main(int argc, char* argv[])
+{
+    if (argc > 5 && string(argv[1]) == "--convert-universe")
+    {
+        // beginning --convert-universe names prices abbr universe.bin
+        return StockMarket().convertUniverse(argv[2], argv[3], argv[4], argv[5]) ? 0 : 1;
+    }
+    if (argc > 2 && string(argv[1]) == "--fast-forward")
+    {
+        runFastForward(strtoull(argv[2], nullptr, 10), "stock_names.txt", "stock_prices.txt", "stock_abbr.txt",
+                       "stock_universe.bin");
+        return 0;
+    }
+    if (argc > 3 && string(argv[1]) == "--traders")
+    {
+        // beginning --traders AGENTS TICKS [THREADS [SEED]]
+        unsigned threads = argc > 4 ? max(1, atoi(argv[4])) : max(1U, thread::hardware_concurrency());
+        uint32_t seed = argc > 5 ? static_cast<uint32_t>(strtoul(argv[5], nullptr, 10)) : 1;
+        runTraders(static_cast<uint32_t>(strtoul(argv[2], nullptr, 10)), strtoull(argv[3], nullptr, 10), threads, seed,
+                   "stock_names.txt", "stock_prices.txt", "stock_abbr.txt", "stock_universe.bin");
+        return 0;
+    }
+    // beginning [--tick-rate HZ [catch-up|skip]] [--stats-file PATH [SECONDS]] [--feed ENDPOINT]
+    //           [--gateway PORT [THREADS]] [--serve SECONDS] [--history PATH [EVERY]] [--seed N]
+    //           [--record PATH] [--replay PATH [SPEED|max]]
+    // The stats table is rewritten every SECONDS (default stats.txt every 10 s; 0 turns it off).
+    // --feed publishes every tick to udp:GROUP:PORT or unix:PATH. --gateway takes orders over TCP on
+    // 127.0.0.1:PORT. --serve runs just those, without the menu. --history archives the price history to
+    // PATH instead of keeping the latest 256 MB of it in memory, with one tick in EVERY (default 1)
+    // kept as ticks; the 1s, 1m and 1h bars see them all. --seed fixes the price path.
+    // --record writes every tick and account action to PATH; --replay plays such a recording
+    // back through a fresh account at the recorded pace, SPEED times faster or flat out.
+    double ticksPerSecond = 1.0;
+    OverrunPolicy overrunPolicy = OverrunPolicy::CatchUp;
+    string statsPath = "stats.txt";
+    double statsSeconds = 10.0;
+    string feedEndpoint;
+    uint16_t gatewayPort = 0;
+    unsigned gatewayThreads = 2;
+    double serveSeconds = 0.0;
+    string historyPath;
+    uint32_t historyEvery = 1;
+    string recordPath;
+    string replayPath;
+    double replaySpeed = 1.0;
+    bool seeded = false;
+    unsigned seed = 0;
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        string option = argv[i];
+        if (option == "--tick-rate")
+        {
+            ticksPerSecond = atof(argv[++i]);
+            if (i + 1 < argc && (string(argv[i + 1]) == "skip" || string(argv[i + 1]) == "catch-up"))
+            {
+                overrunPolicy = string(argv[++i]) == "skip" ? OverrunPolicy::Skip : OverrunPolicy::CatchUp;
+            }
+        }
+        else if (option == "--stats-file")
+        {
+            statsPath = argv[++i];
+            if (i + 1 < argc && isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+            {
+                statsSeconds = atof(argv[++i]);
+            }
+        }
+        else if (option == "--feed")
+        {
+            feedEndpoint = argv[++i];
+        }
+        else if (option == "--gateway")
+        {
+            gatewayPort = static_cast<uint16_t>(atoi(argv[++i]));
+            if (i + 1 < argc && isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+            {
+                gatewayThreads = static_cast<unsigned>(atoi(argv[++i]));
+            }
+        }
+        else if (option == "--serve")
+        {
+            serveSeconds = atof(argv[++i]);
+        }
+        else if (option == "--history")
+        {
+            historyPath = argv[++i];
+            if (i + 1 < argc && isdigit(static_cast<unsigned char>(argv[i + 1][0])))
+            {
+                historyEvery = static_cast<uint32_t>(max(1, atoi(argv[++i])));
+            }
+        }
+        else if (option == "--seed")
+        {
+            seed = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+            seeded = true;
+        }
+        else if (option == "--record")
+        {
+            recordPath = argv[++i];
+        }
+        else if (option == "--replay")
+        {
+            replayPath = argv[++i];
+            if (i + 1 < argc && (string(argv[i + 1]) == "max" || isdigit(static_cast<unsigned char>(argv[i + 1][0]))))
+            {
+                string speed = argv[++i];
+                replaySpeed = speed == "max" ? 0.0 : atof(speed.c_str());
+            }
+        }
+    }
+    if (serveSeconds > 0.0 && (!feedEndpoint.empty() || gatewayPort != 0))
+    {
+        runServer(serveSeconds, feedEndpoint, gatewayPort, gatewayThreads, ticksPerSecond, overrunPolicy,
+                  "stock_names.txt", "stock_prices.txt", "stock_abbr.txt", "stock_universe.bin");
+        return 0;
+    }
+    if (!replayPath.empty())
+    {
+        runReplay(replayPath, replaySpeed, "stock_names.txt", "stock_prices.txt", "stock_abbr.txt",
+                  "stock_universe.bin");
+        return 0;
+    }
+    srand(seeded ? seed : static_cast<unsigned>(time(0)));
+    StockExchange exchange("stock_names.txt", "stock_prices.txt", "stock_abbr.txt", "stock_universe.bin", "portfolio",
+                           ticksPerSecond, overrunPolicy, statsPath, statsSeconds, feedEndpoint, gatewayPort,
+                           gatewayThreads, historyPath, historyEvery, "stock_factors.txt", recordPath);
     cout << "=====WELCOME TO OUR STOCK MARKET SIMULATOR=====" << endl;
     exchange.run();
     return 0;
 }
-
@@ -0,0 +1,1376 @@
+#include "stock_market.h"
+#include "trader_agents.h"
+#include <fcntl.h>
+// Microbenchmarks for the hot paths. Results are written to stdout as one JSON document so runs
+// from different builds can be compared; progress goes to stderr.
+//
+//   stock_bench [--quick] [benchmark ...]
+//
+// With no names every benchmark runs. --quick divides the sizes by ten for a smoke run.
+
+// Collects one object per result and writes them, with the build they came from, as JSON.
+class BenchReport {
+private:
+    vector<vector<pair<string, string>>> results; // Values already encoded
+
+    static string quote(string_view text)
+    {
+        string out = "\"";
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out += '\\';
+            }
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+                continue;
+            }
+            out += c;
+        }
+        return out + '"';
+    }
+
+public:
+    void begin(string_view name)
+    {
+        results.emplace_back();
+        add("name", name);
+    }
+    void add(string_view key, double value)
+    {
+        char digits[32];
+        to_chars_result result = value == floor(value) && fabs(value) < 1e15
+                                     ? to_chars(digits, digits + sizeof(digits), static_cast<int64_t>(value))
+                                     : to_chars(digits, digits + sizeof(digits), value, chars_format::general, 10);
+        results.back().emplace_back(key, isfinite(value) ? string(digits, result.ptr) : "null");
+    }
+    void add(string_view key, string_view value)
+    {
+        results.back().emplace_back(key, quote(value));
+    }
+    // Sorts the samples and adds <prefix>_p50_ns ... <prefix>_max_ns.
+    void addLatencies(const string& prefix, vector<uint32_t>& nanoseconds)
+    {
+        if (nanoseconds.empty())
+        {
+            return;
+        }
+        sort(nanoseconds.begin(), nanoseconds.end());
+        size_t count = nanoseconds.size();
+        auto percentile = [&](double p) { return nanoseconds[min(count - 1, static_cast<size_t>(p * count))]; };
+        add(prefix + "_p50_ns", percentile(0.50));
+        add(prefix + "_p90_ns", percentile(0.90));
+        add(prefix + "_p99_ns", percentile(0.99));
+        add(prefix + "_p999_ns", percentile(0.999));
+        add(prefix + "_max_ns", nanoseconds.back());
+    }
+
+    void write(ostream& out, bool quick) const
+    {
+#if defined(__clang__)
+        string compiler = "clang " __clang_version__;
+#elif defined(__GNUC__)
+        string compiler = "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+        string compiler = "msvc " + to_string(_MSC_VER);
+#else
+        string compiler = "unknown";
+#endif
+#if defined(__AVX2__)
+        const char* kernel = "avx2";
+#elif defined(__SSE4_1__)
+        const char* kernel = "sse4.1";
+#else
+        const char* kernel = "scalar";
+#endif
+        out << "{\n  \"build\": {\"compiler\": " << quote(compiler) << ", \"tick_kernel\": \"" << kernel
+            << "\", \"instrumentation\": " << (STOCK_INSTRUMENTATION ? "true" : "false")
+            << ", \"hardware_threads\": " << thread::hardware_concurrency() << ", \"quick\": "
+            << (quick ? "true" : "false") << ", \"timestamp\": " << time(0) << "},\n  \"results\": [";
+        for (size_t r = 0; r < results.size(); ++r)
+        {
+            out << (r ? ",\n    {" : "\n    {");
+            for (size_t f = 0; f < results[r].size(); ++f)
+            {
+                out << (f ? ", " : "") << quote(results[r][f].first) << ": " << results[r][f].second;
+            }
+            out << "}";
+        }
+        out << "\n  ]\n}" << endl;
+    }
+};
+
+template <class Fn>
+double secondsOf(Fn&& fn)
+{
+    auto start = chrono::steady_clock::now();
+    fn();
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+inline uint32_t nanosecondsSince(chrono::steady_clock::time_point start)
+{
+    return static_cast<uint32_t>(
+        chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+}
+
+// Points stdout at the null device while alive, so code that prints (order confirmations, the
+// live board) does not end up in the JSON.
+class QuietStdout {
+private:
+    int saved;
+
+public:
+    QuietStdout()
+    {
+        cout.flush();
+        fflush(stdout);
+#if defined(_WIN32)
+        saved = _dup(1);
+        int null = _open("NUL", _O_WRONLY);
+        _dup2(null, 1);
+        _close(null);
+#else
+        saved = dup(STDOUT_FILENO);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        close(null);
+#endif
+    }
+    ~QuietStdout()
+    {
+        cout.flush();
+        fflush(stdout);
+#if defined(_WIN32)
+        _dup2(saved, 1);
+        _close(saved);
+#else
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+#endif
+    }
+};
+
+// Synthetic universe: abbreviation "S<i>", prices spread over $10-$510.
+struct SyntheticUniverse
+{
+    vector<string> names;
+    vector<string> abbrs;
+    vector<string_view> nameViews;
+    vector<string_view> abbrViews;
+    vector<double> prices;
+
+    explicit SyntheticUniverse(size_t symbols)
+        : names(symbols), abbrs(symbols), nameViews(symbols), abbrViews(symbols), prices(symbols)
+    {
+        for (size_t i = 0; i < symbols; ++i)
+        {
+            // Appended rather than "S" + to_string(i): GCC 12 flags that with a bogus -Wrestrict in C++20.
+            names[i] = "Company ";
+            names[i] += to_string(i);
+            abbrs[i] = "S";
+            abbrs[i] += to_string(i);
+            nameViews[i] = names[i];
+            abbrViews[i] = abbrs[i];
+            prices[i] = 10.0 + static_cast<double>(i % 500);
+        }
+    }
+    void addTo(StockMarket& market) const
+    {
+        market.addUniverse(nameViews.data(), abbrViews.data(), prices.data(), prices.size());
+    }
+};
+
+// The price kernel alone over `symbols` columns for `ticks` ticks: what a tick would cost if it did
+// nothing else, such as keeping the history windows.
+double secondsOfKernel(size_t symbols, int ticks, TickWorkerPool* pool)
+{
+    AlignedVector<double> prices(symbols);
+    AlignedVector<double> volatilities(symbols, 0.05);
+    for (size_t i = 0; i < symbols; ++i)
+    {
+        prices[i] = 50.0 + static_cast<double>(i % 100);
+    }
+    PriceColumns columns{prices.data(), volatilities.data()};
+    auto step = [&](uint32_t key)
+    {
+        auto shard = [&](size_t begin, size_t end) { updatePrices(columns, columns, begin, end, key); };
+        if (pool)
+        {
+            pool->run(symbols, shard);
+        }
+        else
+        {
+            shard(0, symbols);
+        }
+    };
+    step(tickKey(12345, 0)); // Warm up caches and page in the columns
+    return secondsOf([&]
+    {
+        for (int t = 1; t <= ticks; ++t)
+        {
+            step(tickKey(12345, static_cast<uint64_t>(t)));
+        }
+    });
+}
+
+// One thread stepping every symbol: the per-symbol price update, with the history windows, and
+// the kernel on its own.
+void benchPriceUpdate(BenchReport& report, size_t scale)
+{
+    const size_t symbols = 100000;
+    const int ticks = static_cast<int>(2000 / scale);
+    MarketState bench(12345);
+    bench.reserve(symbols);
+    for (size_t i = 0; i < symbols; ++i)
+    {
+        bench.addSymbol("", "", 50.0 + static_cast<double>(i % 100));
+    }
+    bench.tick();
+    double seconds = secondsOf([&]
+    {
+        for (int t = 0; t < ticks; ++t)
+        {
+            bench.tick();
+        }
+    });
+    double updates = static_cast<double>(symbols) * ticks;
+    double kernelSeconds = secondsOfKernel(symbols, ticks, nullptr);
+    report.begin("price_update");
+    report.add("symbols", symbols);
+    report.add("ticks", ticks);
+    report.add("ns_per_symbol", seconds * 1e9 / updates);
+    report.add("symbols_per_sec", updates / seconds);
+    report.add("kernel_ns_per_symbol", kernelSeconds * 1e9 / updates);
+}
+
+// Full tick on the worker pool, 1k to 1M symbols.
+void benchTickPass(BenchReport& report, size_t scale)
+{
+    TickWorkerPool pool(thread::hardware_concurrency());
+    for (size_t symbols : {1000, 10000, 100000, 1000000})
+    {
+        int ticks = static_cast<int>(clamp<size_t>(100000000 / scale / symbols, 10, 20000));
+        MarketState bench(12345);
+        bench.reserve(symbols);
+        for (size_t i = 0; i < symbols; ++i)
+        {
+            bench.addSymbol("", "", 50.0 + static_cast<double>(i % 100));
+        }
+        bench.tick(&pool); // Warm up caches and page in the columns
+        double seconds = secondsOf([&]
+        {
+            for (int t = 0; t < ticks; ++t)
+            {
+                bench.tick(&pool);
+            }
+        });
+        report.begin("tick_pass");
+        report.add("symbols", symbols);
+        report.add("ticks", ticks);
+        report.add("threads", pool.getThreadCount());
+        report.add("ms_per_tick", seconds * 1e3 / ticks);
+        report.add("symbols_per_sec", static_cast<double>(symbols) * ticks / seconds);
+        report.add("kernel_ms_per_tick", secondsOfKernel(symbols, ticks, &pool) * 1e3 / ticks);
+    }
+}
+
+// Ticks through StockMarket, as the scheduler does: tick pass, publish, listeners and probes.
+void benchFastForward(BenchReport& report, size_t scale)
+{
+    const size_t symbols = 100000;
+    const uint64_t ticks = 2000 / scale;
+    SyntheticUniverse universe(symbols);
+    StockMarket market;
+    universe.addTo(market);
+    market.fastForward(1);
+    double seconds = secondsOf([&] { market.fastForward(ticks); });
+    report.begin("fast_forward");
+    report.add("symbols", symbols);
+    report.add("ticks", ticks);
+    report.add("ms_per_tick", seconds * 1e3 / ticks);
+}
+
+// Parses generated text files with loadStocks, converts them and loads the binary universe.
+void benchLoad(BenchReport& report, size_t scale)
+{
+    const size_t symbols = 1000000 / scale;
+    filesystem::path dir = filesystem::temp_directory_path() / ("stock_bench_" + to_string(time(0)));
+    filesystem::create_directories(dir);
+    string namesFile = (dir / "names.txt").string();
+    string pricesFile = (dir / "prices.txt").string();
+    string abbrFile = (dir / "abbr.txt").string();
+    string universeFile = (dir / "universe.bin").string();
+    {
+        SyntheticUniverse universe(symbols);
+        ofstream names(namesFile), prices(pricesFile), abbrs(abbrFile);
+        for (size_t i = 0; i < symbols; ++i)
+        {
+            names << universe.names[i] << '\n';
+            prices << universe.prices[i] << '\n';
+            abbrs << universe.abbrs[i] << '\n';
+        }
+    }
+    size_t loaded = 0;
+    double textSeconds = secondsOf([&]
+    {
+        StockMarket market;
+        market.loadStocks(namesFile, pricesFile, abbrFile);
+        loaded = market.size();
+    });
+    double convertSeconds = secondsOf([&] { StockMarket().convertUniverse(namesFile, pricesFile, abbrFile, universeFile); });
+    double binarySeconds = secondsOf([&]
+    {
+        StockMarket market;
+        market.loadUniverse(universeFile);
+    });
+    error_code error;
+    filesystem::remove_all(dir, error);
+    report.begin("load_stocks");
+    report.add("symbols", loaded);
+    report.add("text_s", textSeconds);
+    report.add("convert_s", convertSeconds);
+    report.add("binary_s", binarySeconds);
+}
+
+// getStock by abbreviation against the ordered map the symbol table replaced.
+void benchSymbolLookup(BenchReport& report, size_t scale)
+{
+    const size_t symbols = 1000000 / scale;
+    const size_t lookups = 5000000 / scale;
+    SyntheticUniverse universe(symbols);
+    vector<string> queries(lookups);
+    for (size_t i = 0; i < lookups; ++i)
+    {
+        queries[i] = universe.abbrs[symbolDraw(0xFACE, static_cast<uint32_t>(i)) % symbols];
+    }
+    StockMarket market(1);
+    double buildSeconds = secondsOf([&] { universe.addTo(market); });
+    map<string, uint32_t> ordered;
+    double mapBuildSeconds = secondsOf([&]
+    {
+        for (size_t i = 0; i < symbols; ++i)
+        {
+            ordered.emplace(universe.abbrs[i], static_cast<uint32_t>(i));
+        }
+    });
+    uint64_t checksum = 0;
+    double lookupSeconds = secondsOf([&]
+    {
+        for (const string& query : queries)
+        {
+            checksum += market.getStock(query)->getId();
+        }
+    });
+    double mapLookupSeconds = secondsOf([&]
+    {
+        for (const string& query : queries)
+        {
+            checksum -= ordered.find(query)->second;
+        }
+    });
+    report.begin("get_stock");
+    report.add("symbols", symbols);
+    report.add("load_and_build_s", buildSeconds);
+    report.add("map_build_s", mapBuildSeconds);
+    report.add("lookup_ns", lookupSeconds * 1e9 / lookups);
+    report.add("map_lookup_ns", mapLookupSeconds * 1e9 / lookups);
+    report.add("verified", checksum == 0 ? "yes" : "MISMATCH");
+}
+
+// Market buy then market sell of 100 shares through the portfolio, house quotes refreshed
+// each time as in the menu.
+void benchBuySell(BenchReport& report, size_t scale)
+{
+    const size_t symbols = 1000;
+    const size_t roundTrips = 20000 / scale;
+    SyntheticUniverse universe(symbols);
+    StockMarket market(1);
+    universe.addTo(market);
+    Portfolio portfolio;
+    vector<uint32_t> buys(roundTrips), sells(roundTrips);
+    {
+        QuietStdout quiet;
+        portfolio.deposit(Portfolio::Price(1e12));
+        for (size_t i = 0; i < roundTrips; ++i)
+        {
+            Stock* stock = market.getStock(symbolDraw(0xB1D, static_cast<uint32_t>(i)) % symbols);
+            auto start = chrono::steady_clock::now();
+            portfolio.buyStock(market, stock, 100);
+            buys[i] = nanosecondsSince(start);
+            start = chrono::steady_clock::now();
+            portfolio.sellStock(market, stock, 100);
+            sells[i] = nanosecondsSince(start);
+        }
+    }
+    report.begin("buy_sell");
+    report.add("round_trips", roundTrips);
+    report.addLatencies("buy", buys);
+    report.addLatencies("sell", sells);
+}
+
+// CPU per frame of the live board on a screen tall enough for every row, ticking every tenth
+// frame as the menu's 10 Hz redraw does at one tick per second.
+void benchBoard(BenchReport& report, size_t scale)
+{
+    const size_t symbols = 5000;
+    const int frames = static_cast<int>(max<size_t>(20, 200 / scale));
+    const int framesPerTick = 10;
+    SyntheticUniverse universe(symbols);
+    StockMarket market(1);
+    universe.addTo(market);
+    TerminalRenderer screen;
+    size_t top = 0;
+    int rows = static_cast<int>(symbols) + StockMarket::boardChromeRows;
+    double cpuSeconds;
+    {
+        QuietStdout quiet;
+        clock_t cpuStart = clock();
+        for (int frame = 0; frame < frames; ++frame)
+        {
+            if (frame % framesPerTick == 0)
+            {
+                market.fastForward(1);
+            }
+            market.showAllStocksLive(screen, top, rows, 80);
+        }
+        cpuSeconds = static_cast<double>(clock() - cpuStart) / CLOCKS_PER_SEC;
+        screen.release();
+    }
+    report.begin("board_render");
+    report.add("rows", symbols);
+    report.add("frames", frames);
+    report.add("frames_per_tick", framesPerTick);
+    report.add("cpu_us_per_frame", cpuSeconds / frames * 1e6);
+    report.add("core_percent_at_10hz", cpuSeconds / frames * 10 * 100);
+}
+
+// Matching engine on one symbol: 50% limit orders within 50 ticks of the mid (a tenth of them
+// crossing), 35% cancels of random resting orders and 15% market orders.
+void benchOrderBook(BenchReport& report, size_t scale)
+{
+    const size_t operations = 5000000 / scale;
+    MatchingEngine engine(1 << 20);
+    vector<Fill> fills;
+    fills.reserve(1024);
+    vector<uint64_t> live;
+    live.reserve(1 << 20);
+    vector<uint32_t> latencies(operations);
+    const int64_t mid = 10000;
+    uint32_t key = 0x2545F491U;
+    for (int i = 0; i < 20000; ++i) // Seed a book a few thousand orders deep
+    {
+        uint32_t u = symbolDraw(key, i);
+        Side side = (u & 1) ? Side::Buy : Side::Sell;
+        int64_t price = side == Side::Buy ? mid - 1 - (u >> 1) % 50 : mid + 1 + (u >> 1) % 50;
+        live.push_back(engine.submit(0, side, OrderType::Limit, price, 1 + (u >> 8) % 100, 1, fills).orderId);
+    }
+    size_t fillCount = 0;
+    double seconds = secondsOf([&]
+    {
+        for (size_t i = 0; i < operations; ++i)
+        {
+            uint32_t u = symbolDraw(key ^ 0x9E3779B9U, static_cast<uint32_t>(i));
+            uint32_t kind = u % 100;
+            Side side = (u >> 7) & 1 ? Side::Buy : Side::Sell;
+            fills.clear();
+            auto start = chrono::steady_clock::now();
+            if (kind < 50)
+            {
+                int64_t offset = static_cast<int64_t>((u >> 8) % 50) - 5;
+                int64_t price = side == Side::Buy ? mid - offset : mid + offset;
+                OrderResult result = engine.submit(0, side, OrderType::Limit, price, 1 + (u >> 16) % 100, 1, fills);
+                if (result.resting)
+                {
+                    live.push_back(result.orderId);
+                }
+            }
+            else if (kind < 85 && !live.empty())
+            {
+                size_t pick = (u >> 8) % live.size();
+                engine.cancel(live[pick]);
+                live[pick] = live.back();
+                live.pop_back();
+            }
+            else
+            {
+                engine.submit(0, side, OrderType::Market, 0, 1 + (u >> 16) % 200, 1, fills);
+            }
+            latencies[i] = nanosecondsSince(start);
+            fillCount += fills.size();
+        }
+    });
+    report.begin("order_book");
+    report.add("operations", operations);
+    report.add("ops_per_sec", operations / seconds);
+    report.add("fills", fillCount);
+    report.addLatencies("op", latencies);
+}
+
+// Appends fills as fast as one thread can; group commit decides how many fsyncs that takes.
+void benchJournal(BenchReport& report, size_t scale)
+{
+    const size_t records = 1000000 / scale;
+    const string basePath = (filesystem::temp_directory_path() / "stock_bench_journal").string();
+    auto removeFiles = [&]
+    {
+        error_code error;
+        filesystem::remove(basePath + ".snapshot", error);
+        filesystem::remove(basePath + ".journal.0", error);
+    };
+    removeFiles();
+    vector<uint32_t> latencies(records);
+    Journal journal;
+    journal.open(basePath, [](const JournalRecord&, string_view) {});
+    double seconds = secondsOf([&]
+    {
+        for (size_t i = 0; i < records; ++i)
+        {
+            auto start = chrono::steady_clock::now();
+            journal.append(JournalKind::Fill, "BENCH", (i & 1) ? 10 : -10, 100.0 + (i % 100) * 0.01,
+                           static_cast<int64_t>(i));
+            latencies[i] = nanosecondsSince(start);
+        }
+        journal.flush();
+    });
+    uint64_t batches = journal.getBatches();
+    journal.close();
+    size_t replayed = 0;
+    Journal replay;
+    double replaySeconds = secondsOf([&] { replay.open(basePath, [&](const JournalRecord&, string_view) { ++replayed; }); });
+    replay.close();
+    removeFiles();
+    report.begin("journal");
+    report.add("records", records);
+    report.add("records_per_sec", records / seconds);
+    report.add("fsyncs", batches);
+    report.add("replayed", replayed);
+    report.add("replay_s", replaySeconds);
+    report.addLatencies("append", latencies);
+}
+
+void benchRisk(BenchReport& report, size_t scale)
+{
+    RiskScenario scenario;
+    const size_t symbols = 1000;
+    for (size_t s = 0; s < symbols; ++s)
+    {
+        scenario.prices.push_back(10.0 + s % 90);
+        scenario.volatilities.push_back(0.01 + (s % 10) * 0.01);
+        scenario.shares.push_back(100.0);
+    }
+    scenario.paths = 100000 / scale;
+    scenario.steps = 250;
+    scenario.seed = 42;
+    TickWorkerPool pool(thread::hardware_concurrency());
+    RiskReport risk = runRiskSimulation(scenario, pool);
+    report.begin("risk");
+    report.add("paths", scenario.paths);
+    report.add("symbols", symbols);
+    report.add("steps", scenario.steps);
+    report.add("symbol_steps_per_sec", static_cast<double>(scenario.paths) * symbols * scenario.steps / risk.seconds);
+    report.add("var95", risk.valueAtRisk95);
+    report.add("es95", risk.expectedShortfall95);
+}
+
+// Alert levels sit 2-30% from the price, so most never fire in the run.
+void benchAlerts(BenchReport& report, size_t scale)
+{
+    const size_t symbols = 10000;
+    const uint32_t alerts = 100000;
+    const int ticks = static_cast<int>(1000 / scale);
+    MarketState bench(7);
+    bench.reserve(symbols);
+    for (size_t i = 0; i < symbols; ++i)
+    {
+        bench.addSymbol("", "", 20.0 + static_cast<double>(i % 200));
+    }
+    AlertEngine engine;
+    AlertQueue& queue = engine.addConsumer();
+    uint32_t key = 0xA1E47u;
+    bench.readSnapshot([&](const MarketSnapshot& snap)
+    {
+        for (uint32_t a = 0; a < alerts; ++a)
+        {
+            uint32_t symbol = symbolDraw(key, 2 * a) % symbols;
+            uint32_t u = symbolDraw(key, 2 * a + 1);
+            double distance = 0.02 + 0.28 * ((u >> 2) & 0xFFFF) / 65536.0;
+            double price = snap.prices[symbol];
+            switch (u & 3)
+            {
+                case 0: engine.add(symbol, AlertKind::Above, price * (1.0 + distance), price); break;
+                case 1: engine.add(symbol, AlertKind::Below, price * (1.0 - distance), price); break;
+                default: engine.add(symbol, AlertKind::PercentMove, distance * 100.0, price); break;
+            }
+        }
+        return 0;
+    });
+    double evaluateSeconds = 0.0;
+    AlertEvent event;
+    for (int t = 0; t < ticks; ++t)
+    {
+        bench.tick();
+        evaluateSeconds += secondsOf([&] { bench.readSnapshot([&](const MarketSnapshot& snap) { engine.onTick(snap); return 0; }); });
+        while (queue.pop(event))
+        {
+        }
+    }
+    report.begin("alerts");
+    report.add("symbols", symbols);
+    report.add("alerts", alerts);
+    report.add("ticks", ticks);
+    report.add("fired", engine.getFired());
+    report.add("us_per_tick", evaluateSeconds * 1e6 / ticks);
+}
+
+// AccountStore: memory per account holding four positions, then deposit, withdraw, buy and sell
+// in equal parts on random accounts, from one thread and from several.
+void benchAccounts(BenchReport& report, size_t scale)
+{
+    const size_t symbols = 1000;
+    const uint32_t accounts = static_cast<uint32_t>(200000 / scale);
+    const uint32_t positionsEach = 4;
+    const size_t operations = 4000000 / scale;
+    SyntheticUniverse universe(symbols);
+    StockMarket market(1);
+    universe.addTo(market);
+    AccountStore store;
+    auto heldSymbol = [&](uint32_t account, uint32_t p)
+    {
+        return symbolDraw(0xACC7, account * positionsEach + p) % symbols;
+    };
+    double openSeconds = secondsOf([&]
+    {
+        for (uint32_t a = 0; a < accounts; ++a)
+        {
+            uint32_t id = store.open(100000000); // Ids come out 0, 1, 2, ...
+            for (uint32_t p = 0; p < positionsEach; ++p)
+            {
+                store.buyStock(market, id, heldSymbol(a, p), 10);
+            }
+        }
+    });
+    size_t bytes = store.memoryBytes();
+    report.begin("accounts");
+    report.add("accounts", accounts);
+    report.add("positions_per_account", positionsEach);
+    report.add("bytes_per_account", static_cast<double>(bytes) / accounts);
+    report.add("open_ns", openSeconds * 1e9 / accounts);
+    report.add("operations", operations);
+    for (unsigned threads : {1u, max(4u, thread::hardware_concurrency())})
+    {
+        atomic<uint64_t> failed{0};
+        double seconds = secondsOf([&]
+        {
+            vector<thread> workers;
+            for (unsigned t = 0; t < threads; ++t)
+            {
+                workers.emplace_back([&, t]
+                {
+                    uint64_t failures = 0;
+                    uint32_t key = tickKey(0xACC7, t);
+                    for (size_t i = t; i < operations; i += threads)
+                    {
+                        uint32_t id = symbolDraw(key, static_cast<uint32_t>(i)) % accounts;
+                        uint32_t symbol = heldSymbol(id, 0);
+                        AccountStatus status;
+                        switch (i & 3)
+                        {
+                            case 0: status = store.deposit(id, 100); break;
+                            case 1: status = store.withdraw(id, 100); break;
+                            case 2: status = store.buyStock(market, id, symbol, 1); break;
+                            default: status = store.sellStock(market, id, symbol, 1); break;
+                        }
+                        failures += status != AccountStatus::Ok;
+                    }
+                    failed += failures;
+                });
+            }
+            for (thread& worker : workers)
+            {
+                worker.join();
+            }
+        });
+        report.add("ops_per_sec_" + to_string(threads) + "_threads", operations / seconds);
+        report.add("failed_" + to_string(threads) + "_threads", failed.load());
+    }
+}
+
+struct HistoryConfig
+{
+    string name;
+    uint32_t every; // One tick in this many kept as ticks
+    bool quiet;     // Prices follow the model a cent at a time on one tick in twenty
+    double seconds; // Spent appending
+};
+
+// Runs the market for `ticks` ticks, appending each to every history at a simulated 10 Hz,
+// quiet ones with the quiet book's prices. Returns the seconds taken, appends included.
+template <size_t N>
+double recordHistories(StockMarket& market, const vector<double>& prices, uint64_t ticks,
+                       array<HistoryConfig, N>& configs, array<TickHistory, N>& histories)
+{
+    const int64_t startMs = 10 * 3600000; // On the hour, so the bar buckets line up with the ticks
+    TradedVolume traded;                  // No orders in this market
+    traded.resize(prices.size());
+    vector<double> held(prices);
+    market.addTickListener([&, startTick = market.getTickCount()](const MarketSnapshot& snap)
+    {
+        int64_t nowMs = startMs + 100 * static_cast<int64_t>(snap.tick - startTick);
+        for (size_t id = snap.tick % 20; id < snap.count; id += 20)
+        {
+            held[id] += snap.prices[id] > held[id] ? 0.01 : -0.01;
+        }
+        for (size_t c = 0; c < N; ++c)
+        {
+            MarketSnapshot seen = snap;
+            if (configs[c].quiet)
+            {
+                seen.prices = held.data();
+            }
+            configs[c].seconds += secondsOf([&] { histories[c].append(seen, traded, nowMs); });
+        }
+    });
+    double seconds = secondsOf([&] { market.fastForward(ticks); });
+    for (TickHistory& history : histories)
+    {
+        history.close();
+    }
+    return seconds;
+}
+
+// Records the market's ticks into four histories: every tick of this price model, where every
+// price moves by up to 1% a tick (archived), and one tick in ten of it; then the same for a quiet
+// book, where each price follows the model a cent at a time on one tick in twenty. For each: the
+// cost per tick and what a 10 Hz trading day of 100k symbols comes to in the tick stream, each
+// bar series and all told. Those few minutes make only a handful of minute and hour bars, so the
+// bar figures come from two hours of a smaller universe. Then range queries for one symbol over
+// everything archived.
+void benchHistory(BenchReport& report, size_t scale)
+{
+    const size_t symbols = 100000 / scale;
+    const uint64_t ticks = 2 * historySegmentTicks;
+    const string path = (filesystem::temp_directory_path() / "stock_bench_history").string();
+    SyntheticUniverse universe(symbols);
+    StockMarket market;
+    universe.addTo(market);
+    array<HistoryConfig, 4> configs{HistoryConfig{"history", 1, false, 0.0},
+                                    HistoryConfig{"history_every_10", 10, false, 0.0},
+                                    HistoryConfig{"history_quiet", 1, true, 0.0},
+                                    HistoryConfig{"history_quiet_every_10", 10, true, 0.0}};
+    array<TickHistory, 4> histories;
+    histories[0].open(path, 0);
+    for (size_t c = 1; c < configs.size(); ++c)
+    {
+        histories[c].open("", SIZE_MAX, configs[c].every);
+    }
+    double seconds = recordHistories(market, universe.prices, ticks, configs, histories);
+    double historySeconds = 0.0;
+    for (const HistoryConfig& config : configs)
+    {
+        historySeconds += config.seconds;
+    }
+
+    // Bars only: the tick stream keeps next to nothing.
+    const size_t barSymbols = 1000 / scale;
+    const uint64_t barTicks = 2 * 36000;
+    SyntheticUniverse barUniverse(barSymbols);
+    StockMarket barMarket;
+    barUniverse.addTo(barMarket);
+    array<HistoryConfig, 2> barConfigs{HistoryConfig{"model", 1, false, 0.0}, HistoryConfig{"quiet", 1, true, 0.0}};
+    array<TickHistory, 2> barHistories;
+    for (TickHistory& history : barHistories)
+    {
+        history.open("", SIZE_MAX, UINT32_MAX);
+    }
+    recordHistories(barMarket, barUniverse.prices, barTicks, barConfigs, barHistories);
+
+    for (size_t c = 0; c < configs.size(); ++c)
+    {
+        const HistoryConfig& config = configs[c];
+        TickHistory::Stats stats = histories[c].getStats();
+        TickHistory::Stats barStats = barHistories[config.quiet].getStats();
+        report.begin(config.name);
+        report.add("symbols", symbols);
+        report.add("ticks", ticks);
+        report.add("keep_every", config.every);
+        report.add("ms_per_tick", config.seconds * 1e3 / ticks);
+        report.add("market_ms_per_tick", (seconds - historySeconds) * 1e3 / ticks);
+        report.add("tick_bits_per_sample", stats.tickBytes * 8.0 / max<uint64_t>(stats.tickSamples, 1));
+        // A day of 10 Hz ticks for 100k symbols: 864000 ticks, a tenth of them kept with every_10.
+        double tickGb = stats.tickBytes / static_cast<double>(max<uint64_t>(stats.tickSamples, 1)) * 1e5 * 864000 /
+                        config.every / 1e9;
+        report.add("tick_gb_per_100k_symbol_day", tickGb);
+        double totalGb = tickGb;
+        for (auto [name, resolution] : {pair{"second", BarResolution::Second}, pair{"minute", BarResolution::Minute},
+                                        pair{"hour", BarResolution::Hour}})
+        {
+            size_t r = static_cast<size_t>(resolution);
+            double bytesPerBar = barStats.barBytes[r] / static_cast<double>(max<uint64_t>(barStats.bars[r], 1));
+            double barGb = bytesPerBar * 1e5 * static_cast<double>(86400000 / barMilliseconds(resolution)) / 1e9;
+            report.add(string(name) + "_bar_bits", bytesPerBar * 8);
+            report.add(string(name) + "_bar_gb_per_100k_symbol_day", barGb);
+            totalGb += barGb;
+        }
+        report.add("gb_per_100k_symbol_day", totalGb);
+    }
+    report.begin("history_queries");
+    const TickHistory& history = histories[0];
+    const uint32_t symbol = static_cast<uint32_t>(symbols / 2);
+    size_t decoded = 0;
+    double sampleSeconds = secondsOf([&]
+    {
+        history.forEachSample(symbol, 0, INT64_MAX, [&](int64_t, int64_t, uint64_t) { ++decoded; });
+    });
+    report.add("samples_read", decoded);
+    report.add("read_ns_per_sample", sampleSeconds * 1e9 / max<size_t>(decoded, 1));
+    for (auto [name, resolution] : {pair{"second", BarResolution::Second}, pair{"minute", BarResolution::Minute},
+                                    pair{"hour", BarResolution::Hour}})
+    {
+        size_t bars = 0;
+        double barSeconds = secondsOf([&] { bars = history.bars(symbol, resolution, 0, INT64_MAX).size(); });
+        report.add(string(name) + "_bars", bars);
+        report.add(string(name) + "_bars_us", barSeconds * 1e6);
+    }
+    error_code error;
+    filesystem::remove(path, error);
+}
+
+// Records a session of ticks and account actions, then replays it flat out through a fresh
+// market and account.
+void benchReplay(BenchReport& report, size_t scale)
+{
+    const size_t symbols = 50000 / scale;
+    const uint64_t ticks = 200;
+    const string path = (filesystem::temp_directory_path() / "stock_bench_replay").string();
+    SyntheticUniverse universe(symbols);
+    StockMarket plain;
+    universe.addTo(plain);
+    plain.fastForward(1);
+    double plainSeconds = secondsOf([&] { plain.fastForward(ticks); });
+    StockMarket market;
+    universe.addTo(market);
+    Portfolio portfolio;
+    QuietStdout quiet;
+    portfolio.startRecording(market, path);
+    double recordSeconds = secondsOf([&]
+    {
+        for (uint64_t t = 0; t < ticks; ++t)
+        {
+            market.fastForward(1);
+            auto orders = market.lockOrders();
+            portfolio.buyStock(market, market.getStock(static_cast<uint32_t>(t * 7919 % symbols)), 10);
+        }
+        market.stopRecording();
+    });
+    Portfolio::Price cash = portfolio.getCash();
+    uint64_t bytes = filesystem::file_size(path);
+    StockMarket replayed;
+    universe.addTo(replayed);
+    Portfolio account;
+    SessionReplay replay;
+    SessionReplay::Stats stats;
+    string error = replay.open(path);
+    if (error.empty())
+    {
+        error = replay.run(replayed, account, 0.0, stats);
+    }
+    report.begin("replay");
+    report.add("symbols", symbols);
+    report.add("ticks", stats.ticks);
+    report.add("actions", stats.actions);
+    report.add("ms_per_tick_live", plainSeconds * 1e3 / ticks);
+    report.add("ms_per_tick_recording", recordSeconds * 1e3 / ticks);
+    report.add("ms_per_tick_replay", stats.seconds * 1e3 / max<uint64_t>(stats.ticks, 1));
+    report.add("mb_per_tick", bytes / 1e6 / (ticks + 1));
+    report.add("replay_gb_per_sec", bytes / 1e9 / max(stats.seconds, 1e-9));
+    report.add("reproduced", error.empty() && stats.diverged == 0 && account.getCash() == cash ? "yes" : "no");
+    error_code removed;
+    filesystem::remove(path, removed);
+}
+
+// The indicator pass after each tick: a typical strategy's set against no indicators at all.
+void benchIndicators(BenchReport& report, size_t scale)
+{
+    const size_t symbols = 100000 / scale;
+    const uint64_t ticks = 2000 / scale;
+    SyntheticUniverse universe(symbols);
+    StockMarket plain;
+    universe.addTo(plain);
+    plain.fastForward(1);
+    double plainSeconds = secondsOf([&] { plain.fastForward(ticks); });
+    StockMarket market;
+    universe.addTo(market);
+    IndicatorEngine& indicators = market.getIndicators();
+    for (auto [kind, length] : {pair{IndicatorKind::Sma, 20u}, pair{IndicatorKind::Ema, 20u},
+                                pair{IndicatorKind::BollingerUpper, 20u}, pair{IndicatorKind::BollingerLower, 20u},
+                                pair{IndicatorKind::Rsi, 14u}, pair{IndicatorKind::Vwap, 60u}})
+    {
+        indicators.add(kind, length);
+    }
+    market.fastForward(1);
+    double seconds = secondsOf([&] { market.fastForward(ticks); });
+    report.begin("indicators");
+    report.add("symbols", symbols);
+    report.add("ticks", ticks);
+    report.add("indicators", indicators.size());
+    report.add("ms_per_tick", seconds * 1e3 / ticks);
+    report.add("ms_per_tick_without", plainSeconds * 1e3 / ticks);
+    report.add("ns_per_symbol_indicator",
+               (seconds - plainSeconds) * 1e9 / (static_cast<double>(ticks) * symbols * indicators.size()));
+}
+
+// Full tick with the correlated model: a market factor plus 15 sector factors correlated 0.2
+// with each other, symbol i in sector i % 15. Checks the simulated return correlations against
+// the ones the model implies.
+void benchFactorModel(BenchReport& report, size_t scale)
+{
+    const uint32_t sectors = 15;
+    const uint32_t factors = sectors + 1;
+    vector<double> correlation(factors * factors, 0.0);
+    for (uint32_t r = 0; r < factors; ++r)
+    {
+        for (uint32_t c = 0; c < factors; ++c)
+        {
+            correlation[r * factors + c] = r == c ? 1.0 : r > 0 && c > 0 ? 0.2 : 0.0;
+        }
+    }
+    TickWorkerPool pool(thread::hardware_concurrency());
+    for (size_t symbols : {50000, 1000000})
+    {
+        int ticks = static_cast<int>(clamp<size_t>(100000000 / scale / symbols, 10, 2000));
+        vector<double> loadings(symbols * factors, 0.0);
+        for (size_t i = 0; i < symbols; ++i)
+        {
+            loadings[i * factors] = 0.5;
+            loadings[i * factors + 1 + i % sectors] = 0.45;
+        }
+        auto model = make_shared<FactorModel>();
+        model->build(symbols, factors, loadings, correlation);
+        MarketState uniform(12345), bench(12345);
+        for (MarketState* state : {&uniform, &bench})
+        {
+            state->reserve(symbols);
+            for (size_t i = 0; i < symbols; ++i)
+            {
+                state->addSymbol("", "", 50.0 + static_cast<double>(i % 100));
+            }
+        }
+        bench.setFactorModel(model);
+        uniform.tick(&pool);
+        double uniformSeconds = secondsOf([&]
+        {
+            for (int t = 0; t < ticks; ++t)
+            {
+                uniform.tick(&pool);
+            }
+        });
+        bench.tick(&pool);
+        double seconds = secondsOf([&]
+        {
+            for (int t = 0; t < ticks; ++t)
+            {
+                bench.tick(&pool);
+            }
+        });
+        report.begin("factor_model");
+        report.add("symbols", symbols);
+        report.add("factors", factors);
+        report.add("ticks", ticks);
+        report.add("threads", pool.getThreadCount());
+        report.add("ms_per_tick", seconds * 1e3 / ticks);
+        report.add("ms_per_tick_uniform", uniformSeconds * 1e3 / ticks);
+        report.add("ns_per_symbol", seconds * 1e9 / (static_cast<double>(symbols) * ticks));
+    }
+
+    // Symbol 0 against 15 (same sector) and 1 (another sector), over log returns.
+    const size_t symbols = 1000;
+    const int ticks = static_cast<int>(20000 / scale);
+    vector<double> loadings(symbols * factors, 0.0);
+    for (size_t i = 0; i < symbols; ++i)
+    {
+        loadings[i * factors] = 0.5;
+        loadings[i * factors + 1 + i % sectors] = 0.45;
+    }
+    auto model = make_shared<FactorModel>();
+    model->build(symbols, factors, loadings, correlation);
+    MarketState state(777);
+    for (size_t i = 0; i < symbols; ++i)
+    {
+        state.addSymbol("", "", 100.0);
+    }
+    state.setFactorModel(model);
+    const uint32_t pairs[2][2] = {{0, sectors}, {0, 1}};
+    double sums[2][5] = {};
+    array<double, 3> last = {100.0, 100.0, 100.0};
+    for (int t = 0; t < ticks; ++t)
+    {
+        state.tick();
+        array<double, 3> now = state.readSnapshot([&](const MarketSnapshot& snap)
+        {
+            return array<double, 3>{snap.prices[0], snap.prices[sectors], snap.prices[1]};
+        });
+        for (int p = 0; p < 2; ++p)
+        {
+            double x = log(now[0] / last[0]);
+            double y = log(now[1 + p] / last[1 + p]);
+            double* sum = sums[p];
+            sum[0] += x;
+            sum[1] += y;
+            sum[2] += x * x;
+            sum[3] += y * y;
+            sum[4] += x * y;
+        }
+        last = now;
+    }
+    for (int p = 0; p < 2; ++p)
+    {
+        const double* sum = sums[p];
+        double n = ticks;
+        double covariance = sum[4] / n - sum[0] * sum[1] / (n * n);
+        double varianceX = sum[2] / n - sum[0] * sum[0] / (n * n);
+        double varianceY = sum[3] / n - sum[1] * sum[1] / (n * n);
+        report.begin("factor_model_correlation");
+        report.add("pair", p == 0 ? "same_sector" : "other_sector");
+        report.add("ticks", ticks);
+        report.add("implied", model->correlation(pairs[p][0], pairs[p][1]));
+        report.add("simulated", covariance / sqrt(varianceX * varianceY));
+    }
+}
+
+// The uniform model's step written once over the price type, with the volatility in whole
+// tenths of a percent so the Money instantiation does integer arithmetic only.
+template <class Price>
+void stepPricesAs(Price* prices, int32_t* volatility, size_t count, uint32_t key)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        uint32_t u = symbolDraw(key, static_cast<uint32_t>(i));
+        int32_t randChange = static_cast<int32_t>(((u >> 16) * 201U) >> 16) - 100;
+        int32_t volChange = static_cast<int32_t>(((u & 0xFFFFU) * 11U) >> 16) - 5;
+        int32_t vol = volatility[i];
+        prices[i] += prices[i] * (randChange * (1000 + vol)) / 10000000;
+        volatility[i] = clamp(vol + volChange, 10, 100);
+    }
+}
+
+// Prices as double against Money: the tick kernel (the production SIMD one, then the generic
+// step for each type), marking 10k held symbols to market, and what a million ten-cent
+// deposits add up to.
+void benchFixedPoint(BenchReport& report, size_t scale)
+{
+    const size_t symbols = 100000;
+    const int ticks = static_cast<int>(2000 / scale);
+    AlignedVector<double> prices(symbols), volatilities(symbols, 0.05);
+    vector<double> doublePrices(symbols);
+    vector<Money> moneyPrices(symbols);
+    vector<int32_t> doubleVolatilities(symbols, 50), moneyVolatilities(symbols, 50);
+    for (size_t i = 0; i < symbols; ++i)
+    {
+        prices[i] = doublePrices[i] = 50.0 + static_cast<double>(i % 100);
+        moneyPrices[i] = Money(prices[i]);
+    }
+    PriceColumns columns{prices.data(), volatilities.data()};
+    double simdSeconds = secondsOf([&]
+    {
+        for (int t = 0; t < ticks; ++t)
+        {
+            updatePrices(columns, columns, 0, symbols, tickKey(12345, t));
+        }
+    });
+    double doubleSeconds = secondsOf([&]
+    {
+        for (int t = 0; t < ticks; ++t)
+        {
+            stepPricesAs(doublePrices.data(), doubleVolatilities.data(), symbols, tickKey(12345, t));
+        }
+    });
+    double moneySeconds = secondsOf([&]
+    {
+        for (int t = 0; t < ticks; ++t)
+        {
+            stepPricesAs(moneyPrices.data(), moneyVolatilities.data(), symbols, tickKey(12345, t));
+        }
+    });
+    double gap = 0.0; // Largest relative difference the two types' rounding made by the end
+    for (size_t i = 0; i < symbols; ++i)
+    {
+        gap = max(gap, fabs(moneyPrices[i].toDouble() / doublePrices[i] - 1.0));
+    }
+    double updates = static_cast<double>(symbols) * ticks;
+    for (auto [kind, seconds] : {pair{"double_simd", simdSeconds}, pair{"double", doubleSeconds},
+                                 pair{"money", moneySeconds}})
+    {
+        report.begin("fixed_point_tick");
+        report.add("price", kind);
+        report.add("symbols", symbols);
+        report.add("ticks", ticks);
+        report.add("ns_per_symbol", seconds * 1e9 / updates);
+        report.add("symbols_per_sec", updates / seconds);
+    }
+    report.add("max_relative_gap", gap);
+
+    const size_t held = 10000;
+    const int marks = static_cast<int>(20000 / scale);
+    BasicPositionValuation<double> doubleValuation;
+    BasicPositionValuation<Money> moneyValuation;
+    for (size_t i = 0; i < held; ++i)
+    {
+        uint32_t symbol = static_cast<uint32_t>(i * 7);
+        doubleValuation.setShares(symbol, 100, prices[symbol]);
+        moneyValuation.setShares(symbol, 100, Money(prices[symbol]));
+    }
+    MarketSnapshot snap{1, symbols, prices.data(), volatilities.data(), nullptr};
+    double doubleMarkSeconds = secondsOf([&]
+    {
+        for (int t = 0; t < marks; ++t)
+        {
+            doubleValuation.onTick(snap);
+        }
+    });
+    double moneyMarkSeconds = secondsOf([&]
+    {
+        for (int t = 0; t < marks; ++t)
+        {
+            moneyValuation.onTick(snap);
+        }
+    });
+    for (auto [kind, seconds] : {pair{"double", doubleMarkSeconds}, pair{"money", moneyMarkSeconds}})
+    {
+        report.begin("fixed_point_valuation");
+        report.add("price", kind);
+        report.add("positions", held);
+        report.add("us_per_tick", seconds * 1e6 / marks);
+    }
+
+    const int deposits = 1000000;
+    double doubleCash = 0.0;
+    Money moneyCash;
+    for (int i = 0; i < deposits; ++i)
+    {
+        doubleCash += 0.10;
+        moneyCash += Money(0.10);
+    }
+    report.begin("fixed_point_cash");
+    report.add("deposits", deposits);
+    report.add("double_error", doubleCash - deposits * 0.10);
+    report.add("money_error", moneyCash.toDouble() - deposits * 0.10);
+}
+
+// Two million fills over 1000 symbols and an hour: appending, a page of a filtered query
+// against finding the same rows by scanning, and formatting a timestamp from the per-minute
+// cache against localtime and put_time.
+void benchTransactionHistory(BenchReport& report, size_t scale)
+{
+    const size_t fills = 2000000 / scale;
+    const uint32_t symbols = 1000;
+    const time_t start = 1700000000;
+    TransactionHistory history;
+    double appendSeconds = secondsOf([&]
+    {
+        for (size_t i = 0; i < fills; ++i)
+        {
+            uint32_t u = symbolDraw(0x4157, static_cast<uint32_t>(i));
+            history.append(u % symbols, (u >> 16) % 2 ? 100 : -100, Money::fromUnits(500000 + u % 10000),
+                           start + static_cast<time_t>(i * 3600 / fills));
+        }
+    });
+    const int queries = 1000;
+    vector<HistoryQuery> asked(queries);
+    for (int q = 0; q < queries; ++q)
+    {
+        uint32_t u = symbolDraw(0x5159, static_cast<uint32_t>(q));
+        asked[q].symbol = u % symbols;
+        asked[q].side = (u >> 12) % 2 ? HistorySide::Buy : HistorySide::Sell;
+        asked[q].from = start + (u >> 16) % 3000;
+        asked[q].to = asked[q].from + 600;
+    }
+    const size_t pageSize = 20;
+    uint64_t checksum = 0;
+    vector<uint32_t> latencies(queries);
+    for (int q = 0; q < queries; ++q)
+    {
+        auto begin = chrono::steady_clock::now();
+        auto rows = history.select(asked[q]);
+        size_t first = rows.size() / 2 / pageSize * pageSize; // A page from the middle
+        for (size_t i = first; i < min(rows.size(), first + pageSize); ++i)
+        {
+            checksum += history.priceAt(rows[i]).getUnits();
+        }
+        latencies[q] = nanosecondsSince(begin);
+    }
+    const int scans = max(1, queries / 100);
+    double scanSeconds = secondsOf([&]
+    {
+        for (int q = 0; q < scans; ++q)
+        {
+            const HistoryQuery& query = asked[q];
+            for (uint32_t row = 0; row < history.size(); ++row)
+            {
+                time_t t = history.timeAt(row);
+                bool buy = history.quantityAt(row) > 0;
+                if (history.symbolAt(row) == query.symbol && buy == (query.side == HistorySide::Buy) && t >= query.from &&
+                    t < query.to)
+                {
+                    checksum += history.priceAt(row).getUnits();
+                }
+            }
+        }
+    });
+    const size_t formats = 100000 / scale;
+    TimestampFormatter formatter;
+    string text;
+    double cachedSeconds = secondsOf([&]
+    {
+        for (size_t i = 0; i < formats; ++i)
+        {
+            text.clear();
+            formatter.append(history.timeAt(static_cast<uint32_t>(i)), text);
+            checksum += text.size();
+        }
+    });
+    double streamSeconds = secondsOf([&]
+    {
+        for (size_t i = 0; i < formats; ++i)
+        {
+            ostringstream out;
+            time_t t = history.timeAt(static_cast<uint32_t>(i));
+            out << put_time(localtime(&t), "%Y-%m-%d %H:%M:%S");
+            checksum += out.str().size();
+        }
+    });
+    report.begin("transaction_history");
+    report.add("fills", fills);
+    report.add("symbols", symbols);
+    report.add("append_ns", appendSeconds * 1e9 / fills);
+    report.addLatencies("query_page", latencies);
+    report.add("scan_us", scanSeconds * 1e6 / scans);
+    report.add("timestamp_cached_ns", cachedSeconds * 1e9 / formats);
+    report.add("timestamp_put_time_ns", streamSeconds * 1e9 / formats);
+    report.add("checksum", checksum % 1000);
+}
+
+// A synthetic trader population on a seeded headless market: time per tick with the population
+// stepping on one thread and on every hardware thread, and whether both left the same balances.
+void benchTraders(BenchReport& report, size_t scale)
+{
+    const size_t symbols = 2000;
+    const uint32_t agents = static_cast<uint32_t>(50000 / scale);
+    const uint64_t ticks = 100;
+    SyntheticUniverse universe(symbols);
+    auto run = [&](unsigned threads, TraderPopulation::Stats& stats, double& seconds)
+    {
+        StockMarket market;
+        universe.addTo(market);
+        market.setSeed(7);
+        TraderMix mix;
+        mix.makers = agents / 8;
+        mix.momentum = agents / 4;
+        mix.random = agents - mix.makers - mix.momentum;
+        TraderPopulation population(market, mix, 7, threads);
+        seconds = secondsOf([&]
+        {
+            for (uint64_t t = 0; t < ticks; ++t)
+            {
+                market.fastForward(1);
+                population.step();
+            }
+        });
+        stats = population.getStats();
+        return population.checksum();
+    };
+    unsigned threads = max(1U, thread::hardware_concurrency());
+    TraderPopulation::Stats serialStats, stats;
+    double serialSeconds, seconds;
+    uint64_t serialChecksum = run(1, serialStats, serialSeconds);
+    uint64_t checksum = run(threads, stats, seconds);
+    report.begin("traders");
+    report.add("agents", agents);
+    report.add("symbols", symbols);
+    report.add("ticks", ticks);
+    report.add("threads", threads);
+    report.add("tick_ms_1_thread", serialSeconds * 1e3 / ticks);
+    report.add("tick_ms", seconds * 1e3 / ticks);
+    report.add("resumes_per_sec", stats.resumes / seconds);
+    report.add("orders_per_sec", stats.orders / seconds);
+    report.add("orders", stats.orders);
+    report.add("rejected", stats.rejected);
+    report.add("fills", stats.fills);
+    report.add("cancels", stats.cancels);
+    report.add("reproducible", checksum == serialChecksum && stats.orders == serialStats.orders ? "yes" : "no");
+}
+
+// Tick start lateness at the maximum rate with an empty tick.
+void benchScheduler(BenchReport& report, size_t scale)
+{
+    TickScheduler scheduler;
+    scheduler.setRate(maxTicksPerSecond, OverrunPolicy::CatchUp);
+    double seconds = 2.0 / static_cast<double>(scale);
+    atomic<bool> running{true};
+    thread stopper([&]
+    {
+        this_thread::sleep_for(chrono::duration<double>(seconds));
+        running = false;
+    });
+    double elapsed = secondsOf([&] { scheduler.run(running, [] {}); });
+    stopper.join();
+    TickScheduler::Stats stats = scheduler.getStats();
+    report.begin("scheduler");
+    report.add("target_hz", maxTicksPerSecond);
+    report.add("achieved_hz", stats.ticks / elapsed);
+    report.add("overruns", stats.overruns);
+    report.add("mean_lateness_us", stats.meanLatenessUs);
+    report.add("max_lateness_us", stats.maxLatenessUs);
+}
+
+int main(int argc, char* argv[])
+{
+    const vector<pair<string, void (*)(BenchReport&, size_t)>> benchmarks = {
+        {"price_update", benchPriceUpdate}, {"tick_pass", benchTickPass}, {"fast_forward", benchFastForward},
+        {"load_stocks", benchLoad},         {"get_stock", benchSymbolLookup}, {"buy_sell", benchBuySell},
+        {"board_render", benchBoard},       {"order_book", benchOrderBook},   {"journal", benchJournal},
+        {"risk", benchRisk},                {"alerts", benchAlerts},          {"scheduler", benchScheduler},
+        {"accounts", benchAccounts},        {"history", benchHistory},        {"indicators", benchIndicators},
+        {"factor_model", benchFactorModel}, {"replay", benchReplay},      {"fixed_point", benchFixedPoint},
+        {"transaction_history", benchTransactionHistory}, {"traders", benchTraders},
+    };
+    bool quick = false;
+    vector<string> selected;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--quick")
+        {
+            quick = true;
+        }
+        else if (any_of(benchmarks.begin(), benchmarks.end(), [&](const auto& b) { return b.first == arg; }))
+        {
+            selected.push_back(arg);
+        }
+        else
+        {
+            cerr << "usage: stock_bench [--quick] [benchmark ...]\nbenchmarks:";
+            for (const auto& benchmark : benchmarks)
+            {
+                cerr << ' ' << benchmark.first;
+            }
+            cerr << endl;
+            return 1;
+        }
+    }
+    BenchReport report;
+    for (const auto& [name, run] : benchmarks)
+    {
+        if (selected.empty() || std::find(selected.begin(), selected.end(), name) != selected.end())
+        {
+            cerr << "running " << name << endl;
+            run(report, quick ? 10 : 1);
+        }
+    }
+    report.write(cout, quick);
+    return 0;
+}
@@ -0,0 +1,52 @@
+#pragma once
+// Keyboard polling for the interactive menu. Windows has <conio.h>; elsewhere _kbhit and _getch
+// are built on termios. The terminal leaves line mode only for the length of each call, so the
+// menu's cin prompts keep their echo and line editing.
+#if defined(_WIN32)
+#include <conio.h>
+#else
+#include <cstdio>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Runs fn with stdin unbuffered and not echoed, if stdin is a terminal.
+template <class Fn>
+auto withRawInput(Fn&& fn)
+{
+    termios saved;
+    bool terminal = tcgetattr(STDIN_FILENO, &saved) == 0;
+    if (terminal)
+    {
+        termios raw = saved;
+        raw.c_lflag &= ~static_cast<tcflag_t>(ICANON | ECHO);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    }
+    auto result = fn();
+    if (terminal)
+    {
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+    }
+    return result;
+}
+
+inline int _kbhit()
+{
+    return withRawInput([]
+    {
+        pollfd input{STDIN_FILENO, POLLIN, 0};
+        return poll(&input, 1, 0) > 0 && (input.revents & POLLIN) ? 1 : 0;
+    });
+}
+
+inline int _getch()
+{
+    return withRawInput([]
+    {
+        unsigned char ch;
+        return read(STDIN_FILENO, &ch, 1) == 1 ? static_cast<int>(ch) : EOF;
+    });
+}
+#endif
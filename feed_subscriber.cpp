@@ -0,0 +1,61 @@
+#include "market_feed.h"
+// Market data feed subscriber: keeps a replica of the published prices and reports how the feed
+// behaved. Start as many as you like against one publisher (beginning --feed or --serve).
+//
+//     feed_subscriber ENDPOINT [SECONDS] [--drop N]
+//
+// --drop N discards every Nth incremental datagram on arrival, to exercise gap recovery.
+int main(int argc, char* argv[])
+{
+#if defined(_WIN32)
+    cout << "The market data feed needs POSIX sockets." << endl;
+    return 1;
+#else
+    if (argc < 2)
+    {
+        cout << "Usage: feed_subscriber udp:GROUP:PORT|unix:PATH [SECONDS] [--drop N]" << endl;
+        return 1;
+    }
+    double seconds = 10.0;
+    uint64_t dropEvery = 0;
+    for (int i = 2; i < argc; ++i)
+    {
+        string option = argv[i];
+        if (option == "--drop" && i + 1 < argc)
+        {
+            dropEvery = strtoull(argv[++i], nullptr, 10);
+        }
+        else
+        {
+            seconds = atof(argv[i]);
+        }
+    }
+    MarketFeedSubscriber feed;
+    string error = feed.open(argv[1]);
+    if (!error.empty())
+    {
+        cout << error << endl;
+        return 1;
+    }
+    feed.setDropEvery(dropEvery);
+    auto end = chrono::steady_clock::now() + chrono::milliseconds(llround(seconds * 1000.0));
+    while (chrono::steady_clock::now() < end)
+    {
+        feed.poll(50);
+    }
+    const MarketFeedSubscriber::Stats& stats = feed.getStats();
+    const LatencyHistogram& latency = stats.latency;
+    cout << "Datagrams " << stats.datagrams << ", updates " << stats.updates << ", gaps " << stats.gaps
+         << ", snapshots " << stats.recoveries << ", duplicates " << stats.duplicates << ", dropped "
+         << stats.dropped << (feed.isLive() ? "" : " (recovering)") << endl;
+    if (latency.count)
+    {
+        cout << "Latency p50 " << formatDuration(latency.percentile(0.50)) << "  p99 "
+             << formatDuration(latency.percentile(0.99)) << "  p99.9 " << formatDuration(latency.percentile(0.999))
+             << "  max " << formatDuration(latency.max) << endl;
+    }
+    cout << "Symbols " << feed.getPrices().size() << ", checksum " << hex << feedPriceChecksum(feed.getPrices())
+         << dec << endl;
+    return 0;
+#endif
+}
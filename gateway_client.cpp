@@ -0,0 +1,272 @@
+#include "order_gateway.h"
+// Load generator for the order gateway. Opens CONNECTIONS clients, each its own account, and
+// runs every one through market buy, market sell, limit buy below the market and cancel, one
+// order outstanding at a time. Prints the order rate and round-trip latency percentiles.
+//
+//     gateway_client PORT [CONNECTIONS] [SECONDS]
+#if defined(__linux__)
+struct LoadClient
+{
+    int fd = -1;
+    bool connected = false;
+    bool welcomed = false;
+    string input;
+    uint32_t symbols = 0;
+    uint32_t seed;
+    int step = 0;
+    uint32_t symbol = 0;
+    int64_t held = 0;
+    int64_t lastPrice = 0;
+    uint64_t resting = 0;     // Order id of the limit buy to cancel
+    uint64_t outstanding = 0; // Client order id awaiting its report, 0 if none
+    uint64_t nextId = 1;
+    int64_t sentNs = 0;
+};
+
+struct LoadStats
+{
+    uint64_t orders = 0;
+    uint64_t accepted = 0;
+    uint64_t cancelled = 0;
+    uint64_t fills = 0;
+    array<uint64_t, gatewayRejectNames.size()> rejected{};
+    LatencyHistogram latency; // Nanoseconds
+};
+
+inline int64_t clientClockNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Sends the client's next order. Returns false if the connection failed.
+bool sendNext(LoadClient& client, LoadStats& stats)
+{
+    GatewayRequest request{};
+    request.kind = GatewayRequestKind::NewOrder;
+    request.quantity = 10;
+    if (client.step == 0)
+    {
+        client.symbol = client.symbols ? mixBits(client.seed++) % client.symbols : 0;
+        request.side = Side::Buy;
+        request.type = OrderType::Market;
+    }
+    else if (client.step == 1)
+    {
+        request.side = Side::Sell;
+        request.type = OrderType::Market;
+        request.quantity = static_cast<uint32_t>(client.held);
+    }
+    else if (client.step == 2)
+    {
+        request.side = Side::Buy;
+        request.type = OrderType::Limit;
+        request.priceTicks = client.lastPrice - 5; // Below the market, so it rests
+    }
+    else
+    {
+        request.kind = GatewayRequestKind::Cancel;
+        request.orderId = client.resting;
+    }
+    request.symbol = client.symbol;
+    request.clientOrderId = client.outstanding = client.nextId++;
+    client.sentNs = clientClockNs();
+    ++stats.orders;
+    return send(client.fd, &request, sizeof(request), MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(request));
+}
+
+// Moves the script on after the report for the outstanding order.
+void advance(LoadClient& client, const GatewayReport& report)
+{
+    bool ok = report.kind != GatewayReportKind::Rejected;
+    switch (client.step)
+    {
+        case 0:
+            client.held += report.filled;
+            client.lastPrice = report.priceTicks;
+            client.step = ok && client.held > 0 ? 1 : 0;
+            break;
+        case 1:
+            client.held = ok ? client.held - report.filled : 0; // A rejected sell means we were out of sync
+            client.step = ok && client.lastPrice > 5 ? 2 : 0;
+            break;
+        case 2:
+            client.held += report.filled;
+            client.resting = report.orderId;
+            client.step = ok && report.resting > 0 ? 3 : 0;
+            break;
+        default:
+            client.step = 0;
+    }
+    // Shares left from limit buys that filled are sold on the next pass.
+    if (client.step == 0 && client.held > 0)
+    {
+        client.step = 1;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        cout << "Usage: gateway_client PORT [CONNECTIONS] [SECONDS]" << endl;
+        return 1;
+    }
+    uint16_t port = static_cast<uint16_t>(atoi(argv[1]));
+    size_t connections = argc > 2 ? strtoul(argv[2], nullptr, 10) : 100;
+    double seconds = argc > 3 ? atof(argv[3]) : 10.0;
+
+    int epoll = epoll_create1(0);
+    vector<LoadClient> clients(connections);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for (size_t i = 0; i < connections; ++i)
+    {
+        LoadClient& client = clients[i];
+        client.seed = mixBits(static_cast<uint32_t>(i) + 1);
+        client.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        int on = 1;
+        setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        if (client.fd < 0 || (connect(client.fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 &&
+                              errno != EINPROGRESS))
+        {
+            cout << "Cannot connect client " << i << ": " << strerror(errno) << endl;
+            return 1;
+        }
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT;
+        event.data.u64 = i;
+        epoll_ctl(epoll, EPOLL_CTL_ADD, client.fd, &event);
+    }
+
+    LoadStats stats;
+    size_t open = 0, failed = 0;
+    int64_t start = clientClockNs();
+    int64_t end = start + llround(seconds * 1e9);
+    epoll_event events[512];
+    char buffer[1 << 16];
+    while (clientClockNs() < end)
+    {
+        int ready = epoll_wait(epoll, events, 512, 50);
+        for (int e = 0; e < ready; ++e)
+        {
+            LoadClient& client = clients[events[e].data.u64];
+            if (client.fd < 0)
+            {
+                continue;
+            }
+            bool alive = true;
+            if (!client.connected && (events[e].events & (EPOLLOUT | EPOLLERR)))
+            {
+                int error = 0;
+                socklen_t length = sizeof(error);
+                getsockopt(client.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+                alive = error == 0;
+                client.connected = alive;
+                open += alive;
+                epoll_event event{};
+                event.events = EPOLLIN;
+                event.data.u64 = events[e].data.u64;
+                epoll_ctl(epoll, EPOLL_CTL_MOD, client.fd, &event);
+            }
+            while (alive && (events[e].events & EPOLLIN))
+            {
+                ssize_t n = recv(client.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+                if (n <= 0)
+                {
+                    alive = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+                    break;
+                }
+                client.input.append(buffer, static_cast<size_t>(n));
+                size_t used = 0;
+                for (; used + sizeof(GatewayReport) <= client.input.size(); used += sizeof(GatewayReport))
+                {
+                    GatewayReport report;
+                    memcpy(&report, client.input.data() + used, sizeof(report));
+                    if (report.kind == GatewayReportKind::Welcome)
+                    {
+                        client.welcomed = true;
+                        client.symbols = report.symbol;
+                        alive = sendNext(client, stats);
+                        continue;
+                    }
+                    if (report.kind == GatewayReportKind::Fill)
+                    {
+                        ++stats.fills;
+                        client.held += report.filled;
+                        continue;
+                    }
+                    if (report.clientOrderId != client.outstanding)
+                    {
+                        continue;
+                    }
+                    stats.latency.add(static_cast<uint64_t>(clientClockNs() - client.sentNs));
+                    if (report.kind == GatewayReportKind::Accepted)
+                    {
+                        ++stats.accepted;
+                    }
+                    else if (report.kind == GatewayReportKind::Cancelled)
+                    {
+                        ++stats.cancelled;
+                    }
+                    else
+                    {
+                        ++stats.rejected[min<size_t>(static_cast<size_t>(report.reason), stats.rejected.size() - 1)];
+                    }
+                    advance(client, report);
+                    alive = alive && sendNext(client, stats);
+                }
+                client.input.erase(0, used);
+            }
+            if (!alive || (events[e].events & (EPOLLHUP | EPOLLERR)))
+            {
+                ::close(client.fd);
+                client.fd = -1;
+                ++failed;
+            }
+        }
+    }
+    double elapsed = (clientClockNs() - start) / 1e9;
+    for (LoadClient& client : clients)
+    {
+        if (client.fd >= 0)
+        {
+            ::close(client.fd);
+        }
+    }
+    ::close(epoll);
+
+    uint64_t rejected = 0;
+    for (uint64_t count : stats.rejected)
+    {
+        rejected += count;
+    }
+    cout << "Connections " << open << "/" << connections << " (" << failed << " lost), orders " << stats.orders
+         << " (" << fixed << setprecision(0) << stats.orders / elapsed << "/s), accepted " << stats.accepted
+         << ", cancelled " << stats.cancelled << ", rejected " << rejected << ", resting fills " << stats.fills
+         << endl;
+    for (size_t reason = 0; reason < stats.rejected.size(); ++reason)
+    {
+        if (stats.rejected[reason])
+        {
+            cout << "  rejected, " << gatewayRejectNames[reason] << ": " << stats.rejected[reason] << endl;
+        }
+    }
+    const LatencyHistogram& latency = stats.latency;
+    if (latency.count)
+    {
+        cout << "Round trip p50 " << formatDuration(latency.percentile(0.50)) << "  p99 "
+             << formatDuration(latency.percentile(0.99)) << "  p99.9 " << formatDuration(latency.percentile(0.999))
+             << "  max " << formatDuration(latency.max) << "  mean "
+             << formatDuration(static_cast<double>(latency.sum) / latency.count) << endl;
+    }
+    return 0;
+}
+#else
+int main()
+{
+    cout << "The order gateway needs Linux (epoll)." << endl;
+    return 1;
+}
+#endif
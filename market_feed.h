@@ -0,0 +1,867 @@
+#pragma once
+#include "stock_market.h"
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+// Binary market data feed. After each tick the publisher sends the symbols whose price changed,
+// many to a datagram, over UDP multicast on the loopback interface ("udp:GROUP:PORT") or a Unix
+// datagram socket ("unix:PATH").
+//
+// A datagram is a FeedHeader and `count` 12-byte updates (uint32 symbol id, int64 price in
+// 1/feedPriceScale dollars), in host byte order since the feed never leaves the machine.
+// Incremental datagrams are numbered consecutively and every tick sends at least one (an empty
+// one is the heartbeat), so a lost datagram shows up as a sequence gap by the next tick. A
+// subscriber that finds a gap asks for a snapshot: every symbol's last published price, tagged
+// with the sequence number of the last incremental it includes. The subscriber applies it, then
+// the incrementals after that number it buffered while waiting.
+//
+// Multicast has no way back to the publisher, so in UDP mode subscribers send requests to a
+// control port (PORT + 1 on 127.0.0.1) and snapshots come back there. Unix sockets have no
+// multicast; each subscriber binds PATH.<pid>, registers, and the publisher sends to each. They
+// have no MTU either, so Unix datagrams carry up to 64 KB: a receiver queues only a handful of
+// datagrams (net.unix.max_dgram_qlen), and a snapshot split finer would never arrive whole.
+constexpr uint32_t feedMagic = 0x464B5453; // "STKF"
+constexpr uint8_t feedVersion = 1;
+constexpr int64_t feedPriceScale = 10000;
+constexpr size_t feedMaxDatagram = 1400; // One Ethernet frame, should the feed leave loopback
+constexpr size_t feedMaxUnixDatagram = 65536; // No MTU, but only a few datagrams queue per receiver
+constexpr size_t feedUpdateSize = 12;
+
+enum class FeedKind : uint8_t
+{
+    Incremental,
+    Snapshot,
+    Subscribe,       // Unix only: start sending to my address
+    Unsubscribe,
+    SnapshotRequest,
+};
+constexpr uint8_t feedLastPart = 1; // Last datagram of a tick or of a snapshot
+// Most datagrams a snapshot may take: 2^18 parts is some 29 million symbols at the UDP size.
+// A part index beyond it is treated as garbage rather than sized for.
+constexpr uint32_t feedMaxSnapshotParts = 1U << 18;
+
+struct FeedHeader
+{
+    uint32_t magic;
+    uint8_t version;
+    FeedKind kind;
+    uint8_t flags;
+    uint8_t reserved;
+    uint32_t count;    // Updates that follow
+    uint32_t part;     // Index of the datagram within a snapshot
+    uint64_t sequence; // Incremental: this datagram. Snapshot: last incremental it includes
+    uint64_t tick;
+    int64_t sentNs;    // Publisher's steady clock when the datagram was encoded
+};
+static_assert(sizeof(FeedHeader) == 40, "feed headers are sent as laid out");
+
+inline int64_t feedClockNs()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+inline int64_t toFeedPrice(double price)
+{
+    return llround(price * feedPriceScale);
+}
+inline double fromFeedPrice(int64_t price)
+{
+    return static_cast<double>(price) / feedPriceScale;
+}
+
+// Datagrams of at most maxBytes built back to back in one buffer.
+class FeedEncoder {
+private:
+    string bytes;
+    vector<size_t> ends;
+    size_t start = 0; // Header of the datagram being built
+    FeedHeader header{};
+    uint32_t perDatagram;
+
+public:
+    explicit FeedEncoder(size_t maxBytes = feedMaxDatagram)
+        : perDatagram(static_cast<uint32_t>((maxBytes - sizeof(FeedHeader)) / feedUpdateSize))
+    {
+    }
+    void clear()
+    {
+        bytes.clear();
+        ends.clear();
+    }
+    void begin(FeedKind kind, uint64_t sequence, uint64_t tick, uint32_t part)
+    {
+        header = {feedMagic, feedVersion, kind, 0, 0, 0, part, sequence, tick, 0};
+        start = bytes.size();
+        bytes.resize(start + sizeof(FeedHeader));
+    }
+    bool full() const
+    {
+        return header.count == perDatagram;
+    }
+    void add(uint32_t symbol, int64_t price)
+    {
+        char update[feedUpdateSize];
+        memcpy(update, &symbol, 4);
+        memcpy(update + 4, &price, 8);
+        bytes.append(update, feedUpdateSize);
+        ++header.count;
+    }
+    void finish(uint8_t flags)
+    {
+        header.flags = flags;
+        header.sentNs = feedClockNs();
+        memcpy(&bytes[start], &header, sizeof(FeedHeader));
+        ends.push_back(bytes.size());
+    }
+    uint32_t getCount() const { return header.count; }
+    size_t datagrams() const { return ends.size(); }
+    string_view datagram(size_t i) const
+    {
+        size_t from = i ? ends[i - 1] : 0;
+        return string_view(bytes).substr(from, ends[i] - from);
+    }
+};
+
+// Calls fn(symbol, price) for every update in a datagram already checked by readFeedHeader.
+template <class Fn>
+void forEachFeedUpdate(string_view datagram, const FeedHeader& header, Fn&& fn)
+{
+    const char* at = datagram.data() + sizeof(FeedHeader);
+    for (uint32_t i = 0; i < header.count; ++i, at += feedUpdateSize)
+    {
+        uint32_t symbol;
+        int64_t price;
+        memcpy(&symbol, at, 4);
+        memcpy(&price, at + 4, 8);
+        fn(symbol, price);
+    }
+}
+
+inline bool readFeedHeader(string_view datagram, FeedHeader& header)
+{
+    if (datagram.size() < sizeof(FeedHeader))
+    {
+        return false;
+    }
+    memcpy(&header, datagram.data(), sizeof(FeedHeader));
+    return header.magic == feedMagic && header.version == feedVersion &&
+           datagram.size() == sizeof(FeedHeader) + static_cast<size_t>(header.count) * feedUpdateSize;
+}
+
+// FNV-1a over (symbol, price) pairs: publisher and subscriber print it so a run can check that
+// every subscriber ended on the same prices.
+inline uint64_t feedPriceChecksum(const vector<int64_t>& prices)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int64_t price : prices)
+    {
+        hash = (hash ^ static_cast<uint64_t>(price)) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+#if !defined(_WIN32)
+struct FeedAddress
+{
+    sockaddr_storage address{};
+    socklen_t length = 0;
+
+    const sockaddr* get() const { return reinterpret_cast<const sockaddr*>(&address); }
+    bool operator==(const FeedAddress& other) const
+    {
+        return length == other.length && memcmp(&address, &other.address, length) == 0;
+    }
+};
+
+// "udp:GROUP:PORT" or "unix:PATH".
+struct FeedEndpoint
+{
+    bool unixSocket = false;
+    FeedAddress data;    // Multicast group, or the publisher's socket path
+    FeedAddress control; // UDP: 127.0.0.1:PORT+1
+    string path;
+
+    // Returns an error message, empty on success.
+    string parse(const string& text)
+    {
+        if (text.rfind("unix:", 0) == 0)
+        {
+            unixSocket = true;
+            path = text.substr(5);
+            data = unixAddress(path);
+            return path.empty() || path.size() >= sizeof(sockaddr_un::sun_path) ? "Bad socket path: " + path : "";
+        }
+        size_t colon = text.rfind(':');
+        if (text.rfind("udp:", 0) != 0 || colon <= 4)
+        {
+            return "Feed endpoint must be udp:GROUP:PORT or unix:PATH";
+        }
+        int port = atoi(text.c_str() + colon + 1);
+        sockaddr_in group{};
+        group.sin_family = AF_INET;
+        group.sin_port = htons(static_cast<uint16_t>(port));
+        if (port <= 0 || port >= 65535 || inet_pton(AF_INET, text.substr(4, colon - 4).c_str(), &group.sin_addr) != 1 ||
+            !IN_MULTICAST(ntohl(group.sin_addr.s_addr)))
+        {
+            return "Bad multicast group or port: " + text.substr(4);
+        }
+        memcpy(&data.address, &group, sizeof(group));
+        data.length = sizeof(group);
+        sockaddr_in loopback = group;
+        loopback.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        loopback.sin_port = htons(static_cast<uint16_t>(port + 1));
+        memcpy(&control.address, &loopback, sizeof(loopback));
+        control.length = sizeof(loopback);
+        return "";
+    }
+
+    static FeedAddress unixAddress(const string& socketPath)
+    {
+        FeedAddress address;
+        sockaddr_un local{};
+        local.sun_family = AF_UNIX;
+        strncpy(local.sun_path, socketPath.c_str(), sizeof(local.sun_path) - 1);
+        memcpy(&address.address, &local, sizeof(local));
+        address.length = sizeof(local);
+        return address;
+    }
+};
+
+inline void sendFeedRequest(int socket, FeedKind kind, const FeedAddress& to)
+{
+    FeedHeader header{feedMagic, feedVersion, kind, 0, 0, 0, 0, 0, 0, feedClockNs()};
+    sendto(socket, &header, sizeof(header), 0, to.get(), to.length);
+}
+
+// Publishes every tick as a tick listener. Encoding runs on the tick thread (one pass comparing
+// each price with the last one sent); a sender thread does the socket work, so a slow or dead
+// subscriber never holds up a tick. Sends never block: a datagram a subscriber has no room for
+// is dropped and that subscriber recovers through a snapshot.
+class MarketFeedPublisher {
+public:
+    struct Stats
+    {
+        uint64_t ticks;
+        uint64_t datagrams;
+        uint64_t updates;
+        uint64_t snapshots;
+        uint64_t dropped;
+        size_t subscribers;
+        uint64_t checksum; // Of the prices published so far
+    };
+
+private:
+    // Datagrams for everyone (incrementals) or for the subscribers that asked (a snapshot).
+    struct Outgoing
+    {
+        FeedEncoder datagrams;
+        bool snapshot;
+        vector<FeedAddress> requesters;
+    };
+
+    FeedEndpoint endpoint;
+    int dataSocket = -1;
+    int controlSocket = -1; // Same as dataSocket for Unix sockets
+    int wakePipe[2] = {-1, -1};
+    thread sender;
+    atomic<bool> running{false};
+
+    // Tick thread only.
+    vector<int64_t> lastSent; // What subscribers have been told, by symbol id
+    uint64_t sequence = 0;
+    size_t maxDatagram = feedMaxDatagram;
+
+    mutex lock; // Between the tick thread and the sender
+    deque<Outgoing> queue;
+    vector<FeedAddress> snapshotRequests; // Served after the next tick's incrementals
+
+    vector<FeedAddress> subscribers; // Sender thread only (Unix sockets)
+    atomic<uint64_t> ticks{0}, datagrams{0}, updates{0}, snapshots{0}, dropped{0};
+    atomic<size_t> subscriberCount{0};
+    atomic<uint64_t> checksum{0};
+
+    void sendTo(const FeedEncoder& batch, const FeedAddress& to)
+    {
+        for (size_t i = 0; i < batch.datagrams(); ++i)
+        {
+            string_view datagram = batch.datagram(i);
+            if (sendto(dataSocket, datagram.data(), datagram.size(), MSG_DONTWAIT, to.get(), to.length) < 0)
+            {
+                if (errno == ECONNREFUSED || errno == ENOENT)
+                {
+                    auto gone = std::find(subscribers.begin(), subscribers.end(), to);
+                    if (gone != subscribers.end())
+                    {
+                        subscribers.erase(gone); // Subscriber exited without saying so
+                        subscriberCount = subscribers.size();
+                    }
+                    return;
+                }
+                dropped.fetch_add(1, memory_order_relaxed);
+            }
+            else
+            {
+                datagrams.fetch_add(1, memory_order_relaxed);
+            }
+        }
+    }
+
+    void receiveControl()
+    {
+        char buffer[sizeof(FeedHeader)];
+        FeedAddress from;
+        from.length = sizeof(from.address);
+        ssize_t length;
+        while ((length = recvfrom(controlSocket, buffer, sizeof(buffer), MSG_DONTWAIT,
+                                  reinterpret_cast<sockaddr*>(&from.address), &from.length)) >= 0)
+        {
+            FeedHeader header;
+            if (!readFeedHeader(string_view(buffer, static_cast<size_t>(length)), header))
+            {
+                continue;
+            }
+            if (header.kind == FeedKind::Subscribe && endpoint.unixSocket &&
+                std::find(subscribers.begin(), subscribers.end(), from) == subscribers.end())
+            {
+                subscribers.push_back(from);
+            }
+            else if (header.kind == FeedKind::Unsubscribe)
+            {
+                subscribers.erase(remove(subscribers.begin(), subscribers.end(), from), subscribers.end());
+            }
+            else if (header.kind == FeedKind::SnapshotRequest)
+            {
+                lock_guard<mutex> guard(lock);
+                snapshotRequests.push_back(from);
+            }
+            subscriberCount = subscribers.size();
+            from.length = sizeof(from.address);
+        }
+    }
+
+    void sendLoop()
+    {
+        pollfd waits[2] = {{controlSocket, POLLIN, 0}, {wakePipe[0], POLLIN, 0}};
+        deque<Outgoing> work;
+        while (running.load(memory_order_relaxed))
+        {
+            ::poll(waits, 2, 100);
+            if (waits[0].revents & POLLIN)
+            {
+                receiveControl();
+            }
+            if (waits[1].revents & POLLIN)
+            {
+                char drain[64];
+                while (read(wakePipe[0], drain, sizeof(drain)) == static_cast<ssize_t>(sizeof(drain)))
+                {
+                }
+            }
+            {
+                lock_guard<mutex> guard(lock);
+                swap(work, queue);
+            }
+            for (Outgoing& batch : work)
+            {
+                if (batch.snapshot)
+                {
+                    for (const FeedAddress& to : batch.requesters)
+                    {
+                        sendTo(batch.datagrams, to);
+                    }
+                    snapshots.fetch_add(batch.requesters.size(), memory_order_relaxed);
+                }
+                else if (endpoint.unixSocket)
+                {
+                    for (size_t s = subscribers.size(); s-- > 0;) // sendTo may drop a dead one
+                    {
+                        sendTo(batch.datagrams, subscribers[s]);
+                    }
+                }
+                else
+                {
+                    sendTo(batch.datagrams, endpoint.data);
+                }
+            }
+            work.clear();
+        }
+    }
+
+    void enqueue(Outgoing&& batch)
+    {
+        bool wasEmpty;
+        {
+            lock_guard<mutex> guard(lock);
+            wasEmpty = queue.empty();
+            queue.push_back(move(batch));
+        }
+        if (wasEmpty)
+        {
+            char wake = 1;
+            (void)!write(wakePipe[1], &wake, 1);
+        }
+    }
+
+public:
+    ~MarketFeedPublisher()
+    {
+        close();
+    }
+
+    // Returns an error message, empty on success.
+    string open(const string& endpointText)
+    {
+        close();
+        string error = endpoint.parse(endpointText);
+        if (!error.empty())
+        {
+            return error;
+        }
+        if (endpoint.unixSocket)
+        {
+            dataSocket = socket(AF_UNIX, SOCK_DGRAM, 0);
+            unlink(endpoint.path.c_str()); // Left behind by an earlier run
+            if (dataSocket < 0 || bind(dataSocket, endpoint.data.get(), endpoint.data.length) < 0)
+            {
+                close();
+                return "Cannot bind " + endpoint.path + ": " + strerror(errno);
+            }
+            controlSocket = dataSocket;
+            maxDatagram = feedMaxUnixDatagram;
+        }
+        else
+        {
+            maxDatagram = feedMaxDatagram;
+            dataSocket = socket(AF_INET, SOCK_DGRAM, 0);
+            controlSocket = socket(AF_INET, SOCK_DGRAM, 0);
+            in_addr loopback{htonl(INADDR_LOOPBACK)};
+            unsigned char loop = 1, ttl = 0; // ttl 0: never leaves the host
+            if (dataSocket < 0 || controlSocket < 0 ||
+                setsockopt(dataSocket, IPPROTO_IP, IP_MULTICAST_IF, &loopback, sizeof(loopback)) < 0 ||
+                setsockopt(dataSocket, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0 ||
+                setsockopt(dataSocket, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0 ||
+                bind(controlSocket, endpoint.control.get(), endpoint.control.length) < 0)
+            {
+                close();
+                return string("Cannot set up the multicast feed: ") + strerror(errno);
+            }
+        }
+        int sendBuffer = 4 << 20;
+        setsockopt(dataSocket, SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(sendBuffer));
+        if (pipe(wakePipe) < 0)
+        {
+            close();
+            return string("Cannot create wake pipe: ") + strerror(errno);
+        }
+        fcntl(wakePipe[0], F_SETFL, O_NONBLOCK);
+        running = true;
+        sender = thread([this] { sendLoop(); });
+        return "";
+    }
+
+    bool isOpen() const
+    {
+        return running.load(memory_order_relaxed);
+    }
+
+    // Tick listener.
+    void onTick(const MarketSnapshot& snap)
+    {
+        if (!isOpen())
+        {
+            return;
+        }
+        if (lastSent.size() < snap.count)
+        {
+            lastSent.resize(snap.count, INT64_MIN); // New symbols go out on their first tick
+        }
+        Outgoing batch{FeedEncoder(maxDatagram), false, {}};
+        FeedEncoder& out = batch.datagrams;
+        out.begin(FeedKind::Incremental, ++sequence, snap.tick, 0);
+        uint64_t changed = 0;
+        for (uint32_t id = 0; id < snap.count; ++id)
+        {
+            int64_t price = toFeedPrice(snap.prices[id]);
+            if (price != lastSent[id])
+            {
+                if (out.full())
+                {
+                    out.finish(0);
+                    out.begin(FeedKind::Incremental, ++sequence, snap.tick, 0);
+                }
+                out.add(id, price);
+                lastSent[id] = price;
+                ++changed;
+            }
+        }
+        out.finish(feedLastPart);
+        enqueue(move(batch));
+        ticks.fetch_add(1, memory_order_relaxed);
+        updates.fetch_add(changed, memory_order_relaxed);
+        checksum.store(feedPriceChecksum(lastSent), memory_order_relaxed);
+
+        vector<FeedAddress> requesters;
+        {
+            lock_guard<mutex> guard(lock);
+            swap(requesters, snapshotRequests);
+        }
+        if (!requesters.empty())
+        {
+            // One encoding of the prices as of `sequence`, sent to everyone who asked.
+            Outgoing snapshot{FeedEncoder(maxDatagram), true, move(requesters)};
+            FeedEncoder& image = snapshot.datagrams;
+            uint32_t part = 0;
+            image.begin(FeedKind::Snapshot, sequence, snap.tick, part);
+            for (uint32_t id = 0; id < lastSent.size(); ++id)
+            {
+                if (image.full())
+                {
+                    image.finish(0);
+                    image.begin(FeedKind::Snapshot, sequence, snap.tick, ++part);
+                }
+                image.add(id, lastSent[id]);
+            }
+            image.finish(feedLastPart);
+            enqueue(move(snapshot));
+        }
+    }
+
+    void close()
+    {
+        if (running.exchange(false) && sender.joinable())
+        {
+            char wake = 1;
+            (void)!write(wakePipe[1], &wake, 1);
+            sender.join();
+        }
+        if (controlSocket == dataSocket)
+        {
+            controlSocket = -1; // Unix: one socket for both, closed once below
+        }
+        for (int* fd : {&dataSocket, &controlSocket, &wakePipe[0], &wakePipe[1]})
+        {
+            if (*fd >= 0)
+            {
+                ::close(*fd);
+            }
+            *fd = -1;
+        }
+        if (endpoint.unixSocket && !endpoint.path.empty())
+        {
+            unlink(endpoint.path.c_str());
+            endpoint.path.clear();
+        }
+    }
+
+    Stats getStats() const
+    {
+        return {ticks.load(memory_order_relaxed),     datagrams.load(memory_order_relaxed),
+                updates.load(memory_order_relaxed),   snapshots.load(memory_order_relaxed),
+                dropped.load(memory_order_relaxed),   subscriberCount.load(memory_order_relaxed),
+                checksum.load(memory_order_relaxed)};
+    }
+};
+
+// Keeps a replica of the published prices. Call poll() in a loop; it reads whatever arrived,
+// applies incrementals in sequence order and recovers from gaps on its own.
+class MarketFeedSubscriber {
+public:
+    struct Stats
+    {
+        uint64_t datagrams = 0;
+        uint64_t updates = 0;
+        uint64_t gaps = 0;       // Sequence gaps seen while live
+        uint64_t recoveries = 0; // Snapshots applied
+        uint64_t duplicates = 0;
+        uint64_t dropped = 0;    // Discarded on purpose by setDropEvery
+        LatencyHistogram latency; // Encode to receive, in nanoseconds
+    };
+
+private:
+    FeedEndpoint endpoint;
+    int dataSocket = -1;
+    int controlSocket = -1; // UDP: requests and snapshots; Unix: same as dataSocket
+    string ownPath;
+    vector<int64_t> prices;
+    bool live = false;
+    uint64_t expected = 0; // Next incremental sequence
+    vector<string> buffered; // Incrementals that arrived while recovering
+    static constexpr size_t maxBuffered = 1 << 16;
+    vector<string> snapshotParts;
+    uint64_t snapshotSequence = 0;
+    size_t snapshotLastPart = SIZE_MAX;
+    chrono::steady_clock::time_point requestedAt;
+    uint64_t dropEvery = 0;
+    vector<char> buffer = vector<char>(feedMaxUnixDatagram);
+    Stats stats;
+
+    void requestSnapshot()
+    {
+        live = false;
+        snapshotParts.clear();
+        snapshotLastPart = SIZE_MAX;
+        requestedAt = chrono::steady_clock::now();
+        sendFeedRequest(controlSocket, FeedKind::SnapshotRequest, endpoint.unixSocket ? endpoint.data : endpoint.control);
+    }
+
+    void apply(string_view datagram, const FeedHeader& header)
+    {
+        forEachFeedUpdate(datagram, header, [&](uint32_t symbol, int64_t price)
+        {
+            if (symbol >= prices.size())
+            {
+                prices.resize(symbol + 1, 0);
+            }
+            prices[symbol] = price;
+        });
+        stats.updates += header.count;
+    }
+
+    void onIncremental(string_view datagram, const FeedHeader& header)
+    {
+        if (!live)
+        {
+            if (buffered.size() == maxBuffered)
+            {
+                buffered.clear(); // The replay will find the hole and ask again
+            }
+            buffered.emplace_back(datagram);
+            return;
+        }
+        if (header.sequence < expected)
+        {
+            ++stats.duplicates;
+            return;
+        }
+        if (header.sequence > expected)
+        {
+            ++stats.gaps;
+            buffered.emplace_back(datagram);
+            requestSnapshot();
+            return;
+        }
+        apply(datagram, header);
+        ++expected;
+    }
+
+    void onSnapshot(string_view datagram, const FeedHeader& header)
+    {
+        if (live)
+        {
+            return; // Answer to a request already served
+        }
+        if (header.part >= feedMaxSnapshotParts ||
+            (snapshotLastPart != SIZE_MAX && header.sequence == snapshotSequence && header.part > snapshotLastPart))
+        {
+            return; // Not a part of any snapshot the publisher could send
+        }
+        if (header.sequence != snapshotSequence)
+        {
+            snapshotParts.clear(); // A newer snapshot replaces a partial older one
+            snapshotLastPart = SIZE_MAX;
+            snapshotSequence = header.sequence;
+        }
+        if (header.part >= snapshotParts.size())
+        {
+            snapshotParts.resize(header.part + 1);
+        }
+        snapshotParts[header.part].assign(datagram);
+        if (header.flags & feedLastPart)
+        {
+            snapshotLastPart = header.part;
+        }
+        if (snapshotLastPart == SIZE_MAX || snapshotParts.size() != snapshotLastPart + 1 ||
+            any_of(snapshotParts.begin(), snapshotParts.end(), [](const string& part) { return part.empty(); }))
+        {
+            return;
+        }
+        for (const string& part : snapshotParts)
+        {
+            FeedHeader partHeader{};
+            readFeedHeader(part, partHeader);
+            apply(part, partHeader);
+        }
+        snapshotParts.clear();
+        ++stats.recoveries;
+        live = true;
+        expected = snapshotSequence + 1;
+        // Replay what came in meanwhile; a hole in it means asking again.
+        vector<string> pending;
+        swap(pending, buffered);
+        sort(pending.begin(), pending.end(), [](const string& a, const string& b)
+        {
+            FeedHeader x, y;
+            memcpy(&x, a.data(), sizeof(x));
+            memcpy(&y, b.data(), sizeof(y));
+            return x.sequence < y.sequence;
+        });
+        for (const string& message : pending)
+        {
+            FeedHeader messageHeader;
+            memcpy(&messageHeader, message.data(), sizeof(messageHeader));
+            onIncremental(message, messageHeader);
+        }
+    }
+
+    void receive(int socket)
+    {
+        ssize_t length;
+        while ((length = recv(socket, buffer.data(), buffer.size(), MSG_DONTWAIT)) >= 0)
+        {
+            string_view datagram(buffer.data(), static_cast<size_t>(length));
+            FeedHeader header;
+            if (!readFeedHeader(datagram, header))
+            {
+                continue;
+            }
+            if (header.kind == FeedKind::Incremental)
+            {
+                ++stats.datagrams;
+                stats.latency.add(static_cast<uint64_t>(max<int64_t>(0, feedClockNs() - header.sentNs)));
+                if (dropEvery && stats.datagrams % dropEvery == 0)
+                {
+                    ++stats.dropped;
+                    continue;
+                }
+                onIncremental(datagram, header);
+            }
+            else if (header.kind == FeedKind::Snapshot)
+            {
+                onSnapshot(datagram, header);
+            }
+        }
+    }
+
+public:
+    ~MarketFeedSubscriber()
+    {
+        close();
+    }
+
+    // Returns an error message, empty on success. Starts by asking for a snapshot.
+    string open(const string& endpointText)
+    {
+        close();
+        string error = endpoint.parse(endpointText);
+        if (!error.empty())
+        {
+            return error;
+        }
+        int receiveBuffer = 8 << 20; // Room for a whole snapshot burst
+        if (endpoint.unixSocket)
+        {
+            ownPath = endpoint.path + "." + to_string(getpid());
+            unlink(ownPath.c_str());
+            FeedAddress own = FeedEndpoint::unixAddress(ownPath);
+            dataSocket = socket(AF_UNIX, SOCK_DGRAM, 0);
+            if (dataSocket < 0 || bind(dataSocket, own.get(), own.length) < 0)
+            {
+                close();
+                return "Cannot bind " + ownPath + ": " + strerror(errno);
+            }
+            controlSocket = dataSocket;
+            setsockopt(dataSocket, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+            sendFeedRequest(dataSocket, FeedKind::Subscribe, endpoint.data);
+        }
+        else
+        {
+            const sockaddr_in& group = reinterpret_cast<const sockaddr_in&>(endpoint.data.address);
+            sockaddr_in any{};
+            any.sin_family = AF_INET;
+            any.sin_port = group.sin_port;
+            any.sin_addr.s_addr = htonl(INADDR_ANY);
+            ip_mreq membership{};
+            membership.imr_multiaddr = group.sin_addr;
+            membership.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+            int reuse = 1; // Dozens of subscribers share the group port
+            dataSocket = socket(AF_INET, SOCK_DGRAM, 0);
+            controlSocket = socket(AF_INET, SOCK_DGRAM, 0);
+            if (dataSocket < 0 || controlSocket < 0 ||
+                setsockopt(dataSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0 ||
+                bind(dataSocket, reinterpret_cast<const sockaddr*>(&any), sizeof(any)) < 0 ||
+                setsockopt(dataSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0)
+            {
+                close();
+                return string("Cannot join the multicast group: ") + strerror(errno);
+            }
+            setsockopt(dataSocket, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+            setsockopt(controlSocket, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+        }
+        requestSnapshot();
+        return "";
+    }
+
+    // Processes what arrives within timeoutMs. Asks for the snapshot again if one is overdue.
+    void poll(int timeoutMs)
+    {
+        pollfd waits[2] = {{dataSocket, POLLIN, 0}, {controlSocket, POLLIN, 0}};
+        int count = controlSocket == dataSocket ? 1 : 2;
+        if (::poll(waits, static_cast<nfds_t>(count), timeoutMs) > 0)
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                if (waits[i].revents & POLLIN)
+                {
+                    receive(waits[i].fd);
+                }
+            }
+        }
+        if (!live && chrono::steady_clock::now() - requestedAt > chrono::seconds(1))
+        {
+            requestSnapshot();
+        }
+    }
+
+    void close()
+    {
+        if (endpoint.unixSocket && dataSocket >= 0)
+        {
+            sendFeedRequest(dataSocket, FeedKind::Unsubscribe, endpoint.data);
+        }
+        if (controlSocket >= 0 && controlSocket != dataSocket)
+        {
+            ::close(controlSocket);
+        }
+        if (dataSocket >= 0)
+        {
+            ::close(dataSocket);
+        }
+        dataSocket = controlSocket = -1;
+        if (!ownPath.empty())
+        {
+            unlink(ownPath.c_str());
+            ownPath.clear();
+        }
+    }
+
+    // Testing aid: discard every nth incremental datagram to exercise gap recovery.
+    void setDropEvery(uint64_t n)
+    {
+        dropEvery = n;
+    }
+
+    bool isLive() const { return live; }
+    const vector<int64_t>& getPrices() const { return prices; }
+    const Stats& getStats() const { return stats; }
+};
+#else
+// Windows builds have no feed yet: both ends report it as unavailable.
+class MarketFeedPublisher {
+public:
+    struct Stats
+    {
+        uint64_t ticks, datagrams, updates, snapshots, dropped;
+        size_t subscribers;
+        uint64_t checksum;
+    };
+    string open(const string&) { return "The market data feed needs POSIX sockets"; }
+    bool isOpen() const { return false; }
+    void onTick(const MarketSnapshot&) {}
+    void close() {}
+    Stats getStats() const { return {}; }
+};
+#endif
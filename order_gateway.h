@@ -0,0 +1,909 @@
+#pragma once
+#include "stock_market.h"
+#include <unordered_map>
+#if defined(__linux__)
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#endif
+
+// Order-entry gateway: many clients send orders over loopback TCP, each connection trading as
+// its own account.
+//
+// The protocol is fixed-size binary messages in host byte order (the gateway only listens on
+// 127.0.0.1): GatewayRequest from the client, GatewayReport back. A connection first receives a
+// Welcome with its account, then one Accepted, Rejected or Cancelled report per request, in
+// request order, plus a Fill whenever a resting order of the account trades later.
+//
+// Network threads each run an epoll loop over their share of the connections and hand whole
+// requests to a single trading-core thread through one SPSC queue per network thread. The core
+// drains everything queued, takes the market's order lock once for the batch, and queues the
+// reports back to each network thread, which writes all of a connection's reports in one send.
+enum class GatewayRequestKind : uint8_t
+{
+    NewOrder,
+    Cancel,
+};
+
+struct GatewayRequest
+{
+    GatewayRequestKind kind;
+    Side side;
+    OrderType type;
+    uint8_t reserved;
+    uint32_t symbol;       // Id, as in the market data feed
+    uint32_t quantity;
+    uint32_t reserved2;
+    int64_t priceTicks;    // Limit price in cents
+    uint64_t clientOrderId; // Echoed in every report about the order
+    uint64_t orderId;      // Cancel: the gateway's id from the Accepted report
+};
+static_assert(sizeof(GatewayRequest) == 40, "requests are sent as laid out");
+
+enum class GatewayReportKind : uint8_t
+{
+    Welcome,   // orderId: account number, symbol: symbols listed, priceTicks: starting cash
+    Accepted,  // filled at average priceTicks right away, resting in the book
+    Rejected,  // reason says why
+    Cancelled, // resting: quantity cancelled
+    Fill,      // A resting order traded: filled at priceTicks, resting left
+};
+
+enum class GatewayReject : uint8_t
+{
+    None,
+    BadRequest,
+    UnknownSymbol,
+    BadQuantity,
+    BadPrice,
+    InsufficientCash,
+    InsufficientShares,
+    NoLiquidity,
+    UnknownOrder,
+    Busy, // The trading core is behind; nothing was done
+    EngineRejected,
+};
+constexpr array<const char*, 11> gatewayRejectNames = {"none", "bad request", "unknown symbol", "bad quantity",
+                                                       "bad price", "insufficient cash", "insufficient shares",
+                                                       "no liquidity", "unknown order", "busy", "engine rejected"};
+
+struct GatewayReport
+{
+    GatewayReportKind kind;
+    Side side;
+    GatewayReject reason;
+    uint8_t reserved;
+    uint32_t symbol;
+    uint32_t filled;
+    uint32_t resting;
+    int64_t priceTicks;
+    uint64_t clientOrderId;
+    uint64_t orderId;
+};
+static_assert(sizeof(GatewayReport) == 40, "reports are sent as laid out");
+
+constexpr uint32_t gatewayMaxQuantity = 1000000;
+// $10,000,000.00; with gatewayMaxQuantity, order values stay far inside int64.
+constexpr int64_t gatewayMaxPriceTicks = 1000000000;
+constexpr int64_t gatewayStartingCash = 100000000; // $1,000,000 in cents per account
+// Matching-engine owner ids of gateway accounts start after the house and the menu's portfolio,
+// and end before a trader population's.
+constexpr uint32_t gatewayFirstOwner = 2;
+constexpr uint32_t gatewayEndOwner = 1U << 30;
+static_assert(gatewayFirstOwner > marketMakerOwner && gatewayFirstOwner > Portfolio::ownerId,
+              "gateway accounts need owner ids of their own");
+
+#if defined(__linux__)
+class OrderGateway {
+public:
+    struct Stats
+    {
+        uint64_t connections; // Open now
+        uint64_t accepted;
+        uint64_t rejected;
+        uint64_t cancelled;
+        uint64_t fills;       // Reported to resting orders
+        uint64_t batches;     // Times the core took the order lock
+        uint64_t requests;    // Handled by the core
+        uint64_t unsettled;   // Fills or releases the account store refused; should stay 0
+    };
+
+private:
+    enum class InboundKind : uint8_t { Connect, Request, Disconnect };
+    struct Inbound
+    {
+        InboundKind kind;
+        uint32_t slot;       // Connection within its network thread
+        uint32_t generation; // Of the slot, so reports never reach a later connection
+        GatewayRequest request;
+    };
+    struct Outbound
+    {
+        uint32_t slot;
+        uint32_t generation;
+        GatewayReport report;
+    };
+    static constexpr size_t queueCapacity = 1 << 14;
+    static constexpr size_t maxPendingOutput = 1 << 20; // A client this far behind is dropped
+    static constexpr uint64_t listenKey = UINT64_MAX;
+    static constexpr uint64_t wakeKey = UINT64_MAX - 1;
+
+    struct Connection
+    {
+        int fd = -1;
+        uint32_t generation = 0;
+        string input;  // Bytes of a request not complete yet
+        string output; // Reports not written yet
+        bool waitingToWrite = false;
+    };
+
+    struct NetworkThread
+    {
+        int epoll = -1;
+        int listener = -1;
+        int wake = -1; // eventfd: reports are waiting in fromCore
+        thread worker;
+        vector<Connection> connections;
+        vector<uint32_t> freeSlots;
+        vector<Inbound> closing; // Disconnects the core has not been told of; their slots wait
+        unique_ptr<SpscQueue<Inbound, queueCapacity>> toCore = make_unique<SpscQueue<Inbound, queueCapacity>>();
+        unique_ptr<SpscQueue<Outbound, queueCapacity>> fromCore = make_unique<SpscQueue<Outbound, queueCapacity>>();
+        vector<uint32_t> touched; // Connections with reports to write
+        vector<uint32_t> accountOf; // Core thread only: slot -> account
+    };
+
+    // Core thread only.
+    struct OpenOrder
+    {
+        uint32_t symbol;
+        Side side;
+        int64_t limitTicks;
+        uint32_t remaining;
+        uint64_t clientOrderId;
+    };
+    struct Account
+    {
+        bool live = false;
+        uint32_t thread = 0;
+        uint32_t slot = 0;
+        uint32_t generation = 0;
+        uint32_t storeId = 0; // Cash (less what open buys reserved) and shares free to sell
+        unordered_map<uint64_t, OpenOrder> openOrders;
+    };
+
+    StockMarket& market;
+    vector<unique_ptr<NetworkThread>> networkThreads;
+    thread core;
+    int coreWake = -1;
+    atomic<bool> coreSleeping{false};
+    atomic<bool> running{false};
+    uint32_t fillParty = StockMarket::noFillParty;
+    atomic<bool> fillsWaiting{false}; // Another party filled resting orders; see takeFills
+
+    vector<Account> accounts; // Owner id gatewayFirstOwner + index
+    AccountStore store{16};
+    vector<uint32_t> freeAccounts;
+    vector<Fill> fills;
+    vector<bool> reportsFor; // Network threads the current batch reported to
+
+    atomic<uint64_t> connectionCount{0}, accepted{0}, rejected{0}, cancelled{0}, filled{0}, batches{0},
+        requests{0}, unsettled{0};
+
+    void closeConnection(NetworkThread& net, uint32_t slot)
+    {
+        Connection& connection = net.connections[slot];
+        if (connection.fd < 0)
+        {
+            return;
+        }
+        epoll_ctl(net.epoll, EPOLL_CTL_DEL, connection.fd, nullptr);
+        ::close(connection.fd);
+        connection.fd = -1;
+        connection.input.clear();
+        connection.output.clear();
+        connection.waitingToWrite = false;
+        net.closing.push_back({InboundKind::Disconnect, slot, connection.generation, {}});
+        ++connection.generation;
+        connectionCount.fetch_sub(1, memory_order_relaxed);
+    }
+
+    // The core must hear of every disconnect, or the account leaks, but waiting for queue space
+    // here could deadlock with the core waiting to queue reports. A slot is reused only once its
+    // disconnect is queued, so the core never confuses two connections.
+    bool queueDisconnects(NetworkThread& net)
+    {
+        size_t done = 0;
+        while (done < net.closing.size() && net.toCore->push(net.closing[done]))
+        {
+            net.freeSlots.push_back(net.closing[done++].slot);
+        }
+        net.closing.erase(net.closing.begin(), net.closing.begin() + static_cast<ptrdiff_t>(done));
+        return done > 0;
+    }
+
+    void flush(NetworkThread& net, uint32_t slot)
+    {
+        Connection& connection = net.connections[slot];
+        size_t sent = 0;
+        while (sent < connection.output.size())
+        {
+            ssize_t n = send(connection.fd, connection.output.data() + sent, connection.output.size() - sent,
+                             MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    closeConnection(net, slot);
+                    return;
+                }
+                break;
+            }
+            sent += static_cast<size_t>(n);
+        }
+        connection.output.erase(0, sent);
+        bool wantWrite = !connection.output.empty();
+        if (wantWrite && connection.output.size() > maxPendingOutput)
+        {
+            closeConnection(net, slot);
+            return;
+        }
+        if (wantWrite != connection.waitingToWrite)
+        {
+            epoll_event event{};
+            event.events = wantWrite ? EPOLLIN | EPOLLOUT : EPOLLIN;
+            event.data.u64 = slot;
+            epoll_ctl(net.epoll, EPOLL_CTL_MOD, connection.fd, &event);
+            connection.waitingToWrite = wantWrite;
+        }
+    }
+
+    void queueReport(NetworkThread& net, uint32_t slot, const GatewayReport& report)
+    {
+        Connection& connection = net.connections[slot];
+        if (connection.output.empty())
+        {
+            net.touched.push_back(slot);
+        }
+        connection.output.append(reinterpret_cast<const char*>(&report), sizeof(report));
+    }
+
+    void acceptConnections(NetworkThread& net)
+    {
+        int fd;
+        while ((fd = accept4(net.listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+        {
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            uint32_t slot;
+            if (!net.freeSlots.empty())
+            {
+                slot = net.freeSlots.back();
+                net.freeSlots.pop_back();
+            }
+            else
+            {
+                slot = static_cast<uint32_t>(net.connections.size());
+                net.connections.emplace_back();
+            }
+            Connection& connection = net.connections[slot];
+            Inbound message{InboundKind::Connect, slot, connection.generation, {}};
+            if (!net.toCore->push(message))
+            {
+                ::close(fd); // The core is swamped; the client can try again
+                net.freeSlots.push_back(slot);
+                continue;
+            }
+            connection.fd = fd;
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.u64 = slot;
+            epoll_ctl(net.epoll, EPOLL_CTL_ADD, fd, &event);
+            connectionCount.fetch_add(1, memory_order_relaxed);
+        }
+    }
+
+    // Returns true if requests were queued for the core.
+    bool readRequests(NetworkThread& net, uint32_t slot)
+    {
+        Connection& connection = net.connections[slot];
+        char buffer[1 << 16];
+        bool queued = false;
+        while (connection.fd >= 0)
+        {
+            ssize_t n = recv(connection.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (n <= 0)
+            {
+                if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                {
+                    closeConnection(net, slot);
+                }
+                break;
+            }
+            connection.input.append(buffer, static_cast<size_t>(n));
+            size_t used = 0;
+            for (; used + sizeof(GatewayRequest) <= connection.input.size(); used += sizeof(GatewayRequest))
+            {
+                Inbound message{InboundKind::Request, slot, connection.generation, {}};
+                memcpy(&message.request, connection.input.data() + used, sizeof(GatewayRequest));
+                if (net.toCore->push(message))
+                {
+                    queued = true;
+                    continue;
+                }
+                GatewayReport busy{GatewayReportKind::Rejected, message.request.side, GatewayReject::Busy, 0,
+                                   message.request.symbol, 0, 0, 0, message.request.clientOrderId, 0};
+                queueReport(net, slot, busy);
+            }
+            connection.input.erase(0, used);
+        }
+        return queued;
+    }
+
+    void networkLoop(NetworkThread& net)
+    {
+        epoll_event events[256];
+        while (running.load(memory_order_relaxed))
+        {
+            int ready = epoll_wait(net.epoll, events, 256, 100);
+            bool queued = false;
+            for (int i = 0; i < ready; ++i)
+            {
+                uint64_t key = events[i].data.u64;
+                if (key == listenKey)
+                {
+                    acceptConnections(net);
+                    queued = true;
+                }
+                else if (key == wakeKey)
+                {
+                    uint64_t count;
+                    (void)!read(net.wake, &count, sizeof(count));
+                }
+                else if (net.connections[key].fd >= 0)
+                {
+                    uint32_t slot = static_cast<uint32_t>(key);
+                    if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    {
+                        queued |= readRequests(net, slot);
+                    }
+                    if ((events[i].events & EPOLLOUT) && net.connections[slot].fd >= 0)
+                    {
+                        flush(net, slot);
+                    }
+                }
+            }
+            queued |= queueDisconnects(net);
+            if (queued)
+            {
+                wakeCore(); // Once for everything this pass read
+            }
+            Outbound out;
+            while (net.fromCore->pop(out))
+            {
+                if (out.slot < net.connections.size() && net.connections[out.slot].fd >= 0 &&
+                    net.connections[out.slot].generation == out.generation)
+                {
+                    queueReport(net, out.slot, out.report);
+                }
+            }
+            for (uint32_t slot : net.touched)
+            {
+                if (net.connections[slot].fd >= 0 && !net.connections[slot].waitingToWrite)
+                {
+                    flush(net, slot);
+                }
+            }
+            net.touched.clear();
+        }
+    }
+
+    void wakeCore()
+    {
+        atomic_thread_fence(memory_order_seq_cst); // Pairs with the fence in coreLoop
+        if (coreSleeping.exchange(false))
+        {
+            uint64_t one = 1;
+            (void)!write(coreWake, &one, sizeof(one));
+        }
+    }
+
+    void report(const Account& account, const GatewayReport& report)
+    {
+        NetworkThread& net = *networkThreads[account.thread];
+        Outbound out{account.slot, account.generation, report};
+        while (!net.fromCore->push(out))
+        {
+            uint64_t one = 1;
+            (void)!write(net.wake, &one, sizeof(one));
+            this_thread::yield();
+        }
+        reportsFor[account.thread] = true;
+    }
+
+    Account* accountOf(uint32_t owner)
+    {
+        if (owner < gatewayFirstOwner || owner - gatewayFirstOwner >= accounts.size())
+        {
+            return nullptr;
+        }
+        Account& account = accounts[owner - gatewayFirstOwner];
+        return account.live ? &account : nullptr;
+    }
+
+    // The trade happened in the book whatever the store says, so a refusal cannot undo it; it is
+    // counted (Stats::unsettled) and the account keeps what it had.
+    void settleOrCount(const Account& account, int64_t cashDelta, uint32_t symbol = AccountStore::none,
+                       int64_t shareDelta = 0)
+    {
+        if (store.settle(account.storeId, cashDelta, symbol, shareDelta) != AccountStatus::Ok)
+        {
+            unsettled.fetch_add(1, memory_order_relaxed);
+        }
+    }
+
+    // Same bookkeeping as Portfolio::applyFill, in cents.
+    void applyFill(Account& account, const Fill& fill, uint64_t orderId, Side side, bool maker)
+    {
+        auto it = account.openOrders.find(orderId);
+        bool open = it != account.openOrders.end();
+        int64_t value = fill.priceTicks * fill.quantity;
+        if (side == Side::Buy)
+        {
+            // A limit buy reserved cash at its limit; hand back the price improvement.
+            int64_t cash = open ? (it->second.limitTicks - fill.priceTicks) * fill.quantity : -value;
+            settleOrCount(account, cash, fill.symbol, fill.quantity);
+        }
+        else
+        {
+            // Limit sells reserved their shares up front.
+            settleOrCount(account, value, fill.symbol, open ? 0 : -static_cast<int64_t>(fill.quantity));
+        }
+        if (!open)
+        {
+            return;
+        }
+        uint32_t left = it->second.remaining -= fill.quantity;
+        if (maker)
+        {
+            report(account, {GatewayReportKind::Fill, side, GatewayReject::None, 0, fill.symbol, fill.quantity, left,
+                             fill.priceTicks, it->second.clientOrderId, orderId});
+            filled.fetch_add(1, memory_order_relaxed);
+        }
+        if (left == 0)
+        {
+            account.openOrders.erase(it);
+        }
+    }
+
+    // Settles every fill in `fills` that involves a gateway account. The market keeps fills of
+    // another party's resting orders (the menu's portfolio, a trader population) for that party.
+    void settle()
+    {
+        for (const Fill& fill : fills)
+        {
+            if (Account* taker = accountOf(fill.takerOwner))
+            {
+                applyFill(*taker, fill, fill.takerOrderId, fill.takerSide, false);
+            }
+            if (Account* maker = accountOf(fill.makerOwner))
+            {
+                applyFill(*maker, fill, fill.makerOrderId, fill.takerSide == Side::Buy ? Side::Sell : Side::Buy,
+                          true);
+            }
+        }
+    }
+
+    void release(Account& account, unordered_map<uint64_t, OpenOrder>::iterator it)
+    {
+        const OpenOrder& order = it->second;
+        if (order.side == Side::Buy)
+        {
+            settleOrCount(account, order.limitTicks * order.remaining);
+        }
+        else
+        {
+            settleOrCount(account, 0, order.symbol, order.remaining);
+        }
+        account.openOrders.erase(it);
+    }
+
+    GatewayReject placeOrder(Account& account, uint32_t owner, const GatewayRequest& request, GatewayReport& result)
+    {
+        if (request.symbol >= market.size())
+        {
+            return GatewayReject::UnknownSymbol;
+        }
+        if (request.quantity == 0 || request.quantity > gatewayMaxQuantity)
+        {
+            return GatewayReject::BadQuantity;
+        }
+        if (request.side > Side::Sell || request.type > OrderType::Market ||
+            (request.type == OrderType::Limit &&
+             (request.priceTicks <= 0 || request.priceTicks > gatewayMaxPriceTicks)))
+        {
+            return request.type == OrderType::Limit ? GatewayReject::BadPrice : GatewayReject::BadRequest;
+        }
+        uint32_t symbol = request.symbol;
+        bool limit = request.type == OrderType::Limit;
+        fills.clear();
+        market.refreshQuotes(symbol, fills, owner); // New house quotes can fill resting orders
+        settle();
+        int64_t cost = 0;
+        if (!limit && market.estimateMarketOrder(symbol, request.side, request.quantity, cost) < request.quantity)
+        {
+            return GatewayReject::NoLiquidity;
+        }
+        if (request.side == Side::Buy)
+        {
+            if (limit)
+            {
+                cost = request.priceTicks * request.quantity;
+            }
+            if (cost > store.getCash(account.storeId))
+            {
+                return GatewayReject::InsufficientCash;
+            }
+        }
+        else if (store.getShares(account.storeId, symbol) < request.quantity)
+        {
+            return GatewayReject::InsufficientShares;
+        }
+        // A limit order reserves its cash or shares before it can trade, so a refused reservation
+        // leaves nothing to unwind.
+        int64_t reservedCash = limit && request.side == Side::Buy ? cost : 0;
+        int64_t reservedShares = limit && request.side == Side::Sell ? request.quantity : 0;
+        if (limit)
+        {
+            AccountStatus status = store.settle(account.storeId, -reservedCash, symbol, -reservedShares);
+            if (status != AccountStatus::Ok)
+            {
+                return status == AccountStatus::InsufficientShares ? GatewayReject::InsufficientShares
+                                                                    : GatewayReject::InsufficientCash;
+            }
+        }
+        fills.clear();
+        OrderResult order = market.submitOrder(symbol, request.side, request.type,
+                                               limit ? fromPriceTicks(request.priceTicks) : 0.0, request.quantity,
+                                               owner, fills);
+        if (!order.accepted)
+        {
+            if (limit)
+            {
+                settleOrCount(account, reservedCash, symbol, reservedShares);
+            }
+            return GatewayReject::EngineRejected;
+        }
+        if (limit)
+        {
+            account.openOrders.emplace(order.orderId, OpenOrder{symbol, request.side, request.priceTicks,
+                                                                request.quantity, request.clientOrderId});
+        }
+        int64_t value = 0;
+        for (const Fill& fill : fills)
+        {
+            value += fill.takerOrderId == order.orderId ? fill.priceTicks * fill.quantity : 0;
+        }
+        settle();
+        result.kind = GatewayReportKind::Accepted;
+        result.filled = order.filled;
+        result.resting = order.resting;
+        result.priceTicks = order.filled ? value / order.filled : 0;
+        result.orderId = order.orderId;
+        return GatewayReject::None;
+    }
+
+    void cancelOrder(Account& account, const GatewayRequest& request, GatewayReport& result)
+    {
+        auto it = account.openOrders.find(request.orderId);
+        if (it == account.openOrders.end() || !market.cancelOrder(request.orderId))
+        {
+            result.kind = GatewayReportKind::Rejected;
+            result.reason = GatewayReject::UnknownOrder;
+            return;
+        }
+        result.kind = GatewayReportKind::Cancelled;
+        result.symbol = it->second.symbol;
+        result.side = it->second.side;
+        result.resting = it->second.remaining;
+        result.orderId = request.orderId;
+        release(account, it);
+    }
+
+    // Settles the fills of account orders that the menu or traders took, with a Fill report
+    // for each. Runs first in every batch, so no fill outlives the disconnect of its account.
+    void takeFills()
+    {
+        fillsWaiting.store(false);
+        fills.clear();
+        market.takeFills(fillParty, fills);
+        settle();
+    }
+
+    void handle(uint32_t threadIndex, const Inbound& message)
+    {
+        NetworkThread& net = *networkThreads[threadIndex];
+        if (message.kind == InboundKind::Connect)
+        {
+            uint32_t index;
+            if (!freeAccounts.empty())
+            {
+                index = freeAccounts.back();
+                freeAccounts.pop_back();
+            }
+            else
+            {
+                index = static_cast<uint32_t>(accounts.size());
+                accounts.emplace_back();
+            }
+            Account& account = accounts[index];
+            account = Account();
+            account.live = true;
+            account.thread = threadIndex;
+            account.slot = message.slot;
+            account.generation = message.generation;
+            account.storeId = store.open(gatewayStartingCash);
+            if (net.accountOf.size() <= message.slot)
+            {
+                net.accountOf.resize(message.slot + 1);
+            }
+            net.accountOf[message.slot] = index;
+            report(account, {GatewayReportKind::Welcome, Side::Buy, GatewayReject::None, 0,
+                             static_cast<uint32_t>(market.size()), 0, 0, gatewayStartingCash, 0,
+                             gatewayFirstOwner + index});
+            return;
+        }
+        uint32_t index = net.accountOf[message.slot];
+        Account& account = accounts[index];
+        if (message.kind == InboundKind::Disconnect)
+        {
+            // Orders do not outlive their connection, so owner ids can be reused safely.
+            for (const auto& open : account.openOrders)
+            {
+                market.cancelOrder(open.first);
+            }
+            store.close(account.storeId);
+            account = Account();
+            freeAccounts.push_back(index);
+            return;
+        }
+        const GatewayRequest& request = message.request;
+        requests.fetch_add(1, memory_order_relaxed);
+        GatewayReport result{GatewayReportKind::Rejected, request.side, GatewayReject::None, 0, request.symbol,
+                             0, 0, 0, request.clientOrderId, 0};
+        if (request.kind == GatewayRequestKind::NewOrder)
+        {
+            result.reason = placeOrder(account, gatewayFirstOwner + index, request, result);
+        }
+        else if (request.kind == GatewayRequestKind::Cancel)
+        {
+            cancelOrder(account, request, result);
+        }
+        else
+        {
+            result.reason = GatewayReject::BadRequest;
+        }
+        if (result.kind == GatewayReportKind::Rejected)
+        {
+            result.filled = result.resting = 0;
+            result.priceTicks = 0;
+            result.orderId = 0;
+        }
+        (result.kind == GatewayReportKind::Accepted ? accepted
+                                                     : result.kind == GatewayReportKind::Cancelled ? cancelled
+                                                                                                   : rejected)
+            .fetch_add(1, memory_order_relaxed);
+        report(account, result);
+    }
+
+    bool idle() const
+    {
+        return queuesEmpty() && !fillsWaiting.load();
+    }
+
+    bool queuesEmpty() const
+    {
+        for (const auto& net : networkThreads)
+        {
+            if (!net->toCore->empty())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void coreLoop()
+    {
+        reportsFor.assign(networkThreads.size(), false);
+        while (running.load(memory_order_relaxed))
+        {
+            if (idle())
+            {
+                coreSleeping.store(true);
+                atomic_thread_fence(memory_order_seq_cst); // Pairs with the fence in wakeCore
+                if (idle())
+                {
+                    pollfd wait{coreWake, POLLIN, 0};
+                    ::poll(&wait, 1, 100);
+                    uint64_t count;
+                    (void)!read(coreWake, &count, sizeof(count));
+                }
+                coreSleeping.store(false);
+                continue;
+            }
+            {
+                auto orders = market.lockOrders(); // Once per batch, not per order
+                takeFills();
+                for (uint32_t t = 0; t < networkThreads.size(); ++t)
+                {
+                    Inbound message;
+                    for (size_t n = 0; n < queueCapacity && networkThreads[t]->toCore->pop(message); ++n)
+                    {
+                        handle(t, message);
+                    }
+                }
+            }
+            batches.fetch_add(1, memory_order_relaxed);
+            for (uint32_t t = 0; t < networkThreads.size(); ++t)
+            {
+                if (reportsFor[t])
+                {
+                    uint64_t one = 1;
+                    (void)!write(networkThreads[t]->wake, &one, sizeof(one));
+                    reportsFor[t] = false;
+                }
+            }
+        }
+    }
+
+public:
+    explicit OrderGateway(StockMarket& market) : market(market) {}
+
+    ~OrderGateway()
+    {
+        close();
+    }
+
+    // Listens on 127.0.0.1:port with `threads` network threads. Returns an error message, empty
+    // on success.
+    string open(uint16_t port, unsigned threads = 2)
+    {
+        close();
+        coreWake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (coreWake < 0)
+        {
+            return string("Cannot create eventfd: ") + strerror(errno);
+        }
+        for (unsigned t = 0; t < max(1u, threads); ++t)
+        {
+            auto net = make_unique<NetworkThread>();
+            // Every thread listens on the port itself; the kernel spreads new connections.
+            net->listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            net->epoll = epoll_create1(EPOLL_CLOEXEC);
+            net->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            int on = 1;
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(port);
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            epoll_event listen{}, wake{};
+            listen.events = wake.events = EPOLLIN;
+            listen.data.u64 = listenKey;
+            wake.data.u64 = wakeKey;
+            bool ok = net->listener >= 0 && net->epoll >= 0 && net->wake >= 0 &&
+                      setsockopt(net->listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == 0 &&
+                      setsockopt(net->listener, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == 0 &&
+                      bind(net->listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 &&
+                      ::listen(net->listener, SOMAXCONN) == 0 &&
+                      epoll_ctl(net->epoll, EPOLL_CTL_ADD, net->listener, &listen) == 0 &&
+                      epoll_ctl(net->epoll, EPOLL_CTL_ADD, net->wake, &wake) == 0;
+            string error = ok ? "" : "Cannot listen on port " + to_string(port) + ": " + strerror(errno);
+            networkThreads.push_back(move(net));
+            if (!ok)
+            {
+                close();
+                return error;
+            }
+        }
+        {
+            auto orders = market.lockOrders();
+            fillParty = market.addFillParty(gatewayFirstOwner, gatewayEndOwner, [this]
+            {
+                fillsWaiting.store(true);
+                wakeCore();
+            });
+        }
+        running = true;
+        core = thread([this] { coreLoop(); });
+        for (auto& net : networkThreads)
+        {
+            net->worker = thread([this, raw = net.get()] { networkLoop(*raw); });
+        }
+        return "";
+    }
+
+    void close()
+    {
+        if (running.exchange(false))
+        {
+            for (auto& net : networkThreads)
+            {
+                net->worker.join();
+            }
+            core.join();
+        }
+        for (auto& net : networkThreads)
+        {
+            for (Connection& connection : net->connections)
+            {
+                if (connection.fd >= 0)
+                {
+                    ::close(connection.fd);
+                }
+            }
+            for (int fd : {net->listener, net->epoll, net->wake})
+            {
+                if (fd >= 0)
+                {
+                    ::close(fd);
+                }
+            }
+        }
+        networkThreads.clear();
+        if (coreWake >= 0)
+        {
+            ::close(coreWake);
+            coreWake = -1;
+        }
+        // Whatever the accounts had resting goes with them.
+        auto orders = market.lockOrders();
+        market.removeFillParty(fillParty);
+        fillParty = StockMarket::noFillParty;
+        fillsWaiting = false;
+        for (Account& account : accounts)
+        {
+            for (const auto& open : account.openOrders)
+            {
+                market.cancelOrder(open.first);
+            }
+            if (account.live)
+            {
+                store.close(account.storeId);
+            }
+        }
+        accounts.clear();
+        freeAccounts.clear();
+        connectionCount = 0;
+    }
+
+    bool isOpen() const
+    {
+        return running.load(memory_order_relaxed);
+    }
+
+    Stats getStats() const
+    {
+        return {connectionCount.load(memory_order_relaxed), accepted.load(memory_order_relaxed),
+                rejected.load(memory_order_relaxed),        cancelled.load(memory_order_relaxed),
+                filled.load(memory_order_relaxed),          batches.load(memory_order_relaxed),
+                requests.load(memory_order_relaxed),        unsettled.load(memory_order_relaxed)};
+    }
+};
+#else
+// The gateway is built on epoll; elsewhere it reports itself unavailable.
+class OrderGateway {
+public:
+    struct Stats
+    {
+        uint64_t connections, accepted, rejected, cancelled, fills, batches, requests, unsettled;
+    };
+    explicit OrderGateway(StockMarket&) {}
+    string open(uint16_t, unsigned = 2) { return "The order gateway needs Linux (epoll)"; }
+    void close() {}
+    bool isOpen() const { return false; }
+    Stats getStats() const { return {}; }
+};
+#endif
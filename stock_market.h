@@ -0,0 +1,8539 @@
+#pragma once
+// Simulator core: market state, tick engine, matching engine, journal, portfolio and
+// watchlist. Everything is inline so the interactive program and the benchmarks share one
+// copy of the code through the stockcore target.
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <atomic>
+#include <iomanip>
+#include <sstream>
+#include <array>
+#include <deque>
+#include <iterator>
+#include <type_traits>
+#include <cstdint>
+#include <cmath>
+#include <climits>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <filesystem>
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(_MSC_VER)
+#include <x86intrin.h>
+#endif
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/prctl.h>
+#endif
+using namespace std;
+
+// Counter-based random numbers: every draw is a pure function of (seed, tick, symbol id),
+// so there is no hidden generator state and four symbols can be drawn in one SIMD register.
+inline uint32_t mixBits(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+inline uint32_t tickKey(uint32_t seed, uint64_t tick)
+{
+    return mixBits(seed ^ mixBits(static_cast<uint32_t>(tick) ^ mixBits(static_cast<uint32_t>(tick >> 32))));
+}
+inline uint32_t symbolDraw(uint32_t key, uint32_t id)
+{
+    return mixBits((id * 0x9E3779B9U) ^ key);
+}
+
+// Allocator that keeps columns on cache-line boundaries for the vector kernels.
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator
+{
+    using value_type = T;
+    template <typename U> struct rebind { using other = AlignedAllocator<U, Alignment>; };
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(::operator new(n * sizeof(T), align_val_t(Alignment)));
+    }
+    void deallocate(T* p, size_t)
+    {
+        ::operator delete(p, align_val_t(Alignment));
+    }
+    bool operator==(const AlignedAllocator&) const { return true; }
+    bool operator!=(const AlignedAllocator&) const { return false; }
+};
+template <typename T>
+using AlignedVector = vector<T, AlignedAllocator<T>>;
+
+// Per-symbol columns the tick kernel reads from or writes to.
+struct PriceColumns
+{
+    double* price;
+    double* volatility;
+};
+
+// One random step for symbols [begin, end), reading `from` and writing `to` (which may be the
+// same columns). Each symbol takes a single 32-bit draw: the high half picks the price move in
+// [-100, 100] basis points (scaled by volatility), the low half the volatility jitter in
+// [-5, 5] tenths of a percent.
+inline void updatePricesScalar(const PriceColumns& from, const PriceColumns& to, size_t begin, size_t end,
+                               uint32_t key)
+{
+    for (size_t i = begin; i < end; ++i)
+    {
+        uint32_t u = symbolDraw(key, static_cast<uint32_t>(i));
+        int randChange = static_cast<int>(((u >> 16) * 201U) >> 16) - 100;
+        int volChange = static_cast<int>(((u & 0xFFFFU) * 11U) >> 16) - 5;
+        double vol = from.volatility[i];
+        double p = from.price[i];
+        p += p * (randChange * 1e-4 * (1.0 + vol));
+        to.price[i] = p;
+        vol += volChange * 1e-3;
+        if (vol < 0.01) vol = 0.01; // Ensure volatility doesn't go too low.
+        if (vol > 0.10) vol = 0.10; // Ensure volatility doesn't go too high
+        to.volatility[i] = vol;
+    }
+}
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+// Four symbol draws at once; same bits as symbolDraw for ids base..base+3.
+inline __m128i symbolDraw4(uint32_t key, uint32_t base)
+{
+    __m128i x = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(base)), _mm_setr_epi32(0, 1, 2, 3));
+    x = _mm_xor_si128(_mm_mullo_epi32(x, _mm_set1_epi32(static_cast<int>(0x9E3779B9U))),
+                      _mm_set1_epi32(static_cast<int>(key)));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+    x = _mm_mullo_epi32(x, _mm_set1_epi32(0x7feb352d));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 15));
+    x = _mm_mullo_epi32(x, _mm_set1_epi32(static_cast<int>(0x846ca68bU)));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+    return x;
+}
+#endif
+
+inline void updatePrices(const PriceColumns& from, const PriceColumns& to, size_t begin, size_t end, uint32_t key)
+{
+    size_t i = begin;
+#if defined(__AVX2__) || defined(__SSE4_1__)
+    const __m128i mask16 = _mm_set1_epi32(0xFFFF);
+    const __m128i priceSteps = _mm_set1_epi32(201);
+    const __m128i volSteps = _mm_set1_epi32(11);
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128i u = symbolDraw4(key, static_cast<uint32_t>(i));
+        __m128i randChange = _mm_sub_epi32(_mm_srli_epi32(_mm_mullo_epi32(_mm_srli_epi32(u, 16), priceSteps), 16),
+                                           _mm_set1_epi32(100));
+        __m128i volChange = _mm_sub_epi32(_mm_srli_epi32(_mm_mullo_epi32(_mm_and_si128(u, mask16), volSteps), 16),
+                                          _mm_set1_epi32(5));
+#if defined(__AVX2__)
+        __m256d vol = _mm256_loadu_pd(from.volatility + i);
+        __m256d p = _mm256_loadu_pd(from.price + i);
+        __m256d changePercent = _mm256_mul_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(randChange), _mm256_set1_pd(1e-4)),
+                                              _mm256_add_pd(_mm256_set1_pd(1.0), vol));
+        p = _mm256_add_pd(p, _mm256_mul_pd(p, changePercent));
+        _mm256_storeu_pd(to.price + i, p);
+        vol = _mm256_add_pd(vol, _mm256_mul_pd(_mm256_cvtepi32_pd(volChange), _mm256_set1_pd(1e-3)));
+        vol = _mm256_min_pd(_mm256_max_pd(vol, _mm256_set1_pd(0.01)), _mm256_set1_pd(0.10));
+        _mm256_storeu_pd(to.volatility + i, vol);
+#else
+        // SSE4.1: same step as above, two doubles per register.
+        for (int half = 0; half < 2; ++half)
+        {
+            size_t j = i + 2 * half;
+            __m128i rc = half ? _mm_srli_si128(randChange, 8) : randChange;
+            __m128i vc = half ? _mm_srli_si128(volChange, 8) : volChange;
+            __m128d vol = _mm_loadu_pd(from.volatility + j);
+            __m128d p = _mm_loadu_pd(from.price + j);
+            __m128d changePercent = _mm_mul_pd(_mm_mul_pd(_mm_cvtepi32_pd(rc), _mm_set1_pd(1e-4)),
+                                               _mm_add_pd(_mm_set1_pd(1.0), vol));
+            p = _mm_add_pd(p, _mm_mul_pd(p, changePercent));
+            _mm_storeu_pd(to.price + j, p);
+            vol = _mm_add_pd(vol, _mm_mul_pd(_mm_cvtepi32_pd(vc), _mm_set1_pd(1e-3)));
+            vol = _mm_min_pd(_mm_max_pd(vol, _mm_set1_pd(0.01)), _mm_set1_pd(0.10));
+            _mm_storeu_pd(to.volatility + j, vol);
+        }
+#endif
+    }
+#endif
+    updatePricesScalar(from, to, i, end, key);
+}
+
+// Natural log of y in (0, 1], to float precision: the exponent from the bits, the mantissa
+// folded into [sqrt(1/2), sqrt(2)) and an atanh series. Branch-free so loops over it vectorize.
+inline float logUnit(float y)
+{
+    uint32_t bits;
+    memcpy(&bits, &y, sizeof(bits));
+    int32_t exponent = static_cast<int32_t>(bits >> 23) - 127;
+    bits = (bits & 0x7FFFFFU) | 0x3F800000U;
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+    bool high = m > 1.41421356f;
+    m = high ? m * 0.5f : m;
+    exponent += high;
+    float t = (m - 1.0f) / (m + 1.0f);
+    float t2 = t * t;
+    float series = 1.0f + t2 * (1.0f / 3 + t2 * (1.0f / 5 + t2 * (1.0f / 7 + t2 * (1.0f / 9))));
+    return static_cast<float>(exponent) * 0.693147181f + 2.0f * t * series;
+}
+
+// Standard normal variates for draws (key, first + j), j < count: the inverse normal CDF of
+// 24 bits of each draw, via Giles' single precision erfinv, so the tails stop at 5.3 sigma.
+// Both branches are computed and one selected, which lets the loop run 8 or 16 wide.
+inline void standardNormals(uint32_t key, uint32_t first, size_t count, float* out)
+{
+    for (size_t j = 0; j < count; ++j)
+    {
+        uint32_t u = symbolDraw(key, first + static_cast<uint32_t>(j));
+        float x = (static_cast<float>(static_cast<int32_t>(u) >> 8) + 0.5f) * (1.0f / 8388608.0f); // (-1, 1)
+        float w = -logUnit((1.0f - x) * (1.0f + x));
+        float c = w - 2.5f;
+        float central = 2.81022636e-08f;
+        central = 3.43273939e-07f + central * c;
+        central = -3.5233877e-06f + central * c;
+        central = -4.39150654e-06f + central * c;
+        central = 0.00021858087f + central * c;
+        central = -0.00125372503f + central * c;
+        central = -0.00417768164f + central * c;
+        central = 0.246640727f + central * c;
+        central = 1.50140941f + central * c;
+        float s = sqrtf(w) - 3.0f;
+        float tail = -0.000200214257f;
+        tail = 0.000100950558f + tail * s;
+        tail = 0.00134934322f + tail * s;
+        tail = -0.00367342844f + tail * s;
+        tail = 0.00573950773f + tail * s;
+        tail = -0.0076224613f + tail * s;
+        tail = 0.00943887047f + tail * s;
+        tail = 1.00167406f + tail * s;
+        tail = 2.83297682f + tail * s;
+        out[j] = 1.41421356f * x * (w < 5.0f ? central : tail);
+    }
+}
+
+// exp(x) for the small log returns of one tick (|x| < 0.05), within 1e-9 relative.
+inline double expSmall(double x)
+{
+    return 1.0 + x * (1.0 + x * (0.5 + x * (1.0 / 6 + x * (1.0 / 24 + x * (1.0 / 120)))));
+}
+
+// Per-tick standard deviation of the uniform model's step at zero volatility, so switching
+// models keeps prices moving about as much.
+constexpr double factorStepStd = 0.0058;
+
+// Correlated price model: each symbol's shock is its loadings on a few common factors (market,
+// sectors, styles) plus its own noise, scaled to unit variance, and moves the price as a
+// geometric Brownian motion step. The factor correlation's Cholesky factor is folded into the
+// loadings when the model is built, so a tick needs only independent normals and one
+// symbols x factors product.
+class FactorModel {
+private:
+    uint32_t factors = 0;
+    size_t symbols = 0;
+    AlignedVector<float> loadings;      // Column-major: factor k of symbol i at k * symbols + i
+    AlignedVector<float> idiosyncratic; // Weight of each symbol's own noise
+
+public:
+    static constexpr uint32_t maxFactors = 256;
+    static constexpr size_t block = 256; // Symbols per pass, so the shocks stay in L1
+
+    // rawLoadings holds `factors` loadings per symbol, symbol after symbol. correlation is
+    // empty for independent factors, else the factors x factors correlation (or covariance)
+    // matrix, row by row. A symbol whose factor variance exceeds 1 is scaled down to exactly 1
+    // and gets no noise of its own. Returns an error message, or an empty string on success.
+    string build(size_t symbolCount, uint32_t factorCount, const vector<double>& rawLoadings,
+                 const vector<double>& correlation = {})
+    {
+        if (factorCount == 0 || factorCount > maxFactors)
+        {
+            return "the number of factors must be between 1 and " + to_string(maxFactors);
+        }
+        if (rawLoadings.size() != symbolCount * factorCount)
+        {
+            return "expected " + to_string(factorCount) + " loadings for each of " + to_string(symbolCount) +
+                   " symbols";
+        }
+        size_t k = factorCount;
+        vector<double> cholesky(k * k, 0.0); // Lower triangle, row by row
+        for (size_t r = 0; r < k; ++r)
+        {
+            cholesky[r * k + r] = 1.0;
+        }
+        if (!correlation.empty())
+        {
+            if (correlation.size() != k * k)
+            {
+                return "the correlation matrix must be " + to_string(k) + " x " + to_string(k);
+            }
+            for (size_t r = 0; r < k; ++r)
+            {
+                for (size_t c = 0; c <= r; ++c)
+                {
+                    double sum = correlation[r * k + c];
+                    for (size_t j = 0; j < c; ++j)
+                    {
+                        sum -= cholesky[r * k + j] * cholesky[c * k + j];
+                    }
+                    if (r == c && sum <= 0.0)
+                    {
+                        return "the correlation matrix is not positive definite";
+                    }
+                    cholesky[r * k + c] = r == c ? sqrt(sum) : sum / cholesky[c * k + c];
+                }
+            }
+        }
+        factors = factorCount;
+        symbols = symbolCount;
+        loadings.assign(k * symbols, 0.0f);
+        idiosyncratic.assign(symbols, 1.0f);
+        vector<double> effective(k);
+        for (size_t i = 0; i < symbols; ++i)
+        {
+            // Loadings on independent factors: L^T b, with variance b^T C b = |L^T b|^2.
+            const double* b = rawLoadings.data() + i * k;
+            double variance = 0.0;
+            for (size_t c = 0; c < k; ++c)
+            {
+                double sum = 0.0;
+                for (size_t r = c; r < k; ++r)
+                {
+                    sum += b[r] * cholesky[r * k + c];
+                }
+                effective[c] = sum;
+                variance += sum * sum;
+            }
+            double scale = variance > 1.0 ? 1.0 / sqrt(variance) : 1.0;
+            for (size_t c = 0; c < k; ++c)
+            {
+                loadings[c * symbols + i] = static_cast<float>(effective[c] * scale);
+            }
+            idiosyncratic[i] = static_cast<float>(sqrt(max(0.0, 1.0 - variance * scale * scale)));
+        }
+        return "";
+    }
+
+    uint32_t getFactors() const
+    {
+        return factors;
+    }
+
+    // Symbols the model covers; later ones move on their own noise alone.
+    size_t size() const
+    {
+        return symbols;
+    }
+
+    // Correlation the model implies between two symbols' shocks.
+    double correlation(uint32_t a, uint32_t b) const
+    {
+        if (a == b)
+        {
+            return 1.0;
+        }
+        if (a >= symbols || b >= symbols)
+        {
+            return 0.0;
+        }
+        double sum = 0.0;
+        for (size_t k = 0; k < factors; ++k)
+        {
+            sum += static_cast<double>(loadings[k * symbols + a]) * loadings[k * symbols + b];
+        }
+        return sum;
+    }
+
+    // This tick's factor shocks, shared by every shard; out holds getFactors() floats.
+    void drawFactors(uint32_t key, float* out) const
+    {
+        standardNormals(mixBits(key ^ 0x46414354U), 0, factors, out);
+    }
+
+    // One step for symbols [begin, end), as updatePrices but with correlated moves. The
+    // volatility jitter takes the same draw as the uniform model. Each block of symbols gets
+    // its noise, then accumulates one loadings column per factor, then steps its prices.
+    void step(const PriceColumns& from, const PriceColumns& to, size_t begin, size_t end, uint32_t key,
+              const float* factorShocks) const
+    {
+        alignas(64) float shock[block];
+        uint32_t noiseKey = mixBits(key ^ 0x4E4F4953U);
+        for (size_t first = begin; first < end; first += block)
+        {
+            size_t count = min(block, end - first);
+            standardNormals(noiseKey, static_cast<uint32_t>(first), count, shock);
+            size_t covered = first < symbols ? min(count, symbols - first) : 0;
+            const float* weights = idiosyncratic.data() + first;
+            for (size_t j = 0; j < covered; ++j)
+            {
+                shock[j] *= weights[j];
+            }
+            for (size_t k = 0; k < factors && covered; ++k)
+            {
+                const float* column = loadings.data() + k * symbols + first;
+                float f = factorShocks[k];
+                for (size_t j = 0; j < covered; ++j)
+                {
+                    shock[j] += column[j] * f;
+                }
+            }
+            for (size_t j = 0; j < count; ++j)
+            {
+                size_t i = first + j;
+                uint32_t u = symbolDraw(key, static_cast<uint32_t>(i));
+                int volChange = static_cast<int>(((u & 0xFFFFU) * 11U) >> 16) - 5;
+                double vol = from.volatility[i];
+                double sigma = factorStepStd * (1.0 + vol);
+                to.price[i] = from.price[i] * expSmall(sigma * shock[j] - 0.5 * sigma * sigma);
+                vol += volChange * 1e-3;
+                vol = vol < 0.01 ? 0.01 : vol;
+                vol = vol > 0.10 ? 0.10 : vol;
+                to.volatility[i] = vol;
+            }
+        }
+    }
+};
+
+inline int countTrailingZeros(uint64_t x)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+inline int countLeadingZeros(uint64_t x)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return 63 - static_cast<int>(index);
+#else
+    return __builtin_clzll(x);
+#endif
+}
+
+// Hot-path instrumentation: latency histograms and event counters. Build with
+// STOCK_INSTRUMENTATION=0 to compile every probe out.
+//
+// Each thread records into its own shard, so a probe is a couple of plain loads and stores with
+// no locked instruction; shards are pushed once onto a lock-free list and readers merge them by
+// walking it. Timestamps are raw TSC reads on x86 (steady_clock elsewhere), converted to
+// nanoseconds only when a report is built.
+#ifndef STOCK_INSTRUMENTATION
+#define STOCK_INSTRUMENTATION 1
+#endif
+
+enum class Metric : uint8_t
+{
+    TickDuration,   // Tick pass plus tick listeners
+    OrderExecution, // One order through the matching engine
+    FrameRender,    // One live-board frame
+    BoardStaleness, // Age of the tick a live-board frame shows
+    LockWait,       // Time blocked on a contended lock
+};
+constexpr size_t metricCount = 5;
+constexpr array<const char*, metricCount> metricNames = {"tick", "order exec 1/8", "frame render",
+                                                         "board staleness", "lock wait"};
+// Orders take well under a microsecond, so only one in this many is timed; a probe costs a
+// couple of TSC reads and would otherwise be a visible share of the order itself.
+constexpr array<uint32_t, metricCount> metricSampleEvery = {1, 8, 1, 1, 1};
+
+enum class Counter : uint8_t
+{
+    LockContended,   // Lock acquisitions that had to wait
+    SnapshotRetries, // Snapshot reads redone because the tick thread lapped them
+    TickOverruns,    // Ticks that ended after the next deadline
+    TicksSkipped,    // Deadlines dropped under OverrunPolicy::Skip
+};
+constexpr size_t counterCount = 4;
+constexpr array<const char*, counterCount> counterNames = {"contended locks", "snapshot retries", "tick overruns",
+                                                           "ticks skipped"};
+
+// HDR-style log-linear buckets: exact below 8, then eight buckets per power of two, so any
+// value is reported within 12.5%.
+constexpr int histogramSubBits = 3;
+constexpr size_t histogramBuckets = (64 - histogramSubBits + 1) << histogramSubBits;
+
+inline size_t histogramBucket(uint64_t value)
+{
+    if (value < (1u << histogramSubBits))
+    {
+        return static_cast<size_t>(value);
+    }
+    int shift = 63 - countLeadingZeros(value) - histogramSubBits;
+    return (static_cast<size_t>(shift + 1) << histogramSubBits) + ((value >> shift) & ((1u << histogramSubBits) - 1));
+}
+
+// Largest value that falls in a bucket.
+inline uint64_t histogramBucketTop(size_t bucket)
+{
+    if (bucket < (1u << histogramSubBits))
+    {
+        return bucket;
+    }
+    int shift = static_cast<int>(bucket >> histogramSubBits) - 1;
+    uint64_t low = ((1ull << histogramSubBits) + (bucket & ((1u << histogramSubBits) - 1))) << shift;
+    return low + ((1ull << shift) - 1);
+}
+
+// Merged view of one metric, in raw timestamp units.
+struct LatencyHistogram
+{
+    array<uint64_t, histogramBuckets> buckets{};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+    void add(uint64_t value)
+    {
+        ++buckets[histogramBucket(value)];
+        ++count;
+        sum += value;
+        max = std::max(max, value);
+    }
+
+    // Value at or below which a fraction p of the samples fall (bucket top, capped at max).
+    uint64_t percentile(double p) const
+    {
+        uint64_t rank = static_cast<uint64_t>(ceil(p * count));
+        uint64_t seen = 0;
+        for (size_t b = 0; b < histogramBuckets; ++b)
+        {
+            seen += buckets[b];
+            if (seen >= std::max<uint64_t>(rank, 1))
+            {
+                return min(histogramBucketTop(b), max);
+            }
+        }
+        return max;
+    }
+};
+
+struct InstrumentReport
+{
+    array<LatencyHistogram, metricCount> histograms;
+    array<uint64_t, counterCount> counters{};
+    double nanosecondsPerUnit = 1.0;
+    bool enabled = STOCK_INSTRUMENTATION != 0;
+};
+
+#if STOCK_INSTRUMENTATION
+inline uint64_t instrumentNow()
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+// Written only by its owning thread; read by anyone merging.
+struct InstrumentShard
+{
+    array<array<atomic<uint64_t>, histogramBuckets>, metricCount> buckets;
+    array<atomic<uint64_t>, metricCount> counts;
+    array<atomic<uint64_t>, metricCount> sums;
+    array<atomic<uint64_t>, metricCount> maxima;
+    array<atomic<uint64_t>, counterCount> counters;
+    InstrumentShard* next = nullptr;
+};
+
+// Shards outlive their threads, so counts from finished threads stay in the totals.
+inline atomic<InstrumentShard*> instrumentShards{nullptr};
+inline thread_local InstrumentShard* localInstrumentShard = nullptr;
+inline thread_local uint32_t instrumentSampleCounter = 0;
+// Timestamp and clock at startup, to scale TSC units to nanoseconds.
+inline const uint64_t instrumentOriginUnits = instrumentNow();
+inline const chrono::steady_clock::time_point instrumentOriginTime = chrono::steady_clock::now();
+
+inline InstrumentShard& instrumentShard()
+{
+    if (!localInstrumentShard)
+    {
+        InstrumentShard* shard = new InstrumentShard(); // Value-initialised: all zero
+        shard->next = instrumentShards.load(memory_order_relaxed);
+        while (!instrumentShards.compare_exchange_weak(shard->next, shard, memory_order_release, memory_order_relaxed))
+        {
+        }
+        localInstrumentShard = shard;
+    }
+    return *localInstrumentShard;
+}
+
+// Single-writer increment: no read-modify-write needed.
+inline void bumpInstrument(atomic<uint64_t>& cell, uint64_t amount)
+{
+    cell.store(cell.load(memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+inline void recordLatency(Metric metric, uint64_t units)
+{
+    InstrumentShard& shard = instrumentShard();
+    size_t m = static_cast<size_t>(metric);
+    bumpInstrument(shard.buckets[m][histogramBucket(units)], 1);
+    bumpInstrument(shard.counts[m], 1);
+    bumpInstrument(shard.sums[m], units);
+    if (units > shard.maxima[m].load(memory_order_relaxed))
+    {
+        shard.maxima[m].store(units, memory_order_relaxed);
+    }
+}
+
+inline void countEvent(Counter counter, uint64_t amount = 1)
+{
+    bumpInstrument(instrumentShard().counters[static_cast<size_t>(counter)], amount);
+}
+
+inline InstrumentReport collectInstruments()
+{
+    InstrumentReport report;
+    for (InstrumentShard* shard = instrumentShards.load(memory_order_acquire); shard; shard = shard->next)
+    {
+        for (size_t m = 0; m < metricCount; ++m)
+        {
+            LatencyHistogram& histogram = report.histograms[m];
+            for (size_t b = 0; b < histogramBuckets; ++b)
+            {
+                histogram.buckets[b] += shard->buckets[m][b].load(memory_order_relaxed);
+            }
+            histogram.count += shard->counts[m].load(memory_order_relaxed);
+            histogram.sum += shard->sums[m].load(memory_order_relaxed);
+            histogram.max = max(histogram.max, shard->maxima[m].load(memory_order_relaxed));
+        }
+        for (size_t c = 0; c < counterCount; ++c)
+        {
+            report.counters[c] += shard->counters[c].load(memory_order_relaxed);
+        }
+    }
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    // TSC rate measured over the life of the process; a few milliseconds are enough.
+    auto minimum = instrumentOriginTime + chrono::milliseconds(20);
+    this_thread::sleep_until(minimum);
+    double elapsedNs = chrono::duration<double, nano>(chrono::steady_clock::now() - instrumentOriginTime).count();
+    report.nanosecondsPerUnit = elapsedNs / static_cast<double>(instrumentNow() - instrumentOriginUnits);
+#endif
+    return report;
+}
+#else
+inline uint64_t instrumentNow() { return 0; }
+inline void recordLatency(Metric, uint64_t) {}
+inline void countEvent(Counter, uint64_t = 1) {}
+inline InstrumentReport collectInstruments() { return {}; }
+#endif
+
+// Records the lifetime of the scope under a metric (or one scope in metricSampleEvery).
+class ScopedLatency {
+private:
+#if STOCK_INSTRUMENTATION
+    Metric metric;
+    uint64_t start = 0; // 0 when this scope is not sampled
+#endif
+
+public:
+#if STOCK_INSTRUMENTATION
+    explicit ScopedLatency(Metric metric) : metric(metric)
+    {
+        uint32_t every = metricSampleEvery[static_cast<size_t>(metric)];
+        if (every == 1 || ++instrumentSampleCounter % every == 0)
+        {
+            start = instrumentNow();
+        }
+    }
+    ~ScopedLatency()
+    {
+        if (start)
+        {
+            recordLatency(metric, instrumentNow() - start);
+        }
+    }
+#else
+    explicit ScopedLatency(Metric) {}
+#endif
+    ScopedLatency(const ScopedLatency&) = delete;
+    ScopedLatency& operator=(const ScopedLatency&) = delete;
+};
+
+// lock_guard that counts the acquisitions which found the mutex held and times how long they
+// blocked. An uncontended acquisition costs the same as lock().
+class CountingLockGuard {
+private:
+    mutex& held;
+
+public:
+    explicit CountingLockGuard(mutex& m) : held(m)
+    {
+#if STOCK_INSTRUMENTATION
+        if (held.try_lock())
+        {
+            return;
+        }
+        uint64_t start = instrumentNow();
+        held.lock();
+        recordLatency(Metric::LockWait, instrumentNow() - start);
+        countEvent(Counter::LockContended);
+#else
+        held.lock();
+#endif
+    }
+    ~CountingLockGuard() { held.unlock(); }
+    CountingLockGuard(const CountingLockGuard&) = delete;
+    CountingLockGuard& operator=(const CountingLockGuard&) = delete;
+};
+
+inline string formatDuration(double nanoseconds)
+{
+    char text[32];
+    if (nanoseconds < 1e3)
+    {
+        snprintf(text, sizeof(text), "%.0f ns", nanoseconds);
+    }
+    else if (nanoseconds < 1e6)
+    {
+        snprintf(text, sizeof(text), "%.1f us", nanoseconds / 1e3);
+    }
+    else if (nanoseconds < 1e9)
+    {
+        snprintf(text, sizeof(text), "%.2f ms", nanoseconds / 1e6);
+    }
+    else
+    {
+        snprintf(text, sizeof(text), "%.2f s", nanoseconds / 1e9);
+    }
+    return text;
+}
+
+// Plain-text table for the Stats screen and the periodic dump.
+inline string formatInstruments(const InstrumentReport& report)
+{
+    if (!report.enabled)
+    {
+        return "Instrumentation is compiled out (STOCK_INSTRUMENTATION=0).\n";
+    }
+    ostringstream out;
+    out << left << setw(18) << "Metric" << right << setw(10) << "count" << setw(11) << "mean" << setw(11) << "p50"
+        << setw(11) << "p90" << setw(11) << "p99" << setw(11) << "p99.9" << setw(11) << "max" << '\n';
+    for (size_t m = 0; m < metricCount; ++m)
+    {
+        const LatencyHistogram& histogram = report.histograms[m];
+        auto ns = [&](double units) { return formatDuration(units * report.nanosecondsPerUnit); };
+        out << left << setw(18) << metricNames[m] << right << setw(10) << histogram.count;
+        if (histogram.count)
+        {
+            out << setw(11) << ns(static_cast<double>(histogram.sum) / histogram.count) << setw(11)
+                << ns(histogram.percentile(0.50)) << setw(11) << ns(histogram.percentile(0.90)) << setw(11)
+                << ns(histogram.percentile(0.99)) << setw(11) << ns(histogram.percentile(0.999)) << setw(11)
+                << ns(histogram.max);
+        }
+        out << '\n';
+    }
+    for (size_t c = 0; c < counterCount; ++c)
+    {
+        out << left << setw(18) << counterNames[c] << right << setw(10) << report.counters[c] << '\n';
+    }
+    return out.str();
+}
+
+// Rewrites a file with the current instrumentation table every period, replacing it atomically
+// so a reader never sees half a table.
+class StatsDumper {
+private:
+    thread worker;
+    mutex lock;
+    condition_variable wake;
+    bool stopping = false;
+
+public:
+    void start(const string& path, chrono::milliseconds period)
+    {
+        stop();
+        stopping = false;
+        worker = thread([this, path, period]
+        {
+            unique_lock<mutex> guard(lock);
+            while (!wake.wait_for(guard, period, [this] { return stopping; }))
+            {
+                guard.unlock();
+                string temporary = path + ".tmp";
+                {
+                    ofstream out(temporary, ios::trunc);
+                    time_t now = time(0);
+                    out << "# " << put_time(localtime(&now), "%Y-%m-%d %H:%M:%S") << '\n'
+                        << formatInstruments(collectInstruments());
+                }
+                error_code error;
+                filesystem::rename(temporary, path, error);
+                guard.lock();
+            }
+        });
+    }
+    void stop()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (worker.joinable())
+        {
+            worker.join();
+        }
+    }
+    ~StatsDumper() { stop(); }
+};
+
+// Fixed pool of tick workers. A job over [0, count) is cut into shards of consecutive ids, the
+// shards are dealt out evenly as one range per worker, and a worker that finishes its own range
+// steals shards from the back of the others' ranges. The calling thread works as worker 0.
+class TickWorkerPool {
+private:
+    // Remaining shards of one worker packed as (end << 32 | next), so the owner popping the
+    // front and thieves popping the back never hand out the same shard.
+    struct alignas(64) ShardQueue
+    {
+        atomic<uint64_t> range{0};
+    };
+
+    unsigned threadCount;
+    size_t defaultShardSize;
+    size_t shardSize;
+    size_t itemCount = 0;
+    unique_ptr<ShardQueue[]> queues;
+    vector<thread> workers;
+    mutex mtx;
+    condition_variable startCv;
+    condition_variable doneCv;
+    uint64_t generation = 0;
+    unsigned busyWorkers = 0;
+    bool stopping = false;
+    void (*job)(void*, size_t, size_t) = nullptr;
+    void* jobContext = nullptr;
+
+    static uint64_t packRange(uint64_t next, uint64_t end)
+    {
+        return (end << 32) | next;
+    }
+
+    static bool popFront(ShardQueue& queue, size_t& shard)
+    {
+        uint64_t range = queue.range.load(memory_order_relaxed);
+        while (static_cast<uint32_t>(range) < (range >> 32))
+        {
+            if (queue.range.compare_exchange_weak(range, range + 1, memory_order_acq_rel))
+            {
+                shard = static_cast<uint32_t>(range);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool popBack(ShardQueue& queue, size_t& shard)
+    {
+        uint64_t range = queue.range.load(memory_order_relaxed);
+        while (static_cast<uint32_t>(range) < (range >> 32))
+        {
+            uint64_t end = (range >> 32) - 1;
+            if (queue.range.compare_exchange_weak(range, packRange(static_cast<uint32_t>(range), end),
+                                                  memory_order_acq_rel))
+            {
+                shard = end;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void runShard(size_t shard)
+    {
+        size_t begin = shard * shardSize;
+        job(jobContext, begin, min(itemCount, begin + shardSize));
+    }
+
+    void drain(unsigned self)
+    {
+        size_t shard;
+        while (popFront(queues[self], shard))
+        {
+            runShard(shard);
+        }
+        for (unsigned k = 1; k < threadCount; ++k)
+        {
+            ShardQueue& victim = queues[(self + k) % threadCount];
+            while (popBack(victim, shard))
+            {
+                runShard(shard);
+            }
+        }
+    }
+
+    void workLoop(unsigned self)
+    {
+        uint64_t seen = 0;
+        while (true)
+        {
+            {
+                unique_lock<mutex> lock(mtx);
+                startCv.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping)
+                {
+                    return;
+                }
+                seen = generation;
+            }
+            drain(self);
+            lock_guard<mutex> lock(mtx);
+            if (--busyWorkers == 0)
+            {
+                doneCv.notify_one();
+            }
+        }
+    }
+
+public:
+    explicit TickWorkerPool(unsigned threads = thread::hardware_concurrency(), size_t shardSize = 16384)
+        : threadCount(max(1U, threads)), defaultShardSize(max<size_t>(1, shardSize)),
+          shardSize(defaultShardSize),
+          queues(new ShardQueue[max(1U, threads)])
+    {
+        for (unsigned w = 1; w < threadCount; ++w)
+        {
+            workers.emplace_back(&TickWorkerPool::workLoop, this, w);
+        }
+    }
+
+    ~TickWorkerPool()
+    {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopping = true;
+        }
+        startCv.notify_all();
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    TickWorkerPool(const TickWorkerPool&) = delete;
+    TickWorkerPool& operator=(const TickWorkerPool&) = delete;
+
+    unsigned getThreadCount() const
+    {
+        return threadCount;
+    }
+
+    // Calls fn(begin, end) over disjoint shards covering [0, count) and returns when all are done.
+    template <typename Fn>
+    void run(size_t count, Fn&& fn)
+    {
+        run(count, defaultShardSize, forward<Fn>(fn));
+    }
+
+    // Same, with shards of `grain` items instead of the pool's default.
+    template <typename Fn>
+    void run(size_t count, size_t grain, Fn&& fn)
+    {
+        shardSize = max<size_t>(1, grain);
+        if (threadCount == 1 || count <= shardSize)
+        {
+            fn(size_t(0), count);
+            return;
+        }
+        using FnType = remove_reference_t<Fn>;
+        job = [](void* context, size_t begin, size_t end) { (*static_cast<FnType*>(context))(begin, end); };
+        jobContext = &fn;
+        itemCount = count;
+        size_t shards = (count + shardSize - 1) / shardSize;
+        for (unsigned w = 0; w < threadCount; ++w)
+        {
+            queues[w].range.store(packRange(shards * w / threadCount, shards * (w + 1) / threadCount),
+                                  memory_order_relaxed);
+        }
+        {
+            lock_guard<mutex> lock(mtx);
+            busyWorkers = threadCount - 1;
+            ++generation;
+        }
+        startCv.notify_all();
+        drain(0);
+        unique_lock<mutex> lock(mtx);
+        doneCv.wait(lock, [&] { return busyWorkers == 0; });
+    }
+};
+
+// Highest rate the tick scheduler accepts.
+constexpr double maxTicksPerSecond = 10000.0;
+
+// What the scheduler does when a tick ends after the next deadline.
+enum class OverrunPolicy : uint8_t
+{
+    CatchUp, // Run the missed ticks back to back: simulated time stays in step with the clock
+    Skip,    // Drop the missed deadlines and resume on the next one still ahead
+};
+
+// Fires ticks against absolute deadlines (start + n * period) rather than sleeping a fixed time
+// after each pass, so the cost of a tick never shifts the ones after it. On Linux it sleeps with
+// clock_nanosleep(TIMER_ABSTIME) and a 1us timer slack, which holds 10 kHz to a few
+// microseconds of lateness.
+class TickScheduler {
+private:
+    chrono::nanoseconds period{chrono::seconds(1)};
+    OverrunPolicy policy = OverrunPolicy::CatchUp;
+    atomic<uint64_t> ticks{0};
+    atomic<uint64_t> overruns{0};       // Ticks that ended after the next deadline
+    atomic<uint64_t> skipped{0};        // Deadlines dropped under OverrunPolicy::Skip
+    atomic<uint64_t> totalLatenessNs{0};
+    atomic<uint64_t> maxLatenessNs{0};  // Worst start of a tick after its deadline
+
+    // Sleeps in slices of at most 50 ms so stop() never waits out a long period.
+    static void sleepUntil(chrono::steady_clock::time_point deadline, const atomic<bool>& running)
+    {
+        while (running.load(memory_order_relaxed))
+        {
+            auto now = chrono::steady_clock::now();
+            if (now >= deadline)
+            {
+                return;
+            }
+            auto wake = min(deadline, now + chrono::milliseconds(50));
+#if defined(__linux__)
+            // steady_clock is CLOCK_MONOTONIC on Linux, so its epoch can be handed to the kernel.
+            auto sinceEpoch = chrono::duration_cast<chrono::nanoseconds>(wake.time_since_epoch()).count();
+            timespec target{static_cast<time_t>(sinceEpoch / 1000000000), static_cast<long>(sinceEpoch % 1000000000)};
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &target, nullptr);
+#else
+            this_thread::sleep_until(wake);
+#endif
+        }
+    }
+
+public:
+    struct Stats
+    {
+        uint64_t ticks;
+        uint64_t overruns;
+        uint64_t skipped;
+        double meanLatenessUs;
+        double maxLatenessUs;
+    };
+
+    // Accepts rates in (0, maxTicksPerSecond]; returns false and keeps the old rate otherwise.
+    bool setRate(double ticksPerSecond, OverrunPolicy overrunPolicy)
+    {
+        if (!(ticksPerSecond > 0.0 && ticksPerSecond <= maxTicksPerSecond))
+        {
+            return false;
+        }
+        period = chrono::nanoseconds(llround(1e9 / ticksPerSecond));
+        policy = overrunPolicy;
+        return true;
+    }
+
+    double getRate() const
+    {
+        return 1e9 / period.count();
+    }
+
+    // Calls tick() on every deadline until running turns false.
+    template <class Fn>
+    void run(const atomic<bool>& running, Fn&& tick)
+    {
+#if defined(__linux__)
+        if (period < chrono::milliseconds(10))
+        {
+            prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0); // Default 50us slack is half a 10 kHz period
+        }
+#endif
+        auto deadline = chrono::steady_clock::now() + period;
+        while (true)
+        {
+            sleepUntil(deadline, running);
+            if (!running.load(memory_order_relaxed))
+            {
+                return;
+            }
+            auto start = chrono::steady_clock::now();
+            uint64_t lateness = static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(start - deadline).count());
+            totalLatenessNs.fetch_add(lateness, memory_order_relaxed);
+            if (lateness > maxLatenessNs.load(memory_order_relaxed))
+            {
+                maxLatenessNs.store(lateness, memory_order_relaxed);
+            }
+            tick();
+            ticks.fetch_add(1, memory_order_relaxed);
+
+            auto next = deadline + period;
+            auto end = chrono::steady_clock::now();
+            if (end > next)
+            {
+                overruns.fetch_add(1, memory_order_relaxed);
+                countEvent(Counter::TickOverruns);
+                if (policy == OverrunPolicy::Skip)
+                {
+                    auto missed = (end - deadline) / period; // Deadlines already behind us
+                    next = deadline + (missed + 1) * period;
+                    skipped.fetch_add(static_cast<uint64_t>(missed), memory_order_relaxed);
+                    countEvent(Counter::TicksSkipped, static_cast<uint64_t>(missed));
+                }
+            }
+            deadline = next;
+        }
+    }
+
+    Stats getStats() const
+    {
+        uint64_t count = ticks.load(memory_order_relaxed);
+        return {count, overruns.load(memory_order_relaxed), skipped.load(memory_order_relaxed),
+                count ? totalLatenessNs.load(memory_order_relaxed) / 1e3 / count : 0.0,
+                maxLatenessNs.load(memory_order_relaxed) / 1e3};
+    }
+};
+
+// Ticks of price history kept per symbol; also the window the peak high/low cover.
+constexpr size_t priceHistorySize = 60;
+
+// Zero-copy, oldest-first view over one symbol's prices in PriceWindows.
+class RecentPrices {
+private:
+    const double* slots; // The symbol's price in slot s is slots[s * stride]
+    size_t slotCount;
+    size_t stride;
+    uint64_t first;
+    size_t count;
+
+public:
+    class iterator {
+    private:
+        const double* slots;
+        size_t slotCount;
+        size_t stride;
+        uint64_t sequence;
+
+    public:
+        using iterator_category = forward_iterator_tag;
+        using value_type = double;
+        using difference_type = ptrdiff_t;
+        using pointer = const double*;
+        using reference = double;
+
+        iterator(const double* slots, size_t slotCount, size_t stride, uint64_t sequence)
+            : slots(slots), slotCount(slotCount), stride(stride), sequence(sequence) {}
+        double operator*() const { return slots[sequence % slotCount * stride]; }
+        iterator& operator++()
+        {
+            ++sequence;
+            return *this;
+        }
+        bool operator==(const iterator& other) const { return sequence == other.sequence; }
+        bool operator!=(const iterator& other) const { return sequence != other.sequence; }
+    };
+
+    RecentPrices(const double* slots, size_t slotCount, size_t stride, uint64_t first, size_t count)
+        : slots(slots), slotCount(slotCount), stride(stride), first(first), count(count) {}
+    size_t size() const { return count; }
+    double operator[](size_t i) const { return slots[(first + i) % slotCount * stride]; }
+    iterator begin() const { return iterator(slots, slotCount, stride, first); }
+    iterator end() const { return iterator(slots, slotCount, stride, first + count); }
+};
+
+constexpr size_t roundUpPow2(size_t n)
+{
+    size_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+// The last Size prices of every symbol, addressed by a sequence number that advances by one per
+// push and stored at sequence % slotCount. There is at least one spare slot beyond the window,
+// and the next push only overwrites a spare, so a reader holding the previous sequence never sees
+// its window change. slotCount is a power of two to keep the index math to a mask.
+//
+// The prices are a row per slot, each with every symbol's price, so a push is a straight copy of
+// the tick's price column into one row, which is all a tick does here. A symbol's window is a
+// column across the rows; its high and low are worked out from it when read, not kept per tick.
+template <size_t Size>
+class PriceWindows {
+public:
+    static constexpr size_t slotCount = roundUpPow2(Size + 1);
+
+private:
+    AlignedVector<double> prices; // slotCount rows of `stride` prices
+    size_t count = 0;
+    size_t stride = 0; // Symbols a row has room for, a multiple of a cache line
+
+    const double* column(size_t id) const { return prices.data() + id; }
+
+    // Moves the rows apart to make room for `symbols` in each. Setup only, like resize().
+    void widen(size_t symbols)
+    {
+        size_t wider = (symbols + 7) / 8 * 8;
+        AlignedVector<double> moved(slotCount * wider);
+        for (size_t slot = 0; slot < slotCount && count > 0; ++slot)
+        {
+            copy(prices.begin() + slot * stride, prices.begin() + slot * stride + count, moved.begin() + slot * wider);
+        }
+        prices.swap(moved);
+        stride = wider;
+    }
+
+public:
+    size_t size() const { return count; }
+    void reserve(size_t symbols)
+    {
+        if (symbols > stride)
+        {
+            widen(symbols);
+        }
+    }
+    // New symbols' windows must be reset before they are read.
+    void resize(size_t symbols)
+    {
+        if (symbols > stride)
+        {
+            widen(max(symbols, 2 * stride)); // Symbols added one at a time do not move the rows every time
+        }
+        count = symbols;
+    }
+    // Fills the symbol's whole window with one price.
+    void reset(size_t id, double price)
+    {
+        for (size_t slot = 0; slot < slotCount; ++slot)
+        {
+            prices[slot * stride + id] = price;
+        }
+    }
+
+    // Stores price[begin, end) at `sequence`, which must be one past the previous push.
+    void push(const double* price, size_t begin, size_t end, uint64_t sequence)
+    {
+        copy(price + begin, price + end, prices.data() + sequence % slotCount * stride + begin);
+    }
+
+    double at(size_t id, uint64_t sequence) const { return column(id)[sequence % slotCount * stride]; }
+    RecentPrices recent(size_t id, uint64_t newestSequence) const
+    {
+        return RecentPrices(column(id), slotCount, stride, newestSequence + 1 - Size, Size);
+    }
+    // High and low over the window ending at newestSequence.
+    pair<double, double> extremes(size_t id, uint64_t newestSequence) const
+    {
+        const double* slots = column(id);
+        double high = slots[newestSequence % slotCount * stride];
+        double low = high;
+        for (uint64_t sequence = newestSequence + 1 - Size; sequence < newestSequence; ++sequence)
+        {
+            double price = slots[sequence % slotCount * stride];
+            high = max(high, price);
+            low = min(low, price);
+        }
+        return {high, low};
+    }
+};
+
+// Everything a reader may want to know about one symbol at a given tick.
+struct StockQuote
+{
+    uint64_t tick;
+    double price;
+    double volatility;
+    double peakHigh;
+    double peakLow;
+};
+
+// Read-only view of one published tick. Only valid inside MarketState::readSnapshot.
+struct MarketSnapshot
+{
+    uint64_t tick;
+    size_t count;
+    const double* prices;
+    const double* volatilities;
+    const PriceWindows<priceHistorySize>* windows;
+
+    StockQuote quote(uint32_t id) const
+    {
+        auto [high, low] = windows->extremes(id, newestSequence());
+        return {tick, prices[id], volatilities[id], high, low};
+    }
+    // Window positions are tick + priceHistorySize, the initial history filling the ones before.
+    uint64_t newestSequence() const
+    {
+        return tick + priceHistorySize;
+    }
+    // age 0 is the current price, age priceHistorySize - 1 the oldest one kept.
+    double recentPrice(uint32_t id, size_t age) const
+    {
+        return windows->at(id, newestSequence() - age);
+    }
+    RecentPrices recentPrices(uint32_t id) const
+    {
+        return windows->recent(id, newestSequence());
+    }
+};
+
+// Columnar market state: every per-symbol field lives in its own contiguous array indexed by
+// a dense symbol id, so a tick is a straight pass over a handful of arrays.
+//
+// The columns are double-buffered. A single writer (the tick thread) reads the published
+// buffer and writes the next tick into the other one, then publishes it with one atomic
+// store. Each buffer carries a sequence number that is odd while it is being written, so
+// readers never take a lock: they read the published buffer and retry only if the writer
+// lapped them and started overwriting it.
+class MarketState {
+private:
+    struct MarketBuffer
+    {
+        atomic<uint64_t> sequence{0};
+        uint64_t tick = 0;
+        AlignedVector<double> prices;
+        AlignedVector<double> volatilities;
+
+        PriceColumns columns()
+        {
+            return {prices.data(), volatilities.data()};
+        }
+    };
+
+    // Views into text owned by whoever loaded the symbols; see keepAlive().
+    vector<string_view> fullNames;
+    vector<string_view> abbreviations;
+    vector<shared_ptr<const void>> textOwners;
+    MarketBuffer buffers[2];
+    atomic<unsigned> published{0};
+    // Written only by the tick thread; readers reach the prices through the snapshot and
+    // only at positions the next tick does not overwrite.
+    PriceWindows<priceHistorySize> windows;
+    shared_ptr<const FactorModel> factorModel; // Null for independent uniform steps
+    vector<float> factorShocks;
+    uint32_t seed;
+    uint64_t tickCount = 0;
+
+    MarketSnapshot makeSnapshot(const MarketBuffer& buffer) const
+    {
+        return {buffer.tick, buffer.prices.size(), buffer.prices.data(), buffer.volatilities.data(), &windows};
+    }
+
+    // Writes the next tick into the back buffer with step(source, target, begin, end), shard by
+    // shard, updates the windows and publishes it.
+    template <typename Step>
+    void advance(TickWorkerPool* pool, Step&& step)
+    {
+        unsigned front = published.load(memory_order_relaxed);
+        MarketBuffer& from = buffers[front];
+        MarketBuffer& to = buffers[front ^ 1];
+        uint64_t sequence = to.sequence.load(memory_order_relaxed);
+        to.sequence.store(sequence + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+
+        PriceColumns source = from.columns();
+        PriceColumns target = to.columns();
+        uint64_t position = tickCount + 1 + priceHistorySize;
+        auto updateShard = [&](size_t begin, size_t end)
+        {
+            step(source, target, begin, end);
+            windows.push(target.price, begin, end, position);
+        };
+        if (pool)
+        {
+            pool->run(fullNames.size(), updateShard);
+        }
+        else
+        {
+            updateShard(0, fullNames.size());
+        }
+
+        to.tick = ++tickCount;
+        to.sequence.store(sequence + 2, memory_order_release);
+        published.store(front ^ 1, memory_order_release);
+    }
+
+public:
+    explicit MarketState(uint32_t seed = 0) : seed(seed) {}
+
+    // Setup only: the price path is a pure function of the seed and the starting prices.
+    void setSeed(uint32_t value)
+    {
+        seed = value;
+    }
+
+    uint32_t getSeed() const
+    {
+        return seed;
+    }
+
+    // Setup only: must not run concurrently with tick() or readers. The name and abbreviation
+    // are kept as views, so their text must live as long as the state (see keepAlive()).
+    uint32_t addSymbol(string_view fullName, string_view abbreviation, double price, double volatility = 0.05)
+    {
+        fullNames.push_back(fullName);
+        abbreviations.push_back(abbreviation);
+        for (auto& buffer : buffers)
+        {
+            buffer.prices.push_back(price);
+            buffer.volatilities.push_back(volatility);
+        }
+        windows.resize(fullNames.size());
+        windows.reset(fullNames.size() - 1, price);
+        return static_cast<uint32_t>(fullNames.size() - 1);
+    }
+
+    void reserve(size_t count)
+    {
+        fullNames.reserve(count);
+        abbreviations.reserve(count);
+        for (auto& buffer : buffers)
+        {
+            buffer.prices.reserve(count);
+            buffer.volatilities.reserve(count);
+        }
+        windows.reserve(count);
+    }
+
+    // Setup only. Adds `count` symbols at once, filling the columns and history windows in
+    // parallel. Returns the id of the first one.
+    uint32_t addSymbols(const string_view* names, const string_view* abbrs, const double* prices, size_t count,
+                        TickWorkerPool& pool, double volatility = 0.05)
+    {
+        size_t first = fullNames.size();
+        size_t total = first + count;
+        fullNames.insert(fullNames.end(), names, names + count);
+        abbreviations.insert(abbreviations.end(), abbrs, abbrs + count);
+        for (auto& buffer : buffers)
+        {
+            buffer.prices.insert(buffer.prices.end(), prices, prices + count);
+            buffer.volatilities.resize(total, volatility);
+        }
+        windows.resize(total);
+        pool.run(count, [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                windows.reset(first + i, prices[i]);
+            }
+        });
+        return static_cast<uint32_t>(first);
+    }
+
+    // Setup only. Moves prices with the correlated model from the next tick on; null goes back
+    // to independent uniform steps.
+    void setFactorModel(shared_ptr<const FactorModel> model)
+    {
+        factorModel = move(model);
+        factorShocks.assign(factorModel ? factorModel->getFactors() : 0, 0.0f);
+    }
+
+    const FactorModel* getFactorModel() const
+    {
+        return factorModel.get();
+    }
+
+    // Holds on to the storage behind the name views passed to addSymbol(s).
+    void keepAlive(shared_ptr<const void> owner)
+    {
+        textOwners.push_back(move(owner));
+    }
+
+    // Advances every symbol by one step, pushes the new prices into the history windows and
+    // publishes the result. Only one thread may call this. Draws depend only on (seed, tick, id),
+    // so the result is the same however the symbols are sharded.
+    void tick(TickWorkerPool* pool = nullptr)
+    {
+        uint32_t key = tickKey(seed, tickCount);
+        const FactorModel* model = factorModel.get();
+        if (model)
+        {
+            model->drawFactors(key, factorShocks.data());
+        }
+        advance(pool, [&](const PriceColumns& source, const PriceColumns& target, size_t begin, size_t end)
+        {
+            if (model)
+            {
+                model->step(source, target, begin, end, key, factorShocks.data());
+            }
+            else
+            {
+                updatePrices(source, target, begin, end, key);
+            }
+        });
+    }
+
+    // Publishes recorded prices and volatilities (size() of each) as the next tick instead of
+    // stepping the model. Same threading rules as tick().
+    void publishTick(const double* prices, const double* volatilities, TickWorkerPool* pool = nullptr)
+    {
+        advance(pool, [&](const PriceColumns&, const PriceColumns& target, size_t begin, size_t end)
+        {
+            memcpy(target.price + begin, prices + begin, (end - begin) * sizeof(double));
+            memcpy(target.volatility + begin, volatilities + begin, (end - begin) * sizeof(double));
+        });
+    }
+
+    // Runs fn(const MarketSnapshot&) against the latest published tick without locking and
+    // returns its result. fn may be called more than once if the writer laps it, so it must
+    // only read the snapshot and build its result locally.
+    template <typename Fn>
+    auto readSnapshot(Fn&& fn) const
+    {
+        while (true)
+        {
+            const MarketBuffer& buffer = buffers[published.load(memory_order_acquire)];
+            uint64_t sequence = buffer.sequence.load(memory_order_acquire);
+            if (sequence & 1)
+            {
+                countEvent(Counter::SnapshotRetries);
+                this_thread::yield();
+                continue;
+            }
+            if constexpr (is_void_v<decltype(fn(declval<const MarketSnapshot&>()))>)
+            {
+                fn(makeSnapshot(buffer));
+                atomic_thread_fence(memory_order_acquire);
+                if (buffer.sequence.load(memory_order_relaxed) == sequence)
+                {
+                    return;
+                }
+                countEvent(Counter::SnapshotRetries);
+            }
+            else
+            {
+                auto result = fn(makeSnapshot(buffer));
+                atomic_thread_fence(memory_order_acquire);
+                if (buffer.sequence.load(memory_order_relaxed) == sequence)
+                {
+                    return result;
+                }
+                countEvent(Counter::SnapshotRetries);
+            }
+        }
+    }
+
+    size_t size() const { return fullNames.size(); }
+    uint64_t getTickCount() const { return readSnapshot([](const MarketSnapshot& snap) { return snap.tick; }); }
+    string_view getFullName(uint32_t id) const { return fullNames[id]; }
+    string_view getAbbreviation(uint32_t id) const { return abbreviations[id]; }
+    int getHistorySize() const { return static_cast<int>(priceHistorySize); }
+
+    StockQuote getQuote(uint32_t id) const
+    {
+        return readSnapshot([id](const MarketSnapshot& snap) { return snap.quote(id); });
+    }
+
+    // Copy of the window, oldest price first. Use MarketSnapshot::recentPrices inside
+    // readSnapshot to walk it without copying.
+    array<double, priceHistorySize> getRecentPrices(uint32_t id) const
+    {
+        return readSnapshot([id](const MarketSnapshot& snap)
+        {
+            array<double, priceHistorySize> recent;
+            copy(snap.recentPrices(id).begin(), snap.recentPrices(id).end(), recent.begin());
+            return recent;
+        });
+    }
+};
+
+// a / d rounded to the nearest integer, halves away from zero. d must be positive. Branch-free:
+// whether a price step rounds up is a coin flip the predictor would miss half the time.
+inline int64_t divideRound(int64_t a, int64_t d)
+{
+    int64_t quotient = a / d;
+    int64_t remainder = a % d;
+    int64_t sign = (remainder >> 63) | 1;
+    int64_t roundsAway = remainder * sign >= d - remainder * sign;
+    return quotient + roundsAway * sign;
+}
+
+// a * b / d rounded the same way. The product is taken to 128
+// bits so nothing overflows on the way; the division only needs them when it does not fit in
+// 64. d must be positive.
+inline int64_t mulDivRound(int64_t a, int64_t b, int64_t d)
+{
+    int64_t quotient;
+    int64_t remainder;
+#if defined(_MSC_VER)
+    int64_t high;
+    int64_t low = _mul128(a, b, &high);
+    if (high == (low >> 63))
+    {
+        return divideRound(low, d);
+    }
+    quotient = _div128(high, low, d, &remainder);
+#else
+    __int128 product = static_cast<__int128>(a) * b;
+    if (static_cast<int64_t>(product) == product)
+    {
+        return divideRound(static_cast<int64_t>(product), d);
+    }
+    quotient = static_cast<int64_t>(product / d);
+    remainder = static_cast<int64_t>(product % d);
+#endif
+    int64_t magnitude = remainder < 0 ? -remainder : remainder;
+    if (magnitude >= d - magnitude)
+    {
+        quotient += remainder < 0 ? -1 : 1;
+    }
+    return quotient;
+}
+
+constexpr int64_t decimalScale(int decimals)
+{
+    return decimals == 0 ? 1 : 10 * decimalScale(decimals - 1);
+}
+
+// Decimal fixed point: a whole number of 10^-Decimals units in an int64_t. Sums, differences
+// and multiples by a share count are exact, so cash does not drift however many trades go
+// through it. Products of two values and quotients round to the nearest unit, halves away
+// from zero. FixedDecimal<4> reaches about 922 trillion.
+template <int Decimals>
+class FixedDecimal {
+    static_assert(Decimals >= 0 && Decimals <= 18, "the units must fit an int64_t");
+
+private:
+    int64_t units = 0;
+
+    static constexpr double unitLimit = 9223372036854774784.0; // Largest double below 2^63
+    // Branch-free, so converting whole price columns still vectorizes.
+    static double clampScaled(double x)
+    {
+        x = x > -unitLimit ? x : -unitLimit;
+        return x < unitLimit ? x : unitLimit;
+    }
+
+public:
+    static constexpr int decimals = Decimals;
+    static constexpr int64_t scale = decimalScale(Decimals);
+
+    constexpr FixedDecimal() = default;
+    // The nearest value; exact for any double printed with at most Decimals decimals. Rounds
+    // inline rather than through llround, as every mark to market converts a price. Values out
+    // of range saturate (NaN to the lowest); check fits() first for input from outside.
+    explicit FixedDecimal(double value) : units(static_cast<int64_t>(clampScaled(value * scale) + copysign(0.5, value))) {}
+    template <class Int, enable_if_t<is_integral_v<Int>, int> = 0>
+    explicit constexpr FixedDecimal(Int whole) : units(static_cast<int64_t>(whole) * scale) {}
+
+    // Whether value is finite and within range.
+    static bool fits(double value)
+    {
+        return fabs(value * scale) < unitLimit; // False for NaN too
+    }
+
+    static constexpr FixedDecimal fromUnits(int64_t units)
+    {
+        FixedDecimal value;
+        value.units = units;
+        return value;
+    }
+    constexpr int64_t getUnits() const
+    {
+        return units;
+    }
+    double toDouble() const
+    {
+        return static_cast<double>(units) / scale;
+    }
+
+    constexpr FixedDecimal operator-() const
+    {
+        return fromUnits(-units);
+    }
+    constexpr FixedDecimal& operator+=(FixedDecimal other)
+    {
+        units += other.units;
+        return *this;
+    }
+    constexpr FixedDecimal& operator-=(FixedDecimal other)
+    {
+        units -= other.units;
+        return *this;
+    }
+    friend constexpr FixedDecimal operator+(FixedDecimal a, FixedDecimal b)
+    {
+        return fromUnits(a.units + b.units);
+    }
+    friend constexpr FixedDecimal operator-(FixedDecimal a, FixedDecimal b)
+    {
+        return fromUnits(a.units - b.units);
+    }
+    template <class Int, enable_if_t<is_integral_v<Int>, int> = 0>
+    friend constexpr FixedDecimal operator*(FixedDecimal a, Int n)
+    {
+        return fromUnits(a.units * static_cast<int64_t>(n));
+    }
+    template <class Int, enable_if_t<is_integral_v<Int>, int> = 0>
+    friend constexpr FixedDecimal operator*(Int n, FixedDecimal a)
+    {
+        return fromUnits(a.units * static_cast<int64_t>(n));
+    }
+    friend FixedDecimal operator*(FixedDecimal a, FixedDecimal b)
+    {
+        return fromUnits(mulDivRound(a.units, b.units, scale));
+    }
+    template <class Int, enable_if_t<is_integral_v<Int>, int> = 0>
+    friend FixedDecimal operator/(FixedDecimal a, Int n)
+    {
+        int64_t divisor = static_cast<int64_t>(n);
+        return fromUnits(divideRound(divisor < 0 ? -a.units : a.units, divisor < 0 ? -divisor : divisor));
+    }
+    friend constexpr bool operator==(FixedDecimal a, FixedDecimal b) { return a.units == b.units; }
+    friend constexpr bool operator!=(FixedDecimal a, FixedDecimal b) { return a.units != b.units; }
+    friend constexpr bool operator<(FixedDecimal a, FixedDecimal b) { return a.units < b.units; }
+    friend constexpr bool operator<=(FixedDecimal a, FixedDecimal b) { return a.units <= b.units; }
+    friend constexpr bool operator>(FixedDecimal a, FixedDecimal b) { return a.units > b.units; }
+    friend constexpr bool operator>=(FixedDecimal a, FixedDecimal b) { return a.units >= b.units; }
+
+    // With `fixed`, the exact decimal rounded to the stream's precision (so setprecision(2)
+    // prints cents and never 0.30000000000000004); otherwise as a double.
+    friend ostream& operator<<(ostream& out, FixedDecimal value)
+    {
+        if ((out.flags() & ios::floatfield) != ios::fixed)
+        {
+            return out << value.toDouble();
+        }
+        int digits = static_cast<int>(min<streamsize>(max<streamsize>(out.precision(), 0), 18));
+        int kept = min(digits, Decimals);
+        int64_t rounded = kept < Decimals ? divideRound(value.units, decimalScale(Decimals - kept)) : value.units;
+        uint64_t magnitude = rounded < 0 ? 0 - static_cast<uint64_t>(rounded) : static_cast<uint64_t>(rounded);
+        uint64_t keptScale = static_cast<uint64_t>(decimalScale(kept));
+        string text = rounded < 0 ? "-" : "";
+        text += to_string(magnitude / keptScale);
+        if (digits > 0)
+        {
+            text += '.';
+            if (kept > 0)
+            {
+                string fraction = to_string(magnitude % keptScale);
+                text.append(kept - fraction.size(), '0');
+                text += fraction;
+            }
+            text.append(digits - kept, '0');
+        }
+        return out << text;
+    }
+};
+
+// Prices and cash in the account code: exact to a hundredth of a cent.
+using Money = FixedDecimal<4>;
+
+// So code generic over the price type can hand any of them to the double APIs.
+inline double toDouble(double value)
+{
+    return value;
+}
+template <int Decimals>
+double toDouble(FixedDecimal<Decimals> value)
+{
+    return value.toDouble();
+}
+
+// Converts an amount typed in or read back from a recording. Returns false, leaving out as it
+// was, if the amount is not finite or Price cannot hold it.
+template <class Price>
+bool amountAs(double amount, Price& out)
+{
+    if constexpr (is_floating_point_v<Price>)
+    {
+        if (!isfinite(amount))
+        {
+            return false;
+        }
+    }
+    else if (!Price::fits(amount))
+    {
+        return false;
+    }
+    out = Price(amount);
+    return true;
+}
+
+// Lightweight view of one symbol in a MarketState, kept so the menu code can keep
+// working with Stock objects. Every getter reads the latest published tick; use
+// getQuote() when several fields must come from the same tick. Prices come back as Price,
+// double or a FixedDecimal; the market itself keeps them in double columns for the SIMD
+// kernels.
+template <class Price>
+class BasicStock {
+private:
+    const MarketState* state;
+    uint32_t id;
+
+public:
+    BasicStock(const MarketState* state = nullptr, uint32_t id = 0) : state(state), id(id) {}
+
+    uint32_t getId() const
+    {
+        return id;
+    }
+    StockQuote getQuote() const
+    {
+        return state->getQuote(id);
+    }
+    string getFullName() const
+    {
+         return string(state->getFullName(id));
+    }
+    string getAbbreviation() const
+    {
+        return string(state->getAbbreviation(id));
+    }
+    Price getPrice() const
+    {
+        return Price(getQuote().price);
+    }
+    double getVolatility() const
+    {
+        return getQuote().volatility;
+    }
+    Price getPeakHigh() const
+    {
+        return Price(getQuote().peakHigh);
+    }
+    Price getPeakLow() const
+    {
+        return Price(getQuote().peakLow);
+    }
+    array<Price, priceHistorySize> getRecentPrices() const
+    {
+        array<double, priceHistorySize> recent = state->getRecentPrices(id);
+        array<Price, priceHistorySize> prices;
+        transform(recent.begin(), recent.end(), prices.begin(), [](double price) { return Price(price); });
+        return prices;
+    }
+
+    // Public getter for historySize
+    int getHistorySize() const
+    {
+        return state->getHistorySize();
+    }
+};
+using Stock = BasicStock<Money>;
+
+inline uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// Hash of a short string, eight bytes at a time.
+inline uint64_t hashText(string_view text, uint64_t seed)
+{
+    uint64_t h = seed ^ (text.size() * 0x9E3779B97F4A7C15ULL);
+    size_t i = 0;
+    for (; i + 8 <= text.size(); i += 8)
+    {
+        uint64_t chunk;
+        memcpy(&chunk, text.data() + i, 8);
+        h = mix64(h ^ chunk);
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, text.data() + i, text.size() - i);
+    return mix64(h ^ tail);
+}
+
+// Maps a 32-bit hash onto [0, n) without a division.
+inline uint32_t reduceRange(uint32_t hash, uint32_t n)
+{
+    return static_cast<uint32_t>((static_cast<uint64_t>(hash) * n) >> 32);
+}
+
+// Interns abbreviations to dense ids through a minimal perfect hash, built once after the
+// universe is loaded (CHD-style hash and displace). Keys are split into buckets of about two;
+// every key has two hashes f1, f2 in [0, n), and each bucket stores a displacement (d0, d1)
+// that sends its keys to slot (f1 + d0 * f2 + d1) % n. Buckets are placed largest first, while
+// the table is still empty, so the search stays short; single-key buckets take a free slot
+// directly. A lookup is one hash, two array reads and one key compare.
+class SymbolTable {
+public:
+    static constexpr uint32_t none = UINT32_MAX;
+
+private:
+    struct Displacement
+    {
+        uint32_t d0;
+        uint32_t d1;
+    };
+
+    vector<string_view> keys;            // id -> abbreviation
+    vector<Displacement> displacements;  // bucket -> displacement
+    vector<uint32_t> slotIds;            // slot -> id
+    uint64_t seed = 0x5354414E44415244ULL;
+
+    uint32_t bucketOf(uint64_t hash) const
+    {
+        return reduceRange(static_cast<uint32_t>(hash >> 32), static_cast<uint32_t>(displacements.size()));
+    }
+    static uint32_t firstHash(uint64_t hash, uint32_t n)
+    {
+        return reduceRange(static_cast<uint32_t>(hash), n);
+    }
+    static uint32_t secondHash(uint64_t hash, uint32_t n)
+    {
+        return reduceRange(static_cast<uint32_t>(mix64(hash) >> 32), n);
+    }
+    static uint32_t slotOf(uint64_t f1, uint64_t f2, Displacement d, uint32_t n)
+    {
+        return static_cast<uint32_t>((f1 + d.d0 * f2 + d.d1) % n);
+    }
+
+    // One attempt with the current seed; false if some bucket could not be placed.
+    bool tryBuild(vector<size_t>& duplicates)
+    {
+        uint32_t n = static_cast<uint32_t>(keys.size());
+        // Bigger buckets save displacement memory but leave the last multi-key buckets
+        // searching an almost full table; two keys a bucket keeps that search short.
+        size_t bucketCount = max<size_t>(1, n / 2);
+        displacements.assign(bucketCount, {0, 0});
+        slotIds.assign(n, none);
+        vector<uint64_t> hashes(n);
+        vector<uint32_t> f1(n), f2(n);
+        vector<uint32_t> bucketStart(bucketCount + 1, 0);
+        for (uint32_t id = 0; id < n; ++id)
+        {
+            hashes[id] = hashText(keys[id], seed);
+            f1[id] = firstHash(hashes[id], n);
+            f2[id] = secondHash(hashes[id], n);
+            ++bucketStart[bucketOf(hashes[id]) + 1];
+        }
+        for (size_t b = 0; b < bucketCount; ++b)
+        {
+            bucketStart[b + 1] += bucketStart[b];
+        }
+        vector<uint32_t> members(n);
+        vector<uint32_t> fill(bucketStart.begin(), bucketStart.end() - 1);
+        for (uint32_t id = 0; id < n; ++id)
+        {
+            members[fill[bucketOf(hashes[id])]++] = id;
+        }
+        // Largest buckets first (counting sort on size).
+        size_t largest = 0;
+        for (size_t b = 0; b < bucketCount; ++b)
+        {
+            largest = max<size_t>(largest, bucketStart[b + 1] - bucketStart[b]);
+        }
+        vector<vector<uint32_t>> bySize(largest + 1);
+        for (size_t b = 0; b < bucketCount; ++b)
+        {
+            bySize[bucketStart[b + 1] - bucketStart[b]].push_back(static_cast<uint32_t>(b));
+        }
+
+        vector<uint32_t> bucketKeys;
+        vector<uint32_t> bases;
+        vector<uint32_t> slots;
+        uint32_t freeCursor = 0;
+        for (size_t size = largest; size > 0; --size)
+        {
+            for (uint32_t b : bySize[size])
+            {
+                bucketKeys.clear();
+                for (uint32_t k = bucketStart[b]; k < bucketStart[b + 1]; ++k)
+                {
+                    uint32_t id = members[k];
+                    bool repeated = false;
+                    for (uint32_t other : bucketKeys)
+                    {
+                        repeated |= hashes[other] == hashes[id] && keys[other] == keys[id];
+                    }
+                    if (repeated)
+                    {
+                        duplicates.push_back(id);
+                    }
+                    else
+                    {
+                        bucketKeys.push_back(id);
+                    }
+                }
+                if (!duplicates.empty())
+                {
+                    continue; // Caller drops the duplicates and rebuilds
+                }
+                if (bucketKeys.size() == 1)
+                {
+                    while (slotIds[freeCursor] != none) ++freeCursor;
+                    displacements[b] = {0, (freeCursor + n - f1[bucketKeys[0]]) % n};
+                    slotIds[freeCursor] = bucketKeys[0];
+                    continue;
+                }
+                bool placed = false;
+                for (uint32_t d0 = 0; d0 < 64 && !placed; ++d0)
+                {
+                    // Slots move together as d1 grows, so take the division out of the scan.
+                    bases.clear();
+                    for (uint32_t id : bucketKeys)
+                    {
+                        bases.push_back(slotOf(f1[id], f2[id], {d0, 0}, n));
+                    }
+                    for (uint32_t d1 = 0; d1 < n && !placed; ++d1)
+                    {
+                        slots.clear();
+                        bool fits = true;
+                        for (uint32_t base : bases)
+                        {
+                            uint32_t slot = base + d1 >= n ? base + d1 - n : base + d1;
+                            fits = slotIds[slot] == none && std::find(slots.begin(), slots.end(), slot) == slots.end();
+                            if (!fits) break;
+                            slots.push_back(slot);
+                        }
+                        if (fits)
+                        {
+                            for (size_t k = 0; k < slots.size(); ++k)
+                            {
+                                slotIds[slots[k]] = bucketKeys[k];
+                            }
+                            displacements[b] = {d0, d1};
+                            placed = true;
+                        }
+                    }
+                }
+                if (!placed)
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+public:
+    // Builds the table over abbrs[0..count), id i being abbrs[i]. Returns the indexes that
+    // repeat an earlier abbreviation; if there are any the table is not usable and the caller
+    // must build again without them.
+    vector<size_t> build(const string_view* abbrs, size_t count)
+    {
+        keys.assign(abbrs, abbrs + count);
+        vector<size_t> duplicates;
+        while (!tryBuild(duplicates) && duplicates.empty())
+        {
+            seed = mix64(seed + 1); // Unlucky hashes; try another seed
+        }
+        sort(duplicates.begin(), duplicates.end());
+        return duplicates;
+    }
+
+    uint32_t find(string_view abbr) const
+    {
+        if (keys.empty())
+        {
+            return none;
+        }
+        uint64_t hash = hashText(abbr, seed);
+        uint32_t n = static_cast<uint32_t>(keys.size());
+        uint32_t id = slotIds[slotOf(firstHash(hash, n), secondHash(hash, n), displacements[bucketOf(hash)], n)];
+        return keys[id] == abbr ? id : none;
+    }
+
+    size_t size() const { return keys.size(); }
+    string_view getAbbreviation(uint32_t id) const { return keys[id]; }
+};
+
+enum class Side : uint8_t { Buy, Sell };
+enum class OrderType : uint8_t { Limit, Market };
+
+// Prices inside the matching engine are whole cents.
+constexpr double priceTickSize = 0.01;
+inline int64_t toPriceTicks(double price)
+{
+    return llround(price / priceTickSize);
+}
+inline double fromPriceTicks(int64_t ticks)
+{
+    return ticks * priceTickSize;
+}
+
+// The same for any price type; exact for a FixedDecimal, which needs whole cents.
+constexpr int priceTickDecimals = 2;
+template <int Decimals>
+int64_t toPriceTicks(FixedDecimal<Decimals> price)
+{
+    static_assert(Decimals >= priceTickDecimals, "a price must hold whole cents");
+    return divideRound(price.getUnits(), decimalScale(Decimals - priceTickDecimals));
+}
+template <class Price>
+Price fromPriceTicksAs(int64_t ticks)
+{
+    if constexpr (is_floating_point_v<Price>)
+    {
+        return static_cast<Price>(fromPriceTicks(ticks));
+    }
+    else
+    {
+        static_assert(Price::decimals >= priceTickDecimals, "a price must hold whole cents");
+        return Price::fromUnits(ticks * decimalScale(Price::decimals - priceTickDecimals));
+    }
+}
+
+// Owner id of the simulated market maker that provides the resting liquidity.
+constexpr uint32_t marketMakerOwner = 0;
+
+struct Fill
+{
+    uint64_t makerOrderId;
+    uint64_t takerOrderId;
+    uint32_t makerOwner;
+    uint32_t takerOwner;
+    uint32_t symbol;
+    Side takerSide;
+    int64_t priceTicks;
+    uint32_t quantity;
+};
+
+struct OrderResult
+{
+    bool accepted;
+    uint64_t orderId; // Set for every accepted order; cancellable while resting > 0
+    uint32_t filled;
+    uint32_t resting;
+};
+
+// Preallocated pool of order nodes. Live orders sit in intrusive per-level FIFO lists, and an
+// order id is (generation << 32 | slot), so cancel finds its node without a lookup table and a
+// stale id is rejected once its slot has been reused.
+class OrderPool {
+public:
+    static constexpr uint32_t none = UINT32_MAX;
+    struct Node
+    {
+        uint64_t id = 0; // 0 while the slot is free
+        int64_t priceTicks = 0;
+        uint32_t quantity = 0;
+        uint32_t owner = 0;
+        uint32_t symbol = 0;
+        uint32_t prev = none;
+        uint32_t next = none;
+        uint32_t generation = 0;
+        Side side = Side::Buy;
+    };
+
+private:
+    vector<Node> nodes;
+    uint32_t freeHead = none;
+    uint32_t used = 0;
+
+public:
+    explicit OrderPool(uint32_t capacity) : nodes(capacity) {}
+
+    // Returns none when the pool is exhausted.
+    uint32_t acquire()
+    {
+        uint32_t slot;
+        if (freeHead != none)
+        {
+            slot = freeHead;
+            freeHead = nodes[slot].next;
+        }
+        else if (used < nodes.size())
+        {
+            slot = used++;
+        }
+        else
+        {
+            return none;
+        }
+        Node& node = nodes[slot];
+        node.id = (static_cast<uint64_t>(++node.generation) << 32) | slot;
+        node.prev = node.next = none;
+        return slot;
+    }
+
+    void release(uint32_t slot)
+    {
+        nodes[slot].id = 0;
+        nodes[slot].next = freeHead;
+        freeHead = slot;
+    }
+
+    // Slot of a live order, or none.
+    uint32_t find(uint64_t id) const
+    {
+        uint32_t slot = static_cast<uint32_t>(id);
+        return id != 0 && slot < used && nodes[slot].id == id ? slot : none;
+    }
+
+    Node& operator[](uint32_t slot) { return nodes[slot]; }
+    const Node& operator[](uint32_t slot) const { return nodes[slot]; }
+};
+
+// Order book for one symbol: a ladder of price levels covering `width` ticks from minPrice,
+// each level a FIFO of orders, plus one bitmap per side marking the non-empty levels so the
+// next best price is found with a bit scan. Prices off the ladder rest in a sparse map per side,
+// so no valid limit is turned away, and recenter moves the ladder to where the trading is. A
+// level never holds bids and asks at once, since crossing orders match before they rest.
+class OrderBook {
+private:
+    struct PriceLevel
+    {
+        uint32_t head = OrderPool::none;
+        uint32_t tail = OrderPool::none;
+        uint64_t quantity = 0;
+        uint32_t orders = 0;
+    };
+
+    int64_t minPrice;
+    vector<PriceLevel> levels;
+    vector<uint64_t> bidBits;
+    vector<uint64_t> askBits;
+    long bestBid = -1;  // Level index, -1 when there are no bids on the ladder
+    long bestAsk;       // Level index, levels.size() when there are no asks on the ladder
+    map<int64_t, PriceLevel> bidsOff; // Levels off the ladder, by price
+    map<int64_t, PriceLevel> asksOff;
+    size_t orderCount = 0;
+    size_t ladderCount = 0; // Of orderCount, those on the ladder
+
+    static void setBit(vector<uint64_t>& bits, size_t i) { bits[i >> 6] |= uint64_t(1) << (i & 63); }
+    static void clearBit(vector<uint64_t>& bits, size_t i) { bits[i >> 6] &= ~(uint64_t(1) << (i & 63)); }
+
+    // First set bit at or above `from`, or end if there is none.
+    long nextSetBit(const vector<uint64_t>& bits, long from, long end) const
+    {
+        if (from >= end) return end;
+        size_t word = from >> 6;
+        uint64_t w = bits[word] & (~uint64_t(0) << (from & 63));
+        while (true)
+        {
+            if (w) return min<long>(end, static_cast<long>(word * 64 + countTrailingZeros(w)));
+            if (++word == bits.size()) return end;
+            w = bits[word];
+        }
+    }
+
+    // Last set bit at or below `from`, or -1 if there is none.
+    long prevSetBit(const vector<uint64_t>& bits, long from) const
+    {
+        if (from < 0) return -1;
+        long word = from >> 6;
+        uint64_t w = bits[word] & (~uint64_t(0) >> (63 - (from & 63)));
+        while (true)
+        {
+            if (w) return word * 64 + 63 - countLeadingZeros(w);
+            if (--word < 0) return -1;
+            w = bits[word];
+        }
+    }
+
+    long levelCount() const { return static_cast<long>(levels.size()); }
+    map<int64_t, PriceLevel>& offLadder(Side side) { return side == Side::Buy ? bidsOff : asksOff; }
+
+    void append(OrderPool& pool, uint32_t slot, PriceLevel& level)
+    {
+        OrderPool::Node& node = pool[slot];
+        node.prev = level.tail;
+        node.next = OrderPool::none;
+        if (level.tail != OrderPool::none) pool[level.tail].next = slot;
+        else level.head = slot;
+        level.tail = slot;
+        level.quantity += node.quantity;
+        ++level.orders;
+        ++orderCount;
+    }
+
+    void unlink(OrderPool& pool, uint32_t slot, PriceLevel& level)
+    {
+        OrderPool::Node& node = pool[slot];
+        if (node.prev != OrderPool::none) pool[node.prev].next = node.next;
+        else level.head = node.next;
+        if (node.next != OrderPool::none) pool[node.next].prev = node.prev;
+        else level.tail = node.prev;
+        --level.orders;
+        --orderCount;
+    }
+
+    // Puts a whole level on the ladder at `index`.
+    void placeOnLadder(long index, Side side, const PriceLevel& level)
+    {
+        levels[index] = level;
+        ladderCount += level.orders;
+        if (side == Side::Buy)
+        {
+            setBit(bidBits, index);
+            bestBid = max(bestBid, index);
+        }
+        else
+        {
+            setBit(askBits, index);
+            bestAsk = min(bestAsk, index);
+        }
+    }
+
+    // Best price resting on a side, on the ladder or off it; false if the side is empty.
+    bool bestOf(Side side, int64_t& price) const
+    {
+        bool found = false;
+        if (side == Side::Buy)
+        {
+            if (bestBid >= 0)
+            {
+                price = minPrice + bestBid;
+                found = true;
+            }
+            if (!bidsOff.empty() && (!found || bidsOff.rbegin()->first > price))
+            {
+                price = bidsOff.rbegin()->first;
+                found = true;
+            }
+        }
+        else
+        {
+            if (bestAsk < levelCount())
+            {
+                price = minPrice + bestAsk;
+                found = true;
+            }
+            if (!asksOff.empty() && (!found || asksOff.begin()->first < price))
+            {
+                price = asksOff.begin()->first;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    // Walks the ladder from `index` and the levels off it from `off` together, best price first.
+    template <class OffLevel>
+    uint32_t estimateFrom(bool ascending, long index, OffLevel off, OffLevel offEnd, uint32_t quantity,
+                          int64_t& cost) const
+    {
+        uint32_t remaining = quantity;
+        while (remaining > 0)
+        {
+            bool onLadder = index >= 0 && index < levelCount();
+            if (!onLadder && off == offEnd) break;
+            int64_t price;
+            uint64_t available;
+            if (onLadder && (off == offEnd || (ascending ? minPrice + index < off->first : minPrice + index > off->first)))
+            {
+                price = minPrice + index;
+                available = levels[index].quantity;
+                index = ascending ? nextSetBit(askBits, index + 1, levelCount()) : prevSetBit(bidBits, index - 1);
+            }
+            else
+            {
+                price = off->first;
+                available = off->second.quantity;
+                ++off;
+            }
+            uint32_t traded = static_cast<uint32_t>(min<uint64_t>(remaining, available));
+            cost += traded * price;
+            remaining -= traded;
+        }
+        return quantity - remaining;
+    }
+
+public:
+    OrderBook(int64_t referencePrice, size_t width)
+        : minPrice(max<int64_t>(1, referencePrice - static_cast<int64_t>(width) / 2)), levels(width),
+          bidBits((width + 63) / 64), askBits((width + 63) / 64), bestAsk(static_cast<long>(width))
+    {
+    }
+
+    bool empty() const { return orderCount == 0; }
+    bool ladderEmpty() const { return ladderCount == 0; }
+    bool inRange(int64_t price) const { return price >= minPrice && price < minPrice + levelCount(); }
+    bool bestBidPrice(int64_t& price) const { return bestOf(Side::Buy, price); }
+    bool bestAskPrice(int64_t& price) const { return bestOf(Side::Sell, price); }
+
+    // Moves the ladder so `referencePrice` sits in the middle. Levels the new ladder still covers
+    // are re-based onto it, the others move off it, and levels off the ladder that it now covers
+    // move on, each keeping its queue. O(width) plus the levels moved.
+    void recenter(int64_t referencePrice)
+    {
+        int64_t newMin = max<int64_t>(1, referencePrice - levelCount() / 2);
+        if (newMin == minPrice)
+        {
+            return;
+        }
+        for (size_t word = 0; word < bidBits.size() && ladderCount > 0; ++word)
+        {
+            for (uint64_t w = bidBits[word] | askBits[word]; w; w &= w - 1)
+            {
+                long index = static_cast<long>(word * 64 + countTrailingZeros(w));
+                Side side = bidBits[word] >> (index & 63) & 1 ? Side::Buy : Side::Sell;
+                offLadder(side)[minPrice + index] = levels[index];
+                levels[index] = PriceLevel();
+            }
+            bidBits[word] = askBits[word] = 0;
+        }
+        minPrice = newMin;
+        bestBid = -1;
+        bestAsk = levelCount();
+        ladderCount = 0;
+        for (Side side : {Side::Buy, Side::Sell})
+        {
+            map<int64_t, PriceLevel>& off = offLadder(side);
+            auto first = off.lower_bound(minPrice);
+            auto last = off.lower_bound(minPrice + levelCount());
+            for (auto it = first; it != last; ++it)
+            {
+                placeOnLadder(static_cast<long>(it->first - minPrice), side, it->second);
+            }
+            off.erase(first, last);
+        }
+    }
+
+    // Recenters once `referencePrice` has drifted into the outer quarters of the ladder, so the
+    // trading around it stays on the ladder; the slack keeps this rare.
+    void follow(int64_t referencePrice)
+    {
+        long margin = levelCount() / 4;
+        if (referencePrice < minPrice + margin || referencePrice >= minPrice + levelCount() - margin)
+        {
+            recenter(referencePrice);
+        }
+    }
+
+    // Fills up to `quantity` against the opposite side at prices no worse than `limit`, oldest
+    // order first within a level. Returns the quantity filled.
+    uint32_t match(OrderPool& pool, uint64_t takerId, uint32_t takerOwner, uint32_t symbol, Side side,
+                   int64_t limit, uint32_t quantity, vector<Fill>& fills)
+    {
+        uint32_t remaining = quantity;
+        Side restingSide = side == Side::Buy ? Side::Sell : Side::Buy;
+        int64_t price;
+        while (remaining > 0 && bestOf(restingSide, price) && (side == Side::Buy ? price <= limit : price >= limit))
+        {
+            bool onLadder = inRange(price);
+            long index = static_cast<long>(price - minPrice);
+            auto off = onLadder ? offLadder(restingSide).end() : offLadder(restingSide).find(price);
+            PriceLevel& level = onLadder ? levels[index] : off->second;
+            uint32_t orders = level.orders;
+            while (remaining > 0 && level.head != OrderPool::none)
+            {
+                uint32_t slot = level.head;
+                OrderPool::Node& maker = pool[slot];
+                uint32_t traded = min(remaining, maker.quantity);
+                fills.push_back({maker.id, takerId, maker.owner, takerOwner, symbol, side, price, traded});
+                maker.quantity -= traded;
+                level.quantity -= traded;
+                remaining -= traded;
+                if (maker.quantity == 0)
+                {
+                    unlink(pool, slot, level);
+                    pool.release(slot);
+                }
+            }
+            if (!onLadder)
+            {
+                if (level.head == OrderPool::none)
+                {
+                    offLadder(restingSide).erase(off);
+                }
+                continue;
+            }
+            ladderCount -= orders - level.orders;
+            if (level.head == OrderPool::none)
+            {
+                if (side == Side::Buy)
+                {
+                    clearBit(askBits, index);
+                    bestAsk = nextSetBit(askBits, index + 1, levelCount());
+                }
+                else
+                {
+                    clearBit(bidBits, index);
+                    bestBid = prevSetBit(bidBits, index - 1);
+                }
+            }
+        }
+        return quantity - remaining;
+    }
+
+    // Appends an order (already filled in by the caller) to the back of its price level.
+    void rest(OrderPool& pool, uint32_t slot)
+    {
+        OrderPool::Node& node = pool[slot];
+        if (!inRange(node.priceTicks))
+        {
+            append(pool, slot, offLadder(node.side)[node.priceTicks]);
+            return;
+        }
+        long index = static_cast<long>(node.priceTicks - minPrice);
+        append(pool, slot, levels[index]);
+        ++ladderCount;
+        if (node.side == Side::Buy)
+        {
+            setBit(bidBits, index);
+            bestBid = max(bestBid, index);
+        }
+        else
+        {
+            setBit(askBits, index);
+            bestAsk = min(bestAsk, index);
+        }
+    }
+
+    void remove(OrderPool& pool, uint32_t slot)
+    {
+        OrderPool::Node& node = pool[slot];
+        if (!inRange(node.priceTicks))
+        {
+            map<int64_t, PriceLevel>& off = offLadder(node.side);
+            auto it = off.find(node.priceTicks);
+            unlink(pool, slot, it->second);
+            it->second.quantity -= node.quantity;
+            if (it->second.head == OrderPool::none)
+            {
+                off.erase(it);
+            }
+            return;
+        }
+        long index = static_cast<long>(node.priceTicks - minPrice);
+        PriceLevel& level = levels[index];
+        unlink(pool, slot, level);
+        --ladderCount;
+        level.quantity -= node.quantity;
+        if (level.head == OrderPool::none)
+        {
+            if (node.side == Side::Buy)
+            {
+                clearBit(bidBits, index);
+                if (bestBid == index) bestBid = prevSetBit(bidBits, index - 1);
+            }
+            else
+            {
+                clearBit(askBits, index);
+                if (bestAsk == index) bestAsk = nextSetBit(askBits, index + 1, levelCount());
+            }
+        }
+    }
+
+    // Quantity a market order of `quantity` would fill right now, and its cost in ticks * shares.
+    uint32_t estimate(Side side, uint32_t quantity, int64_t& cost) const
+    {
+        cost = 0;
+        return side == Side::Buy ? estimateFrom(true, bestAsk, asksOff.begin(), asksOff.end(), quantity, cost)
+                                 : estimateFrom(false, bestBid, bidsOff.rbegin(), bidsOff.rend(), quantity, cost);
+    }
+};
+
+// Price-time priority matching over one order book per symbol. Books are created the first
+// time a symbol trades; after that, submitting, matching and cancelling never allocate while
+// prices stay on the ladder (fills go into a caller-owned vector that keeps its capacity). Not
+// thread-safe: one thread owns it.
+class MatchingEngine {
+private:
+    OrderPool pool;
+    vector<unique_ptr<OrderBook>> books;
+    size_t ladderWidth;
+
+    OrderBook& bookFor(uint32_t symbol, int64_t referencePrice)
+    {
+        if (symbol >= books.size())
+        {
+            books.resize(symbol + 1);
+        }
+        if (!books[symbol])
+        {
+            books[symbol] = make_unique<OrderBook>(referencePrice, ladderWidth);
+        }
+        return *books[symbol];
+    }
+
+public:
+    explicit MatchingEngine(uint32_t orderCapacity = 1 << 20, size_t ladderWidth = 8192)
+        : pool(orderCapacity), ladderWidth(ladderWidth) {}
+
+    // Matches the order against the book and rests any limit remainder, on the ladder or off
+    // it. Market orders are immediate-or-cancel.
+    OrderResult submit(uint32_t symbol, Side side, OrderType type, int64_t limitTicks, uint32_t quantity,
+                       uint32_t owner, vector<Fill>& fills)
+    {
+        if (quantity == 0 || (type == OrderType::Limit && limitTicks <= 0))
+        {
+            return {false, 0, 0, 0};
+        }
+        uint32_t slot = pool.acquire();
+        if (slot == OrderPool::none)
+        {
+            return {false, 0, 0, 0};
+        }
+        uint64_t id = pool[slot].id;
+        if (type == OrderType::Market && (symbol >= books.size() || !books[symbol]))
+        {
+            pool.release(slot);
+            return {true, id, 0, 0}; // Nothing has ever rested here
+        }
+        OrderBook& book = bookFor(symbol, limitTicks);
+        int64_t limit = type == OrderType::Limit ? limitTicks : (side == Side::Buy ? INT64_MAX : INT64_MIN);
+        uint32_t filled = book.match(pool, id, owner, symbol, side, limit, quantity, fills);
+        uint32_t remaining = quantity - filled;
+        if (remaining > 0 && type == OrderType::Limit)
+        {
+            if (!book.inRange(limitTicks) && book.ladderEmpty())
+            {
+                book.recenter(limitTicks); // Nothing on the ladder to move
+            }
+            OrderPool::Node& node = pool[slot];
+            node.priceTicks = limitTicks;
+            node.quantity = remaining;
+            node.owner = owner;
+            node.symbol = symbol;
+            node.side = side;
+            book.rest(pool, slot);
+            return {true, id, filled, remaining};
+        }
+        pool.release(slot);
+        return {true, id, filled, 0};
+    }
+
+    // O(1): the id locates the node directly. Reports the unfilled quantity that was cancelled.
+    bool cancel(uint64_t orderId, uint32_t* cancelled = nullptr)
+    {
+        uint32_t slot = pool.find(orderId);
+        if (slot == OrderPool::none)
+        {
+            return false;
+        }
+        OrderPool::Node& node = pool[slot];
+        if (cancelled)
+        {
+            *cancelled = node.quantity;
+        }
+        books[node.symbol]->remove(pool, slot);
+        pool.release(slot);
+        return true;
+    }
+
+    // Keeps the symbol's ladder around referencePrice as the market drifts; see OrderBook::follow.
+    void followPrice(uint32_t symbol, int64_t referencePrice)
+    {
+        if (symbol < books.size() && books[symbol])
+        {
+            books[symbol]->follow(referencePrice);
+        }
+    }
+
+    const OrderBook* getBook(uint32_t symbol) const
+    {
+        return symbol < books.size() ? books[symbol].get() : nullptr;
+    }
+
+    // Quantity and cost (ticks * shares) a market order would get right now.
+    uint32_t estimateMarketOrder(uint32_t symbol, Side side, uint32_t quantity, int64_t& cost) const
+    {
+        cost = 0;
+        const OrderBook* book = getBook(symbol);
+        return book ? book->estimate(side, quantity, cost) : 0;
+    }
+};
+
+// Read-only memory mapping of a whole file. isOpen() is false if the file could not be mapped.
+class MappedFile {
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+#if defined(_WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+public:
+    explicit MappedFile(const string& path)
+    {
+#if defined(_WIN32)
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        LARGE_INTEGER size;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size))
+        {
+            return;
+        }
+        length = static_cast<size_t>(size.QuadPart);
+        if (length == 0)
+        {
+            bytes = "";
+            return;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping)
+        {
+            bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        }
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0)
+        {
+            return;
+        }
+        if (fstat(fd, &info) == 0)
+        {
+            length = static_cast<size_t>(info.st_size);
+            if (length == 0)
+            {
+                bytes = "";
+            }
+            else
+            {
+                void* address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (address != MAP_FAILED)
+                {
+                    bytes = static_cast<const char*>(address);
+                }
+            }
+        }
+        close(fd); // The mapping keeps the file contents reachable
+#endif
+        if (!bytes)
+        {
+            length = 0;
+        }
+    }
+
+    ~MappedFile()
+    {
+#if defined(_WIN32)
+        if (bytes && length) UnmapViewOfFile(bytes);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (bytes && length) munmap(const_cast<char*>(bytes), length);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Tells the OS the file is read front to back, so it reads ahead and drops pages behind.
+    void adviseSequential() const
+    {
+#if !defined(_WIN32)
+        if (bytes && length) madvise(const_cast<char*>(bytes), length, MADV_SEQUENTIAL);
+#endif
+    }
+
+    bool isOpen() const { return bytes != nullptr; }
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+    string_view text() const { return string_view(bytes, length); }
+};
+
+// Splits text into lines the way getline would (a final line without '\n' still counts, a
+// trailing '\r' is dropped) using every worker: chunk boundaries are moved to the next newline,
+// each chunk counts its lines, and after a prefix sum each chunk writes its own slice.
+inline vector<string_view> splitLines(string_view text, TickWorkerPool& pool)
+{
+    size_t chunks = max<size_t>(1, min<size_t>(pool.getThreadCount() * 4, text.size() / 65536 + 1));
+    vector<size_t> starts(chunks + 1, text.size());
+    starts[0] = 0;
+    for (size_t c = 1; c < chunks; ++c)
+    {
+        size_t newline = text.find('\n', max(starts[c - 1], text.size() * c / chunks));
+        starts[c] = newline == string_view::npos ? text.size() : newline + 1;
+    }
+    vector<size_t> offsets(chunks + 1, 0);
+    pool.run(chunks, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t c = begin; c < end; ++c)
+        {
+            string_view chunk = text.substr(starts[c], starts[c + 1] - starts[c]);
+            size_t lines = static_cast<size_t>(count(chunk.begin(), chunk.end(), '\n'));
+            offsets[c + 1] = lines + (!chunk.empty() && chunk.back() != '\n' ? 1 : 0);
+        }
+    });
+    for (size_t c = 0; c < chunks; ++c)
+    {
+        offsets[c + 1] += offsets[c];
+    }
+    vector<string_view> lines(offsets[chunks]);
+    pool.run(chunks, 1, [&](size_t begin, size_t end)
+    {
+        for (size_t c = begin; c < end; ++c)
+        {
+            size_t position = starts[c];
+            size_t out = offsets[c];
+            while (position < starts[c + 1])
+            {
+                size_t newline = text.find('\n', position);
+                size_t lineEnd = newline == string_view::npos || newline >= starts[c + 1] ? starts[c + 1] : newline;
+                string_view line = text.substr(position, lineEnd - position);
+                if (!line.empty() && line.back() == '\r')
+                {
+                    line.remove_suffix(1);
+                }
+                lines[out++] = line;
+                position = lineEnd + 1;
+            }
+        }
+    });
+    while (!lines.empty() && lines.back().empty())
+    {
+        lines.pop_back(); // Blank lines at the end of a file are not entries
+    }
+    return lines;
+}
+
+// Parses one price per line with from_chars, in parallel. Returns the index of the first line
+// that is not a number, or lines.size() if all of them parsed.
+inline size_t parsePrices(const vector<string_view>& lines, vector<double>& prices, TickWorkerPool& pool)
+{
+    prices.resize(lines.size());
+    atomic<size_t> firstBad{lines.size()};
+    pool.run(lines.size(), [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            string_view line = lines[i];
+            size_t first = line.find_first_not_of(" \t");
+            size_t last = line.find_last_not_of(" \t");
+            const char* from = line.data() + (first == string_view::npos ? line.size() : first);
+            const char* to = line.data() + (last == string_view::npos ? line.size() : last + 1);
+            auto [stop, error] = from_chars(from, to, prices[i]);
+            if (error != errc() || stop != to || from == to)
+            {
+                size_t seen = firstBad.load();
+                while (i < seen && !firstBad.compare_exchange_weak(seen, i)) {}
+            }
+        }
+    });
+    return firstBad.load();
+}
+
+// Binary symbol universe: a fixed header, then the prices as doubles, then the end offsets of
+// every name and abbreviation inside one text blob, then the blob. All offsets are relative to
+// the start of the file, native endian. Mapped as-is, nothing is parsed at startup.
+struct UniverseHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t pricesOffset;      // double[count]
+    uint64_t nameEndsOffset;    // uint64_t[count], end of each name within the text blob
+    uint64_t abbrEndsOffset;    // uint64_t[count], end of each abbreviation within the text blob
+    uint64_t textOffset;
+    uint64_t textSize;
+};
+constexpr char universeMagic[8] = {'S', 'T', 'K', 'U', 'N', 'I', 'V', '\0'};
+constexpr uint32_t universeVersion = 1;
+
+// Writes the binary universe: names and abbreviations are stored back to back per symbol.
+inline bool writeUniverseFile(const string& path, const vector<string_view>& names,
+                              const vector<string_view>& abbrs, const vector<double>& prices)
+{
+    size_t count = prices.size();
+    UniverseHeader header{};
+    memcpy(header.magic, universeMagic, sizeof(header.magic));
+    header.version = universeVersion;
+    header.count = count;
+    header.pricesOffset = sizeof(UniverseHeader);
+    header.nameEndsOffset = header.pricesOffset + count * sizeof(double);
+    header.abbrEndsOffset = header.nameEndsOffset + count * sizeof(uint64_t);
+    header.textOffset = header.abbrEndsOffset + count * sizeof(uint64_t);
+    vector<uint64_t> nameEnds(count), abbrEnds(count);
+    uint64_t textSize = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        textSize += names[i].size();
+        nameEnds[i] = textSize;
+        textSize += abbrs[i].size();
+        abbrEnds[i] = textSize;
+    }
+    header.textSize = textSize;
+
+    ofstream out(path, ios::binary | ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(prices.data()), count * sizeof(double));
+    out.write(reinterpret_cast<const char*>(nameEnds.data()), count * sizeof(uint64_t));
+    out.write(reinterpret_cast<const char*>(abbrEnds.data()), count * sizeof(uint64_t));
+    for (size_t i = 0; i < count; ++i)
+    {
+        out.write(names[i].data(), names[i].size());
+        out.write(abbrs[i].data(), abbrs[i].size());
+    }
+    return static_cast<bool>(out);
+}
+
+// Validated view over a mapped binary universe file.
+class UniverseFile {
+private:
+    shared_ptr<MappedFile> file;
+    const UniverseHeader* header = nullptr;
+    const double* prices = nullptr;
+    const uint64_t* nameEnds = nullptr;
+    const uint64_t* abbrEnds = nullptr;
+    const char* text = nullptr;
+
+public:
+    // Returns an error message, or an empty string on success.
+    string open(const string& path)
+    {
+        file = make_shared<MappedFile>(path);
+        if (!file->isOpen())
+        {
+            return "cannot open " + path;
+        }
+        if (file->size() < sizeof(UniverseHeader))
+        {
+            return path + " is too small to be a universe file";
+        }
+        header = reinterpret_cast<const UniverseHeader*>(file->data());
+        if (memcmp(header->magic, universeMagic, sizeof(universeMagic)) != 0 || header->version != universeVersion)
+        {
+            return path + " is not a version " + to_string(universeVersion) + " universe file";
+        }
+        uint64_t count = header->count;
+        uint64_t size = file->size();
+        // Offsets are checked against the size first so the sums below cannot wrap.
+        if (count > size / sizeof(double) || header->pricesOffset > size || header->nameEndsOffset > size ||
+            header->abbrEndsOffset > size || header->textOffset > size ||
+            header->pricesOffset % alignof(double) != 0 || header->nameEndsOffset % alignof(uint64_t) != 0 ||
+            header->abbrEndsOffset % alignof(uint64_t) != 0 ||
+            header->nameEndsOffset < header->pricesOffset + count * sizeof(double) ||
+            header->abbrEndsOffset < header->nameEndsOffset + count * sizeof(uint64_t) ||
+            header->textOffset < header->abbrEndsOffset + count * sizeof(uint64_t) ||
+            header->textSize > size - header->textOffset)
+        {
+            return path + " is truncated or corrupt";
+        }
+        prices = reinterpret_cast<const double*>(file->data() + header->pricesOffset);
+        nameEnds = reinterpret_cast<const uint64_t*>(file->data() + header->nameEndsOffset);
+        abbrEnds = reinterpret_cast<const uint64_t*>(file->data() + header->abbrEndsOffset);
+        text = file->data() + header->textOffset;
+        // Every name and abbreviation must lie inside the text, each after the one before it.
+        uint64_t previous = 0;
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            if (nameEnds[i] < previous || abbrEnds[i] < nameEnds[i] || abbrEnds[i] > header->textSize)
+            {
+                prices = nullptr;
+                nameEnds = abbrEnds = nullptr;
+                text = nullptr;
+                return path + " is truncated or corrupt: entry " + to_string(i) + " lies outside the text";
+            }
+            previous = abbrEnds[i];
+        }
+        return "";
+    }
+
+    size_t size() const { return static_cast<size_t>(header->count); }
+    const double* getPrices() const { return prices; }
+    string_view getName(size_t i) const
+    {
+        uint64_t begin = i ? abbrEnds[i - 1] : 0;
+        return string_view(text + begin, nameEnds[i] - begin);
+    }
+    string_view getAbbreviation(size_t i) const
+    {
+        return string_view(text + nameEnds[i], abbrEnds[i] - nameEnds[i]);
+    }
+    // Keeps the mapping alive for as long as views into it are in use.
+    shared_ptr<MappedFile> getFile() const { return file; }
+};
+
+// The three text files parsed in parallel, with views into their mappings.
+struct TextUniverse
+{
+    vector<shared_ptr<MappedFile>> files;
+    vector<string_view> names;
+    vector<string_view> abbrs;
+    vector<double> prices;
+};
+
+// Returns an error message, or an empty string on success.
+inline string parseTextUniverse(const string& namesFile, const string& pricesFile, const string& abbrFile,
+                                TickWorkerPool& pool, TextUniverse& universe)
+{
+    auto names = make_shared<MappedFile>(namesFile);
+    auto prices = make_shared<MappedFile>(pricesFile);
+    auto abbrs = make_shared<MappedFile>(abbrFile);
+    for (auto [file, path] : {make_pair(names.get(), &namesFile), make_pair(prices.get(), &pricesFile),
+                              make_pair(abbrs.get(), &abbrFile)})
+    {
+        if (!file->isOpen())
+        {
+            return "cannot open " + *path;
+        }
+    }
+    universe.files = {names, prices, abbrs};
+    universe.names = splitLines(names->text(), pool);
+    universe.abbrs = splitLines(abbrs->text(), pool);
+    vector<string_view> priceLines = splitLines(prices->text(), pool);
+    if (universe.names.size() != universe.abbrs.size() || universe.names.size() != priceLines.size())
+    {
+        return "Mismatch in the number of entries across files!";
+    }
+    size_t bad = parsePrices(priceLines, universe.prices, pool);
+    if (bad != priceLines.size())
+    {
+        return pricesFile + " line " + to_string(bad + 1) + ": not a price";
+    }
+    return "";
+}
+
+// Parses up to `count` whitespace-separated numbers from text. Returns how many it read, or
+// count + 1 if anything else follows them.
+inline size_t parseNumbers(string_view text, double* out, size_t count)
+{
+    size_t parsed = 0;
+    size_t position = 0;
+    while (true)
+    {
+        position = text.find_first_not_of(" \t", position);
+        if (position == string_view::npos)
+        {
+            return parsed;
+        }
+        size_t stop = min(text.size(), text.find_first_of(" \t", position));
+        double value;
+        auto [last, error] = from_chars(text.data() + position, text.data() + stop, value);
+        if (parsed == count || error != errc() || last != text.data() + stop)
+        {
+            return count + 1;
+        }
+        out[parsed++] = value;
+        position = stop;
+    }
+}
+
+// Reads a factor model for the symbols in `table`:
+//
+//     # comment
+//     factors K
+//     correlation c11 ... c1K      (optional: K rows of the factor correlation matrix)
+//     ABBR b1 ... bK               (one line per symbol; symbols without one move on their own)
+//
+// Returns an error message, or an empty string on success.
+inline string parseFactorModel(const string& path, const SymbolTable& table, size_t symbols, TickWorkerPool& pool,
+                               FactorModel& model)
+{
+    MappedFile file(path);
+    if (!file.isOpen())
+    {
+        return "cannot open " + path;
+    }
+    vector<string_view> lines = splitLines(file.text(), pool);
+    auto keyword = [](string_view line, string_view word)
+    {
+        return line.size() > word.size() && line.substr(0, word.size()) == word &&
+               (line[word.size()] == ' ' || line[word.size()] == '\t');
+    };
+    auto lineError = [&](size_t line, const string& what) { return path + " line " + to_string(line + 1) + ": " + what; };
+    size_t line = 0;
+    while (line < lines.size() && (lines[line].empty() || lines[line][0] == '#'))
+    {
+        ++line;
+    }
+    double factorCount = 0.0;
+    if (line == lines.size() || !keyword(lines[line], "factors") ||
+        parseNumbers(lines[line].substr(7), &factorCount, 1) != 1 || factorCount < 1 ||
+        factorCount > FactorModel::maxFactors || factorCount != floor(factorCount))
+    {
+        return lineError(line, "expected factors K, with K from 1 to " + to_string(FactorModel::maxFactors));
+    }
+    size_t k = static_cast<size_t>(factorCount);
+    vector<double> correlation;
+    for (++line; line < lines.size() && keyword(lines[line], "correlation"); ++line)
+    {
+        correlation.resize(correlation.size() + k);
+        if (parseNumbers(lines[line].substr(11), correlation.data() + correlation.size() - k, k) != k)
+        {
+            return lineError(line, "expected " + to_string(k) + " correlations");
+        }
+    }
+    vector<double> loadings(symbols * k, 0.0);
+    atomic<size_t> firstBad{lines.size()};
+    auto findSymbol = [&](string_view text)
+    {
+        uint32_t id = table.find(text.substr(0, min(text.size(), text.find_first_of(" \t"))));
+        return id < symbols ? id : SymbolTable::none;
+    };
+    pool.run(lines.size() - line, [&](size_t begin, size_t end)
+    {
+        for (size_t i = line + begin; i < line + end; ++i)
+        {
+            string_view text = lines[i];
+            if (text.empty() || text[0] == '#')
+            {
+                continue;
+            }
+            uint32_t id = findSymbol(text);
+            size_t split = min(text.size(), text.find_first_of(" \t"));
+            if (id == SymbolTable::none || parseNumbers(text.substr(split), loadings.data() + id * k, k) != k)
+            {
+                size_t seen = firstBad.load();
+                while (i < seen && !firstBad.compare_exchange_weak(seen, i)) {}
+            }
+        }
+    });
+    size_t bad = firstBad.load();
+    if (bad != lines.size())
+    {
+        return lineError(bad, findSymbol(lines[bad]) == SymbolTable::none
+                                  ? "unknown symbol"
+                                  : "expected a symbol and " + to_string(k) + " loadings");
+    }
+    string error = model.build(symbols, static_cast<uint32_t>(k), loadings, correlation);
+    return error.empty() ? "" : path + ": " + error;
+}
+
+// Account events in the write-ahead journal. Snapshots are written with the same encoding, using
+// the last five kinds to restate the account instead of repeating its history.
+enum class JournalKind : uint8_t
+{
+    Deposit,    // amount
+    Withdrawal, // amount
+    Fill,       // symbol, quantity (+ bought / - sold), price in amount, timestamp
+    Balance,    // amount: settled cash
+    Position,   // symbol, quantity: settled shares, amount: what they cost at average cost
+    History,    // a past fill, restored into the transaction history only
+    Lot,        // symbol, quantity, price in amount: an open FIFO lot, oldest first
+    Realized,   // quantity 0 for FIFO, 1 for average cost; amount: realized P&L
+};
+
+// Fixed part of a journal record; the symbol follows it, padded to 8 bytes.
+struct JournalRecord
+{
+    uint32_t checksum; // Of everything after this field, symbol included
+    JournalKind kind;
+    uint8_t reserved;
+    uint16_t symbolLength;
+    int64_t quantity;
+    double amount;
+    int64_t timestamp;
+};
+static_assert(sizeof(JournalRecord) == 32, "journal records are read straight from the mapping");
+
+inline uint32_t journalChecksum(const char* record, size_t size)
+{
+    return static_cast<uint32_t>(hashText(string_view(record + sizeof(uint32_t), size - sizeof(uint32_t)), 0x4A524E4CULL));
+}
+
+inline size_t journalRecordSize(size_t symbolLength)
+{
+    return sizeof(JournalRecord) + ((symbolLength + 7) & ~size_t(7));
+}
+
+inline void encodeJournalRecord(string& out, JournalKind kind, string_view symbol, int64_t quantity, double amount,
+                                int64_t timestamp)
+{
+    symbol = symbol.substr(0, UINT16_MAX);
+    size_t offset = out.size();
+    out.resize(offset + journalRecordSize(symbol.size()), '\0');
+    JournalRecord record{};
+    record.kind = kind;
+    record.symbolLength = static_cast<uint16_t>(symbol.size());
+    record.quantity = quantity;
+    record.amount = amount;
+    record.timestamp = timestamp;
+    memcpy(&out[offset], &record, sizeof(record));
+    memcpy(&out[offset + sizeof(record)], symbol.data(), symbol.size());
+    record.checksum = journalChecksum(&out[offset], out.size() - offset);
+    memcpy(&out[offset], &record.checksum, sizeof(record.checksum));
+}
+
+// Calls fn(record, symbol) for each intact record and returns the bytes they cover; stops at the
+// first torn or corrupt one.
+template <class Fn>
+size_t forEachJournalRecord(string_view bytes, Fn&& fn)
+{
+    size_t offset = 0;
+    while (bytes.size() - offset >= sizeof(JournalRecord))
+    {
+        JournalRecord record;
+        memcpy(&record, bytes.data() + offset, sizeof(record));
+        size_t size = journalRecordSize(record.symbolLength);
+        if (size > bytes.size() - offset || record.checksum != journalChecksum(bytes.data() + offset, size))
+        {
+            break;
+        }
+        fn(record, bytes.substr(offset + sizeof(record), record.symbolLength));
+        offset += size;
+    }
+    return offset;
+}
+
+// Flushes stdio buffers and asks the OS to put the file on disk.
+inline bool syncFile(FILE* file)
+{
+    if (fflush(file) != 0)
+    {
+        return false;
+    }
+#if defined(_WIN32)
+    return _commit(_fileno(file)) == 0;
+#elif defined(__linux__)
+    return fdatasync(fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Makes a rename in the directory durable (nothing to do on Windows).
+inline void syncDirectory(const filesystem::path& file)
+{
+#if !defined(_WIN32)
+    filesystem::path directory = file.parent_path();
+    int fd = open(directory.empty() ? "." : directory.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+#else
+    (void)file;
+#endif
+}
+
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t generation; // Journal file that continues from this snapshot
+};
+constexpr char snapshotMagic[8] = {'S', 'T', 'K', 'S', 'N', 'A', 'P', '\0'};
+constexpr uint32_t snapshotVersion = 1;
+
+// Append-only journal of account events with group commit. append() only encodes into a
+// pending buffer; a writer thread takes everything that piled up while the previous fsync ran
+// and writes it with a single fsync, so disk latency never reaches the trading path.
+// State is base.snapshot plus base.journal.<generation>. A snapshot request is queued in line
+// with the records: the writer writes the image to a temporary file, renames it over the old
+// snapshot pointing at a fresh journal generation, and deletes the old journal, so replay only
+// ever reads one snapshot and the records after it.
+class Journal {
+private:
+    string basePath;
+    uint64_t generation = 0;
+    FILE* file = nullptr;
+    mutex lock;
+    condition_variable wake;        // Writer: records or a snapshot are waiting
+    condition_variable durableWake; // flush(): a batch reached the disk
+    string pending;                 // Encoded records not yet taken by the writer
+    string snapshotImage;
+    size_t snapshotAt = string::npos; // Offset in pending the snapshot image corresponds to
+    uint64_t appended = 0;
+    uint64_t durable = 0;
+    uint64_t batches = 0;
+    bool stopping = false;
+    bool failed = false;
+    thread writer;
+
+    string snapshotPath() const
+    {
+        return basePath + ".snapshot";
+    }
+    string journalPath(uint64_t journalGeneration) const
+    {
+        return basePath + ".journal." + to_string(journalGeneration);
+    }
+
+    bool writeBytes(const char* bytes, size_t size)
+    {
+        return size == 0 || fwrite(bytes, 1, size, file) == size;
+    }
+
+    // Runs on the writer thread, after the records preceding the snapshot were written.
+    bool rotate(const string& image)
+    {
+        uint64_t next = generation + 1;
+        string temporary = snapshotPath() + ".tmp";
+        FILE* out = fopen(temporary.c_str(), "wb");
+        if (!out)
+        {
+            return false;
+        }
+        SnapshotHeader header{};
+        memcpy(header.magic, snapshotMagic, sizeof(header.magic));
+        header.version = snapshotVersion;
+        header.generation = next;
+        bool written = fwrite(&header, sizeof(header), 1, out) == 1 &&
+                       fwrite(image.data(), 1, image.size(), out) == image.size() && syncFile(out);
+        fclose(out);
+        FILE* nextFile = written ? fopen(journalPath(next).c_str(), "wb") : nullptr;
+        error_code error;
+        if (nextFile)
+        {
+            filesystem::rename(temporary, snapshotPath(), error);
+        }
+        if (!nextFile || error)
+        {
+            if (nextFile)
+            {
+                fclose(nextFile);
+            }
+            filesystem::remove(temporary, error);
+            return false; // Keep appending to the current generation
+        }
+        syncDirectory(snapshotPath());
+        fclose(file);
+        filesystem::remove(journalPath(generation), error);
+        file = nextFile;
+        generation = next;
+        return true;
+    }
+
+    void writerLoop()
+    {
+        string batch;
+        string image;
+        unique_lock<mutex> guard(lock);
+        while (true)
+        {
+            wake.wait(guard, [this] { return stopping || !pending.empty() || snapshotAt != string::npos; });
+            if (pending.empty() && snapshotAt == string::npos)
+            {
+                break; // Stopping with nothing left to write
+            }
+            batch.clear();
+            swap(batch, pending);
+            size_t cut = snapshotAt == string::npos ? batch.size() : snapshotAt;
+            bool snapshot = snapshotAt != string::npos;
+            swap(image, snapshotImage);
+            snapshotAt = string::npos;
+            uint64_t batchEnd = appended;
+            bool skip = failed;
+            guard.unlock();
+
+            bool ok = skip || writeBytes(batch.data(), cut);
+            if (ok && !skip && snapshot && !rotate(image))
+            {
+                cout << "Journal: snapshot failed, replay will read the whole journal." << endl;
+            }
+            ok = skip || (ok && writeBytes(batch.data() + cut, batch.size() - cut) && syncFile(file));
+            if (!ok)
+            {
+                cout << "Journal: write to " << journalPath(generation) << " failed; account changes are no longer saved."
+                     << endl;
+            }
+
+            guard.lock();
+            failed = failed || !ok;
+            durable = batchEnd;
+            ++batches;
+            durableWake.notify_all();
+        }
+    }
+
+public:
+    Journal() = default;
+    ~Journal()
+    {
+        close();
+    }
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    // Replays the snapshot and the journal after it through apply(record, symbol), cuts off a
+    // torn tail left by a crash and starts the writer. Returns an error message, empty on success.
+    template <class Fn>
+    string open(const string& path, Fn&& apply)
+    {
+        close();
+        basePath = path;
+        generation = 0;
+        if (filesystem::exists(snapshotPath()))
+        {
+            MappedFile snapshot(snapshotPath());
+            SnapshotHeader header;
+            if (!snapshot.isOpen() || snapshot.size() < sizeof(header))
+            {
+                return snapshotPath() + ": cannot read snapshot";
+            }
+            memcpy(&header, snapshot.data(), sizeof(header));
+            if (memcmp(header.magic, snapshotMagic, sizeof(header.magic)) != 0 || header.version != snapshotVersion)
+            {
+                return snapshotPath() + ": not a snapshot file";
+            }
+            string_view body = snapshot.text().substr(sizeof(header));
+            if (forEachJournalRecord(body, apply) != body.size())
+            {
+                return snapshotPath() + ": snapshot is corrupt";
+            }
+            generation = header.generation;
+        }
+        error_code error;
+        if (generation > 0)
+        {
+            filesystem::remove(journalPath(generation - 1), error); // Left behind by a crash mid-rotation
+        }
+        if (filesystem::exists(journalPath(generation)))
+        {
+            size_t intact;
+            size_t size;
+            {
+                MappedFile journal(journalPath(generation));
+                if (!journal.isOpen())
+                {
+                    return journalPath(generation) + ": cannot read journal";
+                }
+                size = journal.size();
+                intact = forEachJournalRecord(journal.text(), apply);
+            }
+            if (intact != size)
+            {
+                filesystem::resize_file(journalPath(generation), intact, error);
+                if (error)
+                {
+                    return journalPath(generation) + ": cannot drop torn tail";
+                }
+            }
+        }
+        file = fopen(journalPath(generation).c_str(), "ab");
+        if (!file)
+        {
+            return journalPath(generation) + ": cannot open for appending";
+        }
+        stopping = false;
+        failed = false;
+        writer = thread(&Journal::writerLoop, this);
+        return "";
+    }
+
+    bool isOpen() const
+    {
+        return file != nullptr;
+    }
+
+    void append(JournalKind kind, string_view symbol, int64_t quantity, double amount, int64_t timestamp)
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            encodeJournalRecord(pending, kind, symbol, quantity, amount, timestamp);
+            ++appended;
+        }
+        wake.notify_one();
+    }
+
+    // Queues a compact image of the state after every record appended so far. A newer request
+    // replaces one the writer has not picked up yet.
+    void requestSnapshot(string image)
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            snapshotImage = move(image);
+            snapshotAt = pending.size();
+        }
+        wake.notify_one();
+    }
+
+    // Blocks until every record appended so far is on disk (or the journal has failed).
+    void flush()
+    {
+        unique_lock<mutex> guard(lock);
+        uint64_t target = appended;
+        durableWake.wait(guard, [&] { return durable >= target || failed || !writer.joinable(); });
+    }
+
+    // Writes out everything still pending and stops the writer.
+    void close()
+    {
+        if (writer.joinable())
+        {
+            {
+                lock_guard<mutex> guard(lock);
+                stopping = true;
+            }
+            wake.notify_one();
+            writer.join();
+        }
+        if (file)
+        {
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+    uint64_t getBatches()
+    {
+        lock_guard<mutex> guard(lock);
+        return batches;
+    }
+};
+
+// Inputs of a Monte Carlo run: the symbols held, as parallel columns, plus cash.
+struct RiskScenario
+{
+    vector<double> prices;
+    vector<double> volatilities;
+    vector<double> shares;
+    double cash = 0.0;
+    size_t paths = 10000;
+    int steps = 250; // Horizon in ticks
+    uint32_t seed = 1;
+};
+
+struct RiskReport
+{
+    size_t paths;
+    int steps;
+    double initialValue;
+    double meanValue;
+    double valueAtRisk95;      // Loss not exceeded on 95% of paths
+    double expectedShortfall95; // Mean loss over the worst 5%
+    double valueAtRisk99;
+    double expectedShortfall99;
+    array<double, 7> percentiles; // Portfolio value at the horizon; see riskPercentiles
+    double seconds;
+};
+constexpr array<double, 7> riskPercentiles = {0.01, 0.05, 0.25, 0.50, 0.75, 0.95, 0.99};
+
+// Runs scenario.paths independent futures of the tick model and values the portfolio at the
+// horizon. Paths are simulated in blocks: a block holds a few paths for all symbols as one flat
+// price/volatility column pair of about 8K entries (L2 sized), stepped in place by the same
+// updatePrices kernel the live market uses. Every draw is a pure function of (seed, block,
+// step, entry), so each path has its own stream and the result does not depend on how many
+// threads ran it. Blocks are spread over the pool; nothing is allocated per path.
+inline RiskReport runRiskSimulation(const RiskScenario& scenario, TickWorkerPool& pool)
+{
+    auto start = chrono::steady_clock::now();
+    size_t symbols = scenario.prices.size();
+    size_t paths = max<size_t>(1, scenario.paths);
+    size_t pathsPerBlock = max<size_t>(1, 8192 / max<size_t>(1, symbols));
+    size_t blocks = (paths + pathsPerBlock - 1) / pathsPerBlock;
+    vector<double> values(paths);
+    double initialValue = scenario.cash;
+    for (size_t s = 0; s < symbols; ++s)
+    {
+        initialValue += scenario.shares[s] * scenario.prices[s];
+    }
+
+    pool.run(blocks, 1, [&](size_t beginBlock, size_t endBlock)
+    {
+        AlignedVector<double> price(pathsPerBlock * symbols);
+        AlignedVector<double> volatility(pathsPerBlock * symbols);
+        PriceColumns columns{price.data(), volatility.data()};
+        for (size_t block = beginBlock; block < endBlock; ++block)
+        {
+            size_t firstPath = block * pathsPerBlock;
+            size_t blockPaths = min(pathsPerBlock, paths - firstPath);
+            size_t entries = blockPaths * symbols;
+            for (size_t p = 0; p < blockPaths; ++p)
+            {
+                copy(scenario.prices.begin(), scenario.prices.end(), price.begin() + p * symbols);
+                copy(scenario.volatilities.begin(), scenario.volatilities.end(), volatility.begin() + p * symbols);
+            }
+            uint32_t blockSeed = mixBits(scenario.seed ^ mixBits(static_cast<uint32_t>(block) * 0x9E3779B9U));
+            for (int step = 0; step < scenario.steps; ++step)
+            {
+                updatePrices(columns, columns, 0, entries, tickKey(blockSeed, static_cast<uint64_t>(step)));
+            }
+            for (size_t p = 0; p < blockPaths; ++p)
+            {
+                double value = scenario.cash;
+                const double* pathPrices = price.data() + p * symbols;
+                for (size_t s = 0; s < symbols; ++s)
+                {
+                    value += scenario.shares[s] * pathPrices[s];
+                }
+                values[firstPath + p] = value;
+            }
+        }
+    });
+
+    sort(values.begin(), values.end());
+    auto tailLoss = [&](double tail, double& valueAtRisk, double& expectedShortfall)
+    {
+        size_t count = max<size_t>(1, static_cast<size_t>(ceil(tail * paths)));
+        valueAtRisk = initialValue - values[count - 1];
+        double sum = 0.0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            sum += values[i];
+        }
+        expectedShortfall = initialValue - sum / count;
+    };
+    RiskReport report{};
+    report.paths = paths;
+    report.steps = scenario.steps;
+    report.initialValue = initialValue;
+    double total = 0.0;
+    for (double value : values)
+    {
+        total += value;
+    }
+    report.meanValue = total / paths;
+    tailLoss(0.05, report.valueAtRisk95, report.expectedShortfall95);
+    tailLoss(0.01, report.valueAtRisk99, report.expectedShortfall99);
+    for (size_t i = 0; i < riskPercentiles.size(); ++i)
+    {
+        report.percentiles[i] = values[min(paths - 1, static_cast<size_t>(riskPercentiles[i] * paths))];
+    }
+    report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+// Turns on ANSI escape handling where it is not on by default (Windows consoles).
+inline void enableTerminalEscapes()
+{
+#if defined(_WIN32)
+    HANDLE out = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD mode = 0;
+    if (GetConsoleMode(out, &mode))
+    {
+        SetConsoleMode(out, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+    }
+#endif
+}
+
+// Full-screen renderer for live views. A frame is drawn into a rows x cols character buffer
+// (numbers formatted in place with to_chars), compared with the previous frame, and only the
+// cells that changed are sent, with ANSI cursor moves, in a single write. A board that redraws
+// ten times a second but changes once a tick costs almost nothing between ticks.
+class TerminalRenderer {
+private:
+    int rows = 0;
+    int cols = 0;
+    string frame;    // rows * cols cells being drawn
+    string previous; // What the terminal shows now
+    string output;   // Escape stream for one present(), reused
+    bool repaint = true;
+
+    static void writeTerminal(const string& bytes)
+    {
+#if defined(_WIN32)
+        DWORD written = 0;
+        WriteFile(GetStdHandle(STD_OUTPUT_HANDLE), bytes.data(), static_cast<DWORD>(bytes.size()), &written, nullptr);
+#else
+        for (size_t sent = 0; sent < bytes.size();)
+        {
+            ssize_t n = write(STDOUT_FILENO, bytes.data() + sent, bytes.size() - sent);
+            if (n <= 0)
+            {
+                return;
+            }
+            sent += static_cast<size_t>(n);
+        }
+#endif
+    }
+
+    void moveTo(int row, int col)
+    {
+        char move[24];
+        int length = snprintf(move, sizeof(move), "\033[%d;%dH", row + 1, col + 1);
+        output.append(move, static_cast<size_t>(length));
+    }
+
+public:
+    // Visible terminal size, 24 x 80 when it cannot be queried.
+    static pair<int, int> terminalSize()
+    {
+#if defined(_WIN32)
+        CONSOLE_SCREEN_BUFFER_INFO info;
+        if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info))
+        {
+            return {info.srWindow.Bottom - info.srWindow.Top + 1, info.srWindow.Right - info.srWindow.Left + 1};
+        }
+#else
+        winsize size{};
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 0 && size.ws_col > 0)
+        {
+            return {size.ws_row, size.ws_col};
+        }
+#endif
+        return {24, 80};
+    }
+
+    // Starts a blank frame; a size change makes the next present() repaint everything.
+    void beginFrame(int frameRows, int frameCols)
+    {
+        if (frameRows != rows || frameCols != cols)
+        {
+            rows = frameRows;
+            cols = frameCols;
+            previous.assign(static_cast<size_t>(rows) * cols, ' ');
+            repaint = true;
+        }
+        frame.assign(static_cast<size_t>(rows) * cols, ' ');
+    }
+
+    int getRows() const { return rows; }
+    int getCols() const { return cols; }
+
+    // Left-aligned text, clipped to width (or to the end of the row).
+    void text(int row, int col, string_view value, int width = INT_MAX)
+    {
+        if (row < 0 || row >= rows || col >= cols)
+        {
+            return;
+        }
+        size_t length = min({value.size(), static_cast<size_t>(max(width, 0)), static_cast<size_t>(cols - col)});
+        memcpy(&frame[static_cast<size_t>(row) * cols + col], value.data(), length);
+    }
+
+    // Right-aligned fixed-point number in [col, col + width), then an optional suffix.
+    void number(int row, int col, int width, double value, int precision, char suffix = '\0')
+    {
+        char digits[64];
+        to_chars_result result = to_chars(digits, digits + sizeof(digits) - 1, value, chars_format::fixed, precision);
+        if (result.ec != errc())
+        {
+            return;
+        }
+        if (suffix)
+        {
+            *result.ptr++ = suffix;
+        }
+        size_t length = static_cast<size_t>(result.ptr - digits);
+        int start = col + max(0, width - static_cast<int>(length));
+        text(row, start, string_view(digits, length), static_cast<int>(length));
+    }
+
+    // Sends the difference to the previous frame. Unchanged gaps of a few cells are resent
+    // rather than paying for another cursor move.
+    void present()
+    {
+        output.clear();
+        if (repaint)
+        {
+            output += "\033[?25l\033[2J"; // Hide the cursor while the board is up
+            previous.assign(frame.size(), '\0');
+            repaint = false;
+        }
+        constexpr int maxGap = 6;
+        for (int row = 0; row < rows; ++row)
+        {
+            const char* now = frame.data() + static_cast<size_t>(row) * cols;
+            const char* was = previous.data() + static_cast<size_t>(row) * cols;
+            int col = 0;
+            while (col < cols)
+            {
+                if (now[col] == was[col])
+                {
+                    ++col;
+                    continue;
+                }
+                int end = col + 1;
+                for (int gap = 0; end < cols && gap <= maxGap; ++end)
+                {
+                    gap = now[end] == was[end] ? gap + 1 : 0;
+                }
+                while (end > col && now[end - 1] == was[end - 1])
+                {
+                    --end;
+                }
+                moveTo(row, col);
+                output.append(now + col, static_cast<size_t>(end - col));
+                col = end;
+            }
+        }
+        if (!output.empty())
+        {
+            writeTerminal(output);
+        }
+        swap(previous, frame);
+    }
+
+    // Leaves the screen to ordinary output; the next frame repaints from scratch.
+    void release()
+    {
+        if (rows > 0)
+        {
+            writeTerminal("\033[?25h\033[2J\033[H");
+        }
+        rows = 0;
+        cols = 0;
+        repaint = true;
+    }
+};
+
+// Shares traded in each symbol since the market started, and what they traded for, counted from
+// the matching engine's fills by whichever thread traded. Consumers on the tick thread keep the
+// last totals they saw and take the difference. Grown by StockMarket as symbols load, before
+// anyone trades them.
+class TradedVolume {
+private:
+    unique_ptr<atomic<uint64_t>[]> totals;
+    unique_ptr<atomic<int64_t>[]> notionals; // Cents: fill price x quantity
+    size_t count = 0;
+
+public:
+    void resize(size_t symbols)
+    {
+        if (symbols <= count)
+        {
+            return;
+        }
+        auto grown = make_unique<atomic<uint64_t>[]>(symbols);
+        auto grownNotionals = make_unique<atomic<int64_t>[]>(symbols);
+        for (size_t id = 0; id < count; ++id)
+        {
+            grown[id].store(totals[id].load(memory_order_relaxed), memory_order_relaxed);
+            grownNotionals[id].store(notionals[id].load(memory_order_relaxed), memory_order_relaxed);
+        }
+        totals = move(grown);
+        notionals = move(grownNotionals);
+        count = symbols;
+    }
+    // Counts the fills from index `first` on.
+    void add(const vector<Fill>& fills, size_t first)
+    {
+        for (size_t i = first; i < fills.size(); ++i)
+        {
+            if (fills[i].symbol < count)
+            {
+                totals[fills[i].symbol].fetch_add(fills[i].quantity, memory_order_relaxed);
+                notionals[fills[i].symbol].fetch_add(fills[i].priceTicks * fills[i].quantity, memory_order_relaxed);
+            }
+        }
+    }
+    uint64_t get(uint32_t symbol) const
+    {
+        return symbol < count ? totals[symbol].load(memory_order_relaxed) : 0;
+    }
+    // The two totals are read apart, so a fill landing between them shows up in one a tick
+    // before the other; differences taken every tick still add up.
+    int64_t getNotional(uint32_t symbol) const
+    {
+        return symbol < count ? notionals[symbol].load(memory_order_relaxed) : 0;
+    }
+};
+
+// Bit stream for the tick history: values are packed most significant bit first into 64-bit words.
+class BitWriter {
+private:
+    vector<uint64_t> words;
+    uint64_t current = 0;
+    int used = 0; // Bits taken in current
+
+public:
+    // Appends the low `bits` bits of value, bits in [1, 64]. The bits above them must be zero.
+    void write(uint64_t value, int bits)
+    {
+        int free = 64 - used;
+        if (bits < free)
+        {
+            current |= value << (free - bits);
+            used += bits;
+            return;
+        }
+        int rest = bits - free;
+        words.push_back(current | (value >> rest));
+        current = rest ? value << (64 - rest) : 0;
+        used = rest;
+    }
+    size_t bitCount() const
+    {
+        return words.size() * 64 + used;
+    }
+    // The stream rounded up to whole words.
+    size_t wordCount() const
+    {
+        return words.size() + (used > 0);
+    }
+    // Words copyTo() writes: wordCount() and one zero word of padding, so a reader can always
+    // look 64 bits ahead.
+    size_t paddedWords() const
+    {
+        return wordCount() + 1;
+    }
+    void copyTo(uint64_t* out) const
+    {
+        copy(words.begin(), words.end(), out);
+        size_t n = words.size();
+        if (used > 0)
+        {
+            out[n++] = current;
+        }
+        out[n] = 0;
+    }
+    void clear()
+    {
+        words.clear();
+        current = 0;
+        used = 0;
+    }
+};
+
+class BitReader {
+private:
+    const uint64_t* words;
+    size_t position = 0;
+
+    uint64_t peek() const
+    {
+        size_t index = position >> 6;
+        int offset = static_cast<int>(position & 63);
+        uint64_t value = words[index] << offset;
+        return offset ? value | (words[index + 1] >> (64 - offset)) : value;
+    }
+
+public:
+    explicit BitReader(const uint64_t* words) : words(words) {}
+
+    uint64_t read(int bits)
+    {
+        uint64_t value = peek() >> (64 - bits);
+        position += bits;
+        return value;
+    }
+    // Ones before the next zero, which is consumed too. A run of `limit` ones ends without one.
+    int readOnes(int limit)
+    {
+        uint64_t inverted = ~peek();
+        int ones = inverted ? countLeadingZeros(inverted) : 64;
+        if (ones >= limit)
+        {
+            position += limit;
+            return limit;
+        }
+        position += ones + 1;
+        return ones;
+    }
+};
+
+inline uint64_t zigzagEncode(int64_t value)
+{
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+inline int64_t zigzagDecode(uint64_t value)
+{
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Rice code: the quotient z >> k in unary, then the low k bits. A quotient of riceEscape or more
+// is written as riceEscape ones followed by z in full.
+constexpr int riceEscape = 32;
+constexpr int maxRiceBits = 30;
+inline void writeRice(BitWriter& out, uint64_t z, int k)
+{
+    uint64_t quotient = z >> k;
+    if (quotient < static_cast<uint64_t>(riceEscape))
+    {
+        uint64_t ones = ((uint64_t{1} << quotient) - 1) << 1;
+        uint64_t low = k ? z & ((uint64_t{1} << k) - 1) : 0;
+        out.write((ones << k) | low, static_cast<int>(quotient) + 1 + k);
+    }
+    else
+    {
+        out.write((uint64_t{1} << riceEscape) - 1, riceEscape);
+        out.write(z, 64);
+    }
+}
+inline uint64_t readRice(BitReader& in, int k)
+{
+    int quotient = in.readOnes(riceEscape);
+    if (quotient == riceEscape)
+    {
+        return in.read(64);
+    }
+    return (static_cast<uint64_t>(quotient) << k) | (k ? in.read(k) : 0);
+}
+
+// Timestamp delta-of-delta buckets, as in Gorilla: a steady tick rate costs one bit a tick.
+inline void writeTimeDelta(BitWriter& out, int64_t deltaOfDelta)
+{
+    uint64_t z = zigzagEncode(deltaOfDelta);
+    if (z == 0)
+        out.write(0, 1);
+    else if (z < (1 << 7))
+        out.write((uint64_t{0b10} << 7) | z, 9);
+    else if (z < (1 << 9))
+        out.write((uint64_t{0b110} << 9) | z, 12);
+    else if (z < (1 << 12))
+        out.write((uint64_t{0b1110} << 12) | z, 16);
+    else
+    {
+        out.write(0b1111, 4);
+        out.write(z, 64);
+    }
+}
+inline int64_t readTimeDelta(BitReader& in)
+{
+    static constexpr int payload[] = {0, 7, 9, 12, 64};
+    int bucket = in.readOnes(4);
+    return bucket ? zigzagDecode(in.read(payload[bucket])) : 0;
+}
+
+// Traded volume: one zero bit for none, else a one, the bit length - 1 in six bits and the bits.
+inline void writeVolume(BitWriter& out, uint64_t volume)
+{
+    if (volume == 0)
+    {
+        out.write(0, 1);
+        return;
+    }
+    int length = 64 - countLeadingZeros(volume);
+    out.write((uint64_t{1} << 6) | static_cast<uint64_t>(length - 1), 7);
+    out.write(volume, length);
+}
+inline uint64_t readVolume(BitReader& in)
+{
+    if (in.read(1) == 0)
+    {
+        return 0;
+    }
+    int length = static_cast<int>(in.read(6)) + 1;
+    return in.read(length);
+}
+
+// A price change and the volume traded with it, usually in a single write.
+inline void writeSample(BitWriter& out, uint64_t z, int k, uint64_t volume)
+{
+    uint64_t quotient = z >> k;
+    if (volume == 0 && quotient < static_cast<uint64_t>(riceEscape))
+    {
+        uint64_t ones = ((uint64_t{1} << quotient) - 1) << 1;
+        uint64_t low = k ? z & ((uint64_t{1} << k) - 1) : 0;
+        out.write(((ones << k) | low) << 1, static_cast<int>(quotient) + 2 + k);
+        return;
+    }
+    writeRice(out, z, k);
+    writeVolume(out, volume);
+}
+
+enum class BarResolution : uint8_t { Second, Minute, Hour };
+constexpr size_t barResolutions = 3;
+constexpr int64_t barMilliseconds(BarResolution resolution)
+{
+    return resolution == BarResolution::Second ? 1000 : resolution == BarResolution::Minute ? 60000 : 3600000;
+}
+
+// One OHLCV bar. Prices are whole cents, like the matching engine's.
+struct PriceBar
+{
+    int64_t startMs; // Milliseconds since the epoch, a multiple of the bar length
+    int64_t open;
+    int64_t high;
+    int64_t low;
+    int64_t close;
+    uint64_t volume;
+    uint32_t samples; // Ticks of the market in the bucket
+};
+
+// Rice parameter for values that average `mean`.
+inline int riceBitsFor(uint64_t mean)
+{
+    return min(maxRiceBits, 63 - countLeadingZeros(mean + 1));
+}
+
+// History segments: a run of rows of every symbol, a row being a tick in the tick stream and a
+// bucket in a bar series. Laid out in 64-bit words as the header, the row stream (tick times, or
+// bucket starts and tick counts), one summary per symbol, then the symbols' streams back to back
+// and a zero word; the archive file is just segments of every kind back to back.
+constexpr uint32_t historySegmentTicks = 1024;
+constexpr uint32_t barSegmentRows = 256;
+constexpr char historyMagic[8] = {'S', 'T', 'K', 'H', 'I', 'S', 'T', '\0'};
+constexpr uint32_t historyVersion = 2;
+
+struct HistorySegmentHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t symbols;
+    uint64_t firstTick;
+    uint32_t ticks; // Rows
+    uint32_t timeWords;
+    int64_t firstMs;
+    int64_t lastMs;
+    uint64_t totalWords;
+    uint32_t kind;  // 0 for ticks, 1 + BarResolution for bars
+    uint32_t every; // Ticks: one kept in this many
+};
+static_assert(sizeof(HistorySegmentHeader) % 8 == 0, "history segments are word aligned");
+
+// Per symbol and segment: where the symbol's stream starts and where it is.
+struct HistorySummary
+{
+    int64_t first;       // Cents: the price at the first tick, or the close before the first bar
+    uint32_t wordOffset; // From the start of the streams
+    uint32_t words;
+    uint16_t firstRow;   // Bars: the first row of a symbol listed during the segment
+    uint8_t riceBits[5]; // Bars: the Rice parameters the stream starts with, the gap's first
+    uint8_t reserved;
+};
+static_assert(sizeof(HistorySummary) % 8 == 0, "history segments are word aligned");
+
+constexpr size_t historyHeaderWords = sizeof(HistorySegmentHeader) / 8;
+constexpr size_t historySummaryWords = sizeof(HistorySummary) / 8;
+
+// Long-horizon price history: OHLCV bars of every symbol at 1s, 1m and 1h, rolled up as the ticks
+// arrive, and the ticks themselves, compressed.
+//
+// The bars are series of their own, so a bar query reads bars and never ticks. The 1s bars are
+// rolled up from every tick, each coarser series from the finer bars as their buckets close. A
+// symbol's bar is coded against its last close: the run of flat bars before it (no move, no
+// volume), then the open's move, the high above and the low below the body, the close's move from
+// the open and the volume, each Rice coded with a parameter that follows the recent bars. With
+// this price model a 1s bar takes about 36 bits; in a book where prices move a cent now and
+// then, about 5.
+//
+// The tick stream keeps one tick in `every` (1 keeps them all), with the volume traded since the
+// last one kept. All symbols tick together, so the times are one delta-of-delta stream per
+// segment. A sample is the change in cents since the last one, plus the volume. A tick only
+// copies the prices into a block of stageTicks rows, coded symbol by symbol when it fills: one
+// bit if the symbol neither moved nor traded, else the block's own Rice parameter and either
+// every sample or, when few changed, only those, each after the count of unchanged ones before
+// it. With prices that move by a random fraction every tick that is about 10 bits a sample; XOR
+// of the doubles, the other Gorilla trick, leaves more than 55 of the 64 bits, because every
+// mantissa changes. In the quiet book it is under a bit.
+//
+// Sealed segments stay in memory up to a byte budget, dropping the oldest ticks first, then the
+// oldest bars from the finest series up; or, with an archive path, go to an append-only file on a
+// writer thread and are read back from it by queries.
+class TickHistory {
+private:
+    static constexpr size_t kinds = 1 + barResolutions; // The ticks, then the bars by resolution
+    static constexpr uint32_t stageTicks = 32;
+    static constexpr uint32_t barRiceEvents = 32;
+    static_assert((barRiceEvents & (barRiceEvents - 1)) == 0, "bar Rice parameters adapt at powers of two");
+
+    struct Segment
+    {
+        uint64_t firstTick;
+        int64_t firstMs;
+        int64_t lastMs; // Bars: the start of the last bucket
+        uint32_t rows;
+        uint32_t symbols;
+        uint32_t timeWords;
+        uint64_t fileOffset;
+        shared_ptr<const vector<uint64_t>> words; // Null once it is only in the archive
+    };
+    struct Series // A symbol in the open tick segment
+    {
+        BitWriter bits;
+        HistorySummary summary{};
+        int64_t last = 0;
+    };
+    struct StagedVolume
+    {
+        uint32_t row;
+        uint32_t symbol;
+        uint64_t volume;
+    };
+    // Rice parameters of one symbol's bar stream, one per field; the writer and the reader move
+    // them alike. A segment's summary holds those it starts with, so they carry over from the
+    // last segment without a segment depending on it.
+    struct BarRice
+    {
+        static constexpr size_t fields = 4; // Open's move, high above the body, low below it, the body
+        array<int, fields> valueBits{};
+        int gapBits = 0;
+        uint32_t events = 0;
+        array<uint64_t, fields> valueSums{};
+        uint64_t gapSum = 0;
+
+        // For a symbol that has just listed: a typical move is around 1%, a zigzag value of about
+        // a hundredth of the price.
+        void start(int64_t price)
+        {
+            *this = {};
+            valueBits.fill(riceBitsFor(static_cast<uint64_t>(max<int64_t>(price, 0)) / 100));
+        }
+        // Starts a segment from the parameters as they are, recording them in its summary.
+        void restart(HistorySummary& summary)
+        {
+            summary.riceBits[0] = static_cast<uint8_t>(gapBits);
+            for (size_t field = 0; field < fields; ++field)
+            {
+                summary.riceBits[1 + field] = static_cast<uint8_t>(valueBits[field]);
+            }
+            load(summary);
+        }
+        void load(const HistorySummary& summary)
+        {
+            *this = {};
+            gapBits = min<int>(summary.riceBits[0], maxRiceBits);
+            for (size_t field = 0; field < fields; ++field)
+            {
+                valueBits[field] = min<int>(summary.riceBits[1 + field], maxRiceBits);
+            }
+        }
+        void update(uint64_t gap, const uint64_t* values)
+        {
+            gapSum += gap;
+            for (size_t field = 0; field < fields; ++field)
+            {
+                valueSums[field] += values[field];
+            }
+            // Adapts after 4, 8, 16 and 32 bars, so a new stream settles quickly, then starts over.
+            if (++events < 4 || (events & (events - 1)) != 0)
+            {
+                return;
+            }
+            for (size_t field = 0; field < fields; ++field)
+            {
+                valueBits[field] = riceBitsFor(valueSums[field] / events);
+            }
+            gapBits = riceBitsFor(gapSum / events);
+            if (events == barRiceEvents)
+            {
+                events = 0;
+                valueSums = {};
+                gapSum = 0;
+            }
+        }
+    };
+    struct BarCoder // A symbol in the open segment of a bar series
+    {
+        BitWriter bits;
+        HistorySummary summary{};
+        BarRice rice;
+        int64_t last = 0;  // Close of the last bar
+        uint32_t flat = 0; // Flat bars since the last one written
+    };
+    struct BarSeries
+    {
+        int64_t span = 0;
+        // The bar of every symbol in the bucket at formingMs, while it has ticks.
+        int64_t formingMs = 0;
+        uint32_t formingTicks = 0;
+        vector<int64_t> open;
+        vector<int64_t> high;
+        vector<int64_t> low;
+        vector<int64_t> close;
+        vector<uint64_t> volume;
+        // The open segment.
+        vector<BarCoder> coders;
+        BitWriter rows;
+        uint32_t rowCount = 0;
+        int64_t firstMs = 0;
+        int64_t lastMs = 0;
+    };
+    // One symbol's part of one segment, copied out for decoding without the lock.
+    struct Slice
+    {
+        int64_t firstMs;
+        int64_t lastMs;
+        uint32_t rows;
+        HistorySummary summary;
+        vector<uint64_t> times;
+        vector<uint64_t> data;
+        vector<int64_t> stagedPrices; // Open tick segment: the last ticks, not coded yet
+        vector<uint64_t> stagedVolumes;
+        uint32_t flat = 0;            // Open bar segment: flat bars not written yet
+    };
+
+    mutable mutex lock;
+    array<deque<Segment>, kinds> segments; // Oldest first
+    size_t memoryBudget = 0;
+    size_t memoryUsed = 0; // Words of the sealed segments held in memory, in bytes
+    uint32_t every = 1;
+    uint64_t ticksSeen = 0;
+    int64_t latest = 0;
+    uint64_t samples = 0;
+    array<uint64_t, kinds> sealedRows{}; // Symbol-ticks or symbol-bars
+    array<uint64_t, kinds> sealedBytes{};
+    bool opened = false;
+
+    vector<Series> openSeries;
+    BitWriter openTimes;
+    uint64_t openFirstTick = 0;
+    int64_t openFirstMs = 0;
+    int64_t openLastMs = 0;
+    int64_t lastDelta = 0;
+    uint32_t openTicks = 0;
+    vector<double> stagedPrices; // stageTicks rows of openSeries.size() prices
+    vector<StagedVolume> stagedVolumes;
+    uint32_t staged = 0;
+    vector<uint64_t> tickSeenVolume; // TradedVolume totals at the last kept tick
+
+    array<BarSeries, barResolutions> barSeries;
+    vector<int64_t> tickPrices; // This tick's, in cents
+    vector<uint64_t> tickVolume;
+    vector<uint64_t> barSeenVolume; // TradedVolume totals at the last tick
+
+    string archivePath;
+    FILE* archive = nullptr;
+    uint64_t archiveSize = 0;
+    condition_variable wake;
+    deque<pair<size_t, size_t>> unwritten; // Kind and index into segments, in file order
+    bool stopping = false;
+    bool failed = false;
+    thread writer;
+
+    // Same as toPriceTicks for the positive prices the model produces, without the libm call.
+    static int64_t cents(double price)
+    {
+        return static_cast<int64_t>(price * (1.0 / priceTickSize) + 0.5);
+    }
+
+    // Lays out a sealed segment from the row stream and each symbol's summary and stream, then
+    // queues it for the archive or holds it under the budget.
+    template <class StreamOf>
+    void store(size_t kind, HistorySegmentHeader header, const BitWriter& rowStream, StreamOf streamOf)
+    {
+        uint32_t symbols = header.symbols;
+        size_t timeWords = rowStream.paddedWords();
+        size_t dataWords = 0;
+        for (uint32_t id = 0; id < symbols; ++id)
+        {
+            auto [summary, bits] = streamOf(id);
+            summary->wordOffset = static_cast<uint32_t>(dataWords);
+            summary->words = static_cast<uint32_t>(bits->wordCount());
+            dataWords += summary->words;
+            sealedRows[kind] += header.ticks - summary->firstRow;
+        }
+        size_t total = historyHeaderWords + timeWords + symbols * historySummaryWords + dataWords + 1;
+        auto words = make_shared<vector<uint64_t>>(total);
+        memcpy(header.magic, historyMagic, sizeof(header.magic));
+        header.version = historyVersion;
+        header.timeWords = static_cast<uint32_t>(timeWords);
+        header.totalWords = total;
+        header.kind = static_cast<uint32_t>(kind);
+        uint64_t* out = words->data();
+        memcpy(out, &header, sizeof(header));
+        rowStream.copyTo(out + historyHeaderWords);
+        uint64_t* summaries = out + historyHeaderWords + timeWords;
+        uint64_t* data = summaries + symbols * historySummaryWords;
+        for (uint32_t id = 0; id < symbols; ++id)
+        {
+            auto [summary, bits] = streamOf(id);
+            memcpy(summaries + id * historySummaryWords, summary, sizeof(HistorySummary));
+            bits->copyTo(data + summary->wordOffset); // Its padding is the next stream's first word
+        }
+        sealedBytes[kind] += total * 8;
+        segments[kind].push_back({header.firstTick, header.firstMs, header.lastMs, header.ticks, symbols,
+                                  static_cast<uint32_t>(timeWords), archiveSize, words});
+        memoryUsed += total * 8;
+        if (archive && !failed)
+        {
+            archiveSize += total * 8;
+            unwritten.push_back({kind, segments[kind].size() - 1});
+            wake.notify_one();
+        }
+        else
+        {
+            evictToBudget();
+        }
+    }
+
+    void startSegment(int64_t nowMs, uint64_t tick)
+    {
+        openSeries.resize(tickPrices.size());
+        for (uint32_t id = 0; id < openSeries.size(); ++id)
+        {
+            Series& series = openSeries[id];
+            series.bits.clear();
+            series.summary = {tickPrices[id], 0, 0, 0, {}, 0};
+            series.last = tickPrices[id];
+        }
+        stagedPrices.resize(stageTicks * openSeries.size());
+        openTimes.clear();
+        openFirstTick = tick;
+        openFirstMs = openLastMs = nowMs;
+        lastDelta = 0;
+    }
+
+    // One symbol's block of staged samples: a zero bit if it neither moved nor traded. Else a
+    // one, the block's Rice parameter, a bit for whether it traded (no volumes follow if not) and
+    // one for whether every sample follows; if not, the count of those that do, each after the
+    // count of unchanged ones before it.
+    static void writeBlock(BitWriter& out, const uint64_t* zigzags, const uint64_t* volumes, uint32_t rows,
+                           uint32_t events, uint64_t zigzagSum)
+    {
+        if (events == 0)
+        {
+            out.write(0, 1);
+            return;
+        }
+        int riceBits = riceBitsFor(zigzagSum / events);
+        bool traded = any_of(volumes, volumes + rows, [](uint64_t volume) { return volume != 0; });
+        bool dense = events == rows;
+        out.write(1, 1);
+        writeRice(out, static_cast<uint64_t>(riceBits), 2);
+        out.write((uint64_t{traded} << 1) | dense, 2);
+        auto sample = [&](uint32_t row)
+        {
+            if (traded)
+            {
+                writeSample(out, zigzags[row], riceBits, volumes[row]);
+            }
+            else
+            {
+                writeRice(out, zigzags[row], riceBits);
+            }
+        };
+        if (dense)
+        {
+            for (uint32_t row = 0; row < rows; ++row)
+            {
+                sample(row);
+            }
+            return;
+        }
+        writeRice(out, events - 1, 1);
+        int gapBits = riceBitsFor((rows - events) / events);
+        uint64_t gap = 0;
+        for (uint32_t row = 0; row < rows; ++row)
+        {
+            if ((zigzags[row] | volumes[row]) == 0)
+            {
+                ++gap;
+                continue;
+            }
+            writeRice(out, gap, gapBits);
+            sample(row);
+            gap = 0;
+        }
+    }
+    static void readBlock(BitReader& in, uint64_t* zigzags, uint64_t* volumes, uint32_t rows)
+    {
+        fill(zigzags, zigzags + rows, 0);
+        fill(volumes, volumes + rows, 0);
+        if (in.read(1) == 0)
+        {
+            return;
+        }
+        int riceBits = static_cast<int>(min<uint64_t>(readRice(in, 2), maxRiceBits));
+        bool traded = in.read(1);
+        auto sample = [&](uint64_t row)
+        {
+            zigzags[row] = readRice(in, riceBits);
+            volumes[row] = traded ? readVolume(in) : 0;
+        };
+        if (in.read(1))
+        {
+            for (uint32_t row = 0; row < rows; ++row)
+            {
+                sample(row);
+            }
+            return;
+        }
+        uint32_t events = static_cast<uint32_t>(min<uint64_t>(readRice(in, 1) + 1, rows));
+        int gapBits = riceBitsFor((rows - events) / events);
+        uint64_t row = 0;
+        for (uint32_t event = 0; event < events; ++event, ++row)
+        {
+            row += readRice(in, gapBits);
+            if (row >= rows)
+            {
+                return; // Corrupt; the rest reads as flat
+            }
+            sample(row);
+        }
+    }
+
+    void encodeStaged()
+    {
+        size_t count = openSeries.size();
+        stable_sort(stagedVolumes.begin(), stagedVolumes.end(),
+                    [](const StagedVolume& a, const StagedVolume& b) { return a.symbol < b.symbol; });
+        size_t next = 0;
+        uint64_t zigzags[stageTicks];
+        uint64_t volumes[stageTicks];
+        for (uint32_t id = 0; id < count; ++id)
+        {
+            Series& series = openSeries[id];
+            int64_t last = series.last;
+            uint32_t events = 0;
+            uint64_t zigzagSum = 0;
+            for (uint32_t row = 0; row < staged; ++row)
+            {
+                int64_t price = cents(stagedPrices[row * count + id]);
+                uint64_t volume = 0;
+                if (next < stagedVolumes.size() && stagedVolumes[next].symbol == id && stagedVolumes[next].row == row)
+                {
+                    volume = stagedVolumes[next++].volume;
+                }
+                zigzags[row] = zigzagEncode(price - last);
+                volumes[row] = volume;
+                events += (zigzags[row] | volume) != 0;
+                zigzagSum += zigzags[row];
+                last = price;
+            }
+            writeBlock(series.bits, zigzags, volumes, staged, events, zigzagSum);
+            series.last = last;
+        }
+        staged = 0;
+        stagedVolumes.clear();
+    }
+
+    void seal()
+    {
+        encodeStaged();
+        HistorySegmentHeader header{};
+        header.symbols = static_cast<uint32_t>(openSeries.size());
+        header.firstTick = openFirstTick;
+        header.ticks = openTicks;
+        header.firstMs = openFirstMs;
+        header.lastMs = openLastMs;
+        header.every = every;
+        store(0, header, openTimes, [this](uint32_t id) { return pair{&openSeries[id].summary, &openSeries[id].bits}; });
+        openTicks = 0;
+    }
+
+    // Stages this tick's prices, and the volume since the last tick kept, for the tick stream.
+    void appendTick(const MarketSnapshot& snap, const TradedVolume& traded, int64_t nowMs)
+    {
+        if (openTicks == 0)
+        {
+            startSegment(nowMs, snap.tick);
+        }
+        else
+        {
+            int64_t delta = nowMs - openLastMs;
+            writeTimeDelta(openTimes, delta - lastDelta);
+            lastDelta = delta;
+            openLastMs = nowMs;
+        }
+        size_t count = openSeries.size();
+        copy(snap.prices, snap.prices + count, stagedPrices.begin() + staged * count);
+        for (uint32_t id = static_cast<uint32_t>(tickSeenVolume.size()); id < count; ++id)
+        {
+            tickSeenVolume.push_back(traded.get(id)); // Volume before the symbol joined is not this tick's
+        }
+        for (uint32_t id = 0; id < count; ++id)
+        {
+            uint64_t total = traded.get(id);
+            if (total != tickSeenVolume[id])
+            {
+                stagedVolumes.push_back({staged, id, total - tickSeenVolume[id]});
+                tickSeenVolume[id] = total;
+            }
+        }
+        ++staged;
+        if (++openTicks == historySegmentTicks)
+        {
+            seal();
+        }
+        else if (staged == stageTicks)
+        {
+            encodeStaged();
+        }
+    }
+
+    // Starts the next segment of a bar series: every stream starts again from the symbol's close.
+    static void startBarSegment(BarSeries& series)
+    {
+        series.rows.clear();
+        series.rowCount = 0;
+        for (BarCoder& coder : series.coders)
+        {
+            coder.bits.clear();
+            coder.summary = {coder.last, 0, 0, 0, {}, 0};
+            coder.rice.restart(coder.summary);
+            coder.flat = 0;
+        }
+    }
+
+    // Symbols listed since the last tick join every bar series, flat at this tick's price.
+    void addBarSymbols(size_t from, size_t to)
+    {
+        for (BarSeries& series : barSeries)
+        {
+            series.open.insert(series.open.end(), tickPrices.begin() + from, tickPrices.begin() + to);
+            series.high.insert(series.high.end(), tickPrices.begin() + from, tickPrices.begin() + to);
+            series.low.insert(series.low.end(), tickPrices.begin() + from, tickPrices.begin() + to);
+            series.close.insert(series.close.end(), tickPrices.begin() + from, tickPrices.begin() + to);
+            series.volume.resize(to, 0);
+            for (size_t id = from; id < to; ++id)
+            {
+                BarCoder& coder = series.coders.emplace_back();
+                coder.last = tickPrices[id];
+                coder.summary = {coder.last, 0, 0, static_cast<uint16_t>(series.rowCount), {}, 0};
+                coder.rice.start(coder.last);
+                coder.rice.restart(coder.summary);
+            }
+        }
+    }
+
+    static void writeBar(BarCoder& coder, int64_t open, int64_t high, int64_t low, int64_t close, uint64_t volume)
+    {
+        int64_t last = coder.last;
+        if (open == last && high == last && low == last && close == last && volume == 0)
+        {
+            ++coder.flat;
+            return;
+        }
+        uint64_t values[BarRice::fields] = {zigzagEncode(open - last), static_cast<uint64_t>(high - max(open, close)),
+                                            static_cast<uint64_t>(min(open, close) - low), zigzagEncode(close - open)};
+        writeRice(coder.bits, coder.flat, coder.rice.gapBits);
+        for (size_t field = 0; field < BarRice::fields; ++field)
+        {
+            writeRice(coder.bits, values[field], coder.rice.valueBits[field]);
+        }
+        writeVolume(coder.bits, volume);
+        coder.rice.update(coder.flat, values);
+        coder.flat = 0;
+        coder.last = close;
+    }
+
+    // Writes the finished bucket of every symbol as a row of the series and folds it into the
+    // next coarser one.
+    void closeBucket(size_t resolution)
+    {
+        BarSeries& series = barSeries[resolution];
+        if (series.rowCount == 0)
+        {
+            series.firstMs = series.formingMs;
+        }
+        else
+        {
+            writeRice(series.rows, static_cast<uint64_t>((series.formingMs - series.lastMs) / series.span - 1), 0);
+        }
+        writeVolume(series.rows, series.formingTicks);
+        series.lastMs = series.formingMs;
+        size_t count = series.coders.size();
+        for (size_t id = 0; id < count; ++id)
+        {
+            writeBar(series.coders[id], series.open[id], series.high[id], series.low[id], series.close[id],
+                     series.volume[id]);
+        }
+        if (resolution + 1 < barResolutions)
+        {
+            BarSeries& coarse = barSeries[resolution + 1];
+            if (coarse.formingTicks == 0)
+            {
+                coarse.formingMs = series.formingMs - series.formingMs % coarse.span;
+                coarse.open = series.open;
+                coarse.high = series.high;
+                coarse.low = series.low;
+                coarse.close = series.close;
+                coarse.volume = series.volume;
+            }
+            else
+            {
+                for (size_t id = 0; id < count; ++id)
+                {
+                    coarse.high[id] = max(coarse.high[id], series.high[id]);
+                    coarse.low[id] = min(coarse.low[id], series.low[id]);
+                    coarse.close[id] = series.close[id];
+                    coarse.volume[id] += series.volume[id];
+                }
+            }
+            coarse.formingTicks += series.formingTicks;
+        }
+        series.formingTicks = 0;
+        if (++series.rowCount == barSegmentRows)
+        {
+            sealBars(resolution);
+        }
+    }
+
+    void sealBars(size_t resolution)
+    {
+        BarSeries& series = barSeries[resolution];
+        for (BarCoder& coder : series.coders)
+        {
+            if (coder.flat > 0)
+            {
+                writeRice(coder.bits, coder.flat, coder.rice.gapBits);
+            }
+        }
+        HistorySegmentHeader header{};
+        header.symbols = static_cast<uint32_t>(series.coders.size());
+        header.ticks = series.rowCount;
+        header.firstMs = series.firstMs;
+        header.lastMs = series.lastMs;
+        header.every = 1;
+        store(1 + resolution, header, series.rows,
+              [&series](uint32_t id) { return pair{&series.coders[id].summary, &series.coders[id].bits}; });
+        startBarSegment(series);
+    }
+
+    // Adds this tick to the forming 1s bars, closing the buckets it is past first.
+    void rollUp(int64_t nowMs)
+    {
+        for (size_t resolution = 0; resolution < barResolutions; ++resolution)
+        {
+            BarSeries& series = barSeries[resolution];
+            if (series.formingTicks > 0 && nowMs - nowMs % series.span != series.formingMs)
+            {
+                closeBucket(resolution);
+            }
+        }
+        BarSeries& seconds = barSeries[0];
+        size_t listed = seconds.coders.size();
+        size_t count = tickPrices.size();
+        if (count > listed)
+        {
+            addBarSymbols(listed, count);
+        }
+        const int64_t* prices = tickPrices.data();
+        const uint64_t* volumes = tickVolume.data();
+        if (seconds.formingTicks == 0)
+        {
+            seconds.formingMs = nowMs - nowMs % seconds.span;
+            copy(prices, prices + count, seconds.open.begin());
+            copy(prices, prices + count, seconds.high.begin());
+            copy(prices, prices + count, seconds.low.begin());
+            copy(prices, prices + count, seconds.close.begin());
+            copy(volumes, volumes + count, seconds.volume.begin());
+        }
+        else
+        {
+            int64_t* high = seconds.high.data();
+            int64_t* low = seconds.low.data();
+            uint64_t* volume = seconds.volume.data();
+            for (size_t id = 0; id < count; ++id)
+            {
+                high[id] = max(high[id], prices[id]);
+                low[id] = min(low[id], prices[id]);
+                volume[id] += volumes[id];
+            }
+            copy(prices, prices + count, seconds.close.begin());
+        }
+        ++seconds.formingTicks;
+    }
+
+    // Drops the oldest segments held in memory until they fit the budget: ticks first, then bars
+    // from the finest series up, always keeping the newest of each. Segments already in the archive
+    // cost no memory and stay.
+    void evictToBudget()
+    {
+        for (deque<Segment>& list : segments)
+        {
+            auto it = list.begin();
+            while (memoryUsed > memoryBudget && it != list.end() && next(it) != list.end())
+            {
+                if (!it->words)
+                {
+                    ++it;
+                    continue;
+                }
+                memoryUsed -= it->words->size() * 8;
+                it = list.erase(it);
+            }
+        }
+    }
+
+    void writerLoop()
+    {
+        unique_lock<mutex> guard(lock);
+        while (true)
+        {
+            wake.wait(guard, [this] { return stopping || !unwritten.empty(); });
+            if (unwritten.empty())
+            {
+                return;
+            }
+            auto [kind, index] = unwritten.front();
+            shared_ptr<const vector<uint64_t>> words = segments[kind][index].words;
+            guard.unlock();
+            bool ok = fwrite(words->data(), 8, words->size(), archive) == words->size() && fflush(archive) == 0;
+            guard.lock();
+            unwritten.pop_front();
+            if (ok)
+            {
+                // Readers go to the file from now on.
+                memoryUsed -= words->size() * 8;
+                segments[kind][index].words.reset();
+            }
+            else
+            {
+                // The file may end in part of this segment, so nothing more is appended: the
+                // segments already written stay readable at their offsets, and this one and all
+                // later ones are kept in memory under the budget, as without an archive.
+                failed = true;
+                archiveSize = segments[kind][index].fileOffset;
+                unwritten.clear();
+                evictToBudget();
+                cout << archivePath << ": cannot write price history, keeping it in memory from now on" << endl;
+            }
+        }
+    }
+
+    static void readWords(ifstream& file, uint64_t offset, uint64_t* out, size_t count)
+    {
+        file.seekg(static_cast<streamoff>(offset));
+        file.read(reinterpret_cast<char*>(out), static_cast<streamsize>(count * 8));
+        if (!file)
+        {
+            fill(out, out + count, 0); // Reads as a flat line rather than garbage
+            file.clear();
+        }
+    }
+
+    // Copies the symbol's part of a sealed segment into slice, from memory or the archive.
+    void fetch(const Segment& segment, uint32_t symbol, Slice& slice, ifstream& file) const
+    {
+        slice.firstMs = segment.firstMs;
+        slice.lastMs = segment.lastMs;
+        slice.rows = segment.rows;
+        size_t summaryAt = historyHeaderWords + segment.timeWords + symbol * historySummaryWords;
+        size_t dataAt = historyHeaderWords + segment.timeWords + segment.symbols * historySummaryWords;
+        if (segment.words)
+        {
+            const uint64_t* words = segment.words->data();
+            memcpy(&slice.summary, words + summaryAt, sizeof(HistorySummary));
+            slice.times.assign(words + historyHeaderWords, words + historyHeaderWords + segment.timeWords);
+            const uint64_t* data = words + dataAt + slice.summary.wordOffset;
+            slice.data.assign(data, data + slice.summary.words);
+            slice.data.push_back(0);
+            return;
+        }
+        if (!file.is_open())
+        {
+            file.open(archivePath, ios::binary);
+        }
+        readWords(file, segment.fileOffset + summaryAt * 8, reinterpret_cast<uint64_t*>(&slice.summary),
+                  historySummaryWords);
+        slice.times.resize(segment.timeWords);
+        readWords(file, segment.fileOffset + historyHeaderWords * 8, slice.times.data(), segment.timeWords);
+        slice.data.assign(slice.summary.words + size_t{1}, 0);
+        readWords(file, segment.fileOffset + (dataAt + slice.summary.wordOffset) * 8, slice.data.data(),
+                  slice.summary.words);
+    }
+
+    // The sealed segments of a kind that hold the symbol and overlap [fromMs, toMs], a segment
+    // covering its last row for lastSpan ms.
+    vector<Segment> overlapping(size_t kind, uint32_t symbol, int64_t fromMs, int64_t toMs, int64_t lastSpan) const
+    {
+        const deque<Segment>& list = segments[kind];
+        auto first = partition_point(list.begin(), list.end(), [&](const Segment& segment)
+        {
+            return segment.lastMs + lastSpan <= fromMs;
+        });
+        vector<Segment> found;
+        for (auto it = first; it != list.end() && it->firstMs <= toMs; ++it)
+        {
+            if (symbol < it->symbols)
+            {
+                found.push_back(*it);
+            }
+        }
+        return found;
+    }
+
+    // Copies out the symbol's tick slices overlapping [fromMs, toMs].
+    vector<Slice> slices(uint32_t symbol, int64_t fromMs, int64_t toMs) const
+    {
+        vector<Slice> result;
+        vector<Segment> stored;
+        {
+            lock_guard<mutex> guard(lock);
+            stored = overlapping(0, symbol, fromMs, toMs, 1);
+            if (openTicks > 0 && symbol < openSeries.size() && openLastMs >= fromMs && openFirstMs <= toMs)
+            {
+                const Series& series = openSeries[symbol];
+                Slice slice{openFirstMs, openLastMs, openTicks, series.summary, {}, {}, {}, {}, 0};
+                slice.stagedVolumes.assign(staged, 0);
+                for (const StagedVolume& staging : stagedVolumes)
+                {
+                    if (staging.symbol == symbol)
+                    {
+                        slice.stagedVolumes[staging.row] = staging.volume;
+                    }
+                }
+                for (uint32_t row = 0; row < staged; ++row)
+                {
+                    slice.stagedPrices.push_back(cents(stagedPrices[row * openSeries.size() + symbol]));
+                }
+                slice.times.resize(openTimes.paddedWords());
+                openTimes.copyTo(slice.times.data());
+                slice.data.resize(series.bits.paddedWords());
+                series.bits.copyTo(slice.data.data());
+                result.push_back(move(slice));
+            }
+        }
+        ifstream file;
+        vector<Slice> sealed(stored.size());
+        for (size_t i = 0; i < stored.size(); ++i)
+        {
+            fetch(stored[i], symbol, sealed[i], file);
+        }
+        result.insert(result.begin(), make_move_iterator(sealed.begin()), make_move_iterator(sealed.end()));
+        return result;
+    }
+
+    template <class Fn>
+    static void decode(const Slice& slice, int64_t fromMs, int64_t toMs, Fn& fn)
+    {
+        BitReader times(slice.times.data());
+        BitReader values(slice.data.data());
+        int64_t ms = slice.firstMs;
+        int64_t delta = 0;
+        int64_t price = slice.summary.first;
+        uint32_t encoded = slice.rows - static_cast<uint32_t>(slice.stagedPrices.size());
+        uint64_t zigzags[stageTicks];
+        uint64_t volumes[stageTicks];
+        for (uint32_t block = 0; block < slice.rows; block += stageTicks)
+        {
+            uint32_t rows = min(stageTicks, slice.rows - block);
+            if (block < encoded)
+            {
+                readBlock(values, zigzags, volumes, rows);
+            }
+            for (uint32_t row = 0; row < rows; ++row)
+            {
+                uint32_t t = block + row;
+                if (t > 0)
+                {
+                    delta += readTimeDelta(times);
+                    ms += delta;
+                }
+                uint64_t volume;
+                if (t < encoded)
+                {
+                    price += zigzagDecode(zigzags[row]);
+                    volume = volumes[row];
+                }
+                else
+                {
+                    price = slice.stagedPrices[t - encoded];
+                    volume = slice.stagedVolumes[t - encoded];
+                }
+                if (ms > toMs)
+                {
+                    return;
+                }
+                if (ms >= fromMs)
+                {
+                    fn(ms, price, volume);
+                }
+            }
+        }
+    }
+
+    // Copies out the symbol's bar slices overlapping [fromMs, toMs], and its bar in the forming
+    // bucket (samples 0 if none).
+    vector<Slice> barSlices(uint32_t symbol, size_t resolution, int64_t fromMs, int64_t toMs, PriceBar& forming) const
+    {
+        const BarSeries& series = barSeries[resolution];
+        vector<Slice> result;
+        vector<Segment> stored;
+        {
+            lock_guard<mutex> guard(lock);
+            stored = overlapping(1 + resolution, symbol, fromMs, toMs, series.span);
+            if (symbol >= series.coders.size())
+            {
+                return {};
+            }
+            if (series.rowCount > 0 && series.lastMs + series.span > fromMs && series.firstMs <= toMs)
+            {
+                const BarCoder& coder = series.coders[symbol];
+                Slice slice{series.firstMs, series.lastMs, series.rowCount, coder.summary, {}, {}, {}, {}, coder.flat};
+                slice.times.resize(series.rows.paddedWords());
+                series.rows.copyTo(slice.times.data());
+                slice.data.resize(coder.bits.paddedWords());
+                coder.bits.copyTo(slice.data.data());
+                result.push_back(move(slice));
+            }
+            // The forming bar: this series' bucket so far, then the finer series' forming bars.
+            forming = {};
+            for (size_t finer = resolution + 1; finer-- > 0;)
+            {
+                const BarSeries& part = barSeries[finer];
+                if (part.formingTicks == 0)
+                {
+                    continue;
+                }
+                if (forming.samples == 0)
+                {
+                    forming = {part.formingMs - part.formingMs % series.span, part.open[symbol], part.high[symbol],
+                               part.low[symbol], part.close[symbol], part.volume[symbol], part.formingTicks};
+                    continue;
+                }
+                forming.high = max(forming.high, part.high[symbol]);
+                forming.low = min(forming.low, part.low[symbol]);
+                forming.close = part.close[symbol];
+                forming.volume += part.volume[symbol];
+                forming.samples += part.formingTicks;
+            }
+        }
+        ifstream file;
+        vector<Slice> sealed(stored.size());
+        for (size_t i = 0; i < stored.size(); ++i)
+        {
+            fetch(stored[i], symbol, sealed[i], file);
+        }
+        result.insert(result.begin(), make_move_iterator(sealed.begin()), make_move_iterator(sealed.end()));
+        return result;
+    }
+
+    template <class Fn>
+    static void decodeBars(const Slice& slice, int64_t span, Fn& fn)
+    {
+        BitReader rowStream(slice.times.data());
+        vector<int64_t> starts(slice.rows);
+        vector<uint32_t> ticks(slice.rows);
+        int64_t start = slice.firstMs;
+        for (uint32_t row = 0; row < slice.rows; ++row)
+        {
+            if (row > 0)
+            {
+                start += static_cast<int64_t>(readRice(rowStream, 0) + 1) * span;
+            }
+            starts[row] = start;
+            ticks[row] = static_cast<uint32_t>(readVolume(rowStream));
+        }
+        BitReader in(slice.data.data());
+        BarRice rice;
+        rice.load(slice.summary);
+        int64_t last = slice.summary.first;
+        uint32_t written = slice.rows - slice.flat;
+        uint32_t row = slice.summary.firstRow;
+        auto flatUntil = [&](uint64_t end)
+        {
+            for (; row < end; ++row)
+            {
+                fn(PriceBar{starts[row], last, last, last, last, 0, ticks[row]});
+            }
+        };
+        while (row < written)
+        {
+            uint64_t gap = readRice(in, rice.gapBits);
+            flatUntil(min<uint64_t>(row + gap, written));
+            if (row >= written)
+            {
+                break;
+            }
+            uint64_t values[BarRice::fields];
+            for (size_t field = 0; field < BarRice::fields; ++field)
+            {
+                values[field] = readRice(in, rice.valueBits[field]);
+            }
+            uint64_t volume = readVolume(in);
+            int64_t open = last + zigzagDecode(values[0]);
+            int64_t close = open + zigzagDecode(values[3]);
+            fn(PriceBar{starts[row], open, max(open, close) + static_cast<int64_t>(values[1]),
+                        min(open, close) - static_cast<int64_t>(values[2]), close, volume, ticks[row]});
+            rice.update(gap, values);
+            last = close;
+            ++row;
+        }
+        flatUntil(slice.rows);
+    }
+
+public:
+    TickHistory()
+    {
+        for (size_t resolution = 0; resolution < barResolutions; ++resolution)
+        {
+            barSeries[resolution].span = barMilliseconds(static_cast<BarResolution>(resolution));
+        }
+    }
+    TickHistory(const TickHistory&) = delete;
+    TickHistory& operator=(const TickHistory&) = delete;
+    ~TickHistory()
+    {
+        close();
+    }
+
+    // Starts recording, keeping one tick in `keepEvery` in the tick stream; the bars see them all.
+    // With an archive path, sealed segments are appended to that file (created or truncated)
+    // instead of being held up to `budget` bytes in memory. Returns an error message, empty on
+    // success.
+    string open(const string& path, size_t budget, uint32_t keepEvery = 1)
+    {
+        if (opened)
+        {
+            return "Price history is already being recorded";
+        }
+        if (!path.empty())
+        {
+            archive = fopen(path.c_str(), "wb");
+            if (!archive)
+            {
+                return path + ": cannot open for writing";
+            }
+            archivePath = path;
+            writer = thread(&TickHistory::writerLoop, this);
+        }
+        memoryBudget = budget;
+        every = max<uint32_t>(keepEvery, 1);
+        opened = true;
+        return "";
+    }
+
+    bool isOpen() const
+    {
+        return opened;
+    }
+
+    // Seals what was recorded so far, the forming bars included, and finishes writing the
+    // archive. Later ticks are ignored.
+    void close()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            if (openTicks > 0)
+            {
+                seal();
+            }
+            for (size_t resolution = 0; resolution < barResolutions; ++resolution)
+            {
+                if (barSeries[resolution].formingTicks > 0)
+                {
+                    closeBucket(resolution);
+                }
+            }
+            for (size_t resolution = 0; resolution < barResolutions; ++resolution)
+            {
+                if (barSeries[resolution].rowCount > 0)
+                {
+                    sealBars(resolution);
+                }
+            }
+            stopping = true;
+        }
+        wake.notify_one();
+        if (writer.joinable())
+        {
+            writer.join();
+        }
+        if (archive)
+        {
+            fclose(archive);
+            archive = nullptr;
+        }
+    }
+
+    // Records one tick, with the volume traded since the last one. Runs on the tick thread.
+    void append(const MarketSnapshot& snap, const TradedVolume& traded)
+    {
+        append(snap, traded,
+               chrono::duration_cast<chrono::milliseconds>(chrono::system_clock::now().time_since_epoch()).count());
+    }
+    // The same at a given time, for replay and tests.
+    void append(const MarketSnapshot& snap, const TradedVolume& traded, int64_t nowMs)
+    {
+        lock_guard<mutex> guard(lock);
+        if (stopping)
+        {
+            return;
+        }
+        nowMs = max(nowMs, latest); // Keep time monotonic if the wall clock steps back
+        latest = nowMs;
+        size_t count = snap.count;
+        tickPrices.resize(count);
+        tickVolume.resize(count);
+        for (uint32_t id = static_cast<uint32_t>(barSeenVolume.size()); id < count; ++id)
+        {
+            barSeenVolume.push_back(traded.get(id)); // Volume before recording started is not this tick's
+        }
+        for (uint32_t id = 0; id < count; ++id)
+        {
+            tickPrices[id] = cents(snap.prices[id]);
+            uint64_t total = traded.get(id);
+            tickVolume[id] = total - barSeenVolume[id];
+            barSeenVolume[id] = total;
+        }
+        rollUp(nowMs);
+        samples += count;
+        if (ticksSeen++ % every == 0)
+        {
+            appendTick(snap, traded, nowMs);
+        }
+    }
+
+    // Calls fn(ms, priceCents, volume) for every sample of the symbol in the tick stream with a
+    // time in [fromMs, toMs], oldest first.
+    template <class Fn>
+    void forEachSample(uint32_t symbol, int64_t fromMs, int64_t toMs, Fn&& fn) const
+    {
+        for (const Slice& slice : slices(symbol, fromMs, toMs))
+        {
+            decode(slice, fromMs, toMs, fn);
+        }
+    }
+
+    // OHLCV bars of the symbol whose buckets overlap [fromMs, toMs], oldest first, the forming one
+    // included; buckets with no ticks are left out.
+    vector<PriceBar> bars(uint32_t symbol, BarResolution resolution, int64_t fromMs, int64_t toMs) const
+    {
+        int64_t span = barMilliseconds(resolution);
+        vector<PriceBar> result;
+        auto add = [&](const PriceBar& bar)
+        {
+            if (bar.startMs <= toMs && bar.startMs + span > fromMs)
+            {
+                result.push_back(bar);
+            }
+        };
+        PriceBar forming{};
+        for (const Slice& slice : barSlices(symbol, static_cast<size_t>(resolution), fromMs, toMs, forming))
+        {
+            decodeBars(slice, span, add);
+        }
+        if (forming.samples > 0)
+        {
+            add(forming);
+        }
+        return result;
+    }
+
+    // Time of the latest recorded tick, 0 before the first.
+    int64_t latestMs() const
+    {
+        lock_guard<mutex> guard(lock);
+        return latest;
+    }
+
+    struct Stats
+    {
+        uint64_t samples;      // Symbol-ticks recorded
+        uint64_t tickSamples;  // Symbol-ticks in sealed segments of the tick stream
+        uint64_t tickBytes;    // Their size, as stored
+        array<uint64_t, barResolutions> bars;     // Symbol-bars in sealed segments, by resolution
+        array<uint64_t, barResolutions> barBytes;
+        uint64_t sealedBytes;  // Size of every sealed segment, as stored
+        uint64_t memoryBytes;  // Sealed segments still held in memory
+        uint64_t archiveBytes; // Written to or queued for the archive
+        size_t segments;       // Sealed segments indexed
+    };
+    Stats getStats() const
+    {
+        lock_guard<mutex> guard(lock);
+        Stats stats{samples, sealedRows[0], sealedBytes[0], {}, {}, 0, memoryUsed, archiveSize, 0};
+        for (size_t kind = 0; kind < kinds; ++kind)
+        {
+            if (kind > 0)
+            {
+                stats.bars[kind - 1] = sealedRows[kind];
+                stats.barBytes[kind - 1] = sealedBytes[kind];
+            }
+            stats.sealedBytes += sealedBytes[kind];
+            stats.segments += segments[kind].size();
+        }
+        return stats;
+    }
+};
+
+enum class IndicatorKind : uint8_t { Sma, Ema, StdDev, BollingerUpper, BollingerLower, Rsi, Vwap };
+constexpr array<const char*, 7> indicatorNames = {"SMA", "EMA", "StdDev", "Bollinger upper", "Bollinger lower",
+                                                  "RSI", "VWAP"};
+constexpr double bollingerWidth = 2.0; // Standard deviations between the SMA and a band
+
+// Streaming technical indicators for every symbol, updated once per tick right after the price
+// update with O(1) work per symbol and indicator. State is columnar, one array per quantity
+// indexed by symbol id, so each indicator is one straight loop over all symbols that the
+// compiler vectorizes. Only registered indicators are computed.
+//
+// Indicators with the same window length share a Window: rings of the last `length` ticks of
+// prices and, for VWAP, of the shares traded and what they traded for at their fill prices,
+// with running sums that one fused pass per tick keeps up to date. The sums are recomputed
+// from the rings every resumWraps times round, before rounding can build up. EMA and RSI (Wilder's smoothing) only keep their averages. A symbol, window or
+// indicator starts as if the price had been flat before it appeared.
+class IndicatorEngine {
+private:
+    struct Window
+    {
+        uint32_t length;
+        bool levels = false;  // Keeps the price ring and sum, for SMA, StdDev and the bands
+        bool squares = false; // Keeps sumSquares, for StdDev and the bands
+        bool volume = false;  // Keeps the volume rings, for VWAP
+        uint32_t slot = 0;    // Ring row the next tick replaces: the oldest
+        uint32_t wraps = 0;
+        vector<double> prices; // length rows of one price per symbol
+        vector<double> sum;
+        vector<double> sumSquares;
+        vector<double> notionals; // length rows, what the tick's fills traded for, in dollars
+        vector<double> volumes;   // length rows, shares traded
+        vector<double> notionalSum;
+        vector<double> volumeSum;
+    };
+    struct Indicator
+    {
+        IndicatorKind kind;
+        uint32_t length;
+        uint32_t window;       // Index into windows, for the kinds that use one
+        vector<double> values; // Per symbol, as of the last tick
+        vector<double> first;  // EMA: the average. RSI: average gain
+        vector<double> second; // RSI: average loss
+    };
+    mutable mutex lock;
+    vector<Window> windows;
+    vector<Indicator> indicators;
+    vector<double> previous;    // Prices of the last tick
+    vector<double> tickVolume;   // Shares traded during the last tick
+    vector<double> tickNotional; // And what they traded for, in dollars
+    vector<uint64_t> seenVolume; // TradedVolume totals at the last tick
+    vector<int64_t> seenNotional;
+    size_t count = 0;            // Symbols the state covers
+    atomic<bool> active{false};
+    static constexpr uint32_t resumWraps = 16;
+
+    static bool usesWindow(IndicatorKind kind)
+    {
+        return kind != IndicatorKind::Ema && kind != IndicatorKind::Rsi;
+    }
+
+    // Re-lays rows of `from` values as rows of `to`, the new columns set to fill.
+    static void widenRows(vector<double>& rows, uint32_t length, size_t from, size_t to, const double* fill)
+    {
+        vector<double> wide(length * to);
+        for (uint32_t row = 0; row < length; ++row)
+        {
+            double* out = wide.data() + row * to;
+            if (from > 0)
+            {
+                copy(rows.begin() + row * from, rows.begin() + (row + 1) * from, out);
+            }
+            for (size_t id = from; id < to; ++id)
+            {
+                out[id] = fill ? fill[id] : 0.0;
+            }
+        }
+        rows.swap(wide);
+    }
+
+    // Recomputes the window's sums from its rings.
+    void resum(Window& window)
+    {
+        window.sum.assign(window.levels ? count : 0, 0.0);
+        window.sumSquares.assign(window.squares ? count : 0, 0.0);
+        window.notionalSum.assign(window.volume ? count : 0, 0.0);
+        window.volumeSum.assign(window.volume ? count : 0, 0.0);
+        for (uint32_t row = 0; row < window.length; ++row)
+        {
+            const double* prices = window.prices.data() + row * count;
+            if (window.levels)
+            {
+                for (size_t id = 0; id < count; ++id)
+                {
+                    window.sum[id] += prices[id];
+                }
+            }
+            if (window.squares)
+            {
+                for (size_t id = 0; id < count; ++id)
+                {
+                    window.sumSquares[id] += prices[id] * prices[id];
+                }
+            }
+            if (window.volume)
+            {
+                const double* notionals = window.notionals.data() + row * count;
+                const double* volumes = window.volumes.data() + row * count;
+                for (size_t id = 0; id < count; ++id)
+                {
+                    window.notionalSum[id] += notionals[id];
+                    window.volumeSum[id] += volumes[id];
+                }
+            }
+        }
+    }
+
+    // Extends every window and indicator to the symbols in [from, to), flat at `prices`.
+    void startSymbols(size_t from, size_t to, const double* prices)
+    {
+        for (Window& window : windows)
+        {
+            if (window.levels)
+            {
+                widenRows(window.prices, window.length, from, to, prices);
+            }
+            if (window.volume)
+            {
+                widenRows(window.notionals, window.length, from, to, nullptr);
+                widenRows(window.volumes, window.length, from, to, nullptr);
+            }
+        }
+        for (Indicator& indicator : indicators)
+        {
+            indicator.values.resize(to, numeric_limits<double>::quiet_NaN());
+            if (indicator.kind == IndicatorKind::Ema)
+            {
+                indicator.first.insert(indicator.first.end(), prices + from, prices + to);
+            }
+            else if (indicator.kind == IndicatorKind::Rsi)
+            {
+                indicator.first.resize(to, 0.0);
+                indicator.second.resize(to, 0.0);
+            }
+        }
+        previous.insert(previous.end(), prices + from, prices + to);
+        tickVolume.resize(to, 0.0);
+        tickNotional.resize(to, 0.0);
+        count = to;
+        for (Window& window : windows)
+        {
+            resum(window);
+        }
+    }
+
+    // Replaces the oldest ring row with this tick in one pass over the symbols.
+    template <bool Levels, bool Squares, bool Volume>
+    void advanceRows(Window& window, const double* prices)
+    {
+        size_t row = window.slot * count;
+        double* oldest = window.prices.data() + (Levels ? row : 0);
+        double* sum = window.sum.data();
+        double* sumSquares = window.sumSquares.data();
+        double* oldestNotional = window.notionals.data() + (Volume ? row : 0);
+        double* oldestVolume = window.volumes.data() + (Volume ? row : 0);
+        double* notionalSum = window.notionalSum.data();
+        double* volumeSum = window.volumeSum.data();
+        const double* volumes = tickVolume.data();
+        const double* notionals = tickNotional.data();
+        for (size_t id = 0; id < count; ++id)
+        {
+            double price = prices[id];
+            if constexpr (Levels)
+            {
+                double old = oldest[id];
+                sum[id] += price - old;
+                if constexpr (Squares)
+                {
+                    sumSquares[id] += price * price - old * old;
+                }
+                oldest[id] = price;
+            }
+            if constexpr (Volume)
+            {
+                notionalSum[id] += notionals[id] - oldestNotional[id];
+                volumeSum[id] += volumes[id] - oldestVolume[id];
+                oldestNotional[id] = notionals[id];
+                oldestVolume[id] = volumes[id];
+            }
+        }
+    }
+
+    void advance(Window& window, const double* prices)
+    {
+        if (!window.levels)
+            advanceRows<false, false, true>(window, prices);
+        else if (window.squares)
+            window.volume ? advanceRows<true, true, true>(window, prices) : advanceRows<true, true, false>(window, prices);
+        else
+            window.volume ? advanceRows<true, false, true>(window, prices) : advanceRows<true, false, false>(window, prices);
+        if (++window.slot == window.length)
+        {
+            window.slot = 0;
+            if (++window.wraps % resumWraps == 0)
+            {
+                resum(window);
+            }
+        }
+    }
+
+    void compute(Indicator& indicator, const double* prices)
+    {
+        double* values = indicator.values.data();
+        double length = indicator.length;
+        const Window* window = usesWindow(indicator.kind) ? &windows[indicator.window] : nullptr;
+        switch (indicator.kind)
+        {
+            case IndicatorKind::Sma:
+                for (size_t id = 0; id < count; ++id)
+                {
+                    values[id] = window->sum[id] / length;
+                }
+                break;
+            case IndicatorKind::StdDev:
+            case IndicatorKind::BollingerUpper:
+            case IndicatorKind::BollingerLower:
+            {
+                // StdDev is 0 x mean + 1 x deviation, the bands mean +- bollingerWidth x deviation.
+                bool bands = indicator.kind != IndicatorKind::StdDev;
+                double meanWeight = bands ? 1.0 : 0.0;
+                double deviationWeight = !bands ? 1.0
+                                       : indicator.kind == IndicatorKind::BollingerUpper ? bollingerWidth : -bollingerWidth;
+                const double* sum = window->sum.data();
+                const double* sumSquares = window->sumSquares.data();
+                for (size_t id = 0; id < count; ++id)
+                {
+                    double mean = sum[id] / length;
+                    double deviation = sqrt(max(0.0, sumSquares[id] / length - mean * mean));
+                    values[id] = meanWeight * mean + deviationWeight * deviation;
+                }
+                break;
+            }
+            case IndicatorKind::Ema:
+            {
+                double alpha = 2.0 / (length + 1.0);
+                double* average = indicator.first.data();
+                for (size_t id = 0; id < count; ++id)
+                {
+                    average[id] += alpha * (prices[id] - average[id]);
+                    values[id] = average[id];
+                }
+                break;
+            }
+            case IndicatorKind::Rsi:
+            {
+                double* gain = indicator.first.data();
+                double* loss = indicator.second.data();
+                const double* last = previous.data();
+                double decay = 1.0 / length;
+                for (size_t id = 0; id < count; ++id)
+                {
+                    double change = prices[id] - last[id];
+                    gain[id] += (max(change, 0.0) - gain[id]) * decay;
+                    loss[id] += (max(-change, 0.0) - loss[id]) * decay;
+                    double total = gain[id] + loss[id];
+                    values[id] = total > 0.0 ? 100.0 * gain[id] / total : 50.0; // 100 - 100 / (1 + RS)
+                }
+                break;
+            }
+            case IndicatorKind::Vwap:
+            {
+                const double* notionalSum = window->notionalSum.data();
+                const double* volumeSum = window->volumeSum.data();
+                for (size_t id = 0; id < count; ++id)
+                {
+                    values[id] = volumeSum[id] > 0.0 ? notionalSum[id] / volumeSum[id]
+                                                     : numeric_limits<double>::quiet_NaN();
+                }
+                break;
+            }
+        }
+    }
+
+public:
+    // Registers an indicator over the last `length` ticks (at least 1) and returns its handle.
+    // Registering one that exists returns the existing handle, so strategies can each ask for
+    // what they need. Any thread; takes effect from the next tick.
+    uint32_t add(IndicatorKind kind, uint32_t length)
+    {
+        length = max<uint32_t>(length, 1);
+        lock_guard<mutex> guard(lock);
+        for (uint32_t i = 0; i < indicators.size(); ++i)
+        {
+            if (indicators[i].kind == kind && indicators[i].length == length)
+            {
+                return i;
+            }
+        }
+        Indicator indicator{kind, length, 0, {}, {}, {}};
+        indicator.values.assign(count, numeric_limits<double>::quiet_NaN());
+        if (kind == IndicatorKind::Ema)
+        {
+            indicator.first = previous;
+        }
+        else if (kind == IndicatorKind::Rsi)
+        {
+            indicator.first.assign(count, 0.0);
+            indicator.second.assign(count, 0.0);
+        }
+        else
+        {
+            auto found = find_if(windows.begin(), windows.end(),
+                                 [length](const Window& window) { return window.length == length; });
+            if (found == windows.end())
+            {
+                Window window;
+                window.length = length;
+                windows.push_back(move(window));
+                found = windows.end() - 1;
+            }
+            bool volume = kind == IndicatorKind::Vwap;
+            bool squares = !volume && kind != IndicatorKind::Sma;
+            if (!volume && !found->levels)
+            {
+                found->levels = true;
+                widenRows(found->prices, length, 0, count, previous.data());
+            }
+            found->squares = found->squares || squares;
+            if (volume && !found->volume)
+            {
+                found->volume = true;
+                found->notionals.assign(length * count, 0.0);
+                found->volumes.assign(length * count, 0.0);
+            }
+            resum(*found);
+            indicator.window = static_cast<uint32_t>(found - windows.begin());
+        }
+        indicators.push_back(move(indicator));
+        active.store(true, memory_order_release);
+        return static_cast<uint32_t>(indicators.size() - 1);
+    }
+
+    bool isActive() const
+    {
+        return active.load(memory_order_acquire);
+    }
+
+    // Runs on the tick thread, right after the price update.
+    void update(const MarketSnapshot& snap, const TradedVolume& traded)
+    {
+        CountingLockGuard guard(lock);
+        if (snap.count > count)
+        {
+            for (size_t id = seenVolume.size(); id < snap.count; ++id)
+            {
+                seenVolume.push_back(traded.get(static_cast<uint32_t>(id)));
+                seenNotional.push_back(traded.getNotional(static_cast<uint32_t>(id)));
+            }
+            startSymbols(count, snap.count, snap.prices);
+        }
+        if (any_of(windows.begin(), windows.end(), [](const Window& window) { return window.volume; }))
+        {
+            for (uint32_t id = 0; id < count; ++id)
+            {
+                uint64_t total = traded.get(id);
+                int64_t notional = traded.getNotional(id);
+                tickVolume[id] = static_cast<double>(total - seenVolume[id]);
+                tickNotional[id] = static_cast<double>(notional - seenNotional[id]) * priceTickSize;
+                seenVolume[id] = total;
+                seenNotional[id] = notional;
+            }
+        }
+        for (Window& window : windows)
+        {
+            advance(window, snap.prices);
+        }
+        for (Indicator& indicator : indicators)
+        {
+            compute(indicator, snap.prices);
+        }
+        copy(snap.prices, snap.prices + count, previous.begin());
+    }
+
+    size_t size() const
+    {
+        lock_guard<mutex> guard(lock);
+        return indicators.size();
+    }
+    // NaN before the symbol's first tick, and for VWAP over a window with no trades.
+    double get(uint32_t indicator, uint32_t symbol) const
+    {
+        lock_guard<mutex> guard(lock);
+        const vector<double>& values = indicators[indicator].values;
+        return symbol < values.size() ? values[symbol] : numeric_limits<double>::quiet_NaN();
+    }
+    // "SMA(20)" and so on.
+    string describe(uint32_t indicator) const
+    {
+        lock_guard<mutex> guard(lock);
+        const Indicator& found = indicators[indicator];
+        return string(indicatorNames[static_cast<size_t>(found.kind)]) + "(" + to_string(found.length) + ")";
+    }
+};
+
+// Session recording: everything needed to play a session back through the same code. The file
+// starts with a RecordingHeader and the account as it was (journal records, padded to 8 bytes),
+// then holds records in the order they happened. The first record is the tick recording started
+// from. Every record is 8-byte aligned so replay reads it straight from the mapping.
+struct RecordingHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t symbols;
+    uint64_t universeHash; // Of the abbreviations in id order; replay needs the same universe
+    uint64_t firstTick;
+    uint32_t seed;
+    uint32_t accountBytes;
+};
+constexpr char recordingMagic[8] = {'S', 'T', 'K', 'R', 'E', 'C', '1', '\0'};
+constexpr uint32_t recordingVersion = 1;
+
+enum class RecordKind : uint8_t
+{
+    Tick,       // Payload: the prices, then the volatilities, one double per symbol each
+    Deposit,    // ActionRecord: amount
+    Withdrawal, // amount
+    Buy,        // symbol, quantity: market order
+    Sell,       // symbol, quantity: market order
+    Limit,      // symbol, side, quantity, amount: limit price
+    Cancel,     // orderId
+};
+
+struct RecordHeader
+{
+    RecordKind kind;
+    uint8_t reserved[3];
+    uint32_t size;      // Payload bytes after this header
+    int64_t elapsedNs;  // Since recording started
+    uint64_t tick;      // Latest tick when it happened
+};
+
+// One Portfolio action, with the cash it left behind so a replay can tell where it diverges.
+struct ActionRecord
+{
+    uint32_t symbol;
+    int32_t quantity;
+    double amount;
+    uint64_t orderId;
+    double cash;
+    Side side;
+    uint8_t reserved[7];
+};
+static_assert(sizeof(RecordHeader) == 24 && sizeof(ActionRecord) == 40, "records are read straight from the mapping");
+
+// Identifies a universe by its abbreviations in id order.
+inline uint64_t universeHash(const MarketState& state)
+{
+    uint64_t hash = state.size();
+    for (uint32_t id = 0; id < state.size(); ++id)
+    {
+        hash = hashText(state.getAbbreviation(id), hash);
+    }
+    return hash;
+}
+
+// Streams ticks and account actions to a recording. Appends only encode into a pending buffer;
+// a writer thread takes whatever piled up and writes it, so the tick thread never waits on the
+// disk.
+class TickRecorder {
+private:
+    FILE* file = nullptr;
+    string path;
+    mutex lock;
+    condition_variable wake;
+    string pending;
+    bool stopping = false;
+    bool failed = false;
+    thread writer;
+    chrono::steady_clock::time_point started;
+    uint64_t lastTick = 0;
+    uint64_t ticks = 0;
+    uint64_t actions = 0;
+    uint64_t bytes = 0;
+
+    void writerLoop()
+    {
+        unique_lock<mutex> guard(lock);
+        string batch;
+        while (true)
+        {
+            wake.wait(guard, [this] { return stopping || !pending.empty(); });
+            if (pending.empty())
+            {
+                return;
+            }
+            batch.swap(pending);
+            guard.unlock();
+            bool ok = fwrite(batch.data(), 1, batch.size(), file) == batch.size();
+            batch.clear();
+            guard.lock();
+            if (!ok && !failed)
+            {
+                failed = true;
+                cout << path << ": cannot write the recording" << endl;
+            }
+        }
+    }
+
+    // Caller holds the lock. The payload follows; size counts it.
+    void appendHeader(RecordKind kind, uint64_t tick, size_t size)
+    {
+        RecordHeader header{};
+        header.kind = kind;
+        header.size = static_cast<uint32_t>(size);
+        header.elapsedNs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - started).count();
+        header.tick = tick;
+        pending.append(reinterpret_cast<const char*>(&header), sizeof(header));
+        bytes += sizeof(header) + size;
+    }
+
+    // Caller holds the lock.
+    void appendTickLocked(const MarketSnapshot& snap)
+    {
+        size_t column = snap.count * sizeof(double);
+        appendHeader(RecordKind::Tick, snap.tick, 2 * column);
+        pending.append(reinterpret_cast<const char*>(snap.prices), column);
+        pending.append(reinterpret_cast<const char*>(snap.volatilities), column);
+        lastTick = snap.tick;
+        ++ticks;
+    }
+
+public:
+    TickRecorder() = default;
+    ~TickRecorder()
+    {
+        close();
+    }
+    TickRecorder(const TickRecorder&) = delete;
+    TickRecorder& operator=(const TickRecorder&) = delete;
+
+    // Creates (or truncates) recordingPath and writes the header, the account image and the
+    // current tick. Returns an error message, empty on success.
+    string open(const string& recordingPath, const MarketSnapshot& snap, uint64_t hash, uint32_t seed,
+                const string& accountImage)
+    {
+        close();
+        file = fopen(recordingPath.c_str(), "wb");
+        if (!file)
+        {
+            return recordingPath + ": cannot open for writing";
+        }
+        path = recordingPath;
+        RecordingHeader header{};
+        memcpy(header.magic, recordingMagic, sizeof(header.magic));
+        header.version = recordingVersion;
+        header.symbols = static_cast<uint32_t>(snap.count);
+        header.universeHash = hash;
+        header.firstTick = snap.tick;
+        header.seed = seed;
+        header.accountBytes = static_cast<uint32_t>(accountImage.size());
+        lock_guard<mutex> guard(lock);
+        pending.assign(reinterpret_cast<const char*>(&header), sizeof(header));
+        pending += accountImage;
+        pending.resize((pending.size() + 7) & ~size_t(7), '\0');
+        bytes = pending.size();
+        ticks = actions = 0;
+        started = chrono::steady_clock::now();
+        stopping = false;
+        failed = false;
+        appendTickLocked(snap);
+        writer = thread(&TickRecorder::writerLoop, this);
+        return "";
+    }
+
+    bool isOpen() const
+    {
+        return file != nullptr;
+    }
+
+    // Writes out what is pending and closes the file.
+    void close()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_one();
+        if (writer.joinable())
+        {
+            writer.join();
+        }
+        if (file)
+        {
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+    // Runs on the tick thread after each published tick.
+    void appendTick(const MarketSnapshot& snap)
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            if (stopping || !file)
+            {
+                return;
+            }
+            appendTickLocked(snap);
+        }
+        wake.notify_one();
+    }
+
+    void appendAction(RecordKind kind, const ActionRecord& action)
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            if (stopping || !file)
+            {
+                return;
+            }
+            appendHeader(kind, lastTick, sizeof(action));
+            pending.append(reinterpret_cast<const char*>(&action), sizeof(action));
+            ++actions;
+        }
+        wake.notify_one();
+    }
+
+    struct Stats
+    {
+        uint64_t ticks;
+        uint64_t actions;
+        uint64_t bytes; // Written or queued
+    };
+    Stats getStats()
+    {
+        lock_guard<mutex> guard(lock);
+        return {ticks, actions, bytes};
+    }
+};
+
+class StockMarket {
+private:
+    MarketState state;
+    TickWorkerPool workerPool;
+    SymbolTable symbols;  // Abbreviation -> id, rebuilt after each load, read-only afterwards
+    vector<Stock> stocks; // Indexed by id
+    MatchingEngine engine;
+    mutex orderLock; // Serializes the threads that trade; see lockOrders
+    // Ids of the house quotes currently resting for each symbol, bids then asks.
+    static constexpr int makerLevels = 5;
+    static constexpr uint32_t makerLevelSize = 500;
+    vector<array<uint64_t, 2 * makerLevels>> makerQuotes;
+    // Something that trades here (the menu's portfolio, the order gateway, a trader population)
+    // under a range of owner ids. Fills of its resting orders that another party's order caused
+    // wait in pending until it takes them. Guarded by orderLock, like the engine.
+    struct FillParty
+    {
+        uint32_t firstOwner;
+        uint32_t endOwner; // Equal to firstOwner once removed
+        vector<Fill> pending;
+        function<void()> notify;
+    };
+    vector<FillParty> fillParties;
+    mutex listenerLock;
+    vector<function<void(const MarketSnapshot&)>> tickListeners;
+    atomic<uint64_t> publishedAt{0}; // instrumentNow() of the latest tick, for board staleness
+    TradedVolume traded;
+    TickHistory history;
+    IndicatorEngine indicators;
+    TickRecorder recorder;
+
+    uint32_t fillPartyOf(uint32_t owner) const
+    {
+        for (uint32_t party = 0; party < fillParties.size(); ++party)
+        {
+            if (owner >= fillParties[party].firstOwner && owner < fillParties[party].endOwner)
+            {
+                return party;
+            }
+        }
+        return noFillParty;
+    }
+
+    // Queues the fills from `first` on whose resting order belongs to a party other than owner's;
+    // owner's party settles the rest from `fills` itself.
+    void routeFills(const vector<Fill>& fills, size_t first, uint32_t owner)
+    {
+        if (fillParties.empty())
+        {
+            return;
+        }
+        uint32_t caller = fillPartyOf(owner);
+        for (size_t i = first; i < fills.size(); ++i)
+        {
+            uint32_t party = fillPartyOf(fills[i].makerOwner);
+            if (party == noFillParty || party == caller)
+            {
+                continue;
+            }
+            FillParty& maker = fillParties[party];
+            maker.pending.push_back(fills[i]);
+            if (maker.pending.size() == 1 && maker.notify)
+            {
+                maker.notify();
+            }
+        }
+    }
+
+    // Adds a loaded universe, skipping abbreviations that are already known (first one wins).
+    void addSymbols(const string_view* names, const string_view* abbrs, const double* prices, size_t count)
+    {
+        size_t existing = state.size();
+        vector<string_view> all(existing + count);
+        for (uint32_t id = 0; id < existing; ++id)
+        {
+            all[id] = state.getAbbreviation(id);
+        }
+        copy(abbrs, abbrs + count, all.begin() + existing);
+        vector<size_t> duplicates = symbols.build(all.data(), all.size());
+        if (duplicates.empty())
+        {
+            state.addSymbols(names, abbrs, prices, count, workerPool);
+        }
+        else
+        {
+            all.resize(existing);
+            size_t next = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (next < duplicates.size() && duplicates[next] == existing + i)
+                {
+                    ++next;
+                    continue;
+                }
+                state.addSymbol(names[i], abbrs[i], prices[i]);
+                all.push_back(abbrs[i]);
+            }
+            symbols.build(all.data(), all.size());
+        }
+        traded.resize(state.size());
+        stocks.reserve(state.size());
+        for (size_t id = existing; id < state.size(); ++id)
+        {
+            stocks.emplace_back(&state, static_cast<uint32_t>(id));
+        }
+        numStocks = static_cast<int>(state.size());
+    }
+    atomic<bool> running{true};
+    atomic<int> Userchoice;
+    TickScheduler scheduler;
+    thread priceUpdateThread;
+    int numStocks;
+
+    void runTick()
+    {
+        ScopedLatency latency(Metric::TickDuration);
+        if (recorder.isOpen())
+        {
+            // Orders wait for the tick, so each one sees exactly the tick recorded before it.
+            lock_guard<mutex> orders(orderLock);
+            state.tick(&workerPool);
+            state.readSnapshot([this](const MarketSnapshot& snap) { recorder.appendTick(snap); });
+        }
+        else
+        {
+            state.tick(&workerPool); // Publishes a new snapshot, readers never wait on it
+        }
+        finishTick();
+    }
+
+    // Everything after the prices are published: indicators, then the listeners.
+    void finishTick()
+    {
+        publishedAt.store(instrumentNow(), memory_order_relaxed);
+        if (indicators.isActive())
+        {
+            state.readSnapshot([this](const MarketSnapshot& snap) { indicators.update(snap, traded); });
+        }
+        notifyTickListeners();
+    }
+
+public:
+    static constexpr uint32_t noFillParty = UINT32_MAX;
+
+    explicit StockMarket(unsigned workerThreads = thread::hardware_concurrency())
+        : state(static_cast<uint32_t>(rand())), workerPool(workerThreads), Userchoice(0), priceUpdateThread(),
+          numStocks(0) {}  // Initialize in constructor
+
+    ~StockMarket()
+     {
+        stop(); // Ensure thread is stopped in destructor
+        if (priceUpdateThread.joinable()) {
+            priceUpdateThread.join(); // Wait for thread to finish.
+        }
+    }
+
+    // Parses the three text files in parallel (mapped, split into lines and parsed with
+    // from_chars across the worker pool). The symbol names stay views into the mappings.
+    bool loadStocks(const string& namesFile, const string& pricesFile, const string& abbrFile) {
+        TextUniverse universe;
+        string error = parseTextUniverse(namesFile, pricesFile, abbrFile, workerPool, universe);
+        if (!error.empty())
+        {
+            cout << error << endl;
+            return false;
+        }
+        for (auto& file : universe.files)
+        {
+            state.keepAlive(file);
+        }
+        addSymbols(universe.names.data(), universe.abbrs.data(), universe.prices.data(), universe.prices.size());
+        return true;
+    }
+
+    // Maps a binary universe written by saveUniverse/--convert-universe. Returns false without
+    // a message if the file does not exist, so callers can fall back to the text files.
+    bool loadUniverse(const string& universePath)
+    {
+        if (!ifstream(universePath))
+        {
+            return false;
+        }
+        UniverseFile universe;
+        string error = universe.open(universePath);
+        if (!error.empty())
+        {
+            cout << error << endl;
+            return false;
+        }
+        state.keepAlive(universe.getFile());
+        vector<string_view> names(universe.size()), abbrs(universe.size());
+        workerPool.run(universe.size(), [&](size_t begin, size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
+            {
+                names[i] = universe.getName(i);
+                abbrs[i] = universe.getAbbreviation(i);
+            }
+        });
+        addSymbols(names.data(), abbrs.data(), universe.getPrices(), universe.size());
+        return true;
+    }
+
+    // Adds symbols from memory; the caller keeps the names and abbreviations alive as long as
+    // the market.
+    void addUniverse(const string_view* names, const string_view* abbrs, const double* prices, size_t count)
+    {
+        addSymbols(names, abbrs, prices, count);
+    }
+
+    // Switches prices to the correlated factor model in factorsPath (see parseFactorModel),
+    // for the symbols loaded so far. Returns false without a message if the file does not
+    // exist, so the uniform model stays on. Setup only, before startPriceUpdates().
+    bool loadFactorModel(const string& factorsPath)
+    {
+        if (!ifstream(factorsPath))
+        {
+            return false;
+        }
+        auto model = make_shared<FactorModel>();
+        string error = parseFactorModel(factorsPath, symbols, state.size(), workerPool, *model);
+        if (!error.empty())
+        {
+            cout << error << endl;
+            return false;
+        }
+        state.setFactorModel(move(model));
+        return true;
+    }
+
+    // Setup only; null goes back to independent uniform steps.
+    void setFactorModel(shared_ptr<const FactorModel> model)
+    {
+        state.setFactorModel(move(model));
+    }
+
+    const FactorModel* getFactorModel() const
+    {
+        return state.getFactorModel();
+    }
+
+    // Converts the three text files into the binary universe format.
+    bool convertUniverse(const string& namesFile, const string& pricesFile, const string& abbrFile,
+                         const string& universePath)
+    {
+        TextUniverse universe;
+        string error = parseTextUniverse(namesFile, pricesFile, abbrFile, workerPool, universe);
+        if (error.empty() && !writeUniverseFile(universePath, universe.names, universe.abbrs, universe.prices))
+        {
+            error = "cannot write " + universePath;
+        }
+        if (!error.empty())
+        {
+            cout << error << endl;
+            return false;
+        }
+        return true;
+    }
+
+    size_t size() const
+    {
+        return state.size();
+    }
+
+    void startPriceUpdates()
+    {
+        if (!priceUpdateThread.joinable())
+        { // Only start if not already running.
+            priceUpdateThread = thread
+            ([this]()
+                {
+                    scheduler.run(running, [this] { runTick(); });
+                }
+            );
+        }
+    }
+
+    // Monte Carlo risk of holding (symbol, shares) pairs plus cash, starting from the latest
+    // tick. Uses its own worker pool, so the tick thread keeps its workers meanwhile.
+    RiskReport simulateRisk(const vector<pair<uint32_t, int64_t>>& holdings, double cash, size_t paths, int steps)
+    {
+        RiskScenario scenario = state.readSnapshot([&](const MarketSnapshot& snap)
+        {
+            RiskScenario current;
+            for (const auto& [symbol, shares] : holdings)
+            {
+                current.prices.push_back(snap.prices[symbol]);
+                current.volatilities.push_back(snap.volatilities[symbol]);
+                current.shares.push_back(static_cast<double>(shares));
+            }
+            current.seed = tickKey(0x5EED, snap.tick);
+            return current;
+        });
+        scenario.cash = cash;
+        scenario.paths = paths;
+        scenario.steps = steps;
+        TickWorkerPool pool(thread::hardware_concurrency());
+        return runRiskSimulation(scenario, pool);
+    }
+
+    // Takes effect on the next startPriceUpdates(). Returns false for rates outside
+    // (0, maxTicksPerSecond].
+    bool setTickRate(double ticksPerSecond, OverrunPolicy policy = OverrunPolicy::CatchUp)
+    {
+        return scheduler.setRate(ticksPerSecond, policy);
+    }
+    TickScheduler::Stats getSchedulerStats() const
+    {
+        return scheduler.getStats();
+    }
+
+    // Headless mode: runs ticks back to back with no clock in the loop. Not while the update
+    // thread is running.
+    bool fastForward(uint64_t ticks)
+    {
+        if (priceUpdateThread.joinable())
+        {
+            return false;
+        }
+        for (uint64_t i = 0; i < ticks; ++i)
+        {
+            runTick();
+        }
+        return true;
+    }
+
+    uint64_t getTickCount() const
+    {
+        return state.getTickCount();
+    }
+
+    // Setup only: fixes the price path, which otherwise follows rand().
+    void setSeed(uint32_t seed)
+    {
+        state.setSeed(seed);
+    }
+
+    // Publishes a recorded tick in place of the price model, then runs the indicators and the
+    // listeners as a live tick would. Not while the update thread is running.
+    bool replayTick(const double* prices, const double* volatilities)
+    {
+        if (priceUpdateThread.joinable())
+        {
+            return false;
+        }
+        ScopedLatency latency(Metric::TickDuration);
+        state.publishTick(prices, volatilities, &workerPool);
+        finishTick();
+        return true;
+    }
+
+    // Records every tick from now on to path, starting with the current one and the account
+    // image (see Portfolio::startRecording). Setup only. Returns an error message, empty on
+    // success.
+    string startRecording(const string& path, const string& accountImage)
+    {
+        return state.readSnapshot([&](const MarketSnapshot& snap)
+        {
+            return recorder.open(path, snap, universeHash(state), state.getSeed(), accountImage);
+        });
+    }
+
+    // Finishes writing the recording.
+    void stopRecording()
+    {
+        recorder.close();
+    }
+
+    TickRecorder& getRecorder()
+    {
+        return recorder;
+    }
+
+    uint64_t getUniverseHash() const
+    {
+        return universeHash(state);
+    }
+    // Registers fn to run on the tick thread after every published tick. Keep it short: the
+    // next tick waits for it.
+    void addTickListener(function<void(const MarketSnapshot&)> listener)
+    {
+        lock_guard<mutex> guard(listenerLock);
+        tickListeners.push_back(move(listener));
+    }
+    // Records every tick of every symbol from now on as bars, and one tick in `keepEvery` as
+    // ticks, see TickHistory. Returns an error message, empty on success.
+    string enableHistory(const string& archivePath = "", size_t memoryBudget = size_t{256} << 20,
+                         uint32_t keepEvery = 1)
+    {
+        string error = history.open(archivePath, memoryBudget, keepEvery);
+        if (error.empty())
+        {
+            addTickListener([this](const MarketSnapshot& snap) { history.append(snap, traded); });
+        }
+        return error;
+    }
+    const TickHistory& getHistory() const
+    {
+        return history;
+    }
+    // Register indicators here; they are up to date by the time tick listeners run.
+    IndicatorEngine& getIndicators()
+    {
+        return indicators;
+    }
+    const IndicatorEngine& getIndicators() const
+    {
+        return indicators;
+    }
+    void notifyTickListeners()
+    {
+        CountingLockGuard guard(listenerLock);
+        if (!tickListeners.empty())
+        {
+            // Called by the only writer, so the snapshot cannot change underneath the listeners.
+            state.readSnapshot([this](const MarketSnapshot& snap)
+            {
+                for (auto& listener : tickListeners)
+                {
+                    listener(snap);
+                }
+            });
+        }
+    }
+    void stop()
+    {
+        running = false;
+        if (priceUpdateThread.joinable()) {
+            priceUpdateThread.join(); // Wait for the thread to finish.
+        }
+    }
+    // Rows of the live board taken up by its title, column headers and key help.
+    static constexpr int boardChromeRows = 4;
+
+    // Draws one rows x cols frame of the live board: the rows from `top` that fit, all from the
+    // same tick. Only the visible rows are formatted, so the cost does not grow with the universe.
+    void showAllStocksLive(TerminalRenderer& screen, size_t& top, int rows, int cols)
+    {
+        ScopedLatency latency(Metric::FrameRender);
+        if (uint64_t published = publishedAt.load(memory_order_relaxed))
+        {
+            recordLatency(Metric::BoardStaleness, instrumentNow() - published);
+        }
+        size_t pageRows = static_cast<size_t>(max(1, rows - boardChromeRows));
+        top = min(top, stocks.size() > pageRows ? stocks.size() - pageRows : 0);
+        screen.beginFrame(rows, cols);
+        screen.text(0, 0, "--- Live Stock Prices ---");
+        screen.text(1, 0, "Stock");
+        screen.text(1, 40, "Price");
+        screen.text(1, 50, "Volatility");
+        screen.text(2, 0, string(60, '-'));
+        screen.text(rows - 1, 0, "n/p: page  j/k: line  any other key: back");
+        // A retry after the writer lapped us redraws the same cells, so drawing in place is safe.
+        state.readSnapshot([&](const MarketSnapshot& snap)
+        {
+            char status[96];
+            size_t last = min(stocks.size(), top + pageRows);
+            int length = snprintf(status, sizeof(status), "tick %llu  rows %zu-%zu of %zu",
+                                  static_cast<unsigned long long>(snap.tick), stocks.empty() ? 0 : top + 1, last,
+                                  stocks.size());
+            screen.text(0, 30, string_view(status, static_cast<size_t>(max(length, 0))));
+            for (size_t i = top; i < last; ++i)
+            {
+                int row = 3 + static_cast<int>(i - top);
+                string_view name = state.getFullName(static_cast<uint32_t>(i));
+                string_view abbr = state.getAbbreviation(static_cast<uint32_t>(i));
+                int nameWidth = max(0, 33 - static_cast<int>(abbr.size()) - 4);
+                int col = static_cast<int>(min(name.size(), static_cast<size_t>(nameWidth)));
+                screen.text(row, 0, name, nameWidth);
+                screen.text(row, col, " (");
+                screen.text(row, col + 2, abbr, 33);
+                screen.text(row, col + 2 + static_cast<int>(min<size_t>(abbr.size(), 33)), "):");
+                screen.number(row, 35, 10, snap.prices[i], 2);
+                screen.number(row, 45, 15, snap.volatilities[i] * 100, 2, '%');
+            }
+        });
+        screen.present();
+    }
+
+    // Moves the board for a key press; false if the key means leave the board.
+    bool scrollLiveBoard(int key, size_t& top) const
+    {
+        size_t page = static_cast<size_t>(max(1, TerminalRenderer::terminalSize().first - boardChromeRows));
+        switch (tolower(key))
+        {
+            case 'j':
+                ++top;
+                return true;
+            case 'k':
+                top -= top > 0;
+                return true;
+            case 'n':
+            case ' ':
+                top += page;
+                return true;
+            case 'p':
+                top = top > page ? top - page : 0;
+                return true;
+            default:
+                return false;
+        }
+    }
+    void showStats() const
+    {
+        TickScheduler::Stats ticks = scheduler.getStats();
+        cout << "\n--- Stats ---\n";
+        cout << "Ticks: " << ticks.ticks << " at " << fixed << setprecision(1) << scheduler.getRate()
+             << " Hz, start lateness mean " << ticks.meanLatenessUs << " us, max " << ticks.maxLatenessUs << " us\n\n";
+        cout << formatInstruments(collectInstruments());
+    }
+    void showMenu()
+    {
+        cout << "\n--- Stock Market Menu ---\n";
+        cout << "1. View All Stocks (Live)\n";
+        cout << "2. Buy Stock\n";
+        cout << "3. Sell Stock\n";
+        cout << "4. View Portfolio\n";
+        cout << "5. Add to Watchlist\n";
+        cout << "6. Remove from Watchlist\n";
+        cout << "7. View Watchlist\n";
+        cout << "8. View Stock Details\n";
+        cout << "9. Deposit Funds\n";
+        cout << "10. Withdraw Funds\n";
+        cout << "11. View Transaction History\n";
+        cout << "12. Place Limit Order\n";
+        cout << "13. Cancel Order\n";
+        cout << "14. Risk Report (Monte Carlo)\n";
+        cout << "15. Price Alerts\n";
+        cout << "16. Stats\n";
+        cout << "17. Exit\n";
+        cout << "Enter choice: ";
+    }
+    string getAbbreviation(uint32_t symbol) const
+    {
+        return string(state.getAbbreviation(symbol));
+    }
+    double getPrice(uint32_t symbol) const
+    {
+        return state.getQuote(symbol).price;
+    }
+    // Copies every symbol's price from one tick into prices and returns that tick.
+    uint64_t copyPrices(vector<double>& prices) const
+    {
+        return state.readSnapshot([&](const MarketSnapshot& snap)
+        {
+            prices.assign(snap.prices, snap.prices + snap.count);
+            return snap.tick;
+        });
+    }
+
+    // Replaces the market maker's ladder for one symbol with fresh quotes around the latest
+    // simulated price: makerLevels levels a side, one tick apart, with the spread widening
+    // with volatility. The new quotes can trade against resting orders; those of owner's party
+    // are appended to `fills`, the others queued for their party. Called by the order path,
+    // never by the tick thread.
+    void refreshQuotes(uint32_t symbol, vector<Fill>& fills, uint32_t owner)
+    {
+        if (makerQuotes.size() < state.size())
+        {
+            makerQuotes.resize(state.size(), {});
+        }
+        auto& quotes = makerQuotes[symbol];
+        for (uint64_t& orderId : quotes)
+        {
+            if (orderId)
+            {
+                engine.cancel(orderId);
+                orderId = 0;
+            }
+        }
+        StockQuote quote = state.getQuote(symbol);
+        int64_t mid = toPriceTicks(quote.price);
+        engine.followPrice(symbol, mid);
+        int64_t halfSpread = max<int64_t>(1, llround(mid * quote.volatility * 0.01));
+        for (int level = 0; level < makerLevels; ++level)
+        {
+            int64_t bid = mid - halfSpread - level;
+            int64_t ask = mid + halfSpread + level;
+            if (bid > 0)
+            {
+                size_t first = fills.size();
+                OrderResult result = engine.submit(symbol, Side::Buy, OrderType::Limit, bid, makerLevelSize,
+                                                   marketMakerOwner, fills);
+                traded.add(fills, first);
+                routeFills(fills, first, owner);
+                quotes[level] = result.resting ? result.orderId : 0;
+            }
+            size_t first = fills.size();
+            OrderResult result = engine.submit(symbol, Side::Sell, OrderType::Limit, ask, makerLevelSize,
+                                               marketMakerOwner, fills);
+            traded.add(fills, first);
+            routeFills(fills, first, owner);
+            quotes[makerLevels + level] = result.resting ? result.orderId : 0;
+        }
+    }
+
+    // The matching engine and the house quotes belong to one thread at a time. A program where
+    // more than one thread trades (the menu and the order gateway) holds this around each order,
+    // or each batch of orders.
+    unique_lock<mutex> lockOrders()
+    {
+        return unique_lock<mutex>(orderLock);
+    }
+
+    OrderResult submitOrder(uint32_t symbol, Side side, OrderType type, double limitPrice, uint32_t quantity,
+                            uint32_t owner, vector<Fill>& fills)
+    {
+        ScopedLatency latency(Metric::OrderExecution);
+        size_t first = fills.size();
+        OrderResult result = engine.submit(symbol, side, type, toPriceTicks(limitPrice), quantity, owner, fills);
+        traded.add(fills, first);
+        routeFills(fills, first, owner);
+        return result;
+    }
+
+    // Registers a party trading as owners [firstOwner, endOwner). From then on, fills of its
+    // resting orders that another party's order causes are kept for it until takeFills; notify,
+    // if set, runs (under the order lock, on the other party's thread) when the first one
+    // arrives. Fills its own orders cause still come back in the fills vector as before. Hold
+    // lockOrders() for this, and for removeFillParty and takeFills, whenever another thread trades.
+    uint32_t addFillParty(uint32_t firstOwner, uint32_t endOwner, function<void()> notify = {})
+    {
+        fillParties.push_back({firstOwner, endOwner, {}, move(notify)});
+        return static_cast<uint32_t>(fillParties.size() - 1);
+    }
+    void removeFillParty(uint32_t party)
+    {
+        if (party < fillParties.size())
+        {
+            fillParties[party] = {0, 0, {}, {}};
+        }
+    }
+    // Appends the party's waiting fills to `fills`, oldest first.
+    void takeFills(uint32_t party, vector<Fill>& fills)
+    {
+        if (party < fillParties.size())
+        {
+            vector<Fill>& pending = fillParties[party].pending;
+            fills.insert(fills.end(), pending.begin(), pending.end());
+            pending.clear();
+        }
+    }
+
+    // cancelled, when given, receives the quantity that was still resting.
+    bool cancelOrder(uint64_t orderId, uint32_t* cancelled = nullptr)
+    {
+        return engine.cancel(orderId, cancelled);
+    }
+
+    uint32_t estimateMarketOrder(uint32_t symbol, Side side, uint32_t quantity, int64_t& cost) const
+    {
+        return engine.estimateMarketOrder(symbol, side, quantity, cost);
+    }
+
+    // The table never changes after loading and Stock reads the published snapshot, so no lock.
+    Stock* getStock(string_view abbreviation)
+    {
+        uint32_t id = symbols.find(abbreviation);
+        return id != SymbolTable::none ? &stocks[id] : nullptr;
+    }
+    Stock* getStock(uint32_t symbol)
+    {
+        return symbol < stocks.size() ? &stocks[symbol] : nullptr;
+    }
+
+    void showStockDetails(const string& abbreviation) {
+        if (const Stock* found = getStock(abbreviation))
+        {
+            const Stock& stock = *found;
+            uint32_t id = stock.getId();
+            int historySize = stock.getHistorySize();
+            // Quote and history from the same tick.
+            auto [quote, recent] = state.readSnapshot([id](const MarketSnapshot& snap)
+            {
+                array<double, priceHistorySize> prices;
+                copy(snap.recentPrices(id).begin(), snap.recentPrices(id).end(), prices.begin());
+                return make_pair(snap.quote(id), prices);
+            });
+            cout << "\n--- Stock Details: " << stock.getFullName() << " (" << stock.getAbbreviation() << ") ---\n";
+            cout << "Current Price: $" << fixed << setprecision(2) << quote.price << endl;
+            cout << "Volatility: " << fixed << setprecision(2) << quote.volatility * 100 << "%" << endl;
+            // The window is a number of ticks; how long that is depends on the tick rate.
+            ostringstream window;
+            window << "Last " << historySize << " ticks, " << fixed << setprecision(1)
+                   << historySize / scheduler.getRate() << " s";
+            cout << "Peak High (" << window.str() << "): $" << fixed << setprecision(2) << quote.peakHigh << endl;
+            cout << "Peak Low (" << window.str() << "): $" << fixed << setprecision(2) << quote.peakLow << endl;
+            cout << "Recent Prices (" << window.str() << "): ";
+            for (double recentPrice : recent)
+            {
+                cout << fixed << setprecision(2) << recentPrice << "||";
+            }
+            cout << endl;
+            size_t indicatorCount = indicators.size();
+            for (uint32_t indicator = 0; indicator < indicatorCount; ++indicator)
+            {
+                double value = indicators.get(indicator, id);
+                cout << (indicator ? "  " : "Indicators: ") << indicators.describe(indicator) << " ";
+                if (isnan(value))
+                {
+                    cout << "n/a";
+                }
+                else
+                {
+                    cout << fixed << setprecision(2) << value;
+                }
+            }
+            if (indicatorCount > 0)
+            {
+                cout << endl;
+            }
+            if (history.isOpen())
+            {
+                showRecentBars(id);
+            }
+        }
+        else
+        {
+            cout << "Stock not found." << endl;
+        }
+    }
+
+    // Charts the last hour of 1-minute closes from the price history and lists the last ten bars.
+    void showRecentBars(uint32_t id) const
+    {
+        int64_t now = history.latestMs();
+        vector<PriceBar> minutes = history.bars(id, BarResolution::Minute, now - 3600000, now);
+        if (minutes.empty())
+        {
+            return;
+        }
+        int64_t low = minutes[0].close;
+        int64_t high = minutes[0].close;
+        for (const PriceBar& bar : minutes)
+        {
+            low = min(low, bar.close);
+            high = max(high, bar.close);
+        }
+        static constexpr char levels[] = "_.-=^";
+        constexpr int64_t top = sizeof(levels) - 2;
+        string chart;
+        for (const PriceBar& bar : minutes)
+        {
+            chart += levels[high > low ? (bar.close - low) * top / (high - low) : 0];
+        }
+        cout << "Last hour, 1-minute closes: $" << fixed << setprecision(2) << fromPriceTicks(low) << " " << chart
+             << " $" << fromPriceTicks(high) << endl;
+        cout << "Time      Open       High       Low        Close      Volume" << endl;
+        for (size_t i = minutes.size() > 10 ? minutes.size() - 10 : 0; i < minutes.size(); ++i)
+        {
+            const PriceBar& bar = minutes[i];
+            time_t start = static_cast<time_t>(bar.startMs / 1000);
+            cout << put_time(localtime(&start), "%H:%M") << "     " << left << setw(11) << fromPriceTicks(bar.open)
+                 << setw(11) << fromPriceTicks(bar.high) << setw(11) << fromPriceTicks(bar.low) << setw(11)
+                 << fromPriceTicks(bar.close) << right << bar.volume << endl;
+        }
+    }
+};
+// Define a class for transaction history
+template <class Price>
+class BasicTransaction
+{
+public:
+    uint32_t symbol; // Id in the StockMarket
+    int quantity;
+    Price price;
+    time_t timestamp;
+    BasicTransaction(uint32_t symbol, int qty, Price p, time_t ts)
+        : symbol(symbol), quantity(qty), price(p), timestamp(ts) {}
+};
+using Transaction = BasicTransaction<Money>;
+
+// Mark-to-market value of one account's positions. The tick thread pushes every new price to
+// the symbols the account holds, and only to those, so the total is always current and O(1)
+// to read however many positions there are. With a FixedDecimal Price every mark is rounded to
+// the unit and the total is exact.
+template <class Price>
+class BasicPositionValuation {
+private:
+    struct Mark
+    {
+        uint32_t symbol;
+        int64_t shares;
+        Price price; // Last price pushed for the symbol
+    };
+    mutable mutex lock;
+    vector<Mark> marks;         // One per symbol with shares
+    vector<uint32_t> markIndex; // Symbol id -> index in marks + 1, 0 if not held
+    Price marketValue = Price(0);
+    uint64_t markedTick = 0;
+
+public:
+    // Sets the shares held in a symbol. price marks a symbol that was not held until now.
+    void setShares(uint32_t symbol, int64_t shares, Price price)
+    {
+        CountingLockGuard guard(lock);
+        if (symbol >= markIndex.size())
+        {
+            markIndex.resize(symbol + 1, 0);
+        }
+        if (markIndex[symbol] == 0)
+        {
+            if (shares == 0)
+            {
+                return;
+            }
+            marks.push_back({symbol, 0, price});
+            markIndex[symbol] = static_cast<uint32_t>(marks.size());
+        }
+        Mark& mark = marks[markIndex[symbol] - 1];
+        marketValue += (shares - mark.shares) * mark.price;
+        mark.shares = shares;
+        if (shares == 0)
+        {
+            // Swap-remove, so ticks never visit symbols that were sold out.
+            markIndex[marks.back().symbol] = markIndex[symbol];
+            mark = marks.back();
+            marks.pop_back();
+            markIndex[symbol] = 0;
+        }
+    }
+
+    // Runs on the tick thread after each published tick. The total is re-summed rather than
+    // adjusted, which costs the same and keeps rounding from drifting over millions of ticks.
+    void onTick(const MarketSnapshot& snap)
+    {
+        CountingLockGuard guard(lock);
+        Price value = Price(0);
+        for (Mark& mark : marks)
+        {
+            mark.price = Price(snap.prices[mark.symbol]);
+            value += mark.price * mark.shares;
+        }
+        marketValue = value;
+        markedTick = snap.tick;
+    }
+
+    Price getMarketValue() const
+    {
+        CountingLockGuard guard(lock);
+        return marketValue;
+    }
+
+    // Calls fn(symbol, price) for every held symbol under a single lock.
+    template <class Fn>
+    void forEachMark(Fn&& fn) const
+    {
+        CountingLockGuard guard(lock);
+        for (const Mark& mark : marks)
+        {
+            fn(mark.symbol, mark.price);
+        }
+    }
+};
+using PositionValuation = BasicPositionValuation<Money>;
+
+// Local "YYYY-MM-DD HH:MM:SS" for many timestamps: localtime and strftime run once per minute
+// seen, not once per row, as UTC offsets are whole minutes and the seconds are t mod 60.
+class TimestampFormatter {
+private:
+    struct Entry
+    {
+        int64_t minute = INT64_MIN;
+        char text[24];  // "YYYY-MM-DD HH:MM:", or empty if localtime failed
+        size_t length = 0;
+    };
+    array<Entry, 64> entries; // Direct-mapped by minute
+
+public:
+    static constexpr size_t width = 19;
+
+    // Appends the text for t to out. Returns false, appending nothing, if t cannot be converted.
+    bool append(time_t t, string& out)
+    {
+        int64_t seconds = static_cast<int64_t>(t);
+        int64_t minute = seconds / 60 - (seconds % 60 < 0);
+        Entry& entry = entries[static_cast<uint64_t>(minute) % entries.size()];
+        if (entry.minute != minute)
+        {
+            time_t start = static_cast<time_t>(minute * 60);
+            tm* local = localtime(&start);
+            entry.minute = minute;
+            entry.length = local ? strftime(entry.text, sizeof(entry.text), "%Y-%m-%d %H:%M:", local) : 0;
+        }
+        if (entry.length == 0)
+        {
+            return false;
+        }
+        int second = static_cast<int>(seconds - minute * 60);
+        out.append(entry.text, entry.length);
+        out += static_cast<char>('0' + second / 10);
+        out += static_cast<char>('0' + second % 10);
+        return true;
+    }
+};
+
+enum class HistorySide : uint8_t { Any, Buy, Sell };
+
+// Which fills a history query wants: one symbol or all, one side or both, and fills at times in
+// [from, to).
+struct HistoryQuery
+{
+    uint32_t symbol = SymbolTable::none; // All symbols
+    HistorySide side = HistorySide::Any;
+    time_t from = numeric_limits<time_t>::min();
+    time_t to = numeric_limits<time_t>::max();
+};
+
+// An account's fills, stored column by column in the order they happened. Every (symbol, side)
+// pair and each side on its own has a posting list of its rows, and a time index maps times to
+// rows, so a query is a few binary searches: it comes back as a sorted run of row numbers,
+// and any page of it is read directly. A clock that steps back files the rows after it under
+// the latest time already seen.
+template <class Price>
+class BasicTransactionHistory {
+private:
+    vector<int64_t> timestamps;
+    vector<uint32_t> symbols;
+    vector<int32_t> quantities; // Positive for buys
+    vector<Price> prices;
+    // First row at each new latest time; times strictly increase.
+    vector<pair<int64_t, uint32_t>> timeIndex;
+    // Rows of each traded symbol, all of them and by side: postings[listIndex[symbol] - 1 + side].
+    vector<vector<uint32_t>> postings;
+    vector<uint32_t> listIndex; // Symbol id -> first of its three lists + 1, 0 if never traded
+    array<vector<uint32_t>, 3> sideRows; // By side, all symbols; [Any] stays empty
+
+    static size_t sideOf(int32_t quantity)
+    {
+        return static_cast<size_t>(quantity > 0 ? HistorySide::Buy : HistorySide::Sell);
+    }
+
+    // First row filed at or after time t.
+    uint32_t rowAt(time_t t) const
+    {
+        auto it = lower_bound(timeIndex.begin(), timeIndex.end(), static_cast<int64_t>(t),
+                              [](const pair<int64_t, uint32_t>& entry, int64_t time) { return entry.first < time; });
+        return it == timeIndex.end() ? static_cast<uint32_t>(size()) : it->second;
+    }
+
+public:
+    // The rows a query matched, oldest first.
+    class Selection
+    {
+    private:
+        const uint32_t* rows; // Null when every row in [first, first + count) matched
+        uint32_t first;
+        size_t count;
+
+    public:
+        Selection(const uint32_t* rows, uint32_t first, size_t count) : rows(rows), first(first), count(count) {}
+        size_t size() const
+        {
+            return count;
+        }
+        uint32_t operator[](size_t i) const
+        {
+            return rows ? rows[i] : first + static_cast<uint32_t>(i);
+        }
+    };
+
+    void append(uint32_t symbol, int quantity, Price price, time_t timestamp)
+    {
+        uint32_t row = static_cast<uint32_t>(size());
+        int64_t time = static_cast<int64_t>(timestamp);
+        if (timeIndex.empty() || time > timeIndex.back().first)
+        {
+            timeIndex.emplace_back(time, row);
+        }
+        timestamps.push_back(time);
+        symbols.push_back(symbol);
+        quantities.push_back(quantity);
+        prices.push_back(price);
+        if (symbol >= listIndex.size())
+        {
+            listIndex.resize(symbol + 1, 0);
+        }
+        if (listIndex[symbol] == 0)
+        {
+            postings.resize(postings.size() + 3);
+            listIndex[symbol] = static_cast<uint32_t>(postings.size() - 2);
+        }
+        size_t lists = listIndex[symbol] - 1;
+        postings[lists].push_back(row);
+        postings[lists + sideOf(quantity)].push_back(row);
+        sideRows[sideOf(quantity)].push_back(row);
+    }
+
+    size_t size() const
+    {
+        return timestamps.size();
+    }
+    bool empty() const
+    {
+        return timestamps.empty();
+    }
+
+    BasicTransaction<Price> at(uint32_t row) const
+    {
+        return {symbols[row], quantities[row], prices[row], static_cast<time_t>(timestamps[row])};
+    }
+    uint32_t symbolAt(uint32_t row) const
+    {
+        return symbols[row];
+    }
+    int quantityAt(uint32_t row) const
+    {
+        return quantities[row];
+    }
+    Price priceAt(uint32_t row) const
+    {
+        return prices[row];
+    }
+    time_t timeAt(uint32_t row) const
+    {
+        return static_cast<time_t>(timestamps[row]);
+    }
+
+    Selection select(const HistoryQuery& query) const
+    {
+        uint32_t begin = rowAt(query.from);
+        uint32_t end = query.to > query.from ? rowAt(query.to) : begin;
+        const vector<uint32_t>* list = nullptr;
+        if (query.symbol != SymbolTable::none)
+        {
+            if (query.symbol >= listIndex.size() || listIndex[query.symbol] == 0)
+            {
+                return {nullptr, 0, 0};
+            }
+            list = &postings[listIndex[query.symbol] - 1 + static_cast<size_t>(query.side)];
+        }
+        else if (query.side != HistorySide::Any)
+        {
+            list = &sideRows[static_cast<size_t>(query.side)];
+        }
+        if (!list)
+        {
+            return {nullptr, begin, end - begin};
+        }
+        auto first = lower_bound(list->begin(), list->end(), begin);
+        auto last = lower_bound(first, list->end(), end);
+        return {list->data() + (first - list->begin()), 0, static_cast<size_t>(last - first)};
+    }
+};
+using TransactionHistory = BasicTransactionHistory<Money>;
+
+// One trader's account. Price is the type of every price and sum of cash: Money keeps cash
+// exact to the unit whatever happens to it, double is the old floating-point account.
+template <class P>
+class BasicPortfolio {
+public:
+    using Price = P;
+
+private:
+    // Limit order still working in the book, with what is still reserved for it.
+    struct OpenOrder
+    {
+        uint32_t symbol;
+        Side side;
+        Price limitPrice;
+        uint32_t remaining;
+    };
+
+    // Shares bought and not sold yet, at the price they were bought.
+    struct Lot
+    {
+        int64_t shares;
+        Price price;
+    };
+    struct Position
+    {
+        uint32_t symbol;
+        int shares;                       // Free to sell; shares reserved by limit sells are not included
+        int64_t owned = 0;                // Including reserved shares; the quantity cost basis covers
+        deque<Lot> lots;                  // FIFO lots, oldest first
+        Price fifoCost = Price(0);        // Cost of the open lots
+        Price averageCost = Price(0);     // Cost of the owned shares at their average price
+    };
+    vector<Position> positions;     // One per symbol ever held, in the order first bought
+    vector<uint32_t> positionIndex; // Symbol id -> index in positions + 1, 0 if never held
+    Price balance = Price(10000);
+    Price reservedCash = Price(0);  // Held back for open limit buys
+    // Account totals, kept up to date fill by fill so reading them is O(1).
+    Price openFifoCost = Price(0);
+    Price openAverageCost = Price(0);
+    Price realizedFifo = Price(0);
+    Price realizedAverage = Price(0);
+    BasicPositionValuation<Price> valuation;
+    BasicTransactionHistory<Price> transactionHistory;
+    TimestampFormatter timestampText;
+    map<uint64_t, OpenOrder> openOrders;
+    vector<Fill> fills; // Reused for every order
+    uint32_t fillParty = StockMarket::noFillParty; // Registered with the market on first use
+    Journal* journal = nullptr;              // Where account changes are saved, if anywhere
+    const StockMarket* journalMarket = nullptr;
+    size_t journalRecords = 0;               // Appended since the last snapshot
+    size_t snapshotRecords = 0;              // In the last snapshot image
+    static constexpr size_t snapshotMinimum = 4096;
+    TickRecorder* recorder = nullptr;        // Where actions are recorded, if anywhere
+
+    // Records a public action as it returns, with the cash it left behind.
+    struct RecordedAction
+    {
+        BasicPortfolio& portfolio;
+        RecordKind kind;
+        ActionRecord action;
+        ~RecordedAction()
+        {
+            if (portfolio.recorder)
+            {
+                action.cash = toDouble(portfolio.getCash());
+                portfolio.recorder->appendAction(kind, action);
+            }
+        }
+    };
+    RecordedAction recordAction(RecordKind kind, const Stock* stock, int quantity, Price amount,
+                                uint64_t orderId = 0, Side side = Side::Buy)
+    {
+        ActionRecord action{};
+        action.symbol = stock ? stock->getId() : SymbolTable::none;
+        action.quantity = quantity;
+        action.amount = toDouble(amount);
+        action.orderId = orderId;
+        action.side = side;
+        return {*this, kind, action};
+    }
+
+    // Saves one account change. Once the journal is longer than the last snapshot a new snapshot
+    // is queued, which keeps replay proportional to the size of the account.
+    void journalAppend(JournalKind kind, uint32_t symbol, int64_t quantity, double amount, time_t timestamp)
+    {
+        if (!journal)
+        {
+            return;
+        }
+        journal->append(kind, symbol == SymbolTable::none ? string() : journalMarket->getAbbreviation(symbol),
+                        quantity, amount, static_cast<int64_t>(timestamp));
+        if (++journalRecords >= max(snapshotMinimum, snapshotRecords))
+        {
+            queueSnapshot();
+        }
+    }
+
+    // The settled account as journal records: open orders do not survive a restart, so what they
+    // reserved is counted back into cash and shares. Sets `records` to how many there are.
+    string encodeAccount(const StockMarket& market, size_t& records) const
+    {
+        string image;
+        encodeJournalRecord(image, JournalKind::Balance, {}, 0, toDouble(getCash()), 0);
+        records = 1;
+        for (const Position& position : positions)
+        {
+            if (position.owned == 0)
+            {
+                continue;
+            }
+            string abbr = market.getAbbreviation(position.symbol);
+            encodeJournalRecord(image, JournalKind::Position, abbr, position.owned, toDouble(position.averageCost), 0);
+            for (const Lot& lot : position.lots)
+            {
+                encodeJournalRecord(image, JournalKind::Lot, abbr, lot.shares, toDouble(lot.price), 0);
+            }
+            records += 1 + position.lots.size();
+        }
+        for (uint32_t row = 0; row < transactionHistory.size(); ++row)
+        {
+            encodeJournalRecord(image, JournalKind::History, market.getAbbreviation(transactionHistory.symbolAt(row)),
+                                transactionHistory.quantityAt(row), toDouble(transactionHistory.priceAt(row)),
+                                static_cast<int64_t>(transactionHistory.timeAt(row)));
+            ++records;
+        }
+        encodeJournalRecord(image, JournalKind::Realized, {}, 0, toDouble(realizedFifo), 0);
+        encodeJournalRecord(image, JournalKind::Realized, {}, 1, toDouble(realizedAverage), 0);
+        records += 2;
+        return image;
+    }
+
+    // Snapshots keep replay proportional to the size of the account.
+    void queueSnapshot()
+    {
+        string image = encodeAccount(*journalMarket, snapshotRecords);
+        journalRecords = 0;
+        journal->requestSnapshot(move(image));
+    }
+
+    Position& positionOf(uint32_t symbol)
+    {
+        if (symbol >= positionIndex.size())
+        {
+            positionIndex.resize(symbol + 1, 0);
+        }
+        if (positionIndex[symbol] == 0)
+        {
+            positions.push_back(Position{symbol, 0, 0, {}, Price(0), Price(0)});
+            positionIndex[symbol] = static_cast<uint32_t>(positions.size());
+        }
+        return positions[positionIndex[symbol] - 1];
+    }
+    int& sharesOf(uint32_t symbol)
+    {
+        return positionOf(symbol).shares;
+    }
+
+    // Cost basis of a bought fill: a new FIFO lot, and the same cost added at average cost.
+    void addLot(StockMarket& market, uint32_t symbol, int64_t quantity, Price price)
+    {
+        Position& position = positionOf(symbol);
+        position.lots.push_back({quantity, price});
+        position.fifoCost += quantity * price;
+        position.averageCost += quantity * price;
+        position.owned += quantity;
+        openFifoCost += quantity * price;
+        openAverageCost += quantity * price;
+        valuation.setShares(symbol, position.owned, Price(market.getPrice(symbol)));
+    }
+
+    // Cost basis of a sold fill: FIFO consumes the oldest lots, average cost takes its share of
+    // the position's cost; the difference to the proceeds is realized.
+    void closeLots(StockMarket& market, uint32_t symbol, int64_t quantity, Price price)
+    {
+        Position& position = positionOf(symbol);
+        Price averageCost = position.owned > 0 ? costShare(position.averageCost, min(quantity, position.owned), position.owned)
+                                               : Price(0);
+        Price fifoCost = Price(0);
+        for (int64_t left = quantity; left > 0 && !position.lots.empty();)
+        {
+            Lot& lot = position.lots.front();
+            int64_t taken = min(left, lot.shares);
+            fifoCost += taken * lot.price;
+            left -= taken;
+            if ((lot.shares -= taken) == 0)
+            {
+                position.lots.pop_front();
+            }
+        }
+        position.owned -= quantity;
+        if (position.owned <= 0)
+        {
+            fifoCost = position.fifoCost; // Whatever rounding left behind goes with the last share
+            averageCost = position.averageCost;
+        }
+        position.fifoCost -= fifoCost;
+        position.averageCost -= averageCost;
+        openFifoCost -= fifoCost;
+        openAverageCost -= averageCost;
+        realizedFifo += quantity * price - fifoCost;
+        realizedAverage += quantity * price - averageCost;
+        valuation.setShares(symbol, max<int64_t>(position.owned, 0), Price(market.getPrice(symbol)));
+    }
+    // cost * part / whole, without overflowing a FixedDecimal on the way.
+    static Price costShare(Price cost, int64_t part, int64_t whole)
+    {
+        if constexpr (is_floating_point_v<Price>)
+        {
+            return cost * part / whole;
+        }
+        else
+        {
+            return Price::fromUnits(mulDivRound(cost.getUnits(), part, whole));
+        }
+    }
+    // Largest balance Price can hold.
+    static Price maxCash()
+    {
+        if constexpr (is_floating_point_v<Price>)
+        {
+            return numeric_limits<Price>::max();
+        }
+        else
+        {
+            return Price::fromUnits(numeric_limits<int64_t>::max());
+        }
+    }
+    int sharesHeld(uint32_t symbol) const
+    {
+        return symbol < positionIndex.size() && positionIndex[symbol] ? positions[positionIndex[symbol] - 1].shares : 0;
+    }
+
+    // New house quotes can cross our own resting orders, so settle whatever they fill.
+    void refreshQuotes(StockMarket& market, uint32_t symbol)
+    {
+        takeFills(market);
+        fills.clear();
+        market.refreshQuotes(symbol, fills, ownerId);
+        applyFills(market);
+    }
+
+    void applyFills(StockMarket& market)
+    {
+        for (const Fill& fill : fills)
+        {
+            if (fill.takerOwner == ownerId)
+            {
+                applyFill(market, fill, fill.takerOrderId, fill.takerSide);
+            }
+            if (fill.makerOwner == ownerId)
+            {
+                applyFill(market, fill, fill.makerOrderId, fill.takerSide == Side::Buy ? Side::Sell : Side::Buy);
+            }
+        }
+    }
+
+    void applyFill(StockMarket& market, const Fill& fill, uint64_t orderId, Side side)
+    {
+        string abbr = market.getAbbreviation(fill.symbol);
+        Price price = fromPriceTicksAs<Price>(fill.priceTicks);
+        int quantity = static_cast<int>(fill.quantity);
+        auto it = openOrders.find(orderId);
+        if (side == Side::Buy)
+        {
+            sharesOf(fill.symbol) += quantity;
+            // A limit buy reserved cash at its limit; hand back the price improvement.
+            balance += it != openOrders.end() ? (it->second.limitPrice - price) * quantity : -price * quantity;
+            if (it != openOrders.end())
+            {
+                reservedCash -= it->second.limitPrice * quantity;
+            }
+            addLot(market, fill.symbol, quantity, price);
+        }
+        else
+        {
+            if (it == openOrders.end())
+            {
+                sharesOf(fill.symbol) -= quantity; // Limit sells reserved their shares up front
+            }
+            balance += price * quantity;
+            closeLots(market, fill.symbol, quantity, price);
+        }
+        if (it != openOrders.end() && (it->second.remaining -= fill.quantity) == 0)
+        {
+            openOrders.erase(it);
+            if (openOrders.empty())
+            {
+                reservedCash = Price(0); // Drop rounding left from partial fills
+            }
+        }
+        time_t now = time(0);
+        transactionHistory.append(fill.symbol, side == Side::Buy ? quantity : -quantity, price, now);
+        journalAppend(JournalKind::Fill, fill.symbol, side == Side::Buy ? quantity : -quantity, toDouble(price), now);
+        cout << (side == Side::Buy ? "Bought " : "Sold ") << quantity << " shares of " << abbr << " at $" << fixed
+             << setprecision(2) << price << endl;
+    }
+
+    // Returns what is still reserved for an order that will not fill any further.
+    void releaseOrder(typename map<uint64_t, OpenOrder>::iterator it)
+    {
+        const OpenOrder& order = it->second;
+        if (order.side == Side::Buy)
+        {
+            balance += order.limitPrice * order.remaining;
+            reservedCash -= order.limitPrice * order.remaining;
+        }
+        else
+        {
+            sharesOf(order.symbol) += order.remaining;
+        }
+        openOrders.erase(it);
+        if (openOrders.empty())
+        {
+            reservedCash = Price(0);
+        }
+    }
+
+    // Applies one journal or snapshot record to the account. unknown counts records that name
+    // a symbol no longer listed.
+    void applyJournalRecord(StockMarket& market, const JournalRecord& record, string_view abbr, size_t& unknown)
+    {
+        uint32_t symbol = SymbolTable::none;
+        if (!abbr.empty())
+        {
+            Stock* stock = market.getStock(abbr);
+            symbol = stock ? stock->getId() : SymbolTable::none;
+            unknown += !stock;
+        }
+        int quantity = static_cast<int>(record.quantity);
+        time_t timestamp = static_cast<time_t>(record.timestamp);
+        Price amount = Price(record.amount); // Written from a Price, so this gives it back exactly
+        switch (record.kind)
+        {
+            case JournalKind::Deposit:
+                balance += amount;
+                break;
+            case JournalKind::Withdrawal:
+                balance -= amount;
+                break;
+            case JournalKind::Fill:
+                balance -= quantity * amount;
+                if (symbol != SymbolTable::none)
+                {
+                    sharesOf(symbol) += quantity;
+                    transactionHistory.append(symbol, quantity, amount, timestamp);
+                    if (quantity > 0)
+                    {
+                        addLot(market, symbol, quantity, amount);
+                    }
+                    else
+                    {
+                        closeLots(market, symbol, -quantity, amount);
+                    }
+                }
+                break;
+            case JournalKind::Balance:
+                balance = amount;
+                break;
+            case JournalKind::Position:
+                if (symbol != SymbolTable::none)
+                {
+                    Position& position = positionOf(symbol);
+                    position.shares = quantity;
+                    position.owned = quantity;
+                    position.averageCost = amount;
+                    openAverageCost += amount;
+                    valuation.setShares(symbol, quantity, Price(market.getPrice(symbol)));
+                }
+                break;
+            case JournalKind::History:
+                if (symbol != SymbolTable::none)
+                {
+                    transactionHistory.append(symbol, quantity, amount, timestamp);
+                }
+                break;
+            case JournalKind::Lot:
+                if (symbol != SymbolTable::none)
+                {
+                    Position& position = positionOf(symbol);
+                    position.lots.push_back({record.quantity, amount});
+                    position.fifoCost += record.quantity * amount;
+                    openFifoCost += record.quantity * amount;
+                }
+                break;
+            case JournalKind::Realized:
+                (record.quantity == 0 ? realizedFifo : realizedAverage) = amount;
+                break;
+        }
+    }
+
+public:
+    // Owner id this account trades under in the matching engine.
+    static constexpr uint32_t ownerId = 1;
+
+    // Rebuilds the account from path's snapshot and journal, then saves every later change there.
+    // Returns an error message, empty on success.
+    string attachJournal(StockMarket& market, Journal& accountJournal, const string& path)
+    {
+        size_t unknown = 0;
+        size_t replayed = 0;
+        string error = accountJournal.open(path, [&](const JournalRecord& record, string_view abbr)
+        {
+            applyJournalRecord(market, record, abbr, unknown);
+            bool snapshotKind = record.kind != JournalKind::Deposit && record.kind != JournalKind::Withdrawal &&
+                                record.kind != JournalKind::Fill;
+            (snapshotKind ? snapshotRecords : replayed) += 1;
+        });
+        if (!error.empty())
+        {
+            return error;
+        }
+        if (unknown > 0)
+        {
+            cout << "Journal: " << unknown << " entries name symbols that are no longer listed; their shares were dropped."
+                 << endl;
+        }
+        journal = &accountJournal;
+        journalMarket = &market;
+        journalRecords = replayed;
+        return "";
+    }
+
+    // Records every account action from now on, with the market's ticks, to path; see
+    // TickRecorder. Call before the market starts ticking. Returns an error message, empty on
+    // success.
+    string startRecording(StockMarket& market, const string& path)
+    {
+        size_t records;
+        string error = market.startRecording(path, encodeAccount(market, records));
+        if (error.empty())
+        {
+            recorder = &market.getRecorder();
+        }
+        return error;
+    }
+
+    // Replay: sets a fresh account to a recording's starting image. Returns an error message,
+    // empty on success.
+    string restoreAccount(StockMarket& market, string_view image)
+    {
+        size_t unknown = 0;
+        if (forEachJournalRecord(image, [&](const JournalRecord& record, string_view abbr)
+            {
+                applyJournalRecord(market, record, abbr, unknown);
+            }) != image.size())
+        {
+            return "the recorded account is corrupt";
+        }
+        return "";
+    }
+
+    // Settles the fills of our resting orders that someone else's order caused (the gateway's
+    // accounts, a trader population). Every order and cancel does this first; the menu also
+    // calls it before showing the account. Hold lockOrders() when another thread trades.
+    void takeFills(StockMarket& market)
+    {
+        if (fillParty == StockMarket::noFillParty)
+        {
+            fillParty = market.addFillParty(ownerId, ownerId + 1); // Nothing rests before this
+        }
+        fills.clear();
+        market.takeFills(fillParty, fills);
+        applyFills(market);
+    }
+
+    // Cash including what open limit buys hold back.
+    Price getCash() const
+    {
+        return balance + reservedCash;
+    }
+
+    void deposit(Price amount)
+    {
+        RecordedAction recording = recordAction(RecordKind::Deposit, nullptr, 0, amount);
+        if (!(amount > Price(0)) || amount > maxCash() - balance)
+        {
+            cout << "Deposit must be positive and keep the balance within $" << fixed << setprecision(2)
+                 << maxCash() << "." << endl;
+            return;
+        }
+        balance += amount;
+        journalAppend(JournalKind::Deposit, SymbolTable::none, 0, toDouble(amount), time(0));
+        cout << "Deposited $" << fixed << setprecision(2) << amount << endl;
+    }
+
+    void withdraw(Price amount)
+    {
+        RecordedAction recording = recordAction(RecordKind::Withdrawal, nullptr, 0, amount);
+        if (!(amount > Price(0)))
+        {
+            cout << "Withdrawal must be positive." << endl;
+        }
+        else if (amount <= balance)
+        {
+            balance -= amount;
+            journalAppend(JournalKind::Withdrawal, SymbolTable::none, 0, toDouble(amount), time(0));
+            cout << "Withdrew $" << fixed << setprecision(2) << amount << endl;
+        } else
+        {
+            cout << "Insufficient balance for withdrawal." << endl;
+        }
+    }
+    // Market order: walks the book from the best ask, so large orders pay for the liquidity
+    // they take.
+    void buyStock(StockMarket& market, Stock* stock, int quantity)
+    {
+        RecordedAction recording = recordAction(RecordKind::Buy, stock, quantity, Price(0));
+        if (!stock)
+        {
+            cout << "Stock not found." << endl;
+            return;
+        }
+        if (quantity <= 0)
+        {
+            cout << "Quantity must be positive." << endl;
+            return;
+        }
+        uint32_t symbol = stock->getId();
+        refreshQuotes(market, symbol);
+        int64_t costTicks;
+        if (market.estimateMarketOrder(symbol, Side::Buy, quantity, costTicks) < static_cast<uint32_t>(quantity))
+        {
+            cout << "Not enough liquidity to buy " << quantity << " shares." << endl;
+            return;
+        }
+        if (fromPriceTicksAs<Price>(costTicks) > balance)
+        {
+            cout << "Insufficient balance." << endl;
+            return;
+        }
+        fills.clear();
+        market.submitOrder(symbol, Side::Buy, OrderType::Market, 0.0, quantity, ownerId, fills);
+        applyFills(market);
+    }
+
+    void sellStock(StockMarket& market, Stock* stock, int quantity)
+    {
+        RecordedAction recording = recordAction(RecordKind::Sell, stock, quantity, Price(0));
+        if (!stock)
+        {
+            cout << "Stock not found." << endl;
+            return;
+        }
+        uint32_t symbol = stock->getId();
+        takeFills(market); // Shares bought by resting buys count
+        if (quantity <= 0 || sharesHeld(symbol) < quantity)
+        {
+            cout << "Not enough shares to sell." << endl;
+            return;
+        }
+        refreshQuotes(market, symbol);
+        int64_t proceedsTicks;
+        if (market.estimateMarketOrder(symbol, Side::Sell, quantity, proceedsTicks) < static_cast<uint32_t>(quantity))
+        {
+            cout << "Not enough liquidity to sell " << quantity << " shares." << endl;
+            return;
+        }
+        fills.clear();
+        market.submitOrder(symbol, Side::Sell, OrderType::Market, 0.0, quantity, ownerId, fills);
+        applyFills(market);
+    }
+
+    // Limit order: cash (buys) or shares (sells) are reserved up front at the limit price and
+    // released as the order fills or is cancelled.
+    void placeLimitOrder(StockMarket& market, Stock* stock, Side side, int quantity, Price limitPrice)
+    {
+        RecordedAction recording = recordAction(RecordKind::Limit, stock, quantity, limitPrice, 0, side);
+        if (!stock)
+        {
+            cout << "Stock not found." << endl;
+            return;
+        }
+        int64_t limitTicks = toPriceTicks(limitPrice);
+        if (quantity <= 0 || limitTicks <= 0)
+        {
+            cout << "Quantity and price must be positive." << endl;
+            return;
+        }
+        limitPrice = fromPriceTicksAs<Price>(limitTicks);
+        uint32_t symbol = stock->getId();
+        takeFills(market);
+        if (side == Side::Buy && limitPrice * quantity > balance)
+        {
+            cout << "Insufficient balance." << endl;
+            return;
+        }
+        if (side == Side::Sell && sharesHeld(symbol) < quantity)
+        {
+            cout << "Not enough shares to sell." << endl;
+            return;
+        }
+        refreshQuotes(market, symbol);
+        fills.clear();
+        OrderResult result = market.submitOrder(symbol, side, OrderType::Limit, toDouble(limitPrice), quantity, ownerId,
+                                                fills);
+        if (!result.accepted)
+        {
+            cout << "Order rejected." << endl;
+            return;
+        }
+        if (side == Side::Buy)
+        {
+            balance -= limitPrice * quantity;
+            reservedCash += limitPrice * quantity;
+        }
+        else
+        {
+            sharesOf(symbol) -= quantity;
+        }
+        openOrders.emplace(result.orderId, OpenOrder{symbol, side, limitPrice, static_cast<uint32_t>(quantity)});
+        applyFills(market);
+        if (result.resting > 0)
+        {
+            cout << "Order #" << result.orderId << " resting: " << result.resting << " shares of " << stock->getAbbreviation() << " at $"
+                 << fixed << setprecision(2) << limitPrice << endl;
+        }
+    }
+
+    void cancelOrder(StockMarket& market, uint64_t orderId)
+    {
+        RecordedAction recording = recordAction(RecordKind::Cancel, nullptr, 0, Price(0), orderId);
+        takeFills(market);
+        auto it = openOrders.find(orderId);
+        if (it == openOrders.end() || !market.cancelOrder(orderId))
+        {
+            cout << "No open order #" << orderId << "." << endl;
+            return;
+        }
+        cout << "Cancelled order #" << orderId << " (" << it->second.remaining << " shares unfilled)." << endl;
+        releaseOrder(it);
+    }
+
+    void showOpenOrders(StockMarket& market) const
+    {
+        if (openOrders.empty())
+        {
+            cout << "No open orders." << endl;
+            return;
+        }
+        cout << left << setw(24) << "Order" << setw(10) << "Stock" << setw(6) << "Side" << setw(10) << "Open"
+             << "Limit\n";
+        for (const auto& [orderId, order] : openOrders)
+        {
+            cout << left << setw(24) << orderId << setw(10) << market.getAbbreviation(order.symbol)
+                 << setw(6) << (order.side == Side::Buy ? "BUY" : "SELL") << setw(10) << order.remaining
+                 << fixed << setprecision(2) << order.limitPrice << endl;
+        }
+    }
+
+    // Live valuation; every field is O(1) to read whatever the number of positions.
+    struct Valuation
+    {
+        Price marketValue;       // Owned shares at their last pushed price
+        Price totalValue;        // Cash, reserved cash and market value
+        Price unrealizedFifo;
+        Price unrealizedAverage;
+        Price realizedFifo;
+        Price realizedAverage;
+    };
+    Valuation getValuation() const
+    {
+        Price marketValue = valuation.getMarketValue();
+        return {marketValue, balance + reservedCash + marketValue, marketValue - openFifoCost,
+                marketValue - openAverageCost, realizedFifo, realizedAverage};
+    }
+
+    // Tick listener: pushes the new prices to the symbols this account holds.
+    void onTick(const MarketSnapshot& snap)
+    {
+        valuation.onTick(snap);
+    }
+
+    void showPortfolio(StockMarket& market)
+    {
+        cout << "\n--- Your Portfolio ---\n";
+        cout << "Balance: $" << fixed << setprecision(2) << balance << endl;
+        // One pass under the valuation lock for every price on the page.
+        vector<Price> marks(positions.size(), Price(0));
+        valuation.forEachMark([&](uint32_t symbol, Price price) { marks[positionIndex[symbol] - 1] = price; });
+        for (size_t i = 0; i < positions.size(); ++i)
+        {
+            const Position& position = positions[i];
+            if (position.owned == 0 && position.shares == 0)
+            {
+                continue;
+            }
+            Price price = marks[i];
+            Price currentValue = price * position.owned;
+            Price averagePrice = position.owned > 0 ? position.averageCost / position.owned : Price(0);
+            cout << market.getAbbreviation(position.symbol) << ": " << position.owned << " shares, Current Price: $"
+                 << fixed << setprecision(2) << price << ", Value: $" << currentValue << ", Avg Cost: $" << averagePrice
+                 << ", Unrealized P&L: $" << currentValue - position.fifoCost << " (FIFO) / $"
+                 << currentValue - position.averageCost << " (avg)" << endl;
+        }
+        Valuation value = getValuation();
+        cout << "Total Portfolio Value: $" << fixed << setprecision(2) << value.totalValue << endl;
+        cout << "Unrealized P&L: $" << value.unrealizedFifo << " (FIFO) / $" << value.unrealizedAverage << " (avg)"
+             << endl;
+        cout << "Realized P&L: $" << value.realizedFifo << " (FIFO) / $" << value.realizedAverage << " (avg)" << endl;
+        if (!openOrders.empty())
+        {
+            cout << "\nOpen Orders:\n";
+            showOpenOrders(market);
+        }
+    }
+    // Distribution of the account's value after `steps` ticks over `paths` simulated futures.
+    void showRisk(StockMarket& market, size_t paths, int steps)
+    {
+        vector<pair<uint32_t, int64_t>> holdings;
+        for (const Position& position : positions)
+        {
+            if (position.owned > 0)
+            {
+                holdings.emplace_back(position.symbol, position.owned);
+            }
+        }
+        if (holdings.empty() || paths == 0 || steps <= 0)
+        {
+            cout << "Nothing to simulate: needs positions, paths and a horizon." << endl;
+            return;
+        }
+        RiskReport report = market.simulateRisk(holdings, toDouble(getCash()), paths, steps);
+        cout << "\n--- Risk Report: " << report.paths << " paths, " << report.steps << " ticks ahead ---\n";
+        cout << "Current Value: $" << fixed << setprecision(2) << report.initialValue << endl;
+        cout << "Mean Value: $" << report.meanValue << endl;
+        cout << "VaR 95%: $" << report.valueAtRisk95 << ", Expected Shortfall 95%: $" << report.expectedShortfall95
+             << endl;
+        cout << "VaR 99%: $" << report.valueAtRisk99 << ", Expected Shortfall 99%: $" << report.expectedShortfall99
+             << endl;
+        cout << "Value percentiles:";
+        for (size_t i = 0; i < riskPercentiles.size(); ++i)
+        {
+            cout << " p" << static_cast<int>(riskPercentiles[i] * 100) << " $" << report.percentiles[i];
+        }
+        cout << "\n(" << setprecision(3) << report.seconds << " s)" << endl;
+    }
+
+    const BasicTransactionHistory<Price>& getTransactionHistory() const
+    {
+        return transactionHistory;
+    }
+
+    // Prints page `page` (from 0) of the fills matching query, pageSize to a page. The page is
+    // built in one string and timestamps come from the per-minute cache, so it costs the same
+    // at row 10 as at row 10 million. Returns the number of pages.
+    size_t showTransactionHistory(StockMarket& market, const HistoryQuery& query, size_t page, size_t pageSize = 20)
+    {
+        cout << "\n--- Transaction History ---\n";
+        auto rows = transactionHistory.select(query);
+        if (rows.size() == 0)
+        {
+            cout << (transactionHistory.empty() ? "No transactions yet." : "No transactions match.") << endl;
+            return 0;
+        }
+        pageSize = max<size_t>(pageSize, 1);
+        size_t pages = (rows.size() + pageSize - 1) / pageSize;
+        page = min(page, pages - 1);
+        size_t first = page * pageSize;
+        size_t last = min(rows.size(), first + pageSize);
+        string text;
+        text.reserve((last - first + 2) * 64);
+        auto pad = [&text](size_t width, size_t used) { text.append(used < width ? width - used : 1, ' '); };
+        text += "Stock";
+        pad(15, 5);
+        text += "Quantity";
+        pad(10, 8);
+        text += "Price";
+        pad(15, 5);
+        text += "Timestamp\n";
+        char number[24];
+        for (size_t i = first; i < last; ++i)
+        {
+            uint32_t row = rows[i];
+            size_t start = text.size();
+            text += market.getAbbreviation(transactionHistory.symbolAt(row));
+            pad(15, text.size() - start);
+            int quantity = transactionHistory.quantityAt(row);
+            start = text.size();
+            text += quantity > 0 ? '+' : '-';
+            text.append(number, to_chars(number, number + sizeof(number), abs(quantity)).ptr);
+            pad(10, text.size() - start);
+            int64_t cents = toPriceTicks(transactionHistory.priceAt(row));
+            start = text.size();
+            if (cents < 0)
+            {
+                text += '-';
+            }
+            text.append(number, to_chars(number, number + sizeof(number), abs(cents) / 100).ptr);
+            text += '.';
+            text += static_cast<char>('0' + abs(cents) % 100 / 10);
+            text += static_cast<char>('0' + abs(cents) % 10);
+            pad(15, text.size() - start);
+            if (!timestampText.append(transactionHistory.timeAt(row), text))
+            {
+                text += "Error converting timestamp.";
+            }
+            text += '\n';
+        }
+        text += "Rows " + to_string(first + 1) + "-" + to_string(last) + " of " + to_string(rows.size()) + ", page " +
+                to_string(page + 1) + " of " + to_string(pages) + "\n";
+        cout << text << flush;
+        return pages;
+    }
+};
+using Portfolio = BasicPortfolio<Money>;
+
+// A recording opened for replay. It is read straight from a mapping, so even a multi-GB file
+// opens at once and pages come in as the replay reaches them.
+class SessionReplay {
+private:
+    unique_ptr<MappedFile> file;
+    RecordingHeader header{};
+    size_t recordsAt = 0;
+
+    // Makes the recorded action again, as the menu would.
+    static bool apply(StockMarket& market, Portfolio& portfolio, RecordKind kind, const ActionRecord& action)
+    {
+        Stock* stock = action.symbol == SymbolTable::none ? nullptr : market.getStock(action.symbol);
+        auto orders = market.lockOrders();
+        switch (kind)
+        {
+            case RecordKind::Deposit:
+            case RecordKind::Withdrawal:
+            case RecordKind::Limit:
+                break;
+            case RecordKind::Buy:
+                portfolio.buyStock(market, stock, action.quantity);
+                return true;
+            case RecordKind::Sell:
+                portfolio.sellStock(market, stock, action.quantity);
+                return true;
+            case RecordKind::Cancel:
+                portfolio.cancelOrder(market, action.orderId);
+                return true;
+            default:
+                return false;
+        }
+        Portfolio::Price amount;
+        if (!amountAs(action.amount, amount))
+        {
+            cout << "Amount out of range." << endl; // As the menu rejects it
+            return true;
+        }
+        if (kind == RecordKind::Deposit)
+        {
+            portfolio.deposit(amount);
+        }
+        else if (kind == RecordKind::Withdrawal)
+        {
+            portfolio.withdraw(amount);
+        }
+        else
+        {
+            portfolio.placeLimitOrder(market, stock, action.side, action.quantity, amount);
+        }
+        return true;
+    }
+
+public:
+    // Returns an error message, empty on success.
+    string open(const string& path)
+    {
+        file = make_unique<MappedFile>(path);
+        if (!file->isOpen())
+        {
+            return "cannot open " + path;
+        }
+        if (file->size() >= sizeof(header))
+        {
+            memcpy(&header, file->data(), sizeof(header));
+        }
+        if (file->size() < sizeof(header) || memcmp(header.magic, recordingMagic, sizeof(header.magic)) != 0 ||
+            header.version != recordingVersion)
+        {
+            return path + ": not a recording";
+        }
+        recordsAt = (sizeof(header) + header.accountBytes + 7) & ~size_t(7);
+        if (recordsAt > file->size())
+        {
+            return path + ": recording is truncated";
+        }
+        file->adviseSequential();
+        return "";
+    }
+
+    const RecordingHeader& getHeader() const
+    {
+        return header;
+    }
+
+    // The account when recording started, as journal records.
+    string_view getAccountImage() const
+    {
+        return file->text().substr(sizeof(header), header.accountBytes);
+    }
+
+    struct Stats
+    {
+        uint64_t ticks = 0;
+        uint64_t actions = 0;
+        uint64_t diverged = 0;        // Actions that left different cash than when recorded
+        uint64_t firstDivergedAt = 0; // Tick of the first one
+        double seconds = 0.0;
+        bool truncated = false;       // The recording ends partway through a record
+    };
+
+    // Plays the recording through market (loaded with the recorded universe, not ticking) and
+    // portfolio (fresh, without a journal): ticks are published as recorded, actions made again
+    // and their cash compared. speed 1 keeps the recorded pace, N runs N times faster and 0 as
+    // fast as possible. Returns an error message, empty on success.
+    string run(StockMarket& market, Portfolio& portfolio, double speed, Stats& stats)
+    {
+        if (market.size() != header.symbols || market.getUniverseHash() != header.universeHash)
+        {
+            return "the recording was made with a different universe";
+        }
+        string error = portfolio.restoreAccount(market, getAccountImage());
+        if (!error.empty())
+        {
+            return error;
+        }
+        const char* data = file->data();
+        size_t size = file->size();
+        size_t offset = recordsAt;
+        size_t tickBytes = size_t{header.symbols} * 2 * sizeof(double);
+        auto start = chrono::steady_clock::now();
+        while (size - offset >= sizeof(RecordHeader))
+        {
+            RecordHeader record;
+            memcpy(&record, data + offset, sizeof(record));
+            const char* payload = data + offset + sizeof(record);
+            if (record.size > size - offset - sizeof(record))
+            {
+                stats.truncated = true;
+                break;
+            }
+            if (speed > 0.0)
+            {
+                this_thread::sleep_until(start + chrono::nanoseconds(llround(record.elapsedNs / speed)));
+            }
+            if (record.kind == RecordKind::Tick && record.size == tickBytes)
+            {
+                const double* prices = reinterpret_cast<const double*>(payload);
+                if (!market.replayTick(prices, prices + header.symbols))
+                {
+                    return "the market is ticking on its own";
+                }
+                ++stats.ticks;
+            }
+            else if (record.kind != RecordKind::Tick && record.size == sizeof(ActionRecord))
+            {
+                ActionRecord action;
+                memcpy(&action, payload, sizeof(action));
+                if (!apply(market, portfolio, record.kind, action))
+                {
+                    return "unknown record at offset " + to_string(offset);
+                }
+                if (toDouble(portfolio.getCash()) != action.cash && stats.diverged++ == 0)
+                {
+                    stats.firstDivergedAt = record.tick;
+                }
+                ++stats.actions;
+            }
+            else
+            {
+                return "corrupt record at offset " + to_string(offset);
+            }
+            offset += sizeof(record) + record.size;
+        }
+        stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return "";
+    }
+};
+
+enum class AccountStatus : uint8_t
+{
+    Ok,
+    UnknownAccount,
+    UnknownSymbol,
+    BadAmount,
+    InsufficientCash,
+    InsufficientShares,
+};
+
+// Cash and positions of many accounts (hundreds of thousands), safe to use from any number of
+// threads. Accounts are sharded by id, shard = id % shardCount, each shard with its own lock,
+// so operations on accounts in different shards run in parallel. Cash is whole cents.
+//
+// Positions are not kept per account in a map: each shard has a pool of 64-byte blocks of five
+// (symbol, shares) pairs, and an account chains the blocks it uses from its record, newest
+// first. Only the newest block may have free entries; removing a position moves the newest
+// entry into its place. An account with no positions costs its 24-byte record and nothing else.
+class AccountStore {
+public:
+    static constexpr uint32_t none = UINT32_MAX;
+
+private:
+    struct alignas(64) PositionBlock
+    {
+        static constexpr uint32_t capacity = 5;
+        array<uint32_t, capacity> symbols;
+        uint32_t next;
+        array<int64_t, capacity> shares;
+    };
+    static_assert(sizeof(PositionBlock) == 64, "one block per cache line");
+
+    struct Record
+    {
+        int64_t cash = 0;
+        uint32_t head = none; // Newest position block
+        uint32_t positions = 0;
+        bool open = false;
+    };
+
+    struct alignas(64) Shard
+    {
+        mutable mutex lock;
+        vector<Record> records;
+        vector<uint32_t> freeRecords;
+        vector<PositionBlock> blocks;
+        uint32_t freeBlock = none;
+    };
+
+    unique_ptr<Shard[]> shards;
+    uint32_t shardCount;
+    atomic<uint32_t> nextShard{0};
+    atomic<size_t> openCount{0};
+
+    Shard& shardOf(uint32_t id) const { return shards[id & (shardCount - 1)]; }
+    // Caller holds the shard lock.
+    Record* recordOf(Shard& shard, uint32_t id) const
+    {
+        uint32_t local = id / shardCount;
+        return local < shard.records.size() && shard.records[local].open ? &shard.records[local] : nullptr;
+    }
+    static uint32_t headCount(const Record& record)
+    {
+        return (record.positions - 1) % PositionBlock::capacity + 1;
+    }
+
+    // Block and entry of the symbol's position, or none.
+    static pair<uint32_t, uint32_t> findPosition(const Shard& shard, const Record& record, uint32_t symbol)
+    {
+        uint32_t count = record.positions ? headCount(record) : 0;
+        for (uint32_t block = record.head; block != none; block = shard.blocks[block].next)
+        {
+            const PositionBlock& positions = shard.blocks[block];
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                if (positions.symbols[i] == symbol)
+                {
+                    return {block, i};
+                }
+            }
+            count = PositionBlock::capacity;
+        }
+        return {none, 0};
+    }
+
+    static pair<uint32_t, uint32_t> addPosition(Shard& shard, Record& record, uint32_t symbol)
+    {
+        if (record.positions % PositionBlock::capacity == 0)
+        {
+            uint32_t block = shard.freeBlock;
+            if (block != none)
+            {
+                shard.freeBlock = shard.blocks[block].next;
+            }
+            else
+            {
+                block = static_cast<uint32_t>(shard.blocks.size());
+                shard.blocks.emplace_back();
+            }
+            shard.blocks[block].next = record.head;
+            record.head = block;
+        }
+        uint32_t entry = record.positions++ % PositionBlock::capacity;
+        shard.blocks[record.head].symbols[entry] = symbol;
+        shard.blocks[record.head].shares[entry] = 0;
+        return {record.head, entry};
+    }
+
+    static void removePosition(Shard& shard, Record& record, pair<uint32_t, uint32_t> at)
+    {
+        PositionBlock& newest = shard.blocks[record.head];
+        uint32_t last = headCount(record) - 1;
+        shard.blocks[at.first].symbols[at.second] = newest.symbols[last];
+        shard.blocks[at.first].shares[at.second] = newest.shares[last];
+        if (--record.positions % PositionBlock::capacity == 0)
+        {
+            uint32_t freed = record.head;
+            record.head = newest.next;
+            newest.next = shard.freeBlock;
+            shard.freeBlock = freed;
+        }
+    }
+
+public:
+    explicit AccountStore(size_t shards = 64)
+        : shards(make_unique<Shard[]>(roundUpPow2(max<size_t>(1, shards)))),
+          shardCount(static_cast<uint32_t>(roundUpPow2(max<size_t>(1, shards))))
+    {
+    }
+
+    // Opens an account with `cash` cents and returns its id. Ids of closed accounts are reused.
+    uint32_t open(int64_t cash = 0)
+    {
+        uint32_t shardIndex = nextShard.fetch_add(1, memory_order_relaxed) & (shardCount - 1);
+        Shard& shard = shards[shardIndex];
+        CountingLockGuard guard(shard.lock);
+        uint32_t local;
+        if (!shard.freeRecords.empty())
+        {
+            local = shard.freeRecords.back();
+            shard.freeRecords.pop_back();
+        }
+        else
+        {
+            local = static_cast<uint32_t>(shard.records.size());
+            shard.records.emplace_back();
+        }
+        Record& record = shard.records[local];
+        record = Record();
+        record.cash = cash;
+        record.open = true;
+        openCount.fetch_add(1, memory_order_relaxed);
+        return local * shardCount + shardIndex;
+    }
+
+    // Drops the account and its positions.
+    bool close(uint32_t id)
+    {
+        Shard& shard = shardOf(id);
+        CountingLockGuard guard(shard.lock);
+        Record* record = recordOf(shard, id);
+        if (!record)
+        {
+            return false;
+        }
+        while (record->head != none)
+        {
+            uint32_t block = record->head;
+            record->head = shard.blocks[block].next;
+            shard.blocks[block].next = shard.freeBlock;
+            shard.freeBlock = block;
+        }
+        record->open = false;
+        shard.freeRecords.push_back(id / shardCount);
+        openCount.fetch_sub(1, memory_order_relaxed);
+        return true;
+    }
+
+    // Adds cashDelta cents and shareDelta shares of symbol (none for cash only) together, or
+    // neither if either would go below zero.
+    AccountStatus settle(uint32_t id, int64_t cashDelta, uint32_t symbol = none, int64_t shareDelta = 0)
+    {
+        Shard& shard = shardOf(id);
+        CountingLockGuard guard(shard.lock);
+        Record* record = recordOf(shard, id);
+        if (!record)
+        {
+            return AccountStatus::UnknownAccount;
+        }
+        if (record->cash + cashDelta < 0)
+        {
+            return AccountStatus::InsufficientCash;
+        }
+        if (symbol != none && shareDelta != 0)
+        {
+            pair<uint32_t, uint32_t> at = findPosition(shard, *record, symbol);
+            int64_t held = at.first != none ? shard.blocks[at.first].shares[at.second] : 0;
+            if (held + shareDelta < 0)
+            {
+                return AccountStatus::InsufficientShares;
+            }
+            if (at.first == none)
+            {
+                at = addPosition(shard, *record, symbol);
+            }
+            if ((shard.blocks[at.first].shares[at.second] += shareDelta) == 0)
+            {
+                removePosition(shard, *record, at);
+            }
+        }
+        record->cash += cashDelta;
+        return AccountStatus::Ok;
+    }
+
+    AccountStatus deposit(uint32_t id, int64_t cents)
+    {
+        return cents > 0 ? settle(id, cents) : AccountStatus::BadAmount;
+    }
+    AccountStatus withdraw(uint32_t id, int64_t cents)
+    {
+        return cents > 0 ? settle(id, -cents) : AccountStatus::BadAmount;
+    }
+
+    // Trades at the symbol's current price, straight against the account; the matching engine
+    // is single-threaded and these are meant to run from many threads at once.
+    AccountStatus buyStock(const StockMarket& market, uint32_t id, uint32_t symbol, uint32_t quantity)
+    {
+        if (symbol >= market.size())
+        {
+            return AccountStatus::UnknownSymbol;
+        }
+        int64_t price = toPriceTicks(market.getPrice(symbol));
+        return quantity > 0 ? settle(id, -price * quantity, symbol, quantity) : AccountStatus::BadAmount;
+    }
+    AccountStatus sellStock(const StockMarket& market, uint32_t id, uint32_t symbol, uint32_t quantity)
+    {
+        if (symbol >= market.size())
+        {
+            return AccountStatus::UnknownSymbol;
+        }
+        int64_t price = toPriceTicks(market.getPrice(symbol));
+        return quantity > 0 ? settle(id, price * quantity, symbol, -static_cast<int64_t>(quantity))
+                            : AccountStatus::BadAmount;
+    }
+
+    int64_t getCash(uint32_t id) const
+    {
+        Shard& shard = shardOf(id);
+        CountingLockGuard guard(shard.lock);
+        Record* record = recordOf(shard, id);
+        return record ? record->cash : 0;
+    }
+
+    int64_t getShares(uint32_t id, uint32_t symbol) const
+    {
+        Shard& shard = shardOf(id);
+        CountingLockGuard guard(shard.lock);
+        Record* record = recordOf(shard, id);
+        if (!record)
+        {
+            return 0;
+        }
+        pair<uint32_t, uint32_t> at = findPosition(shard, *record, symbol);
+        return at.first != none ? shard.blocks[at.first].shares[at.second] : 0;
+    }
+
+    // Calls fn(symbol, shares) for each position of the account under its shard lock.
+    template <class Fn>
+    void forEachPosition(uint32_t id, Fn&& fn) const
+    {
+        Shard& shard = shardOf(id);
+        CountingLockGuard guard(shard.lock);
+        Record* record = recordOf(shard, id);
+        uint32_t count = record && record->positions ? headCount(*record) : 0;
+        for (uint32_t block = record ? record->head : none; block != none; block = shard.blocks[block].next)
+        {
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                fn(shard.blocks[block].symbols[i], shard.blocks[block].shares[i]);
+            }
+            count = PositionBlock::capacity;
+        }
+    }
+
+    size_t size() const
+    {
+        return openCount.load(memory_order_relaxed);
+    }
+
+    // Bytes held by the store, allocated capacity included.
+    size_t memoryBytes() const
+    {
+        size_t bytes = sizeof(*this) + shardCount * sizeof(Shard);
+        for (uint32_t s = 0; s < shardCount; ++s)
+        {
+            CountingLockGuard guard(shards[s].lock);
+            bytes += shards[s].records.capacity() * sizeof(Record) + shards[s].freeRecords.capacity() * sizeof(uint32_t) +
+                     shards[s].blocks.capacity() * sizeof(PositionBlock);
+        }
+        return bytes;
+    }
+};
+// Bounded single-producer single-consumer queue: the producer only writes tail, the consumer
+// only writes head, so neither side ever waits on the other.
+template <typename T, size_t Capacity>
+class SpscQueue {
+private:
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+    alignas(64) atomic<size_t> head{0}; // Next slot to pop
+    alignas(64) atomic<size_t> tail{0}; // Next slot to push
+    array<T, Capacity> slots;
+
+public:
+    // Producer side; false when the queue is full.
+    bool push(const T& value)
+    {
+        size_t at = tail.load(memory_order_relaxed);
+        if (at - head.load(memory_order_acquire) == Capacity)
+        {
+            return false;
+        }
+        slots[at & (Capacity - 1)] = value;
+        tail.store(at + 1, memory_order_release);
+        return true;
+    }
+
+    // Consumer side; false when the queue is empty.
+    bool pop(T& value)
+    {
+        size_t at = head.load(memory_order_relaxed);
+        if (at == tail.load(memory_order_acquire))
+        {
+            return false;
+        }
+        value = slots[at & (Capacity - 1)];
+        head.store(at + 1, memory_order_release);
+        return true;
+    }
+
+    // Consumer side.
+    bool empty() const
+    {
+        return head.load(memory_order_relaxed) == tail.load(memory_order_acquire);
+    }
+};
+
+enum class AlertKind : uint8_t
+{
+    Above,       // Price at or above a level
+    Below,       // Price at or below a level
+    PercentMove, // Price moved the given percent either way from where it was when set
+};
+
+struct AlertEvent
+{
+    uint32_t alertId;
+    uint32_t symbol;
+    AlertKind kind;
+    double level; // Threshold that was crossed
+    double price; // Price that crossed it
+    uint64_t tick;
+    bool rising;  // Crossed going up; for PercentMove, which side fired
+};
+constexpr size_t alertQueueCapacity = 4096;
+using AlertQueue = SpscQueue<AlertEvent, alertQueueCapacity>;
+
+// One-shot price alerts evaluated on every tick. Each symbol keeps the levels waiting for a
+// rise sorted high to low and those waiting for a fall sorted low to high, so the next level
+// either way is at the back. Alerts that have not fired are never already crossed, hence the
+// ones a tick crosses, between the old and new price, are exactly a run at the back: a tick
+// does one comparison per symbol with alerts and pops what fired, whatever the number of
+// alerts registered. Cancelled alerts and the other side of a fired percent move are dropped
+// lazily when they reach the back. Fired alerts go to every consumer queue.
+class AlertEngine {
+private:
+    struct Threshold
+    {
+        double level;
+        uint32_t alertId;
+    };
+    struct SymbolAlerts
+    {
+        vector<Threshold> rising;  // Highest level first
+        vector<Threshold> falling; // Lowest level first
+    };
+    struct Alert
+    {
+        uint32_t symbol;
+        AlertKind kind;
+        double value;
+        bool active;
+    };
+
+    mutex lock; // Between the tick thread and whoever adds or cancels alerts
+    vector<Alert> alerts;               // By alert id
+    vector<SymbolAlerts> books;         // By symbol id
+    vector<uint32_t> activeSymbols;     // Symbols with thresholds left
+    vector<uint32_t> activeIndex;       // Symbol id -> index in activeSymbols + 1, 0 if none
+    vector<unique_ptr<AlertQueue>> consumers;
+    atomic<uint64_t> fired{0};
+    atomic<uint64_t> dropped{0};        // Events a full consumer queue could not take
+
+    void insert(uint32_t symbol, Threshold threshold, bool rising)
+    {
+        if (symbol >= books.size())
+        {
+            books.resize(symbol + 1);
+            activeIndex.resize(symbol + 1, 0);
+        }
+        vector<Threshold>& side = rising ? books[symbol].rising : books[symbol].falling;
+        auto at = rising ? upper_bound(side.begin(), side.end(), threshold,
+                                       [](const Threshold& a, const Threshold& b) { return a.level > b.level; })
+                         : upper_bound(side.begin(), side.end(), threshold,
+                                       [](const Threshold& a, const Threshold& b) { return a.level < b.level; });
+        side.insert(at, threshold);
+        if (activeIndex[symbol] == 0)
+        {
+            activeSymbols.push_back(symbol);
+            activeIndex[symbol] = static_cast<uint32_t>(activeSymbols.size());
+        }
+    }
+
+    void deliver(uint32_t alertId, double level, double price, uint64_t tick, bool rising)
+    {
+        Alert& alert = alerts[alertId];
+        alert.active = false;
+        AlertEvent event{alertId, alert.symbol, alert.kind, level, price, tick, rising};
+        for (auto& consumer : consumers)
+        {
+            if (!consumer->push(event))
+            {
+                dropped.fetch_add(1, memory_order_relaxed);
+            }
+        }
+        fired.fetch_add(1, memory_order_relaxed);
+    }
+
+public:
+    // A new queue that receives every alert fired from now on. Each queue has one consumer.
+    AlertQueue& addConsumer()
+    {
+        CountingLockGuard guard(lock);
+        consumers.push_back(make_unique<AlertQueue>());
+        return *consumers.back();
+    }
+
+    // value is a price for Above/Below and a percent for PercentMove, measured from
+    // currentPrice. Returns the alert id.
+    uint32_t add(uint32_t symbol, AlertKind kind, double value, double currentPrice)
+    {
+        CountingLockGuard guard(lock);
+        uint32_t alertId = static_cast<uint32_t>(alerts.size());
+        alerts.push_back({symbol, kind, value, true});
+        if (kind == AlertKind::Above)
+        {
+            insert(symbol, {value, alertId}, true);
+        }
+        else if (kind == AlertKind::Below)
+        {
+            insert(symbol, {value, alertId}, false);
+        }
+        else
+        {
+            insert(symbol, {currentPrice * (1.0 + value / 100.0), alertId}, true);
+            insert(symbol, {currentPrice * (1.0 - value / 100.0), alertId}, false);
+        }
+        return alertId;
+    }
+
+    bool cancel(uint32_t alertId)
+    {
+        CountingLockGuard guard(lock);
+        if (alertId >= alerts.size() || !alerts[alertId].active)
+        {
+            return false;
+        }
+        alerts[alertId].active = false;
+        return true;
+    }
+
+    // Tick listener.
+    void onTick(const MarketSnapshot& snap)
+    {
+        CountingLockGuard guard(lock);
+        for (size_t i = 0; i < activeSymbols.size();)
+        {
+            uint32_t symbol = activeSymbols[i];
+            double price = snap.prices[symbol];
+            SymbolAlerts& book = books[symbol];
+            while (!book.rising.empty() && (book.rising.back().level <= price || !alerts[book.rising.back().alertId].active))
+            {
+                Threshold threshold = book.rising.back();
+                book.rising.pop_back();
+                if (alerts[threshold.alertId].active)
+                {
+                    deliver(threshold.alertId, threshold.level, price, snap.tick, true);
+                }
+            }
+            while (!book.falling.empty() && (book.falling.back().level >= price || !alerts[book.falling.back().alertId].active))
+            {
+                Threshold threshold = book.falling.back();
+                book.falling.pop_back();
+                if (alerts[threshold.alertId].active)
+                {
+                    deliver(threshold.alertId, threshold.level, price, snap.tick, false);
+                }
+            }
+            if (book.rising.empty() && book.falling.empty())
+            {
+                activeIndex[activeSymbols.back()] = activeIndex[symbol];
+                activeSymbols[i] = activeSymbols.back();
+                activeSymbols.pop_back();
+                activeIndex[symbol] = 0;
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    // Calls fn(alertId, symbol, kind, value) for every alert still waiting.
+    template <class Fn>
+    void forEachActive(Fn&& fn)
+    {
+        CountingLockGuard guard(lock);
+        for (uint32_t alertId = 0; alertId < alerts.size(); ++alertId)
+        {
+            const Alert& alert = alerts[alertId];
+            if (alert.active)
+            {
+                fn(alertId, alert.symbol, alert.kind, alert.value);
+            }
+        }
+    }
+
+    uint64_t getFired() const { return fired.load(memory_order_relaxed); }
+    uint64_t getDropped() const { return dropped.load(memory_order_relaxed); }
+};
+class Watchlist {
+private:
+    vector<uint32_t> watchlist; // Symbol ids in the order they were added
+    vector<bool> watched;       // Indexed by symbol id
+    AlertEngine alerts;
+    AlertQueue& triggered = alerts.addConsumer(); // Drained by the menu
+public:
+    // Tick listener.
+    void onTick(const MarketSnapshot& snap)
+    {
+        alerts.onTick(snap);
+    }
+    void addAlert(StockMarket& market, const string& abbr, AlertKind kind, double value)
+    {
+        Stock* stock = market.getStock(abbr);
+        if (!stock)
+        {
+            cout << "Stock not found." << endl;
+            return;
+        }
+        if (value <= 0.0 || (kind == AlertKind::PercentMove && value >= 100.0))
+        {
+            cout << "Alert level must be positive (and a percent below 100)." << endl;
+            return;
+        }
+        uint32_t symbol = stock->getId();
+        uint32_t alertId = alerts.add(symbol, kind, value, market.getPrice(symbol));
+        cout << "Alert #" << alertId << " set on " << abbr << endl;
+    }
+    void cancelAlert(uint32_t alertId)
+    {
+        if (alerts.cancel(alertId))
+        {
+            cout << "Alert #" << alertId << " cancelled" << endl;
+        }
+        else
+        {
+            cout << "No active alert #" << alertId << endl;
+        }
+    }
+    void showAlerts(StockMarket& market)
+    {
+        cout << "\n--- Price Alerts ---\n";
+        bool any = false;
+        alerts.forEachActive([&](uint32_t alertId, uint32_t symbol, AlertKind kind, double value) {
+            any = true;
+            cout << "#" << left << setw(6) << alertId << setw(10) << market.getAbbreviation(symbol);
+            if (kind == AlertKind::PercentMove)
+            {
+                cout << "moves " << fixed << setprecision(2) << value << "%" << endl;
+            }
+            else
+            {
+                cout << (kind == AlertKind::Above ? "at or above $" : "at or below $") << fixed << setprecision(2)
+                     << value << endl;
+            }
+        });
+        if (!any)
+        {
+            cout << "No active alerts." << endl;
+        }
+    }
+    // Prints the alerts fired since the last call.
+    void showTriggeredAlerts(StockMarket& market)
+    {
+        AlertEvent event;
+        while (triggered.pop(event))
+        {
+            // An alert can fire exactly at its level, so the direction comes from the side that fired.
+            const char* crossed = event.kind == AlertKind::Above   ? " reached or crossed above $"
+                                  : event.kind == AlertKind::Below ? " reached or crossed below $"
+                                  : event.rising                   ? " moved up through $"
+                                                                   : " moved down through $";
+            cout << "ALERT #" << event.alertId << ": " << market.getAbbreviation(event.symbol) << " at $" << fixed
+                 << setprecision(2) << event.price << crossed << event.level << endl;
+        }
+    }
+    void add(StockMarket& market, const string& abbr)
+    {
+        Stock* stock = market.getStock(abbr);
+        if (!stock)
+        {
+            cout << "Stock not found." << endl;
+            return;
+        }
+        uint32_t symbol = stock->getId();
+        if (symbol >= watched.size())
+        {
+            watched.resize(market.size(), false);
+        }
+        if (watched[symbol])
+        {
+            cout << "Error: Stock '" << abbr << "' is already in the watchlist." << endl;
+        }
+        else
+        {
+            watched[symbol] = true;
+            watchlist.push_back(symbol);
+            cout << abbr << " added to watchlist" << endl;
+        }
+    }
+    void remove(StockMarket& market, const string& abbr)
+    {
+        Stock* stock = market.getStock(abbr);
+        uint32_t symbol = stock ? stock->getId() : 0;
+        if (!stock || symbol >= watched.size() || !watched[symbol])
+        {
+            cout << "Stock not present" << endl;
+        }
+        else
+        {
+            watched[symbol] = false;
+            watchlist.erase(std::find(watchlist.begin(), watchlist.end(), symbol));
+            cout << abbr <<" erased successfully" << endl;
+        }
+    }
+    void view(StockMarket& market) {
+        cout << "\n--- Watchlist ---\n";
+        if (watchlist.empty()) {
+            cout << "Your watchlist is empty." << endl;
+        }
+        for (uint32_t symbol : watchlist) {
+            Stock* stock = market.getStock(symbol);
+            cout << left << setw(10) << stock->getAbbreviation() << ": $" << fixed << setprecision(2)
+                << stock->getPrice() << endl;
+        }
+        showAlerts(market);
+    }
+    const vector<uint32_t>& getWatchlist() const
+    {
+        return watchlist;
+    }
+};
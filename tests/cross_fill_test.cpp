@@ -0,0 +1,162 @@
+#include "order_gateway.h"
+// Crosses a gateway account against the menu's portfolio in both directions and checks that each
+// side settles the fills of its resting order that the other side's order caused.
+//
+//     cross_fill_test
+#if defined(__linux__)
+#include <arpa/inet.h>
+
+int failures = 0;
+
+void check(bool ok, const string& what)
+{
+    if (!ok)
+    {
+        cout << "FAIL: " << what << endl;
+        ++failures;
+    }
+}
+
+// Next report on the connection, or a report of kind Rejected with reason Busy after 2 s.
+GatewayReport readReport(int fd)
+{
+    GatewayReport report{};
+    report.kind = GatewayReportKind::Rejected;
+    report.reason = GatewayReject::Busy;
+    size_t got = 0;
+    while (got < sizeof(report))
+    {
+        pollfd wait{fd, POLLIN, 0};
+        if (::poll(&wait, 1, 2000) <= 0)
+        {
+            return report;
+        }
+        ssize_t n = recv(fd, reinterpret_cast<char*>(&report) + got, sizeof(report) - got, 0);
+        if (n <= 0)
+        {
+            return report;
+        }
+        got += static_cast<size_t>(n);
+    }
+    return report;
+}
+
+GatewayReport sendOrder(int fd, Side side, OrderType type, uint32_t quantity, int64_t priceTicks, uint64_t clientOrderId)
+{
+    GatewayRequest request{};
+    request.kind = GatewayRequestKind::NewOrder;
+    request.side = side;
+    request.type = type;
+    request.quantity = quantity;
+    request.priceTicks = priceTicks;
+    request.clientOrderId = clientOrderId;
+    if (send(fd, &request, sizeof(request), MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(request)))
+    {
+        return {GatewayReportKind::Rejected, side, GatewayReject::Busy, 0, 0, 0, 0, 0, clientOrderId, 0};
+    }
+    return readReport(fd);
+}
+
+int main()
+{
+    // One symbol at $100.00.
+    string base = "/tmp/cross_fill_test." + to_string(getpid());
+    ofstream(base + ".names") << "Cross Fill Inc\n";
+    ofstream(base + ".prices") << "100.00\n";
+    ofstream(base + ".abbr") << "XFL\n";
+    StockMarket market(1);
+    bool loaded = market.loadStocks(base + ".names", base + ".prices", base + ".abbr");
+    for (const char* suffix : {".names", ".prices", ".abbr"})
+    {
+        remove((base + suffix).c_str());
+    }
+    if (!loaded)
+    {
+        cout << "FAIL: cannot load the test market" << endl;
+        return 1;
+    }
+    Stock* stock = market.getStock("XFL");
+    int64_t mid = toPriceTicks(market.getPrice(0));
+
+    OrderGateway gateway(market);
+    uint16_t port = 0;
+    for (uint16_t candidate = 39100; candidate < 39200 && !port; ++candidate)
+    {
+        port = gateway.open(candidate, 1).empty() ? candidate : 0;
+    }
+    if (!port)
+    {
+        cout << "FAIL: no free port for the gateway" << endl;
+        return 1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        readReport(fd).kind != GatewayReportKind::Welcome)
+    {
+        cout << "FAIL: cannot connect to the gateway" << endl;
+        return 1;
+    }
+
+    // The gateway sells into the portfolio's resting buy.
+    Portfolio portfolio;
+    {
+        auto orders = market.lockOrders();
+        portfolio.placeLimitOrder(market, stock, Side::Buy, 10, fromPriceTicksAs<Portfolio::Price>(mid));
+    }
+    GatewayReport bought = sendOrder(fd, Side::Buy, OrderType::Market, 20, 0, 1);
+    check(bought.kind == GatewayReportKind::Accepted && bought.filled == 20, "gateway market buy");
+    GatewayReport sold = sendOrder(fd, Side::Sell, OrderType::Market, 10, 0, 2);
+    check(sold.kind == GatewayReportKind::Accepted && sold.filled == 10 && sold.priceTicks == mid,
+          "gateway market sell fills at the portfolio's bid");
+    {
+        auto orders = market.lockOrders();
+        portfolio.takeFills(market);
+    }
+    check(abs(toDouble(portfolio.getCash()) - (10000 - 10 * fromPriceTicks(mid))) < 0.005,
+          "portfolio pays for the shares its resting buy bought");
+    check(abs(toDouble(portfolio.getValuation().marketValue) - 10 * fromPriceTicks(mid)) < 0.005,
+          "portfolio holds the shares its resting buy bought");
+
+    // The portfolio buys from the gateway's resting sell.
+    GatewayReport resting = sendOrder(fd, Side::Sell, OrderType::Limit, 5, mid, 3);
+    check(resting.kind == GatewayReportKind::Accepted && resting.resting == 5, "gateway limit sell rests");
+    {
+        auto orders = market.lockOrders();
+        portfolio.buyStock(market, stock, 5);
+    }
+    GatewayReport fill = readReport(fd);
+    check(fill.kind == GatewayReportKind::Fill && fill.orderId == resting.orderId && fill.filled == 5 &&
+              fill.resting == 0 && fill.priceTicks == mid && fill.clientOrderId == 3,
+          "gateway reports the fill of its resting sell");
+    GatewayRequest cancel{};
+    cancel.kind = GatewayRequestKind::Cancel;
+    cancel.orderId = resting.orderId;
+    cancel.clientOrderId = 4;
+    send(fd, &cancel, sizeof(cancel), MSG_NOSIGNAL);
+    GatewayReport cancelled = readReport(fd);
+    check(cancelled.kind == GatewayReportKind::Rejected && cancelled.reason == GatewayReject::UnknownOrder,
+          "gateway no longer holds the filled sell open");
+    check(abs(toDouble(portfolio.getCash()) - (10000 - 15 * fromPriceTicks(mid))) < 0.005,
+          "portfolio pays the gateway's limit");
+
+    // Prices a client sends are bounded before any order arithmetic.
+    GatewayReport huge = sendOrder(fd, Side::Buy, OrderType::Limit, gatewayMaxQuantity, INT64_MAX, 5);
+    check(huge.kind == GatewayReportKind::Rejected && huge.reason == GatewayReject::BadPrice,
+          "gateway rejects a limit price above gatewayMaxPriceTicks");
+
+    ::close(fd);
+    gateway.close();
+    cout << (failures ? "FAILED" : "OK") << endl;
+    return failures ? 1 : 0;
+}
+#else
+int main()
+{
+    cout << "The order gateway needs Linux (epoll); skipped." << endl;
+    return 0;
+}
+#endif
@@ -0,0 +1,313 @@
+#include "stock_market.h"
+// TickHistory: the bit codes round trip, and a recorded history reads back every tick kept and
+// every 1s, 1m and 1h bar as a naive aggregation of the ticks fed makes them, with a symbol that
+// lists part way, a gap in time, one tick in three kept, from an archive and under a budget.
+//
+//     history_test
+
+int failures = 0;
+
+void check(bool ok, const string& what)
+{
+    if (!ok)
+    {
+        cout << "FAIL: " << what << endl;
+        ++failures;
+    }
+}
+
+struct Sample
+{
+    int64_t ms;
+    int64_t price;
+    uint64_t volume;
+
+    bool operator==(const Sample&) const = default;
+};
+
+bool operator==(const PriceBar& a, const PriceBar& b)
+{
+    return a.startMs == b.startMs && a.open == b.open && a.high == b.high && a.low == b.low && a.close == b.close &&
+           a.volume == b.volume && a.samples == b.samples;
+}
+
+void checkCodes()
+{
+    vector<uint64_t> values = {0, 1, 2, 5, 63, 64, 1000, 123456789, uint64_t{1} << 40, UINT64_MAX};
+    vector<int64_t> deltas = {0, 1, -1, 63, -64, 200, -255, 2000, -4095, 1 << 20, INT64_MIN / 2};
+    BitWriter out;
+    for (uint64_t value : values)
+    {
+        for (int k : {0, 3, 17, maxRiceBits})
+        {
+            writeRice(out, value, k); // Large values with a small k take the escape
+        }
+        writeVolume(out, value);
+    }
+    for (int64_t delta : deltas)
+    {
+        writeTimeDelta(out, delta);
+    }
+    vector<uint64_t> words(out.paddedWords());
+    out.copyTo(words.data());
+    BitReader in(words.data());
+    bool same = true;
+    for (uint64_t value : values)
+    {
+        for (int k : {0, 3, 17, maxRiceBits})
+        {
+            same = same && readRice(in, k) == value;
+        }
+        same = same && readVolume(in) == value;
+    }
+    check(same, "Rice codes and volumes round trip, escapes included");
+    same = true;
+    for (int64_t delta : deltas)
+    {
+        same = same && readTimeDelta(in) == delta && zigzagDecode(zigzagEncode(delta)) == delta;
+    }
+    check(same, "time deltas and zigzag round trip");
+    check(riceBitsFor(0) == 0 && riceBitsFor(1) == 1 && riceBitsFor(100) == 6 && riceBitsFor(UINT64_MAX / 2) == maxRiceBits,
+          "the Rice parameter follows the mean");
+}
+
+// Symbol 0 never moves, 1 moves every tick, 2 moves and trades, 3 lists late and moves now and
+// then. Time steps 100 ms, crosses an hour and jumps 150 s once.
+constexpr uint32_t symbols = 4;
+constexpr uint64_t ticks = 3000;
+constexpr uint64_t late = 1200;
+constexpr int64_t startMs = 10 * 3600000 - 120000;
+
+int64_t msAt(uint64_t tick)
+{
+    return startMs + 100 * static_cast<int64_t>(tick) + (tick >= 2000 ? 150000 : 0);
+}
+
+int64_t centsAt(uint32_t id, uint64_t tick)
+{
+    switch (id)
+    {
+        case 0:
+            return 5000;
+        case 1:
+            return 10000 + static_cast<int64_t>((tick * 37) % 301) - 150;
+        case 2:
+            return 2500 + static_cast<int64_t>(tick % 50) - static_cast<int64_t>((tick / 7) % 30);
+        default:
+            return 70000 + (tick % 13 == 0 ? static_cast<int64_t>(tick % 400) : 0);
+    }
+}
+
+uint64_t volumeAt(uint32_t id, uint64_t tick)
+{
+    return id == 2 && tick % 7 == 3 ? 100 + tick % 900 : 0;
+}
+
+struct Fed
+{
+    vector<vector<Sample>> samples{symbols}; // Every tick of every listed symbol
+    vector<uint32_t> count;                  // Symbols listed at each tick
+};
+
+Fed record(TickHistory& history)
+{
+    Fed fed;
+    TradedVolume traded;
+    traded.resize(symbols);
+    vector<double> prices(symbols);
+    vector<Fill> fills;
+    for (uint64_t tick = 0; tick < ticks; ++tick)
+    {
+        uint32_t count = tick < late ? symbols - 1 : symbols;
+        fills.clear();
+        for (uint32_t id = 0; id < count; ++id)
+        {
+            prices[id] = centsAt(id, tick) * priceTickSize;
+            if (uint64_t volume = volumeAt(id, tick))
+            {
+                Fill fill{};
+                fill.symbol = id;
+                fill.quantity = static_cast<uint32_t>(volume);
+                fill.priceTicks = centsAt(id, tick);
+                fills.push_back(fill);
+            }
+            fed.samples[id].push_back({msAt(tick), centsAt(id, tick), volumeAt(id, tick)});
+        }
+        traded.add(fills, 0);
+        MarketSnapshot snap{};
+        snap.tick = tick;
+        snap.count = count;
+        snap.prices = prices.data();
+        history.append(snap, traded, msAt(tick));
+        fed.count.push_back(count);
+    }
+    return fed;
+}
+
+// What the tick stream keeps of a symbol: one tick in `every`, with the volume since the last
+// one kept. A symbol that lists part way joins at the next segment.
+vector<Sample> kept(const Fed& fed, uint32_t id, uint32_t every)
+{
+    vector<Sample> result;
+    bool joined = false;
+    uint64_t volume = 0;
+    for (uint64_t tick = 0; tick < ticks; ++tick)
+    {
+        if (fed.count[tick] <= id)
+        {
+            continue;
+        }
+        const Sample& sample = fed.samples[id][tick - (ticks - fed.samples[id].size())];
+        volume += sample.volume;
+        if (tick % every != 0)
+        {
+            continue;
+        }
+        joined = joined || id < symbols - 1 || (tick / every) % historySegmentTicks == 0;
+        if (joined)
+        {
+            result.push_back({sample.ms, sample.price, volume});
+        }
+        volume = 0;
+    }
+    return result;
+}
+
+// The bars of a symbol, aggregated naively; samples counts every tick of the market in the bucket.
+vector<PriceBar> aggregate(const Fed& fed, uint32_t id, int64_t span)
+{
+    map<int64_t, uint32_t> marketTicks;
+    for (uint64_t tick = 0; tick < ticks; ++tick)
+    {
+        ++marketTicks[msAt(tick) - msAt(tick) % span];
+    }
+    vector<PriceBar> result;
+    for (const Sample& sample : fed.samples[id])
+    {
+        int64_t start = sample.ms - sample.ms % span;
+        if (result.empty() || result.back().startMs != start)
+        {
+            result.push_back({start, sample.price, sample.price, sample.price, sample.price, 0, marketTicks[start]});
+        }
+        PriceBar& bar = result.back();
+        bar.high = max(bar.high, sample.price);
+        bar.low = min(bar.low, sample.price);
+        bar.close = sample.price;
+        bar.volume += sample.volume;
+    }
+    return result;
+}
+
+vector<Sample> read(const TickHistory& history, uint32_t id, int64_t fromMs, int64_t toMs)
+{
+    vector<Sample> result;
+    history.forEachSample(id, fromMs, toMs, [&](int64_t ms, int64_t price, uint64_t volume)
+    {
+        result.push_back({ms, price, volume});
+    });
+    return result;
+}
+
+template <class T, class Keep>
+vector<T> only(const vector<T>& all, Keep keep)
+{
+    vector<T> result;
+    copy_if(all.begin(), all.end(), back_inserter(result), keep);
+    return result;
+}
+
+void checkHistory(const TickHistory& history, const Fed& fed, uint32_t every, const string& what)
+{
+    bool samplesMatch = true;
+    bool barsMatch = true;
+    const int64_t fromMs = msAt(1500) + 50;
+    const int64_t toMs = msAt(2400);
+    for (uint32_t id = 0; id < symbols; ++id)
+    {
+        vector<Sample> expected = kept(fed, id, every);
+        samplesMatch = samplesMatch && read(history, id, 0, INT64_MAX) == expected;
+        samplesMatch = samplesMatch && read(history, id, fromMs, toMs) == only(expected, [&](const Sample& sample)
+        {
+            return sample.ms >= fromMs && sample.ms <= toMs;
+        });
+        for (BarResolution resolution : {BarResolution::Second, BarResolution::Minute, BarResolution::Hour})
+        {
+            int64_t span = barMilliseconds(resolution);
+            vector<PriceBar> bars = aggregate(fed, id, span);
+            barsMatch = barsMatch && history.bars(id, resolution, 0, INT64_MAX) == bars;
+            barsMatch = barsMatch && history.bars(id, resolution, fromMs, toMs) == only(bars, [&](const PriceBar& bar)
+            {
+                return bar.startMs <= toMs && bar.startMs + span > fromMs;
+            });
+        }
+    }
+    check(samplesMatch, what + ": the tick stream reads back the ticks kept");
+    check(barsMatch, what + ": every bar matches the ticks it rolls up");
+}
+
+int main()
+{
+    checkCodes();
+
+    // In memory, read while recording (open segments, staged ticks, forming bars) and after.
+    {
+        TickHistory history;
+        check(history.open("", size_t{1} << 30).empty(), "a history opens in memory");
+        Fed fed = record(history);
+        checkHistory(history, fed, 1, "recording");
+        check(history.latestMs() == msAt(ticks - 1), "the latest time is the last tick's");
+        history.close();
+        checkHistory(history, fed, 1, "closed");
+        TickHistory::Stats stats = history.getStats();
+        check(stats.samples == 3 * ticks + (ticks - late), "every symbol-tick is counted");
+        check(stats.tickSamples == 3 * ticks + (ticks - 2 * historySegmentTicks) && stats.bars[2] == 3 * 2 + 1,
+              "sealed ticks and bars are counted");
+        check(stats.tickBytes * 8.0 / stats.tickSamples < 12.0, "ticks take a few bits each");
+    }
+
+    // One tick in three: the bars still see every tick.
+    {
+        TickHistory history;
+        check(history.open("", size_t{1} << 30, 3).empty(), "a thinned history opens");
+        Fed fed = record(history);
+        history.close();
+        checkHistory(history, fed, 3, "one tick in three");
+    }
+
+    // From an archive, while the writer may still be behind and once it is done.
+    filesystem::path directory = filesystem::temp_directory_path() / ("history_test." + to_string(getpid()));
+    filesystem::create_directories(directory);
+    string path = (directory / "history").string();
+    {
+        TickHistory history;
+        check(history.open(path, 0).empty(), "an archived history opens");
+        Fed fed = record(history);
+        checkHistory(history, fed, 1, "archiving");
+        history.close();
+        checkHistory(history, fed, 1, "archived");
+        TickHistory::Stats stats = history.getStats();
+        check(stats.memoryBytes == 0 && filesystem::file_size(path) == stats.archiveBytes &&
+                  stats.archiveBytes == stats.sealedBytes,
+              "every sealed segment is in the archive and none in memory");
+    }
+
+    // With no budget only the newest segment of each kind is kept: recent ticks, and the whole
+    // of the coarser series, which fit in one.
+    {
+        TickHistory history;
+        history.open("", 0);
+        Fed fed = record(history);
+        history.close();
+        check(read(history, 1, 0, INT64_MAX) == only(kept(fed, 1, 1), [](const Sample& sample)
+        {
+            return sample.ms >= msAt(2 * historySegmentTicks);
+        }), "over budget the oldest ticks go first");
+        check(history.bars(2, BarResolution::Minute, 0, INT64_MAX) == aggregate(fed, 2, 60000) &&
+                  history.bars(2, BarResolution::Hour, 0, INT64_MAX) == aggregate(fed, 2, 3600000),
+              "over budget the coarser bars stay");
+    }
+
+    filesystem::remove_all(directory);
+    cout << (failures ? "FAILED" : "OK") << endl;
+    return failures ? 1 : 0;
+}
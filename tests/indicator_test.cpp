@@ -0,0 +1,199 @@
+#include "stock_market.h"
+// IndicatorEngine against a naive recomputation of every kind from the whole price series,
+// including a symbol that lists part way through and VWAP from the fills' own prices.
+//
+//     indicator_test
+
+int failures = 0;
+
+void check(bool ok, const string& what)
+{
+    if (!ok)
+    {
+        cout << "FAIL: " << what << endl;
+        ++failures;
+    }
+}
+
+bool near(double value, double expected, double tolerance)
+{
+    if (isnan(expected))
+    {
+        return isnan(value);
+    }
+    return abs(value - expected) <= tolerance;
+}
+
+// The last `length` prices, padded with the first: a symbol starts as if it had been flat.
+vector<double> lastPrices(const vector<double>& series, uint32_t length)
+{
+    vector<double> window;
+    for (size_t back = 0; back < length; ++back)
+    {
+        window.push_back(back < series.size() ? series[series.size() - 1 - back] : series.front());
+    }
+    return window;
+}
+
+double reference(IndicatorKind kind, uint32_t length, const vector<double>& series, const vector<double>& notionals,
+                 const vector<double>& volumes)
+{
+    vector<double> window = lastPrices(series, length);
+    double mean = 0.0;
+    for (double price : window)
+    {
+        mean += price / length;
+    }
+    double squares = 0.0;
+    for (double price : window)
+    {
+        squares += (price - mean) * (price - mean);
+    }
+    double deviation = sqrt(squares / length);
+    switch (kind)
+    {
+        case IndicatorKind::Sma:
+            return mean;
+        case IndicatorKind::StdDev:
+            return deviation;
+        case IndicatorKind::BollingerUpper:
+            return mean + bollingerWidth * deviation;
+        case IndicatorKind::BollingerLower:
+            return mean - bollingerWidth * deviation;
+        case IndicatorKind::Ema:
+        {
+            double average = series.front();
+            for (double price : series)
+            {
+                average += 2.0 / (length + 1.0) * (price - average);
+            }
+            return average;
+        }
+        case IndicatorKind::Rsi:
+        {
+            double gain = 0.0;
+            double loss = 0.0;
+            for (size_t i = 0; i < series.size(); ++i)
+            {
+                double change = i ? series[i] - series[i - 1] : 0.0;
+                gain += (max(change, 0.0) - gain) / length;
+                loss += (max(-change, 0.0) - loss) / length;
+            }
+            return gain + loss > 0.0 ? 100.0 * gain / (gain + loss) : 50.0;
+        }
+        case IndicatorKind::Vwap:
+        {
+            double notional = 0.0;
+            double volume = 0.0;
+            for (size_t back = 0; back < length && back < volumes.size(); ++back)
+            {
+                notional += notionals[notionals.size() - 1 - back];
+                volume += volumes[volumes.size() - 1 - back];
+            }
+            return volume > 0.0 ? notional / volume : numeric_limits<double>::quiet_NaN();
+        }
+    }
+    return 0.0;
+}
+
+int main()
+{
+    constexpr uint32_t symbols = 3;
+    constexpr uint32_t listed = 2; // The third symbol lists at tick `late`
+    constexpr uint64_t ticks = 400;
+    constexpr uint64_t late = 90;
+
+    IndicatorEngine engine;
+    vector<pair<IndicatorKind, uint32_t>> registered;
+    for (IndicatorKind kind : {IndicatorKind::Sma, IndicatorKind::Ema, IndicatorKind::StdDev,
+                               IndicatorKind::BollingerUpper, IndicatorKind::BollingerLower, IndicatorKind::Rsi,
+                               IndicatorKind::Vwap})
+    {
+        for (uint32_t length : {1u, 5u, 20u})
+        {
+            uint32_t handle = engine.add(kind, length);
+            check(handle == registered.size(), "each indicator gets the next handle");
+            registered.push_back({kind, length});
+        }
+    }
+    check(engine.add(IndicatorKind::Sma, 20) == 2, "registering an indicator again returns its handle");
+    check(engine.describe(2) == "SMA(20)", "describe names the kind and length");
+
+    TradedVolume traded;
+    traded.resize(symbols);
+    vector<double> prices(symbols);
+    vector<vector<double>> series(symbols);
+    vector<vector<double>> notionals(symbols);
+    vector<vector<double>> volumes(symbols);
+    vector<Fill> fills;
+    size_t wrong = 0;
+    for (uint64_t tick = 0; tick < ticks; ++tick)
+    {
+        uint32_t count = tick < late ? listed : symbols;
+        fills.clear();
+        for (uint32_t id = 0; id < count; ++id)
+        {
+            // Whole cents, so the reference sees exactly the prices the engine does.
+            prices[id] = round(100.0 * (50.0 + 10.0 * id + 3.0 * sin(0.07 * tick * (id + 1)) + (tick % 7) * 0.1)) / 100.0;
+            bool first = series[id].empty();
+            series[id].push_back(prices[id]);
+            // Fills that land during the tick, at prices near the last one; none every fifth tick
+            // and none on the tick a symbol lists, which its volume baseline is taken at.
+            double notional = 0.0;
+            double volume = 0.0;
+            for (uint32_t n = 0; !first && tick % 5 != 0 && n < 1 + (tick + id) % 3; ++n)
+            {
+                Fill fill{};
+                fill.symbol = id;
+                fill.quantity = 10 + static_cast<uint32_t>((tick * 7 + n) % 40);
+                fill.priceTicks = toPriceTicks(prices[id]) + static_cast<int64_t>(n) - 1;
+                fills.push_back(fill);
+                notional += fill.priceTicks * priceTickSize * fill.quantity;
+                volume += fill.quantity;
+            }
+            if (!first)
+            {
+                notionals[id].push_back(notional);
+                volumes[id].push_back(volume);
+            }
+        }
+        traded.add(fills, 0);
+        MarketSnapshot snap{};
+        snap.tick = tick;
+        snap.count = count;
+        snap.prices = prices.data();
+        engine.update(snap, traded);
+
+        for (uint32_t handle = 0; handle < registered.size(); ++handle)
+        {
+            // The deviation comes from running sums of prices and their squares: the square root
+            // of a difference that cancels, good to about 1e-8 of the price.
+            IndicatorKind kind = registered[handle].first;
+            bool deviation = kind == IndicatorKind::StdDev || kind == IndicatorKind::BollingerUpper ||
+                             kind == IndicatorKind::BollingerLower;
+            for (uint32_t id = 0; id < count; ++id)
+            {
+                double expected = reference(registered[handle].first, registered[handle].second, series[id],
+                                            notionals[id], volumes[id]);
+                double tolerance = deviation ? 1e-7 * prices[id] : 1e-9 * max(1.0, abs(expected));
+                if (!near(engine.get(handle, id), expected, tolerance))
+                {
+                    if (wrong++ < 5)
+                    {
+                        cout << engine.describe(handle) << " of symbol " << id << " at tick " << tick << ": "
+                             << engine.get(handle, id) << ", expected " << expected << endl;
+                    }
+                }
+            }
+        }
+        if (tick + 1 < late)
+        {
+            check(isnan(engine.get(0, listed)), "a symbol that has not listed has no value");
+        }
+    }
+    check(wrong == 0, "every indicator matches the naive reference (" + to_string(wrong) + " wrong)");
+    check(isnan(engine.get(0, symbols + 5)), "an unknown symbol has no value");
+
+    cout << (failures ? "FAILED" : "OK") << endl;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,132 @@
+#include "stock_market.h"
+// Journal: group commit, replay in order, snapshot rotation, a torn tail cut off, and an account
+// rebuilt from its journal.
+//
+//     journal_test
+
+int failures = 0;
+
+void check(bool ok, const string& what)
+{
+    if (!ok)
+    {
+        cout << "FAIL: " << what << endl;
+        ++failures;
+    }
+}
+
+struct Replayed
+{
+    JournalKind kind;
+    string symbol;
+    int64_t quantity;
+    double amount;
+    int64_t timestamp;
+};
+
+vector<Replayed> replay(Journal& journal, const string& path, string& error)
+{
+    vector<Replayed> records;
+    error = journal.open(path, [&](const JournalRecord& record, string_view symbol)
+    {
+        records.push_back({record.kind, string(symbol), record.quantity, record.amount, record.timestamp});
+    });
+    return records;
+}
+
+int main()
+{
+    filesystem::path directory = filesystem::temp_directory_path() / ("journal_test." + to_string(getpid()));
+    filesystem::create_directories(directory);
+    string path = (directory / "account").string();
+    string error;
+
+    // Records appended faster than fsync share batches and come back in order.
+    constexpr int records = 5000;
+    {
+        Journal journal;
+        check(replay(journal, path, error).empty() && error.empty(), "a new journal opens empty");
+        for (int i = 0; i < records; ++i)
+        {
+            journal.append(JournalKind::Fill, i % 2 ? "ABC" : "LONGERSYMBOL", i - records / 2, i * 0.25, 1000 + i);
+        }
+        journal.flush();
+        uint64_t batches = journal.getBatches();
+        check(batches >= 1 && batches < records, "appends are committed in groups (" + to_string(batches) + " batches)");
+    }
+    {
+        Journal journal;
+        vector<Replayed> back = replay(journal, path, error);
+        bool same = error.empty() && back.size() == records;
+        for (int i = 0; same && i < records; ++i)
+        {
+            same = back[i].kind == JournalKind::Fill && back[i].symbol == (i % 2 ? "ABC" : "LONGERSYMBOL") &&
+                   back[i].quantity == i - records / 2 && back[i].amount == i * 0.25 && back[i].timestamp == 1000 + i;
+        }
+        check(same, "every record replays in order, unchanged");
+
+        // A snapshot replaces everything before it.
+        string image;
+        encodeJournalRecord(image, JournalKind::Balance, {}, 0, 1234.5, 0);
+        journal.requestSnapshot(image);
+        journal.append(JournalKind::Deposit, {}, 0, 10.0, 7);
+        journal.flush();
+    }
+    check(filesystem::exists(path + ".snapshot") && !filesystem::exists(path + ".journal.0") &&
+              filesystem::exists(path + ".journal.1"),
+          "the snapshot starts a new journal generation and the old one is deleted");
+    {
+        Journal journal;
+        vector<Replayed> back = replay(journal, path, error);
+        check(error.empty() && back.size() == 2 && back[0].kind == JournalKind::Balance && back[0].amount == 1234.5 &&
+                  back[1].kind == JournalKind::Deposit && back[1].amount == 10.0,
+              "replay reads the snapshot, then only the records after it");
+    }
+
+    // A crash mid-write leaves a torn record; replay stops before it and drops it.
+    uintmax_t intactSize = filesystem::file_size(path + ".journal.1");
+    {
+        ofstream torn(path + ".journal.1", ios::binary | ios::app);
+        torn << string(20, 'x');
+    }
+    {
+        Journal journal;
+        vector<Replayed> back = replay(journal, path, error);
+        check(error.empty() && back.size() == 2, "a torn tail is not replayed");
+    }
+    check(filesystem::file_size(path + ".journal.1") == intactSize, "a torn tail is cut off");
+
+    // An account rebuilt from its journal matches the one that wrote it.
+    string base = (directory / "market").string();
+    ofstream(base + ".names") << "Journal Corp\n";
+    ofstream(base + ".prices") << "50.00\n";
+    ofstream(base + ".abbr") << "JRN\n";
+    StockMarket market(1);
+    check(market.loadStocks(base + ".names", base + ".prices", base + ".abbr"), "test market loads");
+    string accountPath = (directory / "portfolio").string();
+    double cash;
+    double value;
+    {
+        Journal journal;
+        Portfolio portfolio;
+        check(portfolio.attachJournal(market, journal, accountPath).empty(), "portfolio journal opens");
+        portfolio.deposit(Portfolio::Price(250.25));
+        portfolio.buyStock(market, market.getStock("JRN"), 30);
+        portfolio.sellStock(market, market.getStock("JRN"), 12);
+        portfolio.withdraw(Portfolio::Price(100));
+        cash = toDouble(portfolio.getCash());
+        value = toDouble(portfolio.getValuation().marketValue);
+        journal.flush();
+    }
+    {
+        Journal journal;
+        Portfolio portfolio;
+        check(portfolio.attachJournal(market, journal, accountPath).empty(), "portfolio journal reopens");
+        check(toDouble(portfolio.getCash()) == cash && toDouble(portfolio.getValuation().marketValue) == value,
+              "the replayed account has the same cash and shares");
+    }
+
+    filesystem::remove_all(directory);
+    cout << (failures ? "FAILED" : "OK") << endl;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,95 @@
+#include "stock_market.h"
+// Price-time priority, partial fills, and orders that rest while the price drifts past the
+// ladder, against a MatchingEngine with a deliberately narrow ladder.
+//
+//     matching_engine_test
+
+int failures = 0;
+
+void check(bool ok, const string& what)
+{
+    if (!ok)
+    {
+        cout << "FAIL: " << what << endl;
+        ++failures;
+    }
+}
+
+int main()
+{
+    constexpr size_t width = 64;
+    vector<Fill> fills;
+
+    // Better prices first, then the oldest order within a price.
+    {
+        MatchingEngine engine(1024, width);
+        uint64_t first = engine.submit(0, Side::Sell, OrderType::Limit, 1002, 10, 1, fills).orderId;
+        uint64_t second = engine.submit(0, Side::Sell, OrderType::Limit, 1002, 10, 2, fills).orderId;
+        uint64_t best = engine.submit(0, Side::Sell, OrderType::Limit, 1001, 5, 3, fills).orderId;
+        fills.clear();
+        OrderResult buy = engine.submit(0, Side::Buy, OrderType::Market, 0, 20, 4, fills);
+        check(buy.filled == 20 && buy.resting == 0, "market buy fills 20");
+        check(fills.size() == 3 && fills[0].makerOrderId == best && fills[0].priceTicks == 1001 &&
+                  fills[0].quantity == 5,
+              "the best price fills first");
+        check(fills.size() == 3 && fills[1].makerOrderId == first && fills[1].quantity == 10 &&
+                  fills[2].makerOrderId == second && fills[2].quantity == 5,
+              "the oldest order at a price fills first, the next one partly");
+        uint32_t cancelled = 0;
+        check(engine.cancel(second, &cancelled) && cancelled == 5, "the partly filled maker keeps its remainder");
+        check(!engine.cancel(first), "a filled maker is gone");
+    }
+
+    // A limit taker fills what it can at its limit or better and rests the rest.
+    {
+        MatchingEngine engine(1024, width);
+        engine.submit(0, Side::Sell, OrderType::Limit, 1000, 7, 1, fills);
+        engine.submit(0, Side::Sell, OrderType::Limit, 1003, 7, 1, fills);
+        fills.clear();
+        OrderResult buy = engine.submit(0, Side::Buy, OrderType::Limit, 1001, 10, 2, fills);
+        check(buy.filled == 7 && buy.resting == 3 && fills.size() == 1 && fills[0].priceTicks == 1000,
+              "limit buy fills up to its limit");
+        int64_t cost;
+        check(engine.estimateMarketOrder(0, Side::Sell, 3, cost) == 3 && cost == 3 * 1001,
+              "the remainder rests at the limit");
+    }
+
+    // The price drifts past the ladder while an order rests: nothing is cancelled, and every
+    // order still trades at its own price, in priority order.
+    {
+        MatchingEngine engine(1024, width);
+        uint64_t bid = engine.submit(0, Side::Buy, OrderType::Limit, 1000, 10, 1, fills).orderId;
+        vector<uint64_t> asks;
+        for (int64_t mid = 1000; mid <= 1000 + 4 * static_cast<int64_t>(width); mid += 16)
+        {
+            engine.followPrice(0, mid);
+            OrderResult ask = engine.submit(0, Side::Sell, OrderType::Limit, mid + 1, 1, 2, fills);
+            check(ask.accepted && ask.resting == 1, "an ask " + to_string(mid + 1 - 1000) + " ticks up rests");
+            asks.push_back(ask.orderId);
+        }
+        OrderResult far = engine.submit(0, Side::Buy, OrderType::Limit, 100, 4, 3, fills);
+        check(far.accepted && far.resting == 4, "a bid far below the ladder rests");
+        fills.clear();
+        OrderResult hit = engine.submit(0, Side::Sell, OrderType::Market, 0, 12, 4, fills);
+        check(hit.filled == 12 && fills.size() == 2 && fills[0].makerOrderId == bid && fills[0].priceTicks == 1000 &&
+                  fills[0].quantity == 10 && fills[1].makerOrderId == far.orderId && fills[1].priceTicks == 100,
+              "the bids left behind by the drift fill best first");
+        int64_t cost;
+        uint32_t available = engine.estimateMarketOrder(0, Side::Buy, 1000, cost);
+        check(available == asks.size(), "every drifting ask is still in the book");
+        fills.clear();
+        OrderResult lift = engine.submit(0, Side::Buy, OrderType::Market, 0, static_cast<uint32_t>(asks.size()), 5, fills);
+        bool ordered = lift.filled == asks.size() && fills.size() == asks.size();
+        for (size_t i = 0; ordered && i < fills.size(); ++i)
+        {
+            ordered = fills[i].makerOrderId == asks[i] && (i == 0 || fills[i].priceTicks > fills[i - 1].priceTicks);
+        }
+        check(ordered, "the drifting asks fill lowest first, on and off the ladder");
+        check(engine.submit(0, Side::Sell, OrderType::Limit, 2000, 1, 2, fills).resting == 1 &&
+                  engine.submit(0, Side::Sell, OrderType::Limit, 5, 1, 2, fills).filled == 1,
+              "the book keeps working after the ladder moved");
+    }
+
+    cout << (failures ? "FAILED" : "OK") << endl;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,101 @@
+#include "stock_market.h"
+// Money: exact sums, rounding halves away from zero, saturation and fits() at the edges of the
+// range, amountAs() turning away what does not fit, and the limits deposits and withdrawals
+// keep the balance in.
+//
+//     money_test
+
+int failures = 0;
+
+void check(bool ok, const string& what)
+{
+    if (!ok)
+    {
+        cout << "FAIL: " << what << endl;
+        ++failures;
+    }
+}
+
+string printed(Money value, int precision)
+{
+    ostringstream out;
+    out << fixed << setprecision(precision) << value;
+    return out.str();
+}
+
+int main()
+{
+    constexpr int64_t top = numeric_limits<int64_t>::max();
+
+    // Sums are exact however many there are.
+    check(Money(0.1) + Money(0.2) == Money(0.3), "0.1 + 0.2 is 0.3");
+    Money total;
+    for (int i = 0; i < 1000000; ++i)
+    {
+        total += Money(0.01);
+    }
+    check(total == Money(10000), "a million cents are $10000 exactly");
+    check(Money(19.99) * 3 == Money(59.97) && 3 * Money(19.99) == Money(59.97), "multiples by a count are exact");
+
+    // Doubles with at most four decimals convert exactly; the rest round to the nearest unit.
+    check(Money(2.675).getUnits() == 26750 && Money(-2.675).getUnits() == -26750, "four decimals convert exactly");
+    check(Money(1.23454).getUnits() == 12345 && Money(1.23456).getUnits() == 12346 &&
+              Money(-1.23456).getUnits() == -12346,
+          "extra decimals round to the nearest unit");
+    check(Money(7).getUnits() == 70000 && Money(-7).getUnits() == -70000, "whole numbers convert exactly");
+
+    // Products and quotients round halves away from zero.
+    Money five = Money::fromUnits(5);
+    check(five * Money(0.5) == Money::fromUnits(3) && -five * Money(0.5) == Money::fromUnits(-3),
+          "a product half way rounds away from zero");
+    check(five / 2 == Money::fromUnits(3) && five / -2 == Money::fromUnits(-3) && -five / 2 == Money::fromUnits(-3),
+          "a quotient half way rounds away from zero");
+    check(Money::fromUnits(7) / 3 == Money::fromUnits(2) && Money::fromUnits(8) / 3 == Money::fromUnits(3),
+          "a quotient rounds to the nearest unit");
+    check(Money(12345.6789) * Money(1.0001) == Money(12346.9135), "a product rounds to the nearest unit");
+
+    // Printing with `fixed` rounds the exact decimal, never showing binary noise.
+    check(printed(Money(0.1) + Money(0.2), 2) == "0.30", "0.1 + 0.2 prints as 0.30");
+    check(printed(Money(-0.005), 2) == "-0.01" && printed(Money(0.005), 2) == "0.01", "printing rounds halves away");
+    check(printed(Money(1.5), 6) == "1.500000" && printed(Money(42), 0) == "42", "printing pads and drops decimals");
+
+    // The range: fits() says which doubles convert, and the rest saturate rather than wrap.
+    check(Money::fits(922337203685477.0) && Money::fits(-922337203685477.0), "the largest whole dollars fit");
+    check(!Money::fits(1e15) && !Money::fits(-1e15) && !Money::fits(numeric_limits<double>::infinity()) &&
+              !Money::fits(numeric_limits<double>::quiet_NaN()),
+          "out of range, infinite and NaN amounts do not fit");
+    check(Money(1e30).getUnits() > top / 2 && Money(-1e30).getUnits() < -top / 2, "out of range amounts saturate");
+    check(Money(numeric_limits<double>::quiet_NaN()).getUnits() < -top / 2, "NaN saturates to the lowest");
+
+    // amountAs() turns away amounts the price type cannot hold and leaves the target alone.
+    Money amount(7);
+    check(!amountAs(1e20, amount) && amount == Money(7), "amountAs rejects an amount beyond Money");
+    check(!amountAs(numeric_limits<double>::quiet_NaN(), amount) && amount == Money(7), "amountAs rejects NaN");
+    check(amountAs(12.34, amount) && amount == Money(12.34), "amountAs takes an amount that fits");
+    double plain = 1.0;
+    check(!amountAs(numeric_limits<double>::infinity(), plain) && amountAs(1e300, plain) && plain == 1e300,
+          "a double account takes any finite amount");
+
+    // Deposits keep the balance within what Money holds; withdrawals keep it from going negative.
+    Portfolio portfolio;
+    Money start = portfolio.getCash();
+    portfolio.deposit(Portfolio::Price(0));
+    portfolio.deposit(Portfolio::Price(-5));
+    check(portfolio.getCash() == start, "deposits must be positive");
+    portfolio.deposit(Money::fromUnits(top));
+    check(portfolio.getCash() == start, "a deposit that would overflow the balance is refused");
+    portfolio.deposit(Money::fromUnits(top) - start);
+    check(portfolio.getCash().getUnits() == top, "a deposit up to the limit is taken");
+    portfolio.deposit(Money::fromUnits(1));
+    check(portfolio.getCash().getUnits() == top, "nothing more fits once the balance is at the limit");
+    portfolio.withdraw(Money::fromUnits(top) - start);
+    check(portfolio.getCash() == start, "a withdrawal takes the balance back down");
+    portfolio.withdraw(start + Money::fromUnits(1));
+    portfolio.withdraw(Portfolio::Price(-1));
+    check(portfolio.getCash() == start, "withdrawals must be positive and within the balance");
+    portfolio.withdraw(start);
+    check(portfolio.getCash() == Money(0), "the whole balance can be withdrawn");
+
+    cout << (failures ? "FAILED" : "OK") << endl;
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,104 @@
+#include "stock_market.h"
+// Records a session of ticks and account actions, plays it back through a fresh market and
+// account, and checks that the replay ends in the same prices, cash and holdings.
+//
+//     session_replay_test
+
+int failures = 0;
+
+void check(bool ok, const string& what)
+{
+    if (!ok)
+    {
+        cout << "FAIL: " << what << endl;
+        ++failures;
+    }
+}
+
+bool loadMarket(StockMarket& market, const string& base, const string& abbrs)
+{
+    ofstream(base + ".names") << "Replay One\nReplay Two\nReplay Three\n";
+    ofstream(base + ".prices") << "25.00\n140.50\n7.25\n";
+    ofstream(base + ".abbr") << abbrs;
+    return market.loadStocks(base + ".names", base + ".prices", base + ".abbr");
+}
+
+int main()
+{
+    filesystem::path directory = filesystem::temp_directory_path() / ("session_replay_test." + to_string(getpid()));
+    filesystem::create_directories(directory);
+    string base = (directory / "market").string();
+    string path = (directory / "session.rec").string();
+
+    // The recorded session: ticks between a deposit, market orders, a limit order that fills and
+    // one that rests, a cancel the account refuses and a withdrawal, as the menu would make them.
+    constexpr uint64_t ticks = 4 * 25;
+    StockMarket market(1);
+    check(loadMarket(market, base, "RPA\nRPB\nRPC\n"), "recorded market loads");
+    market.setSeed(12345);
+    Portfolio portfolio;
+    market.addTickListener([&portfolio](const MarketSnapshot& snap) { portfolio.onTick(snap); });
+    check(portfolio.startRecording(market, path).empty(), "recording starts");
+    auto act = [&](auto&& action)
+    {
+        auto orders = market.lockOrders();
+        action();
+    };
+    act([&] { portfolio.deposit(Portfolio::Price(5000)); });
+    market.fastForward(25);
+    act([&] { portfolio.buyStock(market, market.getStock("RPA"), 40); });
+    act([&] { portfolio.buyStock(market, market.getStock("RPB"), 12); });
+    market.fastForward(25);
+    act([&] { portfolio.sellStock(market, market.getStock("RPA"), 15); });
+    act([&] { portfolio.placeLimitOrder(market, market.getStock("RPC"), Side::Buy, 100, Portfolio::Price(1)); });
+    act([&] { portfolio.placeLimitOrder(market, market.getStock("RPB"), Side::Sell, 5, Portfolio::Price(1)); });
+    market.fastForward(25);
+    act([&] { portfolio.cancelOrder(market, 999999); });
+    act([&] { portfolio.withdraw(Portfolio::Price(250.75)); });
+    market.fastForward(25);
+    market.stopRecording();
+    double cash = toDouble(portfolio.getCash());
+    double value = toDouble(portfolio.getValuation().totalValue);
+    vector<double> prices;
+    for (uint32_t id = 0; id < market.size(); ++id)
+    {
+        prices.push_back(market.getPrice(id));
+    }
+
+    SessionReplay replay;
+    check(replay.open(path).empty(), "the recording opens");
+    check(replay.getHeader().symbols == 3 && replay.getHeader().seed == 12345, "the header names the universe and seed");
+
+    // A market with other symbols is refused rather than replayed.
+    {
+        StockMarket other(1);
+        loadMarket(other, base, "RPA\nRPB\nRPX\n");
+        Portfolio fresh;
+        SessionReplay::Stats stats;
+        check(!replay.run(other, fresh, 0.0, stats).empty() && stats.ticks == 0,
+              "a recording does not replay over a different universe");
+    }
+
+    StockMarket again(1);
+    check(loadMarket(again, base, "RPA\nRPB\nRPC\n"), "replay market loads");
+    Portfolio replayed;
+    again.addTickListener([&replayed](const MarketSnapshot& snap) { replayed.onTick(snap); });
+    SessionReplay::Stats stats;
+    check(replay.run(again, replayed, 0.0, stats).empty(), "the recording replays");
+    check(stats.ticks == ticks + 1 && stats.actions == 8 && !stats.truncated,
+          "every tick and action is replayed (" + to_string(stats.ticks) + " ticks, " + to_string(stats.actions) +
+              " actions)");
+    check(stats.diverged == 0, "every action leaves the cash it left when recorded");
+    bool samePrices = again.size() == prices.size();
+    for (uint32_t id = 0; samePrices && id < again.size(); ++id)
+    {
+        samePrices = again.getPrice(id) == prices[id];
+    }
+    check(samePrices, "the replay ends at the recorded prices");
+    check(toDouble(replayed.getCash()) == cash && toDouble(replayed.getValuation().totalValue) == value,
+          "the replayed account ends with the same cash and value");
+
+    filesystem::remove_all(directory);
+    cout << (failures ? "FAILED" : "OK") << endl;
+    return failures ? 1 : 0;
+}
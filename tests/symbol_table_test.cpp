@@ -0,0 +1,75 @@
+#include "stock_market.h"
+// SymbolTable's minimal perfect hash: every abbreviation finds its own id, anything else finds
+// none, and repeated abbreviations are reported instead of built over.
+//
+//     symbol_table_test
+
+int failures = 0;
+
+void check(bool ok, const string& what)
+{
+    if (!ok)
+    {
+        cout << "FAIL: " << what << endl;
+        ++failures;
+    }
+}
+
+// Distinct abbreviations of one to six letters, like the generated universes.
+vector<string> abbreviations(size_t count)
+{
+    vector<string> abbrs;
+    abbrs.reserve(count);
+    for (size_t i = 0; abbrs.size() < count; ++i)
+    {
+        string abbr;
+        for (size_t n = i + 1; n > 0; n = (n - 1) / 26)
+        {
+            abbr += static_cast<char>('A' + (n - 1) % 26);
+        }
+        abbrs.push_back(abbr);
+    }
+    return abbrs;
+}
+
+int main()
+{
+    SymbolTable empty;
+    check(empty.find("AAPL") == SymbolTable::none, "an empty table finds nothing");
+
+    for (size_t count : {size_t(1), size_t(2), size_t(3), size_t(1000), size_t(100000)})
+    {
+        vector<string> abbrs = abbreviations(count);
+        vector<string_view> views(abbrs.begin(), abbrs.end());
+        SymbolTable table;
+        check(table.build(views.data(), views.size()).empty(), to_string(count) + " keys: no duplicates reported");
+        check(table.size() == count, to_string(count) + " keys: size");
+        size_t wrong = 0;
+        for (size_t id = 0; id < count; ++id)
+        {
+            wrong += table.find(views[id]) != id || table.getAbbreviation(static_cast<uint32_t>(id)) != views[id];
+        }
+        check(wrong == 0, to_string(count) + " keys: every abbreviation finds its id (" + to_string(wrong) + " wrong)");
+        size_t found = 0;
+        for (size_t id = 0; id < count; ++id)
+        {
+            string lower = abbrs[id];
+            transform(lower.begin(), lower.end(), lower.begin(), [](char c) { return static_cast<char>(tolower(c)); });
+            found += table.find(abbrs[id] + "1") != SymbolTable::none; // Digits are in no abbreviation
+            found += table.find(lower) != SymbolTable::none;
+        }
+        check(found == 0, to_string(count) + " keys: unknown abbreviations find nothing");
+        check(table.find("") == SymbolTable::none, to_string(count) + " keys: the empty string finds nothing");
+    }
+
+    vector<string_view> repeated = {"AAA", "BBB", "AAA", "CCC", "BBB"};
+    SymbolTable table;
+    vector<size_t> duplicates = table.build(repeated.data(), repeated.size());
+    check(duplicates == vector<size_t>({2, 4}), "repeated abbreviations are reported by index");
+    repeated = {"AAA", "BBB", "CCC"};
+    check(table.build(repeated.data(), repeated.size()).empty() && table.find("CCC") == 2,
+          "the table builds once the repeats are dropped");
+
+    cout << (failures ? "FAILED" : "OK") << endl;
+    return failures ? 1 : 0;
+}
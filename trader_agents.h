@@ -0,0 +1,667 @@
+#pragma once
+#include "stock_market.h"
+#include <coroutine>
+#include <utility>
+
+// Synthetic trader population for load generation: tens of thousands of simulated traders, each
+// a C++20 coroutine, trading against the matching engine from a small worker pool.
+//
+// A step runs the population against the latest tick in rounds. A round resumes every trader
+// that is due (its timer ran out, or its last request was answered) in parallel on the pool, and
+// each runs until it awaits the next tick, a timer, an order or a cancel. The orders and cancels
+// are then executed on the calling thread in trader order under one order lock, and their
+// traders resume with the result in the next round. A trader only reads its own state, the
+// prices copied at the start of the step and draws keyed by (seed, trader, counter), and orders
+// reach the engine in a fixed order, so a seeded headless market gives the same trades and
+// balances on any number of threads.
+//
+// Each trader is an account in an AccountStore, in cents, settled the way the order gateway
+// settles its connections.
+constexpr uint32_t traderFirstOwner = 1U << 30;      // Owner ids well above any gateway account
+constexpr int64_t traderStartingCash = 10000000;     // $100,000 in cents per trader
+constexpr uint32_t traderMakerShares = 1000;         // Inventory a market-making trader starts with
+constexpr int traderMaxRounds = 8;                   // Orders and cancels a trader gets per tick
+
+enum class TraderKind : uint8_t { Random, Momentum, MarketMaker };
+constexpr array<const char*, 3> traderKindNames = {"random", "momentum", "market maker"};
+
+struct TraderOrder
+{
+    uint32_t symbol;
+    Side side;
+    OrderType type;
+    uint32_t quantity;
+    int64_t priceTicks; // Limit price in cents; ignored for market orders
+};
+
+struct TraderOrderResult
+{
+    bool accepted;
+    uint64_t orderId;
+    uint32_t filled;
+    uint32_t resting;
+    int64_t averageTicks; // Of what filled right away
+};
+
+struct TraderOpenOrder
+{
+    uint64_t orderId;
+    uint32_t symbol;
+    Side side;
+    int64_t limitTicks;
+    uint32_t remaining; // As far as the population has seen fills
+};
+
+// Coroutine handle of one trader. Starts suspended; the population resumes it.
+class TraderTask {
+public:
+    struct promise_type
+    {
+        TraderTask get_return_object()
+        {
+            return TraderTask(coroutine_handle<promise_type>::from_promise(*this));
+        }
+        suspend_always initial_suspend() noexcept { return {}; }
+        suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+
+private:
+    coroutine_handle<promise_type> handle;
+
+public:
+    TraderTask() = default;
+    explicit TraderTask(coroutine_handle<promise_type> h) : handle(h) {}
+    TraderTask(TraderTask&& other) noexcept : handle(exchange(other.handle, nullptr)) {}
+    TraderTask& operator=(TraderTask&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle)
+            {
+                handle.destroy();
+            }
+            handle = exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    ~TraderTask()
+    {
+        if (handle)
+        {
+            handle.destroy();
+        }
+    }
+
+    // Runs the trader to its next co_await. False once it has returned.
+    bool resume()
+    {
+        handle.resume();
+        return !handle.done();
+    }
+};
+
+// What every trader reads: the step's prices and the accounts.
+struct TraderView
+{
+    vector<double> prices;
+    uint64_t tick = 0;
+    const AccountStore* store = nullptr;
+};
+
+// One trader's state, and what its coroutine awaits on.
+class TraderContext {
+private:
+    friend class TraderPopulation;
+    enum class State : uint8_t
+    {
+        Ready,    // Not started yet
+        Waiting,  // Until wakeTick
+        Pending,  // An order or cancel to execute
+        Answered, // Executed; resume with the result
+        Finished,
+    };
+
+    State state = State::Ready;
+    TraderKind kind = TraderKind::Random;
+    bool cancelling = false;
+    uint32_t id = 0;
+    uint32_t storeId = 0;
+    uint32_t symbol = 0;
+    uint32_t key = 0;
+    uint32_t draws = 0;
+    uint64_t wakeTick = 0;
+    uint64_t cancelId = 0;
+    TraderOrder order{};
+    TraderOrderResult result{};
+    vector<TraderOpenOrder> open;
+    const TraderView* view = nullptr;
+
+    struct WaitAwaiter
+    {
+        TraderContext& trader;
+        uint64_t ticks;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(coroutine_handle<>) noexcept
+        {
+            trader.wakeTick = trader.view->tick + ticks;
+            trader.state = State::Waiting;
+        }
+        void await_resume() const noexcept {}
+    };
+    struct RequestAwaiter
+    {
+        TraderContext& trader;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(coroutine_handle<>) noexcept { trader.state = State::Pending; }
+        TraderOrderResult await_resume() const noexcept { return trader.result; }
+    };
+    struct CancelAwaiter
+    {
+        TraderContext& trader;
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(coroutine_handle<>) noexcept { trader.state = State::Pending; }
+        bool await_resume() const noexcept { return trader.result.accepted; }
+    };
+
+public:
+    uint32_t getId() const { return id; }
+    TraderKind getKind() const { return kind; }
+    // The symbol a momentum trader follows or a market maker quotes.
+    uint32_t getSymbol() const { return symbol; }
+    uint64_t tick() const { return view->tick; }
+    size_t symbols() const { return view->prices.size(); }
+    double price(uint32_t s) const { return view->prices[s]; }
+    int64_t priceTicks(uint32_t s) const { return toPriceTicks(view->prices[s]); }
+    int64_t cash() const { return view->store->getCash(storeId); }
+    int64_t shares(uint32_t s) const { return view->store->getShares(storeId, s); }
+    // Resting orders; the population removes them as they fill or are cancelled.
+    const vector<TraderOpenOrder>& openOrders() const { return open; }
+
+    // This trader's next random number.
+    uint32_t draw()
+    {
+        return symbolDraw(key, draws++);
+    }
+
+    WaitAwaiter nextTick()
+    {
+        return {*this, 1};
+    }
+    WaitAwaiter sleepTicks(uint64_t ticks)
+    {
+        return {*this, max<uint64_t>(1, ticks)};
+    }
+    // Resumes with what happened to the order; accepted is false if it was rejected.
+    RequestAwaiter submit(const TraderOrder& request)
+    {
+        cancelling = false;
+        order = request;
+        return {*this};
+    }
+    // Resumes with whether anything was still resting to cancel.
+    CancelAwaiter cancel(uint64_t orderId)
+    {
+        cancelling = true;
+        cancelId = orderId;
+        return {*this};
+    }
+};
+
+// Trades a random symbol every few ticks: mostly market orders, sometimes a limit order near the
+// price, which it cancels at its next turn if it is still resting.
+inline TraderTask randomTrader(TraderContext& trader)
+{
+    while (true)
+    {
+        co_await trader.sleepTicks(1 + trader.draw() % 16);
+        while (!trader.openOrders().empty())
+        {
+            co_await trader.cancel(trader.openOrders().back().orderId);
+        }
+        uint32_t symbol = trader.draw() % static_cast<uint32_t>(trader.symbols());
+        Side side = trader.draw() % 2 ? Side::Sell : Side::Buy;
+        uint32_t quantity = 1 + trader.draw() % 10;
+        if (side == Side::Sell && trader.shares(symbol) < quantity)
+        {
+            side = Side::Buy;
+        }
+        if (trader.draw() % 4)
+        {
+            co_await trader.submit({symbol, side, OrderType::Market, quantity, 0});
+            continue;
+        }
+        int64_t offset = trader.draw() % 5;
+        int64_t limit = trader.priceTicks(symbol) + (side == Side::Buy ? -offset : offset);
+        co_await trader.submit({symbol, side, OrderType::Limit, quantity, max<int64_t>(1, limit)});
+    }
+}
+
+// Follows its symbol with a fast and a slow moving average: buys when the fast one crosses above
+// the slow one and sells what it holds when it crosses back.
+inline TraderTask momentumTrader(TraderContext& trader)
+{
+    const int64_t maxHolding = 100;
+    uint32_t symbol = trader.getSymbol();
+    double fastWeight = 2.0 / (6 + trader.draw() % 6);
+    double slowWeight = 2.0 / (21 + trader.draw() % 20);
+    double fast = trader.price(symbol);
+    double slow = fast;
+    bool above = false;
+    while (true)
+    {
+        co_await trader.nextTick();
+        double price = trader.price(symbol);
+        fast += fastWeight * (price - fast);
+        slow += slowWeight * (price - slow);
+        if ((fast > slow) == above)
+        {
+            continue;
+        }
+        above = !above;
+        int64_t held = trader.shares(symbol);
+        if (above && held < maxHolding)
+        {
+            co_await trader.submit({symbol, Side::Buy, OrderType::Market, 10, 0});
+        }
+        else if (!above && held > 0)
+        {
+            co_await trader.submit({symbol, Side::Sell, OrderType::Market, static_cast<uint32_t>(held), 0});
+        }
+    }
+}
+
+// Quotes its symbol: a bid and an ask a cent or few either side of the price, cancelled and
+// replaced every few ticks, as far as its cash and inventory allow.
+inline TraderTask marketMakerTrader(TraderContext& trader)
+{
+    uint32_t symbol = trader.getSymbol();
+    uint64_t requote = 2 + trader.draw() % 4;
+    int64_t spread = 1 + trader.draw() % 3;
+    while (true)
+    {
+        while (!trader.openOrders().empty())
+        {
+            co_await trader.cancel(trader.openOrders().back().orderId);
+        }
+        int64_t price = trader.priceTicks(symbol);
+        uint32_t size = 5 + trader.draw() % 20;
+        if (price - spread > 0 && trader.cash() >= (price - spread) * size)
+        {
+            co_await trader.submit({symbol, Side::Buy, OrderType::Limit, size, price - spread});
+        }
+        if (trader.shares(symbol) >= size)
+        {
+            co_await trader.submit({symbol, Side::Sell, OrderType::Limit, size, price + spread});
+        }
+        co_await trader.sleepTicks(requote);
+    }
+}
+
+// How many traders of each kind.
+struct TraderMix
+{
+    uint32_t random = 0;
+    uint32_t momentum = 0;
+    uint32_t makers = 0;
+};
+
+// Runs a trader population against a market. Call step() once per tick, from one thread, after
+// the tick is published; the population takes the market's order lock itself. Only one
+// population per market: owner ids start at traderFirstOwner.
+class TraderPopulation {
+private:
+    StockMarket& market;
+    AccountStore store;
+    TickWorkerPool pool;
+    TraderView view;
+    vector<TraderContext> traders; // Never resized after construction; the coroutines hold references
+    vector<TraderTask> tasks;
+    vector<uint32_t> pending;  // Traders with an order or cancel to execute, in order
+    vector<uint32_t> answered; // Last round's, resumed in this one
+    vector<uint64_t> quotedAt; // Tick each symbol's house quotes were last refreshed for
+    vector<Fill> fills;
+    uint32_t fillParty;
+    atomic<uint64_t> resumes{0};
+    uint64_t steps = 0;
+    uint64_t orders = 0;
+    uint64_t rejected = 0;
+    uint64_t filled = 0;
+    uint64_t cancels = 0;
+
+    TraderContext* traderOf(uint32_t owner)
+    {
+        return owner >= traderFirstOwner && owner - traderFirstOwner < traders.size()
+                   ? &traders[owner - traderFirstOwner]
+                   : nullptr;
+    }
+
+    static vector<TraderOpenOrder>::iterator findOpen(TraderContext& trader, uint64_t orderId)
+    {
+        return find_if(trader.open.begin(), trader.open.end(),
+                       [orderId](const TraderOpenOrder& order) { return order.orderId == orderId; });
+    }
+
+    // Same bookkeeping as the gateway's applyFill.
+    void applyFill(TraderContext& trader, const Fill& fill, uint64_t orderId, Side side)
+    {
+        auto it = findOpen(trader, orderId);
+        bool open = it != trader.open.end();
+        int64_t value = fill.priceTicks * fill.quantity;
+        if (side == Side::Buy)
+        {
+            // A limit buy reserved cash at its limit; hand back the price improvement.
+            int64_t cash = open ? (it->limitTicks - fill.priceTicks) * fill.quantity : -value;
+            store.settle(trader.storeId, cash, fill.symbol, fill.quantity);
+        }
+        else
+        {
+            store.settle(trader.storeId, value, fill.symbol, open ? 0 : -static_cast<int64_t>(fill.quantity));
+        }
+        if (open && (it->remaining -= fill.quantity) == 0)
+        {
+            trader.open.erase(it);
+        }
+    }
+
+    void settle()
+    {
+        for (const Fill& fill : fills)
+        {
+            TraderContext* taker = traderOf(fill.takerOwner);
+            TraderContext* maker = traderOf(fill.makerOwner);
+            if (taker)
+            {
+                applyFill(*taker, fill, fill.takerOrderId, fill.takerSide);
+            }
+            if (maker)
+            {
+                applyFill(*maker, fill, fill.makerOrderId, fill.takerSide == Side::Buy ? Side::Sell : Side::Buy);
+            }
+            filled += taker || maker;
+        }
+        fills.clear();
+    }
+
+    // Hands back what an order still had reserved.
+    void release(TraderContext& trader, const TraderOpenOrder& order, uint32_t quantity)
+    {
+        if (order.side == Side::Buy)
+        {
+            store.settle(trader.storeId, order.limitTicks * quantity);
+        }
+        else
+        {
+            store.settle(trader.storeId, 0, order.symbol, quantity);
+        }
+    }
+
+    // As the gateway's placeOrder, except that the house quotes are refreshed once per symbol
+    // per tick rather than before every order.
+    TraderOrderResult place(TraderContext& trader, const TraderOrder& request)
+    {
+        TraderOrderResult result{false, 0, 0, 0, 0};
+        uint32_t symbol = request.symbol;
+        bool limit = request.type == OrderType::Limit;
+        if (symbol >= view.prices.size() || request.quantity == 0 || (limit && request.priceTicks <= 0))
+        {
+            return result;
+        }
+        if (quotedAt[symbol] != view.tick)
+        {
+            market.refreshQuotes(symbol, fills, traderFirstOwner + trader.id);
+            settle();
+            quotedAt[symbol] = view.tick;
+        }
+        int64_t cost = 0;
+        if (!limit && market.estimateMarketOrder(symbol, request.side, request.quantity, cost) < request.quantity)
+        {
+            return result;
+        }
+        if (request.side == Side::Buy)
+        {
+            cost = limit ? request.priceTicks * request.quantity : cost;
+            if (cost > store.getCash(trader.storeId))
+            {
+                return result;
+            }
+        }
+        else if (store.getShares(trader.storeId, symbol) < request.quantity)
+        {
+            return result;
+        }
+        OrderResult order = market.submitOrder(symbol, request.side, request.type,
+                                               limit ? fromPriceTicks(request.priceTicks) : 0.0, request.quantity,
+                                               traderFirstOwner + trader.id, fills);
+        if (!order.accepted)
+        {
+            fills.clear();
+            return result;
+        }
+        if (limit)
+        {
+            if (request.side == Side::Buy)
+            {
+                store.settle(trader.storeId, -cost);
+            }
+            else
+            {
+                store.settle(trader.storeId, 0, symbol, -static_cast<int64_t>(request.quantity));
+            }
+            trader.open.push_back({order.orderId, symbol, request.side, request.priceTicks, request.quantity});
+        }
+        int64_t value = 0;
+        for (const Fill& fill : fills)
+        {
+            value += fill.takerOrderId == order.orderId ? fill.priceTicks * fill.quantity : 0;
+        }
+        settle();
+        result = {true, order.orderId, order.filled, order.resting, order.filled ? value / order.filled : 0};
+        return result;
+    }
+
+    // Fills the menu or the gateway caused are taken at the start of every round, so what is
+    // still open is what the book still holds.
+    bool cancel(TraderContext& trader, uint64_t orderId)
+    {
+        auto it = findOpen(trader, orderId);
+        if (it == trader.open.end())
+        {
+            return false;
+        }
+        uint32_t cancelled = 0;
+        bool ok = market.cancelOrder(orderId, &cancelled);
+        release(trader, *it, ok ? min(cancelled, it->remaining) : 0);
+        trader.open.erase(it);
+        return ok;
+    }
+
+    void execute(TraderContext& trader)
+    {
+        if (trader.cancelling)
+        {
+            trader.result = {cancel(trader, trader.cancelId), trader.cancelId, 0, 0, 0};
+            cancels += trader.result.accepted;
+        }
+        else
+        {
+            trader.result = place(trader, trader.order);
+            ++orders;
+            rejected += !trader.result.accepted;
+        }
+        trader.state = TraderContext::State::Answered;
+    }
+
+    void resume(uint32_t i)
+    {
+        if (!tasks[i].resume())
+        {
+            traders[i].state = TraderContext::State::Finished;
+        }
+    }
+
+    // Resumes every trader due this round and collects, in trader order, those that asked for
+    // something. The first round looks at every trader; later ones only at those just answered.
+    bool resumeDue(bool firstRound)
+    {
+        if (firstRound)
+        {
+            pool.run(traders.size(), 1024, [&](size_t begin, size_t end)
+            {
+                uint64_t resumed = 0;
+                for (size_t i = begin; i < end; ++i)
+                {
+                    const TraderContext& trader = traders[i];
+                    if (trader.state == TraderContext::State::Answered ||
+                        trader.state == TraderContext::State::Ready ||
+                        (trader.state == TraderContext::State::Waiting && trader.wakeTick <= view.tick))
+                    {
+                        resume(static_cast<uint32_t>(i));
+                        ++resumed;
+                    }
+                }
+                resumes.fetch_add(resumed, memory_order_relaxed);
+            });
+            pending.clear();
+            for (uint32_t i = 0; i < traders.size(); ++i)
+            {
+                if (traders[i].state == TraderContext::State::Pending)
+                {
+                    pending.push_back(i);
+                }
+            }
+            return !pending.empty();
+        }
+        answered.swap(pending);
+        pool.run(answered.size(), 256, [&](size_t begin, size_t end)
+        {
+            for (size_t k = begin; k < end; ++k)
+            {
+                resume(answered[k]);
+            }
+            resumes.fetch_add(end - begin, memory_order_relaxed);
+        });
+        pending.clear();
+        for (uint32_t i : answered)
+        {
+            if (traders[i].state == TraderContext::State::Pending)
+            {
+                pending.push_back(i);
+            }
+        }
+        return !pending.empty();
+    }
+
+public:
+    // Opens an account per trader and deals the kinds out in a seeded order. Each trader follows
+    // or quotes one symbol, drawn from the seed. threads includes the caller.
+    TraderPopulation(StockMarket& m, const TraderMix& mix, uint32_t seed,
+                     unsigned threads = thread::hardware_concurrency())
+        : market(m), pool(threads, 1024)
+    {
+        {
+            auto lock = market.lockOrders();
+            fillParty = market.addFillParty(traderFirstOwner, traderFirstOwner + mix.random + mix.momentum + mix.makers);
+        }
+        view.store = &store;
+        view.tick = market.copyPrices(view.prices);
+        quotedAt.assign(view.prices.size(), UINT64_MAX);
+        if (view.prices.empty())
+        {
+            return; // Nothing to trade
+        }
+        vector<TraderKind> kinds;
+        kinds.insert(kinds.end(), mix.random, TraderKind::Random);
+        kinds.insert(kinds.end(), mix.momentum, TraderKind::Momentum);
+        kinds.insert(kinds.end(), mix.makers, TraderKind::MarketMaker);
+        uint32_t shuffleKey = mixBits(seed ^ 0x54524144U);
+        for (size_t i = kinds.size(); i > 1; --i)
+        {
+            swap(kinds[i - 1], kinds[symbolDraw(shuffleKey, static_cast<uint32_t>(i)) % i]);
+        }
+        traders.resize(kinds.size());
+        tasks.reserve(kinds.size());
+        for (uint32_t i = 0; i < traders.size(); ++i)
+        {
+            TraderContext& trader = traders[i];
+            trader.id = i;
+            trader.kind = kinds[i];
+            trader.key = mixBits(seed ^ mixBits(i + 1));
+            trader.symbol = trader.draw() % static_cast<uint32_t>(view.prices.size());
+            trader.view = &view;
+            trader.storeId = store.open(traderStartingCash);
+            if (trader.kind == TraderKind::MarketMaker)
+            {
+                store.settle(trader.storeId, 0, trader.symbol, traderMakerShares);
+            }
+            tasks.push_back(trader.kind == TraderKind::Random     ? randomTrader(trader)
+                            : trader.kind == TraderKind::Momentum ? momentumTrader(trader)
+                                                                  : marketMakerTrader(trader));
+        }
+    }
+
+    ~TraderPopulation()
+    {
+        auto lock = market.lockOrders();
+        market.removeFillParty(fillParty);
+    }
+
+    TraderPopulation(const TraderPopulation&) = delete;
+    TraderPopulation& operator=(const TraderPopulation&) = delete;
+
+    size_t size() const
+    {
+        return traders.size();
+    }
+
+    // Lets every trader act on the latest tick. Not concurrent with anything else that trades
+    // the same symbols if the run is to be reproducible.
+    void step()
+    {
+        view.tick = market.copyPrices(view.prices);
+        ++steps;
+        for (int round = 0; round < traderMaxRounds && resumeDue(round == 0); ++round)
+        {
+            auto lock = market.lockOrders(); // Once per round, not per order
+            market.takeFills(fillParty, fills);
+            settle();
+            for (uint32_t i : pending)
+            {
+                execute(traders[i]);
+            }
+        }
+        // Traders answered in the last round see their result next tick.
+    }
+
+    struct Stats
+    {
+        uint64_t steps;
+        uint64_t resumes;
+        uint64_t orders;
+        uint64_t rejected;
+        uint64_t fills; // Trades with a trader on at least one side
+        uint64_t cancels;
+    };
+    Stats getStats() const
+    {
+        return {steps, resumes.load(memory_order_relaxed), orders, rejected, filled, cancels};
+    }
+
+    // Digest of every trader's cash and positions; equal runs give equal checksums.
+    uint64_t checksum() const
+    {
+        uint64_t hash = traders.size();
+        for (const TraderContext& trader : traders)
+        {
+            hash = mix64(hash ^ static_cast<uint64_t>(store.getCash(trader.storeId)));
+            uint64_t positions = 0; // Order-free: the store keeps no position order
+            store.forEachPosition(trader.storeId, [&](uint32_t symbol, int64_t shares)
+            {
+                positions += mix64((static_cast<uint64_t>(symbol) << 32) ^ static_cast<uint64_t>(shares));
+            });
+            hash = mix64(hash ^ positions);
+        }
+        return hash;
+    }
+};